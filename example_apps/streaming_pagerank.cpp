@@ -33,6 +33,7 @@
 
 #include "graphchi_basic_includes.hpp"
 #include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+#include "engine/dynamic_graphs/edgestream.hpp"
 #include "util/toplist.hpp"
 
 /* HTTP admin tool */
@@ -50,6 +51,7 @@ typedef float VertexDataType;
 typedef float EdgeDataType;
 
 graphchi_dynamicgraph_engine<float, float> * dyngraph_engine;
+dynamic_edge_stream<float, float> * edge_stream;
 std::string streaming_graph_file;
 
 std::string getname(vid_t v);
@@ -85,13 +87,19 @@ struct PagerankProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
      */
     void after_iteration(int iteration, graphchi_context &gcontext) {
 #ifdef DEMO
-        std::vector< vertex_value<float> > top = get_top_vertices<float>(gcontext.filename, 20);
+        /* The vertex data file is being written, read the latest snapshot instead */
+        std::vector< vertex_value<float> > top = get_top_vertices_snapshot<float>(gcontext.filename, 20);
         
         for(int i=0; i < (int) top.size(); i++) {
             vertex_value<float> vv = top[i];
             std::cout << (i+1) << ". " << vv.vertex << " " << getname(vv.vertex) << ": " << vv.value << std::endl; 
         }
         
+        /* Ingest rate and lag */
+        edge_stream->report_metrics();
+        dyngraph_engine->set_json("ingestspeed", edge_stream->rate());
+        dyngraph_engine->set_json("ingestedges", edge_stream->num_edges());
+        
         /* Keep top 20 available for http admin */
         for(int i=0; i < (int) top.size(); i++) {
             vertex_value<float> vv = top[i];
@@ -198,70 +206,12 @@ void * dynamic_graph_reader(void * info) {
     std::cout << "End sleeping..." << std::endl;
     
     int edges_per_sec = get_option_int("edges_per_sec", 100000);
-    
-    logstream(LOG_INFO) << "Going to stream from: " << streaming_graph_file << std::endl;   
-    FILE * f = fopen(streaming_graph_file.c_str(), "r");
-    if (f == NULL) {
-        logstream(LOG_ERROR) << "Could not open file for streaming: " << streaming_graph_file << 
-        " error: " << strerror(errno) << std::endl;
-    }
-    assert(f != NULL);
-    
     logstream(LOG_INFO) << "Streaming speed capped at: " << edges_per_sec << " edges/sec." << std::endl;
     
-    size_t c = 0;
-    size_t ingested = 0;
-    // Used for flow control
-    timeval last, now;
-    gettimeofday(&last, NULL);
-    
-    vid_t from;
-    vid_t to;
-    char s[1024];
-    
-    while(fgets(s, 1024, f) != NULL) {
-        FIXLINE(s);
-        /* Read next line */
-        char delims[] = "\t ";	
-        char * t;
-        t = strtok(s, delims);
-        from = atoi(t);
-        t = strtok(NULL, delims);
-        to = atoi(t);
-        
-        if (from == to) {
-            // logstream(LOG_WARNING) << "Self-edge in stream: " << from << " <-> " << to << std::endl;
-            continue;
-        }
-        
-        bool success=false;
-        while (!success) {
-            success = dyngraph_engine->add_edge(from, to, 0.0f);
-        }
-        dyngraph_engine->add_task(from);
-        ingested++;
-        
-        if (++c % edges_per_sec == 0) {
-            std::cout << "Stream speed check...." << std::endl;
-            double sincelast;
-            double speed;
-            
-            // Throttling - keeps average speed of edges/sec in control
-            do {
-                gettimeofday(&now, NULL);
-                sincelast =  now.tv_sec-last.tv_sec+ ((double)(now.tv_usec-last.tv_usec))/1.0E6;
-                usleep(20000);
-                speed = (c / sincelast);
-            } while (speed > edges_per_sec);
-            dyngraph_engine->set_json("ingestspeed", speed);
-            logstream(LOG_INFO) << "Stream speed check ended.... Speed now:" << speed << " edges/sec" << std::endl;
-            dyngraph_engine->set_json("ingestedges", ingested);
-        }
-        
-                
-        
-    } 
-    fclose(f);
+    /* The stream is read and parsed in its own threads; see edgestream.hpp */
+    edge_stream->set_max_rate(edges_per_sec);
+    edge_stream->start();
+    edge_stream->join();
     dyngraph_engine->finish_after_iters(10);
     return NULL;
 }
@@ -288,6 +238,10 @@ int main(int argc, const char ** argv) {
     /* Create the engine object */
     dyngraph_engine = new graphchi_dynamicgraph_engine<float, float>(filename, nshards, scheduler, m); 
     dyngraph_engine->set_modifies_inedges(false); // Improves I/O performance.
+    dyngraph_engine->set_edge_added_hook(true);   // Schedules the endpoints of new edges
+    /* Ranks for the top list while running. Each snapshot copies the vertex data. */
+    dyngraph_engine->set_snapshot_interval(get_option_int("snapshot.interval", 5));
+    edge_stream = new dynamic_edge_stream<float, float>(dyngraph_engine, streaming_graph_file, m);
     
     /* Start streaming thread */
     pthread_t strthread;
@@ -307,6 +261,9 @@ int main(int argc, const char ** argv) {
     
     
     running = false;
+    pthread_join(strthread, NULL);
+    edge_stream->report_metrics();
+    delete edge_stream;
     
     /* Output top ranked vertices */
     std::vector< vertex_value<float> > top = get_top_vertices<float>(filename, ntop);
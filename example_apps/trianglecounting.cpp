@@ -289,7 +289,7 @@ struct TriangleCountingProgram : public GraphChiProgram<VertexDataType, EdgeData
             for(int i=0; i<v.num_edges(); i++) {
                 graphchi_edge<uint32_t> * e = v.edge(i);
                 if (e->vertexid > v.id() && e->vertexid >= adjcontainer->pivot_st) {
-                    assert(!is_deleted_edge_value(e->get_data()));
+                    assert(!e->is_deleted());
                     if (e->vertexid != lastvid) {  // Handles reciprocal edges (a->b, b<-a)
                         if (adjcontainer->is_pivot(e->vertexid)) {
                             uint32_t pivot_triangle_count = adjcontainer->intersection_size(v, e->vertexid, i);
@@ -60,6 +60,59 @@ namespace graphchi {
         return ss.str();
     }
     
+    /**
+      * Vertex data file of a reordered graph, written in the order
+      * of the original vertex ids.
+      */
+    template <typename VertexDataType>
+    static std::string filename_vertex_data_origorder(std::string basefilename) {
+        std::stringstream ss;
+        ss << basefilename;
+        ss << "." << sizeof(VertexDataType) << "B.origorder.vout";
+        return ss.str();
+    }
+
+    /**
+      * Latest snapshot of the vertex data published by the engine: a symbolic
+      * link to the file of the snapshot (see engine/auxdata/vertex_snapshot.hpp).
+      */
+    template <typename VertexDataType>
+    static std::string filename_vertex_snapshot(std::string basefilename) {
+        return filename_vertex_data<VertexDataType>(basefilename) + ".snapshot";
+    }
+
+    /**
+      * Snapshot of the vertex data after the given iteration.
+      */
+    template <typename VertexDataType>
+    static std::string filename_vertex_snapshot(std::string basefilename, int epoch) {
+        std::stringstream ss;
+        ss << filename_vertex_snapshot<VertexDataType>(basefilename) << "." << epoch;
+        return ss.str();
+    }
+
+    /**
+      * Mapping from original vertex ids to the ids of a reordered graph.
+      */
+    static std::string VARIABLE_IS_NOT_USED filename_vertex_map(std::string basefilename) {
+        return basefilename + ".vertexmap";
+    }
+
+    /**
+      * Mapping from the ids of a reordered graph to the original ids.
+      */
+    static std::string VARIABLE_IS_NOT_USED filename_vertex_map_inverse(std::string basefilename) {
+        return basefilename + ".vertexmap.inv";
+    }
+
+    /**
+      * Sorted original vertex ids of a graph whose ids were compacted:
+      * vertex i has the i-th id.
+      */
+    static std::string VARIABLE_IS_NOT_USED filename_vertex_dictionary(std::string basefilename) {
+        return basefilename + ".vertexdict";
+    }
+
     static std::string filename_degree_data(std::string basefilename)  {
         return basefilename + "_degs.bin";
     }
@@ -71,6 +124,12 @@ namespace graphchi {
         return ss.str();
     }
 
+    /**
+      * Predicted cost of each interval, written by the sharder.
+      */
+    static std::string VARIABLE_IS_NOT_USED filename_interval_costs(std::string basefilename, int nshards) {
+        return filename_intervals(basefilename, nshards) + ".cost";
+    }
     
     static std::string VARIABLE_IS_NOT_USED get_part_str(int p, int nshards) {
         char partstr[32];
@@ -95,7 +154,14 @@ namespace graphchi {
         ss << p << "_" << nshards << ".adj";
         return ss.str();
     }
-    
+
+    /**
+      * Deletion bitmap of a shard, kept beside its adjacency file.
+      */
+    static std::string VARIABLE_IS_NOT_USED filename_shard_deletions(std::string adjfilename) {
+        return adjfilename + ".deleted";
+    }
+
     /**
       * Configuration file name
       */
@@ -50,17 +50,56 @@ namespace graphchi {
 #define VARIABLE_IS_NOT_USED
 #endif
     
+    /**
+      * Deleted-flag of an edge: a bit in the deletion bitmap of a shard
+      * (see shards/deletionbitmap.hpp), or the flag of a buffered edge.
+      * Edges without a flag cannot be deleted.
+      */
+    struct edge_tombstone {
+        uint32_t * word;
+        uint32_t mask;
+        
+        edge_tombstone() : word(NULL), mask(0) {}
+        edge_tombstone(uint32_t * word, uint32_t mask) : word(word), mask(mask) {}
+        
+        bool is_set() const {
+            return word != NULL && (*word & mask) != 0;
+        }
+        
+        void set() {
+            if (word != NULL) __sync_fetch_and_or(word, mask);
+        }
+    };
+    
     template <typename EdgeDataType>
     class graphchi_edge {
         
     public:
         vid_t vertexid; // Source or Target vertex id. Clear from context.
         EdgeDataType * data_ptr;
+#ifdef SUPPORT_DELETIONS
+        edge_tombstone tombstone;
+#endif
         
         graphchi_edge() {}
         graphchi_edge(vid_t _vertexid, EdgeDataType * edata_ptr) : vertexid(_vertexid), data_ptr(edata_ptr) {
         }
         
+#ifdef SUPPORT_DELETIONS
+        graphchi_edge(vid_t _vertexid, EdgeDataType * edata_ptr, edge_tombstone tombstone) : vertexid(_vertexid), data_ptr(edata_ptr),
+                    tombstone(tombstone) {
+        }
+        
+        /**
+          * Returns true if the edge has been removed. Removed edges
+          * are not loaded anymore, but an edge removed during the
+          * current iteration is still visible to the other vertices.
+          */
+        bool is_deleted() const {
+            return tombstone.is_set();
+        }
+#endif
+        
         
         EdgeDataType get_data() {
             return * data_ptr;
@@ -162,12 +201,6 @@ namespace graphchi {
         // Optimization: as only memshard (not streaming shard) creates inedgers,
         // we do not need atomic instructions here!
         inline void add_inedge(vid_t src, EdgeDataType * ptr, bool special_edge) {
-#ifdef SUPPORT_DELETIONS
-            if (inedges_ptr != NULL && is_deleted_edge_value(*ptr)) {
-                deleted_inc++;
-                return;
-            }
-#endif
             if (inedges_ptr != NULL) inedges_ptr[inc] = graphchi_edge<EdgeDataType>(src, ptr);
             inc++;
 
@@ -175,17 +208,27 @@ namespace graphchi {
         }
         
         inline void add_outedge(vid_t dst, EdgeDataType * ptr, bool special_edge) {
-#ifdef SUPPORT_DELETIONS
-            if (outedges_ptr != NULL && is_deleted_edge_value(*ptr)) {
-                deleted_outc++;
-                return;
-            }
-#endif
             int i = __sync_add_and_fetch(&outc, 1);
             if (outedges_ptr != NULL) outedges_ptr[i-1] = graphchi_edge<EdgeDataType>(dst, ptr);
             assert(dst != vertexid);
         }
         
+#ifdef SUPPORT_DELETIONS
+        /* Deleted edges are skipped by the shards, see shards/deletionbitmap.hpp */
+        inline void add_inedge(vid_t src, EdgeDataType * ptr, bool special_edge, edge_tombstone tombstone) {
+            if (inedges_ptr != NULL) inedges_ptr[inc] = graphchi_edge<EdgeDataType>(src, ptr, tombstone);
+            inc++;
+            
+            assert(src != vertexid);
+        }
+        
+        inline void add_outedge(vid_t dst, EdgeDataType * ptr, bool special_edge, edge_tombstone tombstone) {
+            int i = __sync_add_and_fetch(&outc, 1);
+            if (outedges_ptr != NULL) outedges_ptr[i-1] = graphchi_edge<EdgeDataType>(dst, ptr, tombstone);
+            assert(dst != vertexid);
+        }
+#endif
+        
         
     };
     
@@ -270,16 +313,21 @@ namespace graphchi {
         
         
 #ifdef SUPPORT_DELETIONS
+        /**
+          * Removes an edge from the graph. The edge is marked deleted in
+          * the deletion bitmap of its shard, and it is not loaded anymore.
+          * The value of the edge is not changed.
+          */
         void VARIABLE_IS_NOT_USED remove_edge(int i) {
-            remove_edgev(edge(i));
+            edge(i)->tombstone.set();
         }
         
         void VARIABLE_IS_NOT_USED remove_inedge(int i) {
-            remove_edgev(inedge(i));
+            inedge(i)->tombstone.set();
         }
         
         void VARIABLE_IS_NOT_USED remove_outedge(int i) {
-            remove_edgev(outedge(i));
+            outedge(i)->tombstone.set();
         }
 #endif
         
@@ -293,8 +341,8 @@ namespace graphchi {
     // If highest order bit is set, the edge is "special". This is used
     // to indicate - in the neighborhood model - that neighbor's value is
     // cached in memory. 
-#define HIGHMASK (1 + (2147483647 >> 1))
-#define CLEARMASK (2147483647 >> 1)
+#define HIGHMASK ((vid_t)1 << (8 * sizeof(vid_t) - 2))
+#define CLEARMASK (HIGHMASK - 1)
     inline vid_t translate_edge(vid_t rawid, bool &is_special) {
         is_special = (rawid & HIGHMASK) != 0;
         return rawid & CLEARMASK;
@@ -306,50 +354,6 @@ namespace graphchi {
         return (rawid & HIGHMASK) != 0;
     }
     
-#ifdef SUPPORT_DELETIONS
-    
-    /*
-     * Hacky support for edge deletions.
-     * Edges are deleted by setting the value of the edge to a special
-     * value that denotes it was deleted.
-     * In the future, a better system could be designed.
-     */
-    
-    // This is hacky...
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(bool val) {
-        return val;
-    }
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(int val) {
-        return 0xffffffff == (unsigned int)val;
-    }
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(vid_t val) {
-        return 0xffffffffu == val;
-    }
-    
-    
-    static inline bool VARIABLE_IS_NOT_USED is_deleted_edge_value(float val) {
-        return !(val < 0 || val > 0);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bool> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<bool> * e) {
-        e->set_data(true);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<vid_t> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<vid_t> * e) {
-        e->set_data(0xffffffff);
-    }
-    
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<int> * e);
-    static void VARIABLE_IS_NOT_USED remove_edgev(graphchi_edge<int> * e) {
-        e->set_data(0xffffffff);
-    }
-    
-#endif  
-    
 
 } // Namespace
 
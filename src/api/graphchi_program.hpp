@@ -71,6 +71,20 @@ namespace graphchi {
         virtual void after_exec_interval(vid_t window_st, vid_t window_en, graphchi_context &gcontext) {        
         }
         
+        /**
+         * Called by the dynamic graph engine for each added edge, when the
+         * edge becomes visible to the update functions, if enabled with
+         * graphchi_dynamicgraph_engine::set_edge_added_hook(). With selective
+         * scheduling, only the vertices affected by the new edges are updated.
+         * By default, schedules both endpoints.
+         */
+        virtual void edge_added(vid_t src, vid_t dst, graphchi_context &gcontext) {
+            if (gcontext.scheduler != NULL) {
+                gcontext.scheduler->add_task(src);
+                gcontext.scheduler->add_task(dst);
+            }
+        }
+        
         /**
          * Update function.
          */
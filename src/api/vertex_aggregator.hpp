@@ -40,6 +40,7 @@
 #include "graphchi_types.hpp"
 #include "api/chifilenames.hpp"
 #include "util/ioutil.hpp"
+#include "util/vertexmap.hpp"
 
 namespace graphchi {
     
@@ -49,6 +50,10 @@ namespace graphchi {
         virtual void callback(vid_t vertex_id, VertexDataType &value) = 0;
     };
     
+    /**
+      * Calls the callback for vertices fromv..tov-1. If the graph was
+      * reordered or its ids compacted, the callback gets the original vertex ids.
+      */
     template <typename VertexDataType>
     void foreach_vertices(std::string basefilename, vid_t fromv, vid_t tov, VCallback<VertexDataType> &callback) {
         std::string filename = filename_vertex_data<VertexDataType>(basefilename);
@@ -63,13 +68,14 @@ namespace graphchi {
         bufsize = sizeof(VertexDataType) * nbuf; 
         
         VertexDataType * buffer = (VertexDataType*) calloc(nbuf, sizeof(VertexDataType));
+        original_vertex_ids origids(basefilename);
         
         for(vid_t v=fromv; v < tov; v += nbuf) {
             size_t nelements = std::min(tov, v + nbuf) - v;
             preada(f, buffer, nelements * sizeof(VertexDataType), v * sizeof(VertexDataType));
             
             for(int i=0; i < (int)nelements; i++) {
-                callback.callback(i + v, buffer[i]);
+                callback.callback(origids.translate(i + v), buffer[i]);
             }
         }
     }
@@ -34,12 +34,20 @@
 #define DEF_GRAPHCHI_VERTEXDATA
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <deque>
+#include <algorithm>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "graphchi_types.hpp"
 #include "api/chifilenames.hpp"
 #include "io/stripedio.hpp"
+#include "logger/logger.hpp"
 #include "util/ioutil.hpp"
 
 namespace graphchi {
@@ -55,10 +63,14 @@ namespace graphchi {
         vid_t vertex_st;
         vid_t vertex_en;
         
+        std::string base_filename;
         std::string filename;
         int filedesc;
         
         VertexDataType * loaded_chunk;
+        
+        /* Snapshot files that may still be used by readers, oldest first */
+        std::deque<std::string> snapshots;
 
 
         virtual void open_file(std::string base_filename) {
@@ -67,7 +79,7 @@ namespace graphchi {
         
     public:
         
-        vertex_data_store(std::string base_filename, size_t nvertices, stripedio * iomgr) : iomgr(iomgr), loaded_chunk(NULL){
+        vertex_data_store(std::string base_filename, size_t nvertices, stripedio * iomgr) : iomgr(iomgr), base_filename(base_filename), loaded_chunk(NULL){
             vertex_st = vertex_en = 0;
             filename = filename_vertex_data<VertexDataType>(base_filename);
             check_size(nvertices);
@@ -128,6 +140,68 @@ namespace graphchi {
         }
         
         
+        /**
+          * Publishes a snapshot of the vertex values for readers running
+          * beside the engine (see vertex_snapshot.hpp). Must be called between
+          * iterations, after the pending writes have finished. The values are
+          * taken from the chunk in memory or read through the I/O manager, as
+          * the vertex data file may be preloaded and stale on disk. The snapshot
+          * is written to a new file, which then replaces the latest snapshot
+          * by renaming a symbolic link. The previous snapshot is kept for the
+          * readers still mapping it.
+          */
+        void publish_snapshot(int epoch, size_t nvertices) {
+            std::string snapfile = filename_vertex_snapshot<VertexDataType>(base_filename, epoch);
+            std::string tmpfile = snapfile + ".tmp";
+            int f = open(tmpfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not create vertex data snapshot " << tmpfile << std::endl;
+                return;
+            }
+            
+            size_t chunkverts = 1024 * 1024;
+            for(size_t st=0; st < nvertices; st += chunkverts) {
+                size_t en = std::min(st + chunkverts, nvertices) - 1; // Inclusive
+                if (loaded_chunk != NULL && st >= vertex_st && en <= vertex_en) {
+                    pwritea(f, &loaded_chunk[st - vertex_st], (en - st + 1) * sizeof(VertexDataType), st * sizeof(VertexDataType));
+                    continue;
+                }
+                VertexDataType * buf = NULL;
+                size_t datasize = (en - st + 1) * sizeof(VertexDataType);
+                size_t datastart = st * sizeof(VertexDataType);
+                iomgr->managed_malloc(filedesc, &buf, datasize, datastart);
+                iomgr->managed_preada_now(filedesc, &buf, datasize, datastart);
+                /* The chunk in memory is newer than the file */
+                if (loaded_chunk != NULL && vertex_st <= en && vertex_en >= st) {
+                    size_t ost = std::max((size_t)vertex_st, st);
+                    size_t oen = std::min((size_t)vertex_en, en);
+                    memcpy(&buf[ost - st], &loaded_chunk[ost - vertex_st], (oen - ost + 1) * sizeof(VertexDataType));
+                }
+                pwritea(f, buf, datasize, datastart);
+                iomgr->managed_release(filedesc, &buf);
+            }
+            close(f);
+            rename(tmpfile.c_str(), snapfile.c_str());
+            
+            /* Readers open the link, so replacing it is atomic for them */
+            std::string link = filename_vertex_snapshot<VertexDataType>(base_filename);
+            std::string tmplink = link + ".tmp";
+            std::string target = snapfile.substr(snapfile.find_last_of('/') + 1);
+            unlink(tmplink.c_str());
+            if (symlink(target.c_str(), tmplink.c_str()) != 0 || rename(tmplink.c_str(), link.c_str()) != 0) {
+                logstream(LOG_ERROR) << "Could not link vertex data snapshot " << snapfile << " to " << link << std::endl;
+                return;
+            }
+            
+            if (snapshots.empty() || snapshots.back() != snapfile) {
+                snapshots.push_back(snapfile);
+            }
+            while (snapshots.size() > 2) {
+                unlink(snapshots.front().c_str());
+                snapshots.pop_front();
+            }
+        }
+        
         /**
          * Returns id of the first vertex currently in memory. Fails if nothing loaded yet.
          */
@@ -0,0 +1,168 @@
+
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @section DESCRIPTION
+ *
+ * Read access to the vertex values while the engine is running. The engine
+ * publishes a snapshot of the vertex values after every n iterations
+ * (option snapshot.interval, or graphchi_engine::set_snapshot_interval()).
+ * Each snapshot is a new file, named by the iteration (epoch) after which
+ * it was taken, and a symbolic link is atomically replaced to point to
+ * the latest one (filename_vertex_snapshot()). A snapshot file is never
+ * modified after it has been published, so a reader maps it and sees the
+ * values of a single iteration without blocking the engine. The engine
+ * removes the older snapshots; a mapped snapshot stays readable until the
+ * reader refreshes or is destroyed.
+ */
+
+#ifndef DEF_GRAPHCHI_VERTEX_SNAPSHOT
+#define DEF_GRAPHCHI_VERTEX_SNAPSHOT
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "graphchi_types.hpp"
+#include "api/chifilenames.hpp"
+#include "logger/logger.hpp"
+
+namespace graphchi {
+
+    template <typename VertexDataType>
+    class vertex_snapshot {
+
+        std::string linkname;
+        int epoch;
+        ino_t inode;
+        size_t nvertices;
+        size_t maplen;
+        VertexDataType * values;
+
+        void unmap() {
+            if (values != NULL) {
+                munmap(values, maplen);
+                values = NULL;
+            }
+            nvertices = maplen = 0;
+        }
+
+    public:
+        /**
+          * Maps the latest snapshot of the graph, if one has been published.
+          */
+        vertex_snapshot(std::string basefilename) : epoch(-1), inode(0), nvertices(0), maplen(0), values(NULL) {
+            linkname = filename_vertex_snapshot<VertexDataType>(basefilename);
+            refresh();
+        }
+
+        ~vertex_snapshot() {
+            unmap();
+        }
+
+        /**
+          * Maps the latest snapshot, if it is not the one already mapped.
+          * Returns true if a new snapshot was mapped.
+          */
+        bool refresh() {
+            /* The link may be replaced between reading it and opening
+               the file, so the link is read again after opening. */
+            for(int attempt=0; attempt < 10; attempt++) {
+                char target[1024];
+                ssize_t len = readlink(linkname.c_str(), target, sizeof(target) - 1);
+                if (len < 0) return false; // Nothing published yet
+                target[len] = '\0';
+
+                int f = open(linkname.c_str(), O_RDONLY);
+                if (f < 0) continue; // Removed after being replaced
+                struct stat st;
+                fstat(f, &st);
+                if (st.st_ino == inode) {
+                    close(f);
+                    return false;
+                }
+                char target2[1024];
+                ssize_t len2 = readlink(linkname.c_str(), target2, sizeof(target2) - 1);
+                if (len2 != len || strncmp(target, target2, len) != 0) {
+                    close(f);
+                    continue;
+                }
+
+                void * ptr = NULL;
+                if (st.st_size > 0) {
+                    ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, f, 0);
+                    if (ptr == MAP_FAILED) {
+                        logstream(LOG_ERROR) << "Could not map vertex data snapshot " << target << std::endl;
+                        close(f);
+                        return false;
+                    }
+                }
+                close(f);
+
+                unmap();
+                values = (VertexDataType *) ptr;
+                maplen = st.st_size;
+                nvertices = st.st_size / sizeof(VertexDataType);
+                inode = st.st_ino;
+                const char * dot = strrchr(target, '.');
+                epoch = (dot == NULL ? -1 : atoi(dot + 1));
+                return true;
+            }
+            return false;
+        }
+
+        /**
+          * Returns true if a snapshot has been mapped.
+          */
+        bool available() const {
+            return epoch >= 0;
+        }
+
+        /**
+          * Iteration after which the mapped snapshot was taken, or -1.
+          */
+        int get_epoch() const {
+            return epoch;
+        }
+
+        size_t num_vertices() const {
+            return nvertices;
+        }
+
+        const VertexDataType & operator[](vid_t vertexid) const {
+            assert(vertexid < nvertices);
+            return values[vertexid];
+        }
+
+        const VertexDataType * data() const {
+            return values;
+        }
+    };
+
+}
+
+#endif
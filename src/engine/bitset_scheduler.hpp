@@ -41,7 +41,7 @@ namespace graphchi {
     public:
         bool has_new_tasks;
         
-        bitset_scheduler(int nvertices) : bitset(nvertices) {
+        bitset_scheduler(size_t nvertices) : bitset(nvertices) {
         }
         
         virtual ~bitset_scheduler() {}
@@ -0,0 +1,332 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Decides how the dynamic graph engine commits the changes of the graph.
+ * For each shard, the policy chooses between keeping the buffered edges in
+ * memory, writing them to a new delta shard and compacting the shard with
+ * its deltas. A compacted shard is split into as many shards as needed to
+ * stay under the maximum shard size, and small neighbouring shards are
+ * merged into it.
+ *
+ * The choice is made with a cost model. The engine reports the time it
+ * spends loading the shards, the deltas and the buffered edges, and the
+ * policy estimates from them the cost of each alternative over the next
+ * dynamic.horizon iterations. Buffered edges are always committed before
+ * the buffers would fill up, estimated from the rate of the ingestion and
+ * the duration of the previous commit.
+ */
+
+#ifndef DEF_GRAPHCHI_COMMITPOLICY
+#define DEF_GRAPHCHI_COMMITPOLICY
+
+#include <vector>
+#include <algorithm>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "util/cmdopts.hpp"
+
+namespace graphchi {
+
+    enum { COMMIT_NONE, COMMIT_DELTA, COMMIT_COMPACT };
+
+    /**
+     * A shard of a dynamic graph, as seen by the commit policy. The edges
+     * include the edges of the deltas of the shard.
+     */
+    struct shard_commit_state {
+        vid_t nvertices;
+        size_t edges;
+        size_t deleted;
+        size_t buffered;
+        int ndeltas;
+    };
+
+    /**
+     * What a commit does with a shard. A compacted shard is split into nparts
+     * shards. If shards are merged, the first shard is compacted with the
+     * others up to shard mergeto, which have action COMMIT_COMPACT and nparts 0.
+     */
+    struct shard_commit_decision {
+        int action;
+        int nparts;
+        int mergeto;
+
+        shard_commit_decision() : action(COMMIT_NONE), nparts(1), mergeto(-1) {}
+    };
+
+    class commit_policy {
+
+        size_t edgebytes;        // Bytes of an edge in the shard files
+        size_t max_buffered;     // Capacity of the edge buffers
+        size_t max_shard_edges;
+        int max_deltas;
+        int horizon;
+        size_t compaction_budget;
+
+        /* Measured during the current iteration */
+        double shardtime;
+        double deltatime;
+        double buffertime;
+        size_t last_ingested;
+
+        /* Estimates, or negative if not known yet */
+        double secs_per_byte;      // Loading the shards
+        double delta_overhead;     // Seconds per iteration for each delta, beyond its edges
+        double secs_per_buffered;  // Seconds per iteration for each buffered edge
+        double ingest_rate;        // Edges per second
+        double iteration_secs;
+        double commit_secs;
+
+        /* Estimates are averaged with the previous ones to smooth out noise */
+        void estimate(double &est, double sample) {
+            est = (est < 0 ? sample : (est + sample) / 2);
+        }
+
+        double known(double est) {
+            return std::max(est, 0.0);
+        }
+
+    public:
+        /**
+         * @param edatasize size of the edge data type
+         * @param max_buffered capacity of the edge buffers, in edges
+         * @param membudget memory budget of the engine, in bytes
+         */
+        commit_policy(size_t edatasize, size_t max_buffered, size_t membudget) : max_buffered(max_buffered) {
+            edgebytes = edatasize + sizeof(vid_t);
+            // Like the sharder, see sharder::determine_number_of_shards()
+            size_t def = std::max((size_t)1, membudget / 8 / edatasize);
+            max_shard_edges = std::max((size_t)2, (size_t)get_option_long("dynamic.maxshardedges", def));
+            max_deltas = get_option_int("dynamic.maxdeltas", 8);
+            horizon = std::max(1, get_option_int("dynamic.horizon", 10));
+            compaction_budget = get_option_long("dynamic.compaction_mb", 4096) * 1024 * 1024;
+            shardtime = deltatime = buffertime = 0;
+            last_ingested = 0;
+            secs_per_byte = delta_overhead = secs_per_buffered = -1;
+            ingest_rate = iteration_secs = commit_secs = -1;
+        }
+
+        size_t get_max_shard_edges() {
+            return max_shard_edges;
+        }
+
+        /* Measurements by the engine */
+        void shards_loaded(double secs) {
+            shardtime += secs;
+        }
+
+        void deltas_loaded(double secs) {
+            deltatime += secs;
+        }
+
+        void buffered_added(double secs) {
+            buffertime += secs;
+        }
+
+        void commit_finished(double secs) {
+            commit_secs = secs;
+        }
+
+        /**
+         * Updates the estimates at the end of an iteration. Each edge of
+         * the shards and the deltas is loaded twice in an iteration: as an
+         * in-edge from the memory shard and as an out-edge from a sliding shard.
+         * @param shardedges edges in the shards
+         * @param deltaedges edges in the deltas
+         * @param ndeltas number of deltas
+         * @param buffered edges in the buffers
+         * @param ingested edges ingested since the engine started
+         */
+        void iteration_finished(double secs, size_t shardedges, size_t deltaedges, int ndeltas,
+                                size_t buffered, size_t ingested, metrics &m) {
+            if (shardtime > 0 && shardedges > 0) {
+                estimate(secs_per_byte, shardtime / (2.0 * shardedges * edgebytes));
+            }
+            if (deltatime > 0 && ndeltas > 0) {
+                double edgetime = 2.0 * deltaedges * edgebytes * known(secs_per_byte);
+                estimate(delta_overhead, std::max(0.0, deltatime - edgetime) / ndeltas);
+            }
+            if (buffertime > 0 && buffered > 0) {
+                estimate(secs_per_buffered, buffertime / buffered);
+            }
+            if (secs > 0) {
+                estimate(ingest_rate, (ingested - last_ingested) / secs);
+                estimate(iteration_secs, secs);
+            }
+            last_ingested = ingested;
+            shardtime = deltatime = buffertime = 0;
+
+            if (secs_per_byte > 0) m.set("dynamic.cost.load_mbps", 1.0 / secs_per_byte / 1024 / 1024);
+            m.set("dynamic.cost.delta_overhead", known(delta_overhead));
+            m.set("dynamic.cost.buffered_edge", known(secs_per_buffered));
+            m.set("dynamic.cost.ingest_rate", known(ingest_rate));
+        }
+
+        /**
+         * Decides the commit of each shard.
+         * @param remaining number of iterations left to run
+         */
+        std::vector<shard_commit_decision> decide(std::vector<shard_commit_state> &shards, int remaining, metrics &m) {
+            int nshards = (int) shards.size();
+            std::vector<shard_commit_decision> plan(nshards);
+            double H = (double) std::max(1, std::min(horizon, remaining));
+            double spb = known(secs_per_byte);
+            std::vector<size_t> live(nshards);
+            size_t buffered = 0;
+            for(int p=0; p < nshards; p++) {
+                live[p] = shards[p].edges - std::min(shards[p].deleted, shards[p].edges) + shards[p].buffered;
+                buffered += shards[p].buffered;
+            }
+
+            /* Compact the shards whose deltas and deleted edges cost more to load in the next
+               iterations than the compaction, and the shards that have grown too large. The
+               shards with the highest gain are compacted first, within dynamic.compaction_mb. */
+            std::vector< std::pair<double, int> > candidates;
+            for(int p=0; p < nshards; p++) {
+                shard_commit_state &s = shards[p];
+                bool oversized = live[p] > max_shard_edges && s.nvertices > 1;
+                double keepcost = H * (2.0 * s.deleted * edgebytes * spb + s.ndeltas * known(delta_overhead));
+                double compactcost = 2.0 * (s.edges + s.buffered) * edgebytes * spb;
+                if (oversized || s.ndeltas >= max_deltas) {
+                    candidates.push_back(std::pair<double, int>(1e30, p));
+                } else if (keepcost > compactcost && keepcost > 0) {
+                    candidates.push_back(std::pair<double, int>(keepcost / std::max(compactcost, 1e-9), p));
+                }
+            }
+            std::sort(candidates.rbegin(), candidates.rend());
+            size_t io = 0;
+            for(int i=0; i < (int)candidates.size(); i++) {
+                int p = candidates[i].second;
+                size_t cost = 2 * (shards[p].edges + shards[p].buffered) * edgebytes;
+                if (io > 0 && io + cost > compaction_budget) {
+                    logstream(LOG_DEBUG) << p << ": compaction postponed, budget used: " << io / 1024 / 1024 << " MB" << std::endl;
+                    continue;
+                }
+                io += cost;
+                plan[p].action = COMMIT_COMPACT;
+                plan[p].nparts = (int) std::min((size_t)shards[p].nvertices, (live[p] + max_shard_edges - 1) / max_shard_edges);
+                plan[p].nparts = std::max(1, plan[p].nparts);
+            }
+
+            /* Merge the compacted shards with their neighbours, while the merged
+               shard has at most half of the maximum edges. */
+            for(int p=0; p < nshards; p++) {
+                if (plan[p].action != COMMIT_COMPACT || plan[p].nparts != 1 || plan[p].mergeto >= 0) continue;
+                int first = p, last = p;
+                size_t edges = live[p];
+                bool grown = true;
+                while(grown) {
+                    grown = false;
+                    for(int q=first - 1; q <= last + 1 && !grown; q += last - first + 2) {
+                        if (q < 0 || q >= nshards) continue;
+                        // Shards before this one have been handled already
+                        if (plan[q].action == COMMIT_COMPACT && (q < first || plan[q].nparts != 1)) continue;
+                        size_t cost = (plan[q].action == COMMIT_COMPACT ? 0 : 2 * (shards[q].edges + shards[q].buffered) * edgebytes);
+                        if (edges + live[q] > max_shard_edges / 2 || io + cost > compaction_budget) continue;
+                        edges += live[q];
+                        io += cost;
+                        if (q < first) first = q; else last = q;
+                        grown = true;
+                    }
+                }
+                for(int q=first; q <= last; q++) {
+                    plan[q].action = COMMIT_COMPACT;
+                    plan[q].nparts = (q == first ? 1 : 0);
+                    plan[q].mergeto = last;
+                }
+                p = last;
+            }
+
+            /* Write a delta for the buffered edges of a shard, when they cost more to load
+               in the next iterations than writing them and loading the delta. */
+            size_t committed = 0;
+            for(int p=0; p < nshards; p++) {
+                shard_commit_state &s = shards[p];
+                if (plan[p].action == COMMIT_COMPACT) {
+                    committed += s.buffered;
+                    continue;
+                }
+                if (s.buffered == 0 || secs_per_buffered < 0) continue;
+                double keepcost = H * s.buffered * secs_per_buffered;
+                double deltacost = s.buffered * edgebytes * spb + H * known(delta_overhead);
+                if (keepcost > deltacost) {
+                    plan[p].action = COMMIT_DELTA;
+                    committed += s.buffered;
+                }
+            }
+
+            /* The buffers must not fill up before the commit is swapped in, which takes at
+               least an iteration, and another iteration passes before the next commit. If
+               they would, commit the largest buffers to bring them to half of the capacity. */
+            double inflow = known(ingest_rate) * (known(iteration_secs) + std::max(known(iteration_secs), known(commit_secs)));
+            if (buffered + inflow > max_buffered) {
+                double needed = buffered + inflow - max_buffered / 2;
+                std::vector< std::pair<size_t, int> > largest;
+                for(int p=0; p < nshards; p++) {
+                    if (plan[p].action == COMMIT_NONE && shards[p].buffered > 0) {
+                        largest.push_back(std::pair<size_t, int>(shards[p].buffered, p));
+                    }
+                }
+                std::sort(largest.rbegin(), largest.rend());
+                for(int i=0; i < (int)largest.size() && committed < needed; i++) {
+                    plan[largest[i].second].action = COMMIT_DELTA;
+                    committed += largest[i].first;
+                }
+            }
+
+            int ndeltas = 0, ncompactions = 0, nsplits = 0, nmerges = 0;
+            for(int p=0; p < nshards; p++) {
+                shard_commit_state &s = shards[p];
+                if (plan[p].action == COMMIT_DELTA) {
+                    logstream(LOG_DEBUG) << p << ": writing delta " << s.ndeltas << ", bufedges: " << s.buffered << std::endl;
+                    ndeltas++;
+                } else if (plan[p].action == COMMIT_COMPACT) {
+                    logstream(LOG_DEBUG) << p << ": going to compact, deltas: " << s.ndeltas << " deleted:" << s.deleted
+                        << "/" << s.edges << " bufedges: " << s.buffered << " parts: " << plan[p].nparts << " merge to: " << plan[p].mergeto << std::endl;
+                    if (plan[p].nparts > 0) ncompactions++;
+                    if (plan[p].nparts > 1) nsplits++;
+                    if (plan[p].nparts == 0) nmerges++;
+                } else {
+                    logstream(LOG_DEBUG) << p << ": nothing to commit, bufedges: " << s.buffered << " deleted:" << s.deleted << "/" << s.edges << std::endl;
+                }
+            }
+            if (ndeltas + ncompactions > 0) {
+                logstream(LOG_INFO) << "Commit: " << ndeltas << " deltas, " << ncompactions << " compactions, "
+                    << nsplits << " splits, " << nmerges << " merges" << std::endl;
+                m.add("dynamic.commits", 1);
+                m.add("dynamic.commit.deltas", ndeltas);
+                m.add("dynamic.commit.compactions", ncompactions);
+                m.add("dynamic.commit.splits", nsplits);
+                m.add("dynamic.commit.merges", nmerges);
+            }
+            return plan;
+        }
+    };
+
+}
+
+#endif
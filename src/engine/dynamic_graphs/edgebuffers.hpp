@@ -30,8 +30,12 @@
 #define DEF_GRAPHCHI_EDGEBUFFERS
 
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include <vector> 
+#include <algorithm>
 
+#include "api/graph_objects.hpp"
 
 namespace graphchi {
     
@@ -46,8 +50,27 @@ namespace graphchi {
         EdgeDataType data;
         bool accounted_for_outc;
         bool accounted_for_inc;
+#ifdef SUPPORT_DELETIONS
+        uint32_t deleted;
+#endif
         created_edge(vid_t src, vid_t dst, EdgeDataType _data) : src(src), dst(dst), data(_data), accounted_for_outc(false),
-        accounted_for_inc(false) {}
+        accounted_for_inc(false) {
+#ifdef SUPPORT_DELETIONS
+            deleted = 0;
+#endif
+        }
+        
+        /**
+          * Deleted-flag of the edge. Edges removed while they are
+          * buffered are not committed.
+          */
+        edge_tombstone tombstone() {
+#ifdef SUPPORT_DELETIONS
+            return edge_tombstone(&deleted, 1);
+#else
+            return edge_tombstone();
+#endif
+        }
     };
     
 #define EDGE_BUFFER_CHUNKSIZE 65536
@@ -55,12 +78,58 @@ namespace graphchi {
     /**
      * Efficient chunked edge-buffer with very low memory-overhead (compared
      * to just using a std-vector.
+     * The buffer keeps indices of the edges sorted by source and by destination,
+     * so that the edges of a range of vertices can be found without scanning
+     * the whole buffer. The indices are updated when they are queried: the new
+     * edges are sorted and merged to the index.
      */
     template <typename ET>
     class edge_buffer_flat {
         
         unsigned int count;
         std::vector<created_edge<ET> *> bufs;
+        std::vector<unsigned int> bysrc;
+        std::vector<unsigned int> bydst;
+        
+        struct index_less {
+            edge_buffer_flat * buf;
+            bool src;
+            index_less(edge_buffer_flat * buf, bool src) : buf(buf), src(src) {}
+            inline vid_t key(unsigned int i) const {
+                created_edge<ET> * e = (*buf)[i];
+                return (src ? e->src : e->dst);
+            }
+            bool operator()(unsigned int a, unsigned int b) const {
+                return key(a) < key(b);
+            }
+        };
+        
+        void update_index(std::vector<unsigned int> &idx, bool src) {
+            size_t sorted = idx.size();
+            if (sorted == count) return;
+            index_less cmp(this, src);
+            for(unsigned int i=(unsigned int)sorted; i < count; i++) idx.push_back(i);
+            std::stable_sort(idx.begin() + sorted, idx.end(), cmp);
+            std::inplace_merge(idx.begin(), idx.begin() + sorted, idx.end(), cmp);
+        }
+        
+        std::pair<unsigned int, unsigned int> range(std::vector<unsigned int> &idx, bool src, vid_t st, vid_t en) {
+            update_index(idx, src);
+            index_less cmp(this, src);
+            /* Binary search over the index for the first key >= st and the first key > en */
+            unsigned int lo = 0, hi = (unsigned int) idx.size();
+            while (lo < hi) {
+                unsigned int mid = lo + (hi - lo) / 2;
+                if (cmp.key(idx[mid]) < st) lo = mid + 1; else hi = mid;
+            }
+            unsigned int from = lo;
+            hi = (unsigned int) idx.size();
+            while (lo < hi) {
+                unsigned int mid = lo + (hi - lo) / 2;
+                if (cmp.key(idx[mid]) <= en) lo = mid + 1; else hi = mid;
+            }
+            return std::pair<unsigned int, unsigned int>(from, lo);
+        }
         
     public:    
         
@@ -76,6 +145,8 @@ namespace graphchi {
                 free(bufs[i]);
             }   
             bufs.clear();       
+            bysrc.clear();
+            bydst.clear();
             count = 0;
         }
         
@@ -100,11 +171,116 @@ namespace graphchi {
             bufs[bufidx][idx % EDGE_BUFFER_CHUNKSIZE] = cedge;
         }
         
+        /**
+         * Returns the positions [first, second) of the edges with source in
+         * [st, en] in the source order. Use with by_src().
+         */
+        std::pair<unsigned int, unsigned int> src_range(vid_t st, vid_t en) {
+            return range(bysrc, true, st, en);
+        }
+        
+        /**
+         * Returns the positions [first, second) of the edges with destination
+         * in [st, en] in the destination order. Use with by_dst().
+         */
+        std::pair<unsigned int, unsigned int> dst_range(vid_t st, vid_t en) {
+            return range(bydst, false, st, en);
+        }
+        
+        created_edge<ET> * by_src(unsigned int pos) {
+            return (*this)[bysrc[pos]];
+        }
+        
+        created_edge<ET> * by_dst(unsigned int pos) {
+            return (*this)[bydst[pos]];
+        }
+        
     private:
         // Disable value copying
         edge_buffer_flat(const edge_buffer_flat&);
         edge_buffer_flat& operator=(const edge_buffer_flat&);
     };
+    
+    /**
+     * Batch of edges added to the dynamic graph, waiting to be
+     * handed off to the edge buffers.
+     */
+    template <typename ET>
+    struct edge_batch {
+        edge_batch * next;
+        size_t count;
+        created_edge<ET> * edges;
+        
+        static edge_batch * create(const created_edge<ET> * edges, size_t count) {
+            edge_batch * b = (edge_batch *) malloc(sizeof(edge_batch) + count * sizeof(created_edge<ET>));
+            assert(b != NULL);
+            b->next = NULL;
+            b->count = count;
+            b->edges = (created_edge<ET> *) (b + 1);
+            memcpy(b->edges, edges, count * sizeof(created_edge<ET>));
+            return b;
+        }
+        
+        static void free_list(edge_batch * b) {
+            while (b != NULL) {
+                edge_batch * next = b->next;
+                free(b);
+                b = next;
+            }
+        }
+    };
+    
+    /**
+     * Lock-free multi-producer queue of edge batches. Producers push batches
+     * with a compare-and-swap; the single consumer takes all of them at once,
+     * so there is no ABA problem.
+     */
+    template <typename ET>
+    class edge_ingest_queue {
+        edge_batch<ET> * volatile head;
+        
+    public:
+        edge_ingest_queue() : head(NULL) {}
+        
+        ~edge_ingest_queue() {
+            edge_batch<ET>::free_list(take_all());
+        }
+        
+        void push(const created_edge<ET> * edges, size_t count) {
+            if (count == 0) return;
+            edge_batch<ET> * b = edge_batch<ET>::create(edges, count);
+            edge_batch<ET> * h;
+            do {
+                h = head;
+                b->next = h;
+            } while (!__sync_bool_compare_and_swap(&head, h, b));
+        }
+        
+        bool empty() {
+            return head == NULL;
+        }
+        
+        /**
+         * Removes all batches from the queue and returns them in the order
+         * they were pushed. The caller frees the list with edge_batch::free_list().
+         */
+        edge_batch<ET> * take_all() {
+            edge_batch<ET> * b = __sync_lock_test_and_set(&head, (edge_batch<ET> *) NULL);
+            edge_batch<ET> * fifo = NULL;
+            while (b != NULL) {
+                edge_batch<ET> * next = b->next;
+                b->next = fifo;
+                fifo = b;
+                b = next;
+            }
+            return fifo;
+        }
+        
+    private:
+        // Disable value copying
+        edge_ingest_queue(const edge_ingest_queue&);
+        edge_ingest_queue& operator=(const edge_ingest_queue&);
+    };
 
 
 };
@@ -0,0 +1,523 @@
+
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Streams edges into the dynamic graph engine while it computes. A reader
+ * thread reads the edge list in chunks from a file, a FIFO, the standard
+ * input ("-") or a local socket ("unix:<path>"), and worker threads parse
+ * the chunks. Each worker sorts its batch by the destination vertex, so
+ * the engine hands the edges off to the buffers of a shard in long runs,
+ * and adds the batch with graphchi_dynamicgraph_engine::add_edges(). When
+ * the edge buffers are full, the workers wait for a commit and the reader
+ * waits for the workers, so the stream is read only as fast as the engine
+ * takes the edges.
+ *
+ * The edge list has a source and a destination vertex on each line,
+ * optionally followed by the value of the edge. Lines starting with '#'
+ * or '%' are skipped, as are self-edges.
+ *
+ * Options:
+ *   ingest.workers        number of parse threads (default 2)
+ *   ingest.batch          edges added to the engine at a time (default 10000)
+ *   ingest.chunk_kb       size of the chunks read (default 1024)
+ *   ingest.edges_per_sec  maximum rate of the stream, 0 for no limit (default 0)
+ */
+
+#ifndef DEF_GRAPHCHI_EDGESTREAM
+#define DEF_GRAPHCHI_EDGESTREAM
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+#include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "util/cmdopts.hpp"
+#include "util/pthread_tools.hpp"
+
+namespace graphchi {
+
+    template <typename VertexDataType, typename EdgeDataType, typename svertex_t = graphchi_vertex<VertexDataType, EdgeDataType> >
+    class dynamic_edge_stream {
+    public:
+        typedef graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType, svertex_t> engine_t;
+        typedef void (*value_parser_t)(EdgeDataType &, const char *);
+
+    private:
+        struct stream_chunk {
+            char * data;
+            size_t len;
+        };
+
+        struct worker_info {
+            dynamic_edge_stream * stream;
+            pthread_t thread;
+        };
+
+        engine_t * engine;
+        std::string source;
+        metrics &m;
+        value_parser_t value_parser;
+
+        int nworkers;
+        size_t batchsize;
+        size_t chunksize;
+        size_t max_rate;
+
+        int fd;
+        int wakepipe[2];         // stop() writes to it to wake up the reader
+        pthread_t reader;
+        std::vector<worker_info> workers;
+        bool started;
+        volatile bool stopped;   // The engine finished, or stop() was called
+
+        /* Chunks read but not yet parsed. The reader waits while the queue is full. */
+        std::deque<stream_chunk> chunks;
+        bool eof;
+        mutex qlock;
+        conditional qnotempty, qnotfull;
+
+        timeval start_time;
+        size_t nbytes;
+        size_t nlines;
+        size_t nedges;
+        size_t nskipped;
+        size_t max_lag;
+        double endsecs;     // Duration of the stream, when it has ended
+        double readsecs;    // Time the reader waited for the stream
+        double parsesecs;   // Time the workers parsed and added edges
+
+    public:
+        /**
+          * Creates the stream. It is started with start().
+          * @param source file, FIFO, "-" for the standard input or "unix:<path>" for a local socket
+          */
+        dynamic_edge_stream(engine_t * engine, std::string source, metrics &_m) : engine(engine), source(source), m(_m),
+                                value_parser(NULL), fd(-1), started(false), stopped(false), eof(false),
+                                nbytes(0), nlines(0), nedges(0), nskipped(0), max_lag(0),
+                                endsecs(-1), readsecs(0), parsesecs(0) {
+            nworkers = std::max(1, get_option_int("ingest.workers", 2));
+            batchsize = (size_t) std::max((uint64_t)1, get_option_long("ingest.batch", 10000));
+            chunksize = (size_t) std::max((uint64_t)1, get_option_long("ingest.chunk_kb", 1024)) * 1024;
+            max_rate = (size_t) get_option_long("ingest.edges_per_sec", 0);
+            wakepipe[0] = wakepipe[1] = -1;
+            gettimeofday(&start_time, NULL);
+        }
+
+        virtual ~dynamic_edge_stream() {
+            if (started) {
+                stop();
+                join();
+            }
+        }
+
+        /**
+          * Parses the value column of the edges. Without a parser, the
+          * edges get the value EdgeDataType(). For the basic types, the
+          * parsers of preprocessing/conversions.hpp can be used:
+          * set_value_parser(parse).
+          */
+        void set_value_parser(value_parser_t parser) {
+            value_parser = parser;
+        }
+
+        /**
+          * Limits the rate of the stream, in edges per second. 0 for no limit.
+          */
+        void set_max_rate(size_t edges_per_sec) {
+            max_rate = edges_per_sec;
+        }
+
+        void start() {
+            assert(!started);
+            fd = open_source();
+            int ret = pipe(wakepipe);
+            assert(ret == 0);
+            gettimeofday(&start_time, NULL);
+            logstream(LOG_INFO) << "Streaming edges from " << source << " with " << nworkers << " parse threads" << std::endl;
+
+            workers.resize(nworkers);
+            for(int i=0; i < nworkers; i++) {
+                workers[i].stream = this;
+                ret = pthread_create(&workers[i].thread, NULL, worker_loop, (void *) &workers[i]);
+                assert(ret == 0);
+            }
+            ret = pthread_create(&reader, NULL, reader_loop, (void *) this);
+            assert(ret == 0);
+            started = true;
+        }
+
+        /**
+          * Waits until the stream has ended and all its edges have been
+          * added to the engine, or the engine has finished.
+          * @see report_metrics()
+          */
+        void join() {
+            if (!started) return;
+            pthread_join(reader, NULL);
+            for(int i=0; i < nworkers; i++) {
+                pthread_join(workers[i].thread, NULL);
+            }
+            started = false;
+            endsecs = elapsed();
+            if (fd >= 0) close(fd);
+            fd = -1;
+            qlock.lock();
+            close(wakepipe[0]);
+            close(wakepipe[1]);
+            wakepipe[0] = wakepipe[1] = -1;
+            qlock.unlock();
+            logstream(LOG_INFO) << "Stream " << source << " ended: " << nedges << " edges, "
+                << nskipped << " lines skipped, " << rate() << " edges/sec" << std::endl;
+        }
+
+        /**
+          * Stops reading the stream. The edges that have not been added yet are dropped.
+          */
+        void stop() {
+            stopped = true;
+            qlock.lock();
+            if (wakepipe[1] >= 0) {
+                /* Wakes up the reader waiting for data, whatever the type of the source */
+                char c = 0;
+                ssize_t VARIABLE_IS_NOT_USED n = write(wakepipe[1], &c, 1);
+            }
+            qnotfull.broadcast();
+            qlock.unlock();
+        }
+
+        size_t num_edges() {
+            return nedges;
+        }
+
+        double elapsed() {
+            if (endsecs >= 0) return endsecs;
+            timeval now;
+            gettimeofday(&now, NULL);
+            return now.tv_sec - start_time.tv_sec + ((double)(now.tv_usec - start_time.tv_usec)) / 1.0E6;
+        }
+
+        /**
+          * Edges added per second since the start of the stream.
+          */
+        double rate() {
+            double secs = elapsed();
+            return secs > 0 ? nedges / secs : 0.0;
+        }
+
+        /**
+          * Edges added to the engine, but not yet visible to the update functions.
+          */
+        size_t lag() {
+            return engine->num_queued_edges();
+        }
+
+        /**
+          * Writes the ingest metrics. The metrics are not thread-safe, so
+          * call this from the thread running the engine, for example in
+          * after_iteration(), or after the engine has finished.
+          */
+        void report_metrics() {
+            qlock.lock();
+            m.set("ingest.read", readsecs, TIME);
+            m.set("ingest.parse", parsesecs, TIME);
+            qlock.unlock();
+            m.set("ingest.edges", (size_t) nedges);
+            m.set("ingest.bytes", (size_t) nbytes);
+            m.set("ingest.lines_skipped", (size_t) nskipped);
+            m.set("ingest.rate", rate());
+            m.set("ingest.lag", lag());
+            m.set("ingest.lag.max", (size_t) max_lag);
+            double r = rate();
+            m.set("ingest.lag.secs", r > 0 ? lag() / r : 0.0);
+        }
+
+    private:
+        int open_source() {
+            int f;
+            if (source == "-") {
+                f = dup(0);
+            } else if (source.substr(0, 5) == "unix:") {
+                std::string path = source.substr(5);
+                struct sockaddr_un addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sun_family = AF_UNIX;
+                if (path.size() >= sizeof(addr.sun_path)) {
+                    logstream(LOG_FATAL) << "Socket path too long: " << path << std::endl;
+                    assert(false);
+                }
+                strcpy(addr.sun_path, path.c_str());
+                f = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (f >= 0 && connect(f, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+                    close(f);
+                    f = -1;
+                }
+            } else {
+                f = open(source.c_str(), O_RDONLY);
+            }
+            if (f < 0) {
+                logstream(LOG_FATAL) << "Could not open the edge stream " << source << ": " << strerror(errno) << std::endl;
+                assert(false);
+            }
+            return f;
+        }
+
+        static void * reader_loop(void * _stream) {
+            ((dynamic_edge_stream *) _stream)->read_chunks();
+            return NULL;
+        }
+
+        static void * worker_loop(void * _info) {
+            ((worker_info *) _info)->stream->parse_chunks();
+            return NULL;
+        }
+
+        /**
+          * Reads the stream in chunks that end at a line break. The partial
+          * line at the end of a read is moved to the next chunk.
+          */
+        void read_chunks() {
+            std::vector<char> partial;
+            while (!stopped) {
+                char * buf = (char *) malloc(partial.size() + chunksize + 1);
+                if (!partial.empty()) memcpy(buf, &partial[0], partial.size());
+                size_t len = partial.size();
+
+                metrics_entry me = m.start_time();
+                ssize_t n = wait_readable() ? -1 : 0;
+                while (n < 0 && !stopped) {
+                    n = read(fd, buf + len, chunksize);
+                    if (n >= 0 || errno != EINTR) break;
+                }
+                if (stopped) {
+                    free(buf);
+                    break;
+                }
+                me.timer_stop();
+                if (n < 0 && !stopped) {
+                    logstream(LOG_ERROR) << "Error reading the edge stream " << source << ": " << strerror(errno) << std::endl;
+                }
+                qlock.lock();
+                readsecs += me.lasttime;
+                qlock.unlock();
+                bool end = (n <= 0);
+                len += (n > 0 ? n : 0);
+                __sync_fetch_and_add(&nbytes, (size_t) (n > 0 ? n : 0));
+
+                /* Keep the partial line for the next chunk */
+                size_t chunklen = len;
+                if (!end) {
+                    while (chunklen > 0 && buf[chunklen - 1] != '\n') chunklen--;
+                }
+                partial.assign(buf + chunklen, buf + len);
+
+                if (chunklen > 0) {
+                    buf[chunklen] = '\0';
+                    throttle(buf, chunklen);
+                    if (!push_chunk(buf, chunklen)) free(buf);
+                } else {
+                    free(buf);
+                }
+
+                size_t l = lag();
+                if (l > max_lag) max_lag = l;
+                if (end) break;
+            }
+            qlock.lock();
+            eof = true;
+            qnotempty.broadcast();
+            qlock.unlock();
+        }
+
+        /**
+          * Waits until the source has data or stop() is called. Returns 
+          * false if the stream was stopped or the source failed.
+          */
+        bool wait_readable() {
+            struct pollfd fds[2];
+            fds[0].fd = fd;
+            fds[0].events = POLLIN;
+            fds[1].fd = wakepipe[0];
+            fds[1].events = POLLIN;
+            while (!stopped) {
+                fds[0].revents = fds[1].revents = 0;
+                int ret = poll(fds, 2, -1);
+                if (ret < 0 && errno == EINTR) continue;
+                if (ret < 0) {
+                    logstream(LOG_ERROR) << "Error polling the edge stream " << source << ": " << strerror(errno) << std::endl;
+                    return false;
+                }
+                if (fds[1].revents != 0) return false;
+                /* Also an error or hang-up: read() reports it */
+                if (fds[0].revents != 0) return true;
+            }
+            return false;
+        }
+        
+        /**
+          * Keeps the average rate under the limit, counting the lines.
+          */
+        void throttle(const char * buf, size_t len) {
+            if (max_rate == 0) return;
+            const char * p = buf, * end = buf + len;
+            while ((p = (const char *) memchr(p, '\n', end - p)) != NULL) {
+                nlines++;
+                p++;
+            }
+            while (!stopped && nlines > max_rate * elapsed()) {
+                usleep(10000);
+            }
+        }
+
+        bool push_chunk(char * buf, size_t len) {
+            qlock.lock();
+            while (!stopped && (int) chunks.size() >= 2 * nworkers) {
+                qnotfull.wait(qlock);
+            }
+            bool accepted = !stopped;
+            if (accepted) {
+                stream_chunk c;
+                c.data = buf;
+                c.len = len;
+                chunks.push_back(c);
+                qnotempty.signal();
+            }
+            qlock.unlock();
+            return accepted;
+        }
+
+        bool pop_chunk(stream_chunk &c) {
+            qlock.lock();
+            while (chunks.empty() && !eof) {
+                qnotempty.wait(qlock);
+            }
+            bool got = !chunks.empty();
+            if (got) {
+                c = chunks.front();
+                chunks.pop_front();
+                qnotfull.signal();
+            }
+            qlock.unlock();
+            return got;
+        }
+
+        static bool is_delim(char c) {
+            return c == ' ' || c == '\t' || c == ',' || c == '\r';
+        }
+
+        void parse_chunks() {
+            std::vector< created_edge<EdgeDataType> > batch;
+            batch.reserve(batchsize);
+            stream_chunk c;
+            while (pop_chunk(c)) {
+                metrics_entry me = m.start_time();
+                size_t skipped = 0;
+                char * line = c.data, * end = c.data + c.len;
+                while (line < end) {
+                    char * eol = (char *) memchr(line, '\n', end - line);
+                    if (eol == NULL) eol = end;
+                    *eol = '\0';
+
+                    char * p = line;
+                    while (is_delim(*p)) p++;
+                    if (*p != '\0' && *p != '#' && *p != '%') {
+                        char * e;
+                        vid_t src = (vid_t) strtoul(p, &e, 10);
+                        bool valid = (e != p);
+                        p = e;
+                        while (is_delim(*p)) p++;
+                        vid_t dst = (vid_t) strtoul(p, &e, 10);
+                        valid = valid && (e != p) && src != dst;
+                        if (valid) {
+                            EdgeDataType val = EdgeDataType();
+                            p = e;
+                            while (is_delim(*p)) p++;
+                            if (value_parser != NULL && *p != '\0') value_parser(val, p);
+                            batch.push_back(created_edge<EdgeDataType>(src, dst, val));
+                        } else {
+                            skipped++;
+                        }
+                    }
+                    line = eol + 1;
+
+                    if (batch.size() >= batchsize) add_batch(batch);
+                }
+                free(c.data);
+                add_batch(batch);
+                if (skipped > 0) __sync_fetch_and_add(&nskipped, skipped);
+                me.timer_stop();
+                qlock.lock();
+                parsesecs += me.lasttime;
+                qlock.unlock();
+
+                if (stopped) {
+                    /* Drain the queue, so that the reader is not blocked */
+                    while (pop_chunk(c)) free(c.data);
+                    break;
+                }
+            }
+        }
+
+        /**
+          * Adds the edges in the order of the destination vertices, so that
+          * the edges of a shard are handed off together.
+          */
+        void add_batch(std::vector< created_edge<EdgeDataType> > &batch) {
+            if (batch.empty()) return;
+            std::sort(batch.begin(), batch.end(), dst_less);
+            if (!stopped && engine->add_edges(batch)) {
+                __sync_fetch_and_add(&nedges, batch.size());
+            } else if (!stopped) {
+                logstream(LOG_INFO) << "Engine has finished, stopping the edge stream " << source << std::endl;
+                stop();
+            }
+            batch.clear();
+        }
+
+        static bool dst_less(const created_edge<EdgeDataType> &a, const created_edge<EdgeDataType> &b) {
+            return a.dst < b.dst;
+        }
+
+        // Disable value copying
+        dynamic_edge_stream(const dynamic_edge_stream&);
+        dynamic_edge_stream& operator=(const dynamic_edge_stream&);
+    };
+
+};
+
+#endif
+
@@ -32,10 +32,14 @@
 #define GRAPHCHI_DYNAMICGRAPHENGINE_DEF
 
 #include <stdlib.h>
+#include <pthread.h>
 #include <vector>
+#include <set>
+#include <algorithm>
 
 #include "engine/graphchi_engine.hpp"
 #include "engine/dynamic_graphs/edgebuffers.hpp"
+#include "engine/dynamic_graphs/commitpolicy.hpp"
 #include "logger/logger.hpp"
 
 
@@ -55,7 +59,35 @@ namespace graphchi {
         graphchi_engine<VertexDataType, EdgeDataType, svertex_t>(base_filename, nshards, selective_scheduling, _m){
             _m.set("engine", "dynamicgraphs");
             added_edges = 0;
-            maxshardsize = 200 * 1024 * 1024;
+            ingested_edges = 0;
+            last_commit = 0;
+            ingest_closed = false;
+            waiting_for_work = false;
+            max_edge_buffer = get_option_long("max_edgebuffer_mb", 1000) * 1024 * 1024 / sizeof(created_edge<EdgeDataType>);
+            policy = new commit_policy(sizeof(EdgeDataType), max_edge_buffer, (size_t)this->membudget_mb * 1024 * 1024);
+            ndeltas_created = 0;
+            commit = NULL;
+            userprogram = NULL;
+            edge_added_hook = false;
+            hook_batches = NULL;
+            max_vertex_id = (vid_t) (this->num_vertices() - 1);
+            next_vertex_id = 0;
+        }
+        
+        virtual ~graphchi_dynamicgraph_engine() {
+            if (commit != NULL) {
+                pthread_join(commit->thread, NULL);
+                release_commit();
+            }
+            for(int p=0; p < (int)deltashards.size(); p++) {
+                for(int k=0; k < (int)deltashards[p].size(); k++) {
+                    if (deltashards[p][k].memshard != NULL) delete deltashards[p][k].memshard;
+                    if (deltashards[p][k].sliding != NULL) delete deltashards[p][k].sliding;
+                    if (deltashards[p][k].deletions != NULL) delete deltashards[p][k].deletions;
+                }
+            }
+            edge_batch<EdgeDataType>::free_list(hook_batches);
+            delete policy;
         }
         
     protected:
@@ -67,14 +99,62 @@ namespace graphchi {
         std::vector<int> deletecounts;
         std::vector<std::string> shard_suffices;
         
+        /**
+         * Edges committed after the last compaction of a shard are stored in
+         * delta shards of the shard, which have the same format as the shard
+         * and are read with it. Compaction merges them into the shard.
+         */
+        struct delta_shard {
+            std::string adjfile;
+            std::string edatafile;
+            size_t nedges;
+            typename base_engine::memshard_t * memshard;
+            typename base_engine::slidingshard_t * sliding;
+            deletion_bitmap * deletions;
+        };
+        std::vector< std::vector<delta_shard> > deltashards;
+        int ndeltas_created;
+        
+        /* Decides what to commit, from the load times measured in the iterations */
+        commit_policy * policy;
+        metrics_entry itertimer;
+        
+        /* Commit running in the background, or NULL */
+        struct graph_commit;
+        graph_commit * commit;
+        
         vid_t max_vertex_id;
         size_t max_edge_buffer;
         size_t last_commit;
-        size_t added_edges;
+        size_t added_edges;     // Edges accepted by add_edge(s), including queued ones
+        size_t ingested_edges;  // Edges moved from the queue to the buffers
         std::string state;
-        size_t maxshardsize;
         size_t edges_in_shards;
         
+        /* Program notified of the added edges, see set_edge_added_hook() */
+        GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> * userprogram;
+        bool edge_added_hook;
+        edge_batch<EdgeDataType> * hook_batches;  // Handed off, but not yet passed to the hook
+        
+        
+        /**
+         * Edges are added by producer threads to a lock-free queue, and handed
+         * off to the buffers by the engine thread before each sub-interval.
+         */
+        edge_ingest_queue<EdgeDataType> ingest_queue;
+        std::vector<vid_t> pending_tasks;
+        bool ingest_closed;
+        
+        /**
+         * Deleted vertices. The requests of delete_vertex() are handed off with
+         * the edges. The edges of a vertex are removed when it is next loaded,
+         * and its id is then free for new_vertex_id().
+         */
+        std::vector<vid_t> deletion_requests;
+        std::set<vid_t> deleted_vertices;   // Being removed, or free
+        std::set<vid_t> removing_vertices;  // Edges in the shards not yet removed
+        std::set<vid_t> free_vertex_ids;
+        vid_t next_vertex_id;
         
         /**
          * Concurrency control
@@ -82,6 +162,11 @@ namespace graphchi {
         mutex modification_lock;
         mutex schedulerlock;
         mutex shardlock;
+        mutex ingest_lock;
+        mutex vertexlock;
+        conditional buffer_space;
+        conditional work_available;   // See wait_for_work()
+        volatile bool waiting_for_work;
         
         /** 
          * Preloading will interfere with the operation.
@@ -90,6 +175,11 @@ namespace graphchi {
             return true;
         }
         
+        /* Edges are added during the run, so the graph cannot be kept in memory */
+        virtual bool disable_inmemory_mode() {
+            return true;
+        }
+        
         /** 
           * Create a dynamic version of the degree file.
           */
@@ -105,9 +195,13 @@ namespace graphchi {
             shardlock.lock();
             size_t ne = 0;
             for(int i=0; i < this->nshards; i++) {
-                ne += this->sliding_shards[i]->num_edges();
+                ne += this->sliding_shards[i]->num_edges() + delta_edges(i);
                 for(int j=0; j < (int) new_edge_buffers[i].size(); j++)
                     ne += new_edge_buffers[i][j]->size();
+                if (commit != NULL) {
+                    for(int j=0; j < (int) commit->buffers[i].size(); j++)
+                        ne += commit->buffers[i][j]->size();
+                }
             }
             shardlock.unlock();
             return ne;
@@ -125,8 +219,6 @@ namespace graphchi {
         
     protected:
         void init_buffers() {
-            max_edge_buffer = get_option_long("max_edgebuffer_mb", 1000) * 1024 * 1024 / sizeof(created_edge<EdgeDataType>);
-            
             // Save old so if there are existing edges, they can be moved
             std::vector< std::vector< edge_buffer * > > tmp_new_edge_buffers;
             for(int i=0; i < this->nshards; i++) {
@@ -169,8 +261,7 @@ namespace graphchi {
             char * buf;
             int f = open(origfile.c_str(), O_RDONLY);    
             size_t len = readfull(f, &buf);
-            std::cout << "Length: " << len << std::endl;
-            std::cout << origfile << " ----> " << dstfile << std::endl;
+            logstream(LOG_DEBUG) << "Copying " << origfile << " (" << len << " bytes) to " << dstfile << std::endl;
             
             close(f);
             remove(dstfile.c_str());
@@ -192,6 +283,19 @@ namespace graphchi {
             int p = this->exec_interval;
             std::string adj_filename = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];          
             std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];
+            
+            /* Memory shards of the deltas */
+            for(int k=0; k < (int)deltashards[p].size(); k++) {
+                delta_shard &d = deltashards[p][k];
+                if (d.sliding != NULL) d.sliding->flush();
+                if (d.memshard != NULL) delete d.memshard;
+                d.memshard = new typename base_engine::memshard_t(this->iomgr, d.edatafile, d.adjfile,
+                                                                  interval_st, interval_en, this->m);
+                d.memshard->only_adjacency = this->only_adjacency;
+                d.memshard->set_deletions(d.deletions);
+            }
+            this->iomgr->wait_for_writes();
+            
             return new typename base_engine::memshard_t(this->iomgr,
                                                         edata_filename,
                                                         adj_filename,  
@@ -200,6 +304,33 @@ namespace graphchi {
                                                         this->m);
         }
         
+        size_t delta_edges(int p) {
+            size_t ne = 0;
+            for(int k=0; k < (int)deltashards[p].size(); k++) {
+                ne += deltashards[p][k].nedges;
+            }
+            return ne;
+        }
+        
+        /**
+         * Commits the memory shards of the deltas of the execution interval
+         * and moves their stream shards to continue after the interval.
+         */
+        virtual void interval_finished() {
+            std::vector<delta_shard> &deltas = deltashards[this->exec_interval];
+            for(int k=0; k < (int)deltas.size(); k++) {
+                typename base_engine::memshard_t * memshard = deltas[k].memshard;
+                if (memshard == NULL) continue;
+                if (memshard->loaded()) {
+                    memshard->commit(this->modifies_inedges);
+                    deltas[k].sliding->set_offset(memshard->offset_for_stream_cont(), memshard->offset_vid_for_stream_cont(),
+                                                  memshard->edata_ptr_for_stream_cont());
+                }
+                delete memshard;
+                deltas[k].memshard = NULL;
+            }
+        }
+        
         
         /**
          * Initialize streaming shards in the start of each iteration.
@@ -207,34 +338,39 @@ namespace graphchi {
         virtual void initialize_sliding_shards() {
             shardlock.lock();
             if (this->sliding_shards.empty()) {
-                for(int p=0; p < this->nshards; p++) {
+                this->sliding_shards.resize(this->nshards, NULL);
+                this->deletions.resize(this->nshards, NULL);
+            }
+            for(int p=0; p < this->nshards; p++) {
+                if (this->sliding_shards[p] == NULL) {
                     std::string adj_filename = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];          
                     std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];
                     
-                    this->sliding_shards.push_back(
-                                                   new typename base_engine::slidingshard_t(this->iomgr, edata_filename, 
-                                                                                            adj_filename,
-                                                                                            this->intervals[p].first, 
-                                                                                            this->intervals[p].second, 
-                                                                                            this->blocksize, 
-                                                                                            this->m, 
-                                                                                            !this->modifies_outedges, 
-                                                                                            false));
+                    this->sliding_shards[p] =  new typename base_engine::slidingshard_t(this->iomgr, edata_filename, 
+                                                                                        adj_filename,
+                                                                                        this->intervals[p].first, 
+                                                                                        this->intervals[p].second, 
+                                                                                        this->blocksize, 
+                                                                                        this->m, 
+                                                                                        !this->modifies_outedges, 
+                                                                                        false);
+                    this->deletions[p] = open_deletion_bitmap<EdgeDataType>(adj_filename, edata_filename);
+                    this->sliding_shards[p]->set_deletions(this->deletions[p]);
                 }
-            } else {
-                for(int p=0; p < this->nshards; p++) {
-                    if (this->sliding_shards[p] == NULL) {
-                        std::string adj_filename = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];          
-                        std::string edata_filename = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[p];
-                        
-                        this->sliding_shards[p] =  new typename base_engine::slidingshard_t(this->iomgr, edata_filename, 
-                                                                                            adj_filename,
-                                                                                            this->intervals[p].first, 
-                                                                                            this->intervals[p].second, 
-                                                                                            this->blocksize, 
-                                                                                            this->m, 
-                                                                                            !this->modifies_outedges, 
-                                                                                            false);
+            }
+            for(int p=0; p < this->nshards; p++) {
+                for(int k=0; k < (int)deltashards[p].size(); k++) {
+                    delta_shard &d = deltashards[p][k];
+                    if (d.sliding == NULL) {
+                        d.sliding = new typename base_engine::slidingshard_t(this->iomgr, d.edatafile, d.adjfile,
+                                                                             this->intervals[p].first,
+                                                                             this->intervals[p].second,
+                                                                             this->blocksize,
+                                                                             this->m,
+                                                                             !this->modifies_outedges,
+                                                                             false);
+                        if (d.deletions == NULL) d.deletions = open_deletion_bitmap<EdgeDataType>(d.adjfile, d.edatafile);
+                        d.sliding->set_deletions(d.deletions);
                     }
                 }
             }
@@ -243,6 +379,28 @@ namespace graphchi {
 
         }
         
+        virtual void save_deletions() {
+            base_engine::save_deletions();
+            for(int p=0; p < (int)deltashards.size(); p++) {
+                for(int k=0; k < (int)deltashards[p].size(); k++) {
+                    if (deltashards[p][k].deletions != NULL) deltashards[p][k].deletions->save();
+                }
+            }
+        }
+        
+        /**
+         * Counts the deleted edges of each shard and its deltas.
+         */
+        void count_deletions() {
+            deletecounts.assign(this->nshards, 0);
+            for(int p=0; p < this->nshards; p++) {
+                if (this->deletions[p] != NULL) deletecounts[p] += this->deletions[p]->num_deleted();
+                for(int k=0; k < (int)deltashards[p].size(); k++) {
+                    if (deltashards[p][k].deletions != NULL) deletecounts[p] += deltashards[p][k].deletions->num_deleted();
+                }
+            }
+        }
+        
         void prepare_clean_slate() {
             logstream(LOG_INFO) << "Preparing clean slate..." << std::endl;
             for(int shard=0; shard < this->nshards; shard++) {
@@ -255,7 +413,14 @@ namespace graphchi {
                 
                 cp(edata_filename, dest_edata, true);
                 cp(adj_filename, dest_adj);
+                
+                /* The edges deleted from the shard stay deleted */
+                remove(filename_shard_deletions(dest_adj).c_str());
+                if (shard_file_exists(filename_shard_deletions(adj_filename))) {
+                    cp(filename_shard_deletions(adj_filename), filename_shard_deletions(dest_adj));
+                }
             }
+            deltashards.resize(this->nshards);
         }
         
         int get_shard_for(vid_t dst) {
@@ -267,70 +432,470 @@ namespace graphchi {
             return this->nshards - 1; // Last shard
         }
         
-    public:       
+        inline bool in_shard(int shard, vid_t v) {
+            return v >= this->intervals[shard].first && v <= this->intervals[shard].second;
+        }
+        
+    public:
+        /**
+         * Runs the program. The edges can be added while it runs.
+         */
+        void run(GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> &program, int niters) {
+            userprogram = &program;
+            graphchi_engine<VertexDataType, EdgeDataType, svertex_t>::run(program, niters);
+            userprogram = NULL;
+        }
+        
+        /**
+         * Calls GraphChiProgram::edge_added() for each added edge when it
+         * becomes visible, to schedule the vertices affected by the change.
+         * With selective scheduling, an iteration then updates only the
+         * neighborhood of the new edges, and the intervals without scheduled
+         * vertices are skipped.
+         */
+        void set_edge_added_hook(bool enabled) {
+            edge_added_hook = enabled;
+        }
+        
+        /**
+         * Adds an edge to the graph. Can be called concurrently from several
+         * threads. Blocks while the edge buffers are full, and returns false
+         * only if the engine has finished. The edge is visible to the update
+         * functions from the next iteration on.
+         * For high ingest rates, use add_edges().
+         */
         bool add_edge(vid_t src, vid_t dst, EdgeDataType edata) {
             if (src == dst) {
                 logstream(LOG_WARNING) << "WARNING : tried to add self-edge!" << std::endl;
                 return true;
             }
-            if (this->iter < 1) {
-                logstream(LOG_WARNING) << "Tried to add edge before first iteration has passed" << std::endl;
-                usleep(1000000);
-                return false;
+            created_edge<EdgeDataType> e(src, dst, edata);
+            return add_edges(&e, 1);
+        }
+        
+        /**
+         * Adds a batch of edges with a single hand-off. Self-edges are skipped.
+         * @see add_edge()
+         */
+        bool add_edges(const created_edge<EdgeDataType> * edges, size_t n) {
+            if (!wait_for_buffer_space()) return false;
+            size_t nself = 0;
+            for(size_t i=0; i < n; i++) {
+                if (edges[i].src == edges[i].dst) nself++;
             }
-            if (added_edges - last_commit > 1.2 * max_edge_buffer) {
-                logstream(LOG_INFO) << "Over 20% of max buffer... hold on...." << std::endl;
-                usleep(1000000); // Sleep 1 sec
-                return false;
+            if (nself == 0) {
+                ingest_queue.push(edges, n);
+            } else {
+                logstream(LOG_WARNING) << "Skipped " << nself << " self-edges" << std::endl;
+                std::vector< created_edge<EdgeDataType> > valid;
+                valid.reserve(n - nself);
+                for(size_t i=0; i < n; i++) {
+                    if (edges[i].src != edges[i].dst) valid.push_back(edges[i]);
+                }
+                if (!valid.empty()) ingest_queue.push(&valid[0], valid.size());
             }
-            modification_lock.lock();
-            added_edges++;
-            int shard = get_shard_for(dst);
-            int srcshard = get_shard_for(src);
-            /* Maintain max vertex id */
+            __sync_fetch_and_add(&added_edges, n - nself);
+            wake_engine();
+            return true;
+        }
+        
+        bool add_edges(const std::vector< created_edge<EdgeDataType> > &edges) {
+            if (edges.empty()) return true;
+            return add_edges(&edges[0], edges.size());
+        }
+        
+        /**
+         * Number of edges added, but not yet handed off to the buffers:
+         * they become visible to the update functions after the hand-off.
+         */
+        size_t num_queued_edges() {
+            size_t added = added_edges, ingested = ingested_edges;
+            return added > ingested ? added - ingested : 0;
+        }
+        
+        /**
+         * Schedules a vertex. Tasks for vertices that are not yet in the
+         * graph are kept until their edges have been handed off.
+         */
+        void add_task(vid_t vid) {
+            if (this->scheduler != NULL) {
+                schedulerlock.lock();
+                if (vid > max_vertex_id) {
+                    pending_tasks.push_back(vid);
+                } else {
+                    this->scheduler->add_task(vid);
+                }
+                schedulerlock.unlock();
+                wake_engine();
+            }
+        }
+        
+        /**
+         * Deletes a vertex and its edges. Can be called concurrently with
+         * add_edge(). The buffered edges of the vertex are removed when the
+         * request is handed off, and the edges in the shards when the vertex is
+         * next loaded: the vertex is then not updated, and its value is reset.
+         * Edges added to the vertex are dropped until new_vertex_id() has
+         * returned its id again. Requires SUPPORT_DELETIONS.
+         */
+        void delete_vertex(vid_t vid) {
+#ifndef SUPPORT_DELETIONS
+            logstream(LOG_FATAL) << "Deleting vertices requires SUPPORT_DELETIONS to be defined before including GraphChi." << std::endl;
+            assert(false);
+#endif
+            vertexlock.lock();
+            deletion_requests.push_back(vid);
+            vertexlock.unlock();
+            wake_engine();
+        }
+        
+        /**
+         * Returns an id for a new vertex: the smallest id of a removed vertex,
+         * or an id above the vertices of the graph. Reusing the smallest ids
+         * first lets the trailing ids be trimmed (see trim_deleted_vertices()).
+         */
+        vid_t new_vertex_id() {
+            vertexlock.lock();
+            vid_t vid;
+            if (!free_vertex_ids.empty()) {
+                vid = *free_vertex_ids.begin();
+                free_vertex_ids.erase(free_vertex_ids.begin());
+                deleted_vertices.erase(vid);
+            } else {
+                vid = std::max(next_vertex_id, max_vertex_id + 1);
+            }
+            next_vertex_id = std::max(next_vertex_id, vid + 1);
+            vertexlock.unlock();
+            return vid;
+        }
+        
+    protected:
+        bool buffers_full() {
+            return added_edges - last_commit > 1.2 * max_edge_buffer;
+        }
+        
+        /**
+         * Backpressure: blocks until a commit has made room in the buffers.
+         * Returns false if the engine has finished.
+         */
+        bool wait_for_buffer_space() {
+            if (!buffers_full() && !ingest_closed) return true;
+            ingest_lock.lock();
+            if (buffers_full() && !ingest_closed) {
+                logstream(LOG_INFO) << "Over 20% of max buffer... waiting for commit." << std::endl;
+            }
+            while (buffers_full() && !ingest_closed) {
+                buffer_space.wait(ingest_lock);
+            }
+            bool accepted = !ingest_closed;
+            ingest_lock.unlock();
+            return accepted;
+        }
+        
+        /**
+         * Moves the queued edges to the edge buffers. Called by the engine
+         * thread with the modification lock held. Edges added during the
+         * first iteration are handed off after it, as before.
+         */
+        void handoff_queued_edges() {
+            if (this->iter < 1) return;
+            vertexlock.lock();
+            handoff_deletions();
+            if (ingest_queue.empty()) {
+                vertexlock.unlock();
+                return;
+            }
+            edge_batch<EdgeDataType> * batches = ingest_queue.take_all();
             vid_t prev_max_id = max_vertex_id;
-            max_vertex_id = std::max(max_vertex_id, dst);
-            max_vertex_id = std::max(max_vertex_id, src);
+            size_t n = 0, ndropped = 0;
+            /* Batches sorted by destination (see edgestream.hpp) go to the same
+               shard in long runs, so the shards of the previous edge are tried first */
+            int dstshard = 0, srcshard = 0;
+            for(edge_batch<EdgeDataType> * b = batches; b != NULL; b = b->next) {
+                for(size_t i=0; i < b->count; i++) {
+                    created_edge<EdgeDataType> &e = b->edges[i];
+                    if (!deleted_vertices.empty() && (deleted_vertices.count(e.src) || deleted_vertices.count(e.dst))) {
+                        e.dst = e.src; // Dropped: marked as a self-edge for call_edge_added_hook()
+                        ndropped++;
+                        continue;
+                    }
+                    max_vertex_id = std::max(max_vertex_id, std::max(e.src, e.dst));
+                    if (!in_shard(dstshard, e.dst)) dstshard = get_shard_for(e.dst);
+                    if (!in_shard(srcshard, e.src)) srcshard = get_shard_for(e.src);
+                    new_edge_buffers[dstshard][srcshard]->add(e);
+                }
+                n += b->count;
+            }
+            vertexlock.unlock();
+            ingested_edges += n;
+            if (ndropped > 0) {
+                this->m.add("dynamic.dropped_edges", ndropped);
+            }
             
             // Extend degree and vertex data files
-            if (max_vertex_id>prev_max_id) {
-                this->degree_handler->ensure_size(this->max_vertex_id); // Expand the file
-                
-                // Expand scheduler
-                if (this->scheduler != NULL) {
-                    schedulerlock.lock();
+            if (max_vertex_id > prev_max_id) {
+                this->degree_handler->ensure_size(max_vertex_id); // Expand the file
+            }
+            
+            // Expand scheduler
+            if (this->scheduler != NULL) {
+                schedulerlock.lock();
+                if (max_vertex_id > prev_max_id) {
                     this->scheduler->resize(1 + max_vertex_id);
-                    schedulerlock.unlock();
                 }
+                std::vector<vid_t> deferred;
+                for(size_t i=0; i < pending_tasks.size(); i++) {
+                    if (pending_tasks[i] <= max_vertex_id) this->scheduler->add_task(pending_tasks[i]);
+                    else deferred.push_back(pending_tasks[i]);
+                }
+                pending_tasks.swap(deferred);
+                schedulerlock.unlock();
             }
             
-            // Add edge to buffers
-            new_edge_buffers[shard][srcshard]->add(src, dst, edata);            
-            modification_lock.unlock();
-            return true;
+            if (edge_added_hook && userprogram != NULL) {
+                edge_batch<EdgeDataType> * last = batches;
+                while (last->next != NULL) last = last->next;
+                last->next = hook_batches;
+                hook_batches = batches;
+            } else {
+                edge_batch<EdgeDataType>::free_list(batches);
+            }
         }
         
-        void add_task(vid_t vid) {
+        /**
+         * Passes the handed-off edges to GraphChiProgram::edge_added(). The edges
+         * handed off before a sub-interval is updated are not yet in its vertices,
+         * so they are passed after the tasks of the sub-interval have been cleared.
+         */
+        void call_edge_added_hook() {
+            edge_batch<EdgeDataType> * batches = hook_batches;
+            hook_batches = NULL;
+            for(edge_batch<EdgeDataType> * b = batches; b != NULL; b = b->next) {
+                for(size_t i=0; i < b->count; i++) {
+                    if (b->edges[i].src == b->edges[i].dst) continue; // Dropped
+                    userprogram->edge_added(b->edges[i].src, b->edges[i].dst, this->chicontext);
+                }
+            }
+            edge_batch<EdgeDataType>::free_list(batches);
+        }
+        
+        /**
+         * Marks the vertices requested to be deleted. Called with the vertex lock
+         * held. The buffered edges of a vertex are removed at once, and the vertex
+         * is scheduled, so that the edges in the shards are removed when it is loaded.
+         */
+        void handoff_deletions() {
+            for(size_t i=0; i < deletion_requests.size(); i++) {
+                vid_t vid = deletion_requests[i];
+                if (!deleted_vertices.insert(vid).second) continue; // Deleted already
+                if (vid > max_vertex_id) {
+                    free_vertex_ids.insert(vid); // No edges yet
+                    continue;
+                }
+                removing_vertices.insert(vid);
+                remove_buffered_edges(new_edge_buffers, vid);
+                if (commit != NULL) {
+                    remove_buffered_edges(commit->buffers, vid);
+                }
+                add_task(vid);
+            }
+            deletion_requests.clear();
+        }
+        
+        /**
+         * Removes the buffered edges of a vertex. The buffers are indexed by the
+         * shards of the destination and the source.
+         */
+        void remove_buffered_edges(std::vector< std::vector< edge_buffer * > > &buffers, vid_t vid) {
+            int vshard = get_shard_for(vid);
+            for(int p=0; p < (int)buffers.size(); p++) {
+                if (buffers[p].empty()) continue;
+                edge_buffer &outbuf = *buffers[p][vshard];
+                std::pair<unsigned int, unsigned int> r = outbuf.src_range(vid, vid);
+                for(unsigned int ebi=r.first; ebi < r.second; ebi++) {
+                    remove_buffered_edge(outbuf.by_src(ebi), outbuf.by_src(ebi)->dst);
+                }
+                if (p != vshard) continue;
+                for(int w=0; w < (int)buffers[p].size(); w++) {
+                    edge_buffer &inbuf = *buffers[p][w];
+                    r = inbuf.dst_range(vid, vid);
+                    for(unsigned int ebi=r.first; ebi < r.second; ebi++) {
+                        remove_buffered_edge(inbuf.by_dst(ebi), inbuf.by_dst(ebi)->src);
+                    }
+                }
+            }
+        }
+        
+        void remove_buffered_edge(created_edge<EdgeDataType> * edge, vid_t neighbor) {
+            if (edge->tombstone().is_set()) return;
+            edge->tombstone().set();
+            add_task(neighbor);
+        }
+        
+        /**
+         * Removes the deleted vertices of the sub-interval, which have been
+         * loaded with their edges: the edges are removed, the neighbors are
+         * scheduled and the value and the degree of the vertex are reset.
+         * The vertices are not updated, and their ids can then be reused.
+         * Vertices whose ids are free are not updated either.
+         */
+        void remove_deleted_vertices(std::vector<svertex_t> &vertices) {
+            if (deleted_vertices.empty()) return;
+            vertexlock.lock();
+            std::set<vid_t>::iterator fit = free_vertex_ids.lower_bound(this->sub_interval_st);
+            for(; fit != free_vertex_ids.end() && *fit <= this->sub_interval_en; ++fit) {
+                vertices[*fit - this->sub_interval_st].scheduled = false;
+            }
+            vertexlock.unlock();
+            
+            std::vector<vid_t> removed;
+            std::set<vid_t>::iterator it = removing_vertices.lower_bound(this->sub_interval_st);
+            while (it != removing_vertices.end() && *it <= this->sub_interval_en) {
+                vid_t vid = *it;
+                svertex_t &v = vertices[vid - this->sub_interval_st];
+                if (!v.scheduled) {
+                    ++it;
+                    continue;
+                }
+#ifdef SUPPORT_DELETIONS
+                for(int i=0; i < v.num_edges(); i++) {
+                    v.remove_edge(i);
+                    add_task(v.edge(i)->vertex_id());
+                }
+#endif
+                *this->vertex_data_handler->vertex_data_ptr(vid) = VertexDataType();
+                v.modified = true;
+                v.scheduled = false;
+                this->degree_handler->set_degree(vid, 0, 0);
+                removed.push_back(vid);
+                removing_vertices.erase(it++);
+            }
+            if (removed.empty()) return;
+            this->degree_handler->save();
+            
+            vertexlock.lock();
+            free_vertex_ids.insert(removed.begin(), removed.end());
+            vertexlock.unlock();
+            this->m.add("dynamic.deleted_vertices", removed.size());
+        }
+        
+        /**
+         * Shrinks the vertex-indexed files when the largest ids of the graph
+         * have been freed. Not done while a commit is running, as the commit
+         * writes the shards up to the largest id when it started. The last
+         * interval keeps at least one vertex.
+         */
+        void trim_deleted_vertices() {
+            vertexlock.lock();
+            vid_t newmax = max_vertex_id;
+            vid_t minmax = this->intervals[this->nshards - 1].first;
+            while (newmax > minmax && free_vertex_ids.count(newmax) > 0) {
+                free_vertex_ids.erase(newmax);
+                deleted_vertices.erase(newmax);
+                newmax--;
+            }
+            if (newmax == max_vertex_id) {
+                vertexlock.unlock();
+                return;
+            }
+            logstream(LOG_INFO) << "Trimmed " << (max_vertex_id - newmax) << " deleted vertices, largest id now " << newmax << std::endl;
+            this->m.add("dynamic.trimmed_vertices", max_vertex_id - newmax);
+            if (next_vertex_id <= max_vertex_id + 1) {
+                next_vertex_id = newmax + 1;
+            }
+            max_vertex_id = newmax;
+            vertexlock.unlock();
+            
+            this->intervals[this->nshards - 1].second = max_vertex_id;
+            this->degree_handler->ensure_size(max_vertex_id);
+            this->vertex_data_handler->check_size(max_vertex_id + 1);
             if (this->scheduler != NULL) {
-                modification_lock.lock();
-                this->scheduler->add_task(vid);                
-                modification_lock.unlock();
+                schedulerlock.lock();
+                this->scheduler->resize(1 + max_vertex_id);
+                schedulerlock.unlock();
+            }
+        }
+        
+        /**
+         * Wakes the engine if it is waiting for new edges in wait_for_work().
+         * Called after the work has been published: either the engine sees 
+         * the work before it waits, or it is waiting when this checks the flag.
+         */
+        void wake_engine() {
+            __sync_synchronize();
+            if (!waiting_for_work) return;
+            ingest_lock.lock();
+            work_available.broadcast();
+            ingest_lock.unlock();
+        }
+        
+        bool has_work() {
+            if (this->scheduler->has_new_tasks || !ingest_queue.empty() || 
+                this->chicontext.last_iteration >= 0 || ingest_closed) return true;
+            vertexlock.lock();
+            bool deletions = !deletion_requests.empty();
+            vertexlock.unlock();
+            return deletions;
+        }
+        
+        /**
+          * Blocks until edges are added, vertices deleted or scheduled, or
+          * finish_after_iters() is called.
+          */
+        void wait_for_work() {
+            ingest_lock.lock();
+            waiting_for_work = true;
+            __sync_synchronize();
+            while (!has_work()) {
+                work_available.wait(ingest_lock);
             }
+            waiting_for_work = false;
+            ingest_lock.unlock();
+        }
+        
+        /**
+         * Wakes producers waiting for buffer space.
+         */
+        void signal_buffer_space(bool close) {
+            ingest_lock.lock();
+            if (close) ingest_closed = true;
+            buffer_space.broadcast();
+            ingest_lock.unlock();
         }
        
     protected:
+        /**
+         * Adds the buffered edges to the vertices. Only edges that have been
+         * accounted for in the degrees are added, because the edge arrays of
+         * the vertices were allocated by the degrees. Edges handed off after
+         * the degrees of the sub-interval were loaded are added on the next visit.
+         * The edges of a running commit are added until it has been swapped in.
+         */
         void incorporate_buffered_edges(int window, vid_t window_st, vid_t window_en, std::vector<svertex_t> & vertices) {
             // Lock acquired
+            metrics_entry me = this->m.start_time();
+            int ncreated = incorporate_edges(new_edge_buffers, window, window_st, window_en, vertices);
+            if (commit != NULL) {
+                ncreated += incorporate_edges(commit->buffers, window, window_st, window_en, vertices);
+            }
+            me.timer_stop();
+            policy->buffered_added(me.lasttime);
+            logstream(LOG_INFO) << "::: Used " << ncreated << " buffered edges." << std::endl;
+        }
+        
+        int incorporate_edges(std::vector< std::vector< edge_buffer * > > &buffers, int window, vid_t window_st, vid_t window_en,
+                              std::vector<svertex_t> & vertices) {
             int ncreated = 0;
             // First outedges
             for(int shard=0; shard<this->nshards; shard++) {
-                edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->src >= window_st && edge->src <= window_en) {
+                if (buffers[shard].empty()) continue;
+                edge_buffer &buffer_for_window = *buffers[shard][window];
+                std::pair<unsigned int, unsigned int> r = buffer_for_window.src_range(window_st, window_en);
+                for(unsigned int ebi=r.first; ebi<r.second; ebi++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window.by_src(ebi);
+                    if (edge->accounted_for_outc) {
                         if (vertices[edge->src-window_st].scheduled) {
-                            if (vertices[edge->src-window_st].scheduled)
-                                vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
+                            add_buffered_outedge(vertices[edge->src-window_st], edge);
                             ncreated++;
                         }
                     }
@@ -338,21 +903,53 @@ namespace graphchi {
             }
             
             // Then inedges
-            for(int w=0; w<this->nshards; w++) {
-                edge_buffer &buffer_for_window = *new_edge_buffers[window][w];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->dst >= window_st && edge->dst <= window_en) {
+            for(int w=0; w<this->nshards && !buffers[window].empty(); w++) {
+                edge_buffer &buffer_for_window = *buffers[window][w];
+                std::pair<unsigned int, unsigned int> r = buffer_for_window.dst_range(window_st, window_en);
+                for(unsigned int ebi=r.first; ebi<r.second; ebi++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window.by_dst(ebi);
+                    if (edge->accounted_for_inc) {
                         if (vertices[edge->dst - window_st].scheduled) {
                             assert(edge->data < 1e20);
-                            if (vertices[edge->dst-window_st].scheduled)
-                                vertices[edge->dst - window_st].add_inedge(edge->src, &edge->data, false);
+                            add_buffered_inedge(vertices[edge->dst - window_st], edge);
                             ncreated++;
+                            // As in the memory shard: vertices that share an edge are not updated in parallel
+                            if (edge->src >= window_st && edge->src <= window_en) {
+                                vertices[edge->dst - window_st].parallel_safe = false;
+                                vertices[edge->src - window_st].parallel_safe = false;
+                            }
                         }
                     }
                 }
             }
-            logstream(LOG_INFO) << "::: Used " << ncreated << " buffered edges." << std::endl;
+            return ncreated;
+        }
+        
+        /**
+         * Adds a buffered edge to a vertex, unless it has been removed.
+         */
+        void add_buffered_outedge(svertex_t &vertex, created_edge<EdgeDataType> * edge) {
+#ifdef SUPPORT_DELETIONS
+            if (edge->tombstone().is_set()) {
+                __sync_add_and_fetch(&vertex.deleted_outc, 1);
+                return;
+            }
+            vertex.add_outedge(edge->dst, &edge->data, false, edge->tombstone());
+#else
+            vertex.add_outedge(edge->dst, &edge->data, false);
+#endif
+        }
+        
+        void add_buffered_inedge(svertex_t &vertex, created_edge<EdgeDataType> * edge) {
+#ifdef SUPPORT_DELETIONS
+            if (edge->tombstone().is_set()) {
+                vertex.deleted_inc++;
+                return;
+            }
+            vertex.add_inedge(edge->src, &edge->data, false, edge->tombstone());
+#else
+            vertex.add_inedge(edge->src, &edge->data, false);
+#endif
         }
         
         bool incorporate_new_edge_degrees(int window, vid_t window_st, vid_t window_en) {
@@ -360,17 +957,16 @@ namespace graphchi {
             // First outedges
             for(int shard=0; shard < this->nshards; shard++) {
                 edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->src >= window_st && edge->src <= window_en) {
-                        if (!edge->accounted_for_outc) {
-                            degree d = this->degree_handler->get_degree(edge->src);
-                            d.outdegree++;
-                            this->degree_handler->set_degree(edge->src, d);
-                            
-                            modified = true;
-                            edge->accounted_for_outc = true;
-                        }
+                std::pair<unsigned int, unsigned int> r = buffer_for_window.src_range(window_st, window_en);
+                for(unsigned int ebi=r.first; ebi<r.second; ebi++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window.by_src(ebi);
+                    if (!edge->accounted_for_outc) {
+                        degree d = this->degree_handler->get_degree(edge->src);
+                        d.outdegree++;
+                        this->degree_handler->set_degree(edge->src, d);
+                        
+                        modified = true;
+                        edge->accounted_for_outc = true;
                     }
                 }
             }
@@ -378,16 +974,15 @@ namespace graphchi {
             // Then inedges
             for(int w=0; w < this->nshards; w++) {
                 edge_buffer &buffer_for_window = *new_edge_buffers[window][w];
-                for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                    created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                    if (edge->dst >= window_st && edge->dst <= window_en) {
-                        if (!edge->accounted_for_inc) {
-                            degree d = this->degree_handler->get_degree(edge->dst);
-                            d.indegree++;
-                            this->degree_handler->set_degree(edge->dst, d);                            
-                            edge->accounted_for_inc = true;
-                            modified = true;
-                        }
+                std::pair<unsigned int, unsigned int> r = buffer_for_window.dst_range(window_st, window_en);
+                for(unsigned int ebi=r.first; ebi<r.second; ebi++) {
+                    created_edge<EdgeDataType> * edge = buffer_for_window.by_dst(ebi);
+                    if (!edge->accounted_for_inc) {
+                        degree d = this->degree_handler->get_degree(edge->dst);
+                        d.indegree++;
+                        this->degree_handler->set_degree(edge->dst, d);                            
+                        edge->accounted_for_inc = true;
+                        modified = true;
                     }
                 }
             }
@@ -425,8 +1020,8 @@ namespace graphchi {
             }
             
             size_t memreq = 0;
-            int max_interval = maxvid - fromvid;
-            for(int i=0; i < max_interval; i++) {
+            size_t max_interval = (size_t) (maxvid - fromvid);
+            for(size_t i=0; i < max_interval; i++) {
                 degree deg = this->degree_handler->get_degree(fromvid + i);
                 int inc = deg.indegree;
                 int outc = deg.outdegree;
@@ -443,19 +1038,58 @@ namespace graphchi {
         
         
         virtual void load_before_updates(std::vector<svertex_t> &vertices) {            
+            call_edge_added_hook();
+            metrics_entry me = this->m.start_time();
             this->base_engine::load_before_updates(vertices);
+            me.timer_stop();
+            policy->shards_loaded(me.lasttime);
             
-#ifdef SUPPORT_DELETIONS
-            for(unsigned int i=0; i < (unsigned int)vertices.size(); i++) {
-                deletecounts[this->exec_interval] += vertices[i].deleted_inc;
-            }
-        #endif
+            me = this->m.start_time();
+            load_delta_shards(vertices);
+            me.timer_stop();
+            policy->deltas_loaded(me.lasttime);
+            
+            remove_deleted_vertices(vertices);
         }
         
         
+        /**
+         * Loads the edges of the delta shards. In-edges are not added
+         * atomically, so the memory shards of the deltas are loaded by one
+         * thread, in parallel with the stream shards of the other intervals.
+         */
+        void load_delta_shards(std::vector<svertex_t> &vertices) {
+            std::vector<delta_shard> &own = deltashards[this->exec_interval];
+            std::vector<delta_shard *> streamed;
+            for(int p=0; p < this->nshards; p++) {
+                if (p == this->exec_interval) continue;
+                for(int k=0; k < (int)deltashards[p].size(); k++) {
+                    streamed.push_back(&deltashards[p][k]);
+                }
+            }
+            if (own.empty() && streamed.empty()) return;
+            
+            bool record_index = this->scheduler != NULL && this->chicontext.iteration == 0;
+#pragma omp parallel for schedule(dynamic, 1)
+            for(int i=-1; i < (int)streamed.size(); i++) {
+                if (i == -1) {
+                    for(int k=0; k < (int)own.size(); k++) {
+                        if (!own[k].memshard->loaded()) {
+                            own[k].memshard->load();
+                        }
+                        own[k].memshard->load_vertices(this->sub_interval_st, this->sub_interval_en, vertices);
+                    }
+                } else {
+                    streamed[i]->sliding->read_next_vertices((int) vertices.size(), this->sub_interval_st, vertices, record_index);
+                }
+            }
+            this->iomgr->wait_for_reads();
+        }
+        
         virtual void init_vertices(std::vector<svertex_t> &vertices, 
                                    graphchi_edge<EdgeDataType> * &edata) {
             modification_lock.lock();
+            handoff_queued_edges();
             base_engine::init_vertices(vertices, edata);
             incorporate_buffered_edges(this->exec_interval, this->sub_interval_st, this->sub_interval_en, vertices);
             modification_lock.unlock();
@@ -463,33 +1097,78 @@ namespace graphchi {
         
         
         virtual void initialize_iter() {
+            /* With the edge-added hook, the engine waits for new edges instead of
+               finishing when no vertex is scheduled, until finish_after_iters() */
+            if (edge_added_hook && this->scheduler != NULL && this->iter > 0) {
+                wait_for_work();
+            }
+            
+            /* Hand off the edges added during the previous iteration, so that
+               the vertices they schedule are seen by the scheduler check */
+            modification_lock.lock();
+            handoff_queued_edges();
+            modification_lock.unlock();
+            call_edge_added_hook();
             this->intervals[this->nshards - 1].second = max_vertex_id;
             this->vertex_data_handler->check_size(max_vertex_id + 1);
             initialize_sliding_shards();
-            
-            /* Deleted edge tracking */
-            deletecounts.clear();
-            for(int p=0; p < this->nshards; p++) 
-                deletecounts.push_back(0);
+            itertimer = this->m.start_time();
         }
         
         virtual void iteration_finished() {
-            if (this->iter < this->niters - 1) {
-                // Flush and restart stream shards before commiting edges
-                for(int p=0; p < this->nshards; p++) {
-                    this->sliding_shards[p]->flush();
-                    this->sliding_shards[p]->set_offset(0, 0, 0);
+            /* Restart the stream shards of the deltas, as the engine did for the shards */
+            for(int p=0; p < this->nshards; p++) {
+                for(int k=0; k < (int)deltashards[p].size(); k++) {
+                    deltashards[p][k].sliding->flush();
+                    deltashards[p][k].sliding->set_offset(0, 0, 0);
                 }
-                
-                this->iomgr->wait_for_writes();
-                
-                commit_graph_changes();
+            }
+            this->iomgr->wait_for_writes();
+            measure_iteration();
+            
+            /* Swap in a finished commit, or wait for it after the last iteration */
+            bool last_iteration = (this->iter >= this->niters - 1);
+            if (commit != NULL && (commit->finished || last_iteration)) {
+                finish_commit();
+            }
+            
+            if (commit == NULL) {
+                trim_deleted_vertices();
+            }
+            if (!last_iteration && commit == NULL) {
+                start_commit();
             }
         }
         
-        virtual void initialize_before_run() {
-            prepare_clean_slate();
-            init_buffers();
+        /**
+         * Reports the sizes of the shards loaded in the iteration to the commit policy.
+         */
+        void measure_iteration() {
+            itertimer.timer_stop();
+            size_t shardedges = 0, deltaedges = 0, buffered = 0;
+            int ndeltas = 0;
+            for(int p=0; p < this->nshards; p++) {
+                shardedges += this->sliding_shards[p]->num_edges();
+                deltaedges += delta_edges(p);
+                ndeltas += (int) deltashards[p].size();
+                buffered += buffered_edges(p);
+                if (commit != NULL && !commit->buffers[p].empty()) {
+                    for(int w=0; w < this->nshards; w++) buffered += commit->buffers[p][w]->size();
+                }
+            }
+            policy->iteration_finished(itertimer.lasttime, shardedges, deltaedges, ndeltas, buffered, ingested_edges, this->m);
+        }
+        
+        virtual void run_finished() {
+            if (commit != NULL) {
+                finish_commit();
+            }
+            signal_buffer_space(true);
+        }
+        
+        virtual void initialize_before_run() {
+            prepare_clean_slate();
+            init_buffers();
 
             max_vertex_id = (vid_t) (this->num_vertices() - 1);
             
@@ -506,6 +1185,7 @@ namespace graphchi {
     public:
         void finish_after_iters(int extra_iters) {
             this->chicontext.last_iteration = this->chicontext.iteration + extra_iters;
+            wake_engine();
         }
         
     protected:
@@ -513,353 +1193,948 @@ namespace graphchi {
         
 #define BBUF 32000000
         
+        /* Source of a buffered edge in written_part::sources */
+        enum { BUFFERED_SOURCE = 0x7fff, SKIPPED_SOURCE = 0x8000 };
+        
         /**
-         * Code for committing changes to disk.
+         * The update functions can change the values of the edges, and remove
+         * edges, while a commit is running, so the values and the deleted edges
+         * are written again when the commit is swapped in. A delta shard keeps
+         * its edges in the order they were written. A compacted shard keeps the
+         * source of each edge it read: a shard or a delta (see compaction_sources())
+         * or the buffers, and whether the edge belongs to another part of a split shard.
          */
-        void commit_graph_changes() {
-            // Count deleted
-            size_t ndeleted = 0;
-            for(size_t i=0; i < deletecounts.size(); i++) {
-                ndeleted += deletecounts[i];
-            }
+        struct written_delta {
+            std::string adjfile;
+            std::string edatafile;
+            std::vector< created_edge<EdgeDataType> * > edges;
+        };
+        
+        struct written_part {
+            int first;  // The compacted shards
+            int last;
+            std::string adjfile;
+            std::string edatafile;
+            std::vector<uint16_t> sources;
+            std::vector< graphchi_edge<EdgeDataType> > buffered;
+        };
+        
+        /**
+         * A commit of the buffered edges, run by a background thread. The
+         * thread writes the new shard files from a snapshot of the buffers and
+         * of the shard layout, while ingestion continues to new buffers and the
+         * computation reads the snapshot as buffered edges. The new files are
+         * swapped in at an iteration boundary.
+         */
+        struct graph_commit {
+            graphchi_dynamicgraph_engine * engine;
+            std::vector<shard_commit_decision> plan;
+            std::vector< std::vector< edge_buffer * > > buffers;
+            std::vector< std::pair<vid_t, vid_t> > intervals;
+            std::vector<std::string> suffices;
+            std::vector< std::vector<delta_shard> > deltas;
+            vid_t max_vertex_id;
+            int iter;
+            bool rewrite_values;
+            bool carry_deletions;
             
-            // TODO: remove ad hoc limits, move to configuration.
-            // Perhaps do some cost estimation?
-            logstream(LOG_DEBUG) << "Total deleted: " << ndeleted << " total edges: " << this->num_edges() << std::endl;
-
-            if (added_edges - last_commit < max_edge_buffer * 0.8 && ndeleted < this->num_edges() * 0.1) {
-                std::cout << "==============================" << std::endl;
-                std::cout << "No time to commit yet.... Only " << (added_edges - last_commit) << " / " << max_edge_buffer
-                << " in buffers" << std::endl;
-                return;
-            }
+            /* Deleted edges of the compacted shards and their deltas when the commit started */
+            std::vector< std::vector<deletion_bitmap *> > deleted;
             
+            metrics m;
+            stripedio * iomgr;
+            degree_data * degrees;
+            pthread_t thread;
+            volatile bool finished;
+            double secs;
             
-            bool rangeschanged = false;
-            state = "commit-ingests";
-            vid_t maxwindow = 4000000; // FIXME: HARDCODE
-            size_t mem_budget = this->membudget_mb * 1024 * 1024;
+            /* Written by the commit thread */
+            std::vector< std::pair<vid_t, vid_t> > newranges;
+            std::vector<std::string> newsuffices;
+            std::vector<int> nparts;
+            std::vector<delta_shard> newdelta;
+            std::vector<written_delta> written_deltas;
+            std::vector<written_part> written_parts;
+            bool rangeschanged;
+            
+            graph_commit() : m("dynamic-commit"), iomgr(NULL), degrees(NULL), finished(false), secs(0), rangeschanged(false) {}
+            
+            bool record_edges() {
+                return rewrite_values || carry_deletions;
+            }
+        };
+        
+        static void * commit_thread_loop(void * _commit) {
+            graph_commit * c = (graph_commit *) _commit;
+            metrics_entry me = c->m.start_time();
+            c->engine->run_commit(*c);
+            me.timer_stop();
+            c->secs = me.lasttime;
+            __sync_synchronize();
+            c->finished = true;
+            return NULL;
+        }
+        
+        /**
+         * Starts a commit of the changes that the commit policy finds worth
+         * committing. The buffered edges of a shard are written to a new delta
+         * shard, so a commit writes only the new edges. Shards whose deltas and
+         * deleted edges are costly to load are compacted: the shard, its deltas
+         * and the buffered edges are merged into a new shard, which is split if
+         * it has grown too large, or merged with small neighbouring shards.
+         */
+        void start_commit() {
             modification_lock.lock();
+            handoff_queued_edges();
+            modification_lock.unlock();
+            call_edge_added_hook();
             
-            // Clean up sliding shards
-            // NOTE: there is a problem since this will waste
-            // io-sessions
-            std::vector<int> edgespershard;
+            /* The previous commit may have been swapped in at this boundary */
+            this->intervals[this->nshards - 1].second = max_vertex_id;
+            initialize_sliding_shards();
+            
+            count_deletions();
+            std::vector<shard_commit_state> shards;
             for(int p=0; p < this->nshards; p++) {
-                edgespershard.push_back(this->sliding_shards[p]->num_edges());
+                shard_commit_state s;
+                s.nvertices = this->intervals[p].second - this->intervals[p].first + 1;
+                s.edges = this->sliding_shards[p]->num_edges() + delta_edges(p);
+                s.deleted = deletecounts[p];
+                s.buffered = buffered_edges(p);
+                s.ndeltas = (int) deltashards[p].size();
+                shards.push_back(s);
             }
+            std::vector<shard_commit_decision> plan = policy->decide(shards, this->niters - this->iter - 1, this->m);
             
-            std::vector<std::pair<vid_t, vid_t> > newranges;
-            std::vector<std::string> newsuffices;
+            bool anything = false;
+            for(int p=0; p < this->nshards; p++) {
+                anything = anything || plan[p].action != COMMIT_NONE;
+            }
+            if (!anything) {
+                logstream(LOG_INFO) << "Nothing to commit yet, " << (ingested_edges - last_commit) << " / " << max_edge_buffer
+                    << " edges in buffers" << std::endl;
+                return;
+            }
             
-            char iterstr[128];
-            sprintf(iterstr, "%d", this->iter);
+            state = "commit-ingests";
+            modification_lock.lock();
             
-            size_t min_buffer_in_shard_to_commit = max_edge_buffer / this->nshards / 2;
+            /* The degrees of the edges must be stored before they leave the buffers */
+            account_buffered_edges();
             
-            std::vector<bool> was_commited(this->nshards, true);
+            graph_commit * c = new graph_commit();
+            c->engine = this;
+            c->plan = plan;
+            c->intervals = this->intervals;
+            c->suffices = shard_suffices;
+            c->deltas = deltashards;
+            c->max_vertex_id = max_vertex_id;
+            c->iter = this->iter;
+            c->rewrite_values = this->modifies_inedges || this->modifies_outedges;
+#ifdef SUPPORT_DELETIONS
+            c->carry_deletions = true;
+#else
+            c->carry_deletions = false;
+#endif
             
+            size_t remaining = 0;
             for(int shard=0; shard < this->nshards; shard++) {
-                std::vector<edge_buffer*> &shard_buffer = new_edge_buffers[shard];
+                int action = plan[shard].action;
                 
-                // Check there are any new edges
-                size_t bufedges = 0;
-                for(int w=0; w < this->nshards; w++) {
-                    bufedges += shard_buffer[w]->size();
-                    
+                /* The compaction drops the edges deleted so far */
+                std::vector<deletion_bitmap *> deleted;
+                if (action == COMMIT_COMPACT) {
+                    deleted.push_back(this->deletions[shard] == NULL ? NULL : new deletion_bitmap(*this->deletions[shard]));
+                    for(int k=0; k < (int)deltashards[shard].size(); k++) {
+                        deletion_bitmap * d = deltashards[shard][k].deletions;
+                        deleted.push_back(d == NULL ? NULL : new deletion_bitmap(*d));
+                    }
                 }
+                c->deleted.push_back(deleted);
                 
-                if (bufedges < min_buffer_in_shard_to_commit && deletecounts[shard] * 1.0 / edgespershard[shard] < 0.2) {
-                    logstream(LOG_DEBUG) << shard << ": not enough edges for shard: " << bufedges << " deleted:" << deletecounts[shard] << "/" << edgespershard[shard] << std::endl;
-                    newranges.push_back(this->intervals[shard]);
-                    newsuffices.push_back(shard_suffices[shard]);
-                    was_commited[shard] = false;
-                    continue;
+                /* Move the buffers of the shard to the snapshot */
+                std::vector<edge_buffer *> snapshot;
+                if (action != COMMIT_NONE) {
+                    snapshot = new_edge_buffers[shard];
+                    for(int w=0; w < this->nshards; w++) {
+                        new_edge_buffers[shard][w] = new edge_buffer();
+                        // Bring the indices up to date, so that the snapshot is not modified by reads
+                        snapshot[w]->src_range(0, 0);
+                        snapshot[w]->dst_range(0, 0);
+                    }
                 } else {
-                    logstream(LOG_DEBUG) << shard << ": going to rewrite, deleted:" << deletecounts[shard] << "/" << edgespershard[shard] << " bufedges: " << bufedges << std::endl;
-                    shardlock.lock();
+                    remaining += buffered_edges(shard);
+                }
+                c->buffers.push_back(snapshot);
+            }
+            
+            /* The edges left in the buffers count against the capacity */
+            last_commit = ingested_edges - remaining;
+            c->iomgr = new stripedio(c->m);
+            /* The engine keeps removing the deleted edges from the degrees while the
+               commit runs, so the commit allocates the edges by a copy of them */
+            cp(filename_degree_data(this->base_filename + ".dynamic"), filename_degree_data(this->base_filename + ".dynamic.commit"));
+            c->degrees = new degree_data(this->base_filename + ".dynamic.commit", c->iomgr);
+            commit = c;
+            int ret = pthread_create(&c->thread, NULL, commit_thread_loop, (void *) c);
+            assert(ret == 0);
+            modification_lock.unlock();
+            signal_buffer_space(false);
+        }
+        
+        /**
+         * Writes the files of a commit. Runs in the commit thread, so reads only
+         * the snapshot in the commit and uses its own I/O manager and degree data.
+         */
+        void run_commit(graph_commit &c) {
+            int nshards = (int) c.intervals.size();
+            for(int shard=0; shard < nshards; shard++) {
+                delta_shard none;
+                none.nedges = 0;
+                none.memshard = NULL;
+                none.sliding = NULL;
+                none.deletions = NULL;
+                c.newdelta.push_back(none);
+                
+                shard_commit_decision &d = c.plan[shard];
+                if (d.action == COMMIT_COMPACT) {
+                    /* The shards merged into an earlier shard have no parts of their own */
+                    int outparts = (d.nparts == 0 ? 0 : compact_shards(c, shard, std::max(shard, d.mergeto), d.nparts));
+                    c.nparts.push_back(outparts);
+                    c.rangeschanged = c.rangeschanged || outparts != 1;
+                } else {
+                    c.newranges.push_back(c.intervals[shard]);
+                    c.newsuffices.push_back(c.suffices[shard]);
+                    c.nparts.push_back(1);
+                    if (d.action == COMMIT_DELTA) {
+                        c.newdelta[shard] = write_delta_shard(c, shard);
+                    }
+                }
+            }
+            c.iomgr->wait_for_writes();
+        }
+        
+        /**
+         * Waits for the commit thread and swaps the new files in. Called at an
+         * iteration boundary, when the shards have been flushed.
+         */
+        void finish_commit() {
+            graph_commit * c = commit;
+            if (!c->finished) {
+                logstream(LOG_INFO) << "Waiting for the commit to finish..." << std::endl;
+            }
+            metrics_entry me = this->m.start_time();
+            pthread_join(c->thread, NULL);
+            policy->commit_finished(c->secs);
+            
+            modification_lock.lock();
+            state = "commit-swap";
+            for(int i=0; i < (int)c->written_deltas.size(); i++) {
+                rewrite_delta(*c, c->written_deltas[i]);
+            }
+            for(int i=0; i < (int)c->written_parts.size(); i++) {
+                rewrite_part(*c, c->written_parts[i]);
+            }
+            
+            /* Replace the compacted shards and their deltas */
+            shardlock.lock();
+            std::vector< std::vector<delta_shard> > newdeltas;
+            for(int shard=0; shard < this->nshards; shard++) {
+                if (c->plan[shard].action == COMMIT_COMPACT) {
                     delete this->sliding_shards[shard];
                     this->sliding_shards[shard] = NULL;
-                    shardlock.unlock();
+                    std::string old_file_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];          
+                    std::string old_file_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
+                    remove(old_file_adj.c_str());
+                    remove(old_file_edata.c_str());
+                    remove(filename_shard_deletions(old_file_adj).c_str());
+                    if (this->deletions[shard] != NULL) delete this->deletions[shard];
+                    this->deletions[shard] = NULL;
+                    for(int k=0; k < (int)deltashards[shard].size(); k++) {
+                        delta_shard &d = deltashards[shard][k];
+                        if (d.sliding != NULL) delete d.sliding;
+                        if (d.memshard != NULL) delete d.memshard;
+                        if (d.deletions != NULL) delete d.deletions;
+                        remove(d.adjfile.c_str());
+                        remove(d.edatafile.c_str());
+                        remove(filename_shard_deletions(d.adjfile).c_str());
+                    }
+                    for(int part=0; part < c->nparts[shard]; part++) {
+                        newdeltas.push_back(std::vector<delta_shard>());
+                    }
+                } else {
+                    if (c->newdelta[shard].nedges > 0) {
+                        deltashards[shard].push_back(c->newdelta[shard]);
+                    }
+                    newdeltas.push_back(deltashards[shard]);
                 }
-                std::string origshardfile = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                std::string origadjfile = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                
-                // Get file size
-                int of = open(origshardfile.c_str(), O_RDONLY);
-                off_t sz = lseek(of, 0, SEEK_END);
-                lseek(of, 0, SEEK_SET);
-                close(of);
-                
-                int outparts = ( sz >= (off_t) maxshardsize ? 2 : 1);
-                
-                vid_t splitpos = 0;
-                if (sz > (off_t)maxshardsize) {
-                    rangeschanged = true;
-                    // Compute number edges (not including ingested ones!)
-                    size_t halfedges = (sz / sizeof(EdgeDataType)) / 2;
-                    // Correct to include estimate of ingested ones
-                    for(int w=0; w < this->nshards; w++) {
-                        halfedges += new_edge_buffers[shard][w]->size() / 2;
+            }
+            
+            // Update number of shards:
+            this->intervals = c->newranges;
+            // Vertices may have been added while the commit was running
+            this->intervals[this->intervals.size() - 1].second = max_vertex_id;
+            shard_suffices = c->newsuffices;
+            deltashards = newdeltas;
+            this->nshards = (int) this->intervals.size();
+            deletecounts.assign(this->nshards, 0);
+            
+            /* If the vertex intervals change, need to recreate the shard objects. The deltas
+               of the shards that were not compacted keep their intervals. */
+            if (c->rangeschanged) {
+                for (int i=0; i<(int)this->sliding_shards.size(); i++) {
+                    if (this->sliding_shards[i] != NULL) delete this->sliding_shards[i];
+                    if (this->deletions[i] != NULL) {
+                        this->deletions[i]->save();
+                        delete this->deletions[i];
                     }
-                    size_t nedges = 0;
-                    
-                    vid_t st = this->intervals[shard].first;
-                    splitpos = st + (this->intervals[shard].second - st) / 2;
-                    bool found = false;
-                    while(st < this->intervals[shard].second) {
-                        vid_t en = std::min(st + maxwindow, this->intervals[shard].second);
-                        this->degree_handler->load(st, en);
-                        int nv = en - st + 1;
-                        
-                        for(int i=0; i<nv; i++) {
-                            nedges += this->degree_handler->get_degree(st + i).indegree;
-                            if (nedges >= halfedges) {
-                                splitpos = i+st-1;
-                                found = true;
-                                break;
-                            }
+                }
+                this->sliding_shards.clear();
+                this->deletions.clear();
+            }
+            shardlock.unlock();
+            
+            // Clear buffers
+            for(int shard=0; shard < (int)c->buffers.size(); shard++) {
+                for (int win=0; win < (int)c->buffers[shard].size(); win++) {
+                    edge_buffer &buffer_for_window = *c->buffers[shard][win];
+                    for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
+                        created_edge<EdgeDataType> * edge = buffer_for_window[ebi];                            
+                        if (!edge->accounted_for_outc) {
+                            std::cout << "Edge not accounted (out)! " << edge->src << " -- " << edge->dst << std::endl;
+                        }
+                        if (!edge->accounted_for_inc) {
+                            std::cout << "Edge not accounted (in)! " << edge->src << " -- " << edge->dst << std::endl;
                         }
-                        if (found) break;
-                        st = en+1;
+                        
+                        assert(edge->accounted_for_inc);
+                        assert(edge->accounted_for_outc);
+                    }
+                }
+            }
+            release_commit();
+            
+            init_buffers();
+            modification_lock.unlock();
+            this->m.stop_time(me, "commit_swap");
+            signal_buffer_space(false);
+        }
+        
+        void release_commit() {
+            for(int shard=0; shard < (int)commit->buffers.size(); shard++) {
+                for (int win=0; win < (int)commit->buffers[shard].size(); win++) {
+                    delete commit->buffers[shard][win];
+                }
+            }
+            for(int shard=0; shard < (int)commit->deleted.size(); shard++) {
+                for(int k=0; k < (int)commit->deleted[shard].size(); k++) {
+                    if (commit->deleted[shard][k] != NULL) delete commit->deleted[shard][k];
+                }
+            }
+            delete commit->degrees;
+            remove(filename_degree_data(this->base_filename + ".dynamic.commit").c_str());
+            delete commit->iomgr;
+            delete commit;
+            commit = NULL;
+        }
+        
+        size_t buffered_edges(int shard) {
+            size_t bufedges = 0;
+            for(int w=0; w < this->nshards; w++) {
+                bufedges += new_edge_buffers[shard][w]->size();
+            }
+            return bufedges;
+        }
+        
+        /**
+         * Number of vertices whose degrees are loaded at a time when committing:
+         * the degrees may use a quarter of the memory budget.
+         */
+        vid_t degree_window() {
+            return (vid_t) std::max((size_t)1024, (size_t)this->membudget_mb * 1024 * 1024 / 4 / sizeof(degree));
+        }
+        
+        /**
+         * Stores the degrees of all buffered edges that have not been
+         * accounted for yet.
+         */
+        void account_buffered_edges() {
+            vid_t maxwindow = degree_window();
+            for(int window=0; window < this->nshards; window++) {
+                vid_t range_st = this->intervals[window].first;
+                vid_t range_en = (window == this->nshards - 1 ? max_vertex_id : this->intervals[window].second);
+                for(vid_t window_st=range_st; window_st <= range_en; ) {
+                    vid_t window_en = std::min(range_en, window_st + maxwindow);
+                    this->degree_handler->load(window_st, window_en);
+                    if (incorporate_new_edge_degrees(window, window_st, window_en)) {
+                        this->degree_handler->save();
                     }
-                    assert(splitpos > this->intervals[shard].first && splitpos < this->intervals[shard].second);
+                    window_st = window_en + 1;
                 }
+            }
+        }
+        
+        /**
+         * Determines the window of vertices for a compaction, as
+         * determine_next_window() but with the degree data of the commit.
+         */
+        vid_t commit_window(graph_commit &c, vid_t fromvid, vid_t maxvid, size_t membudget) {
+            c.degrees->load(fromvid, maxvid);
+            
+            size_t memreq = 0;
+            size_t max_interval = (size_t) (maxvid - fromvid);
+            for(size_t i=0; i < max_interval; i++) {
+                degree deg = c.degrees->get_degree(fromvid + i);
+                int inc = deg.indegree;
+                int outc = deg.outdegree;
                 
-                for(int splits=0; splits<outparts; splits++) { // Note: this is not super-efficient because we do the operation twice in case of split
-                    typename base_engine::slidingshard_t * curshard = 
-                    new typename base_engine::slidingshard_t(this->iomgr, origshardfile, origadjfile, 
-                                                             this->intervals[shard].first, this->intervals[shard].second, 
-                                                             1024 * 1024, this->m, true);
-                    
-                    
-                    std::string suffix = "";
-                    char partstr[128];
-                    sprintf(partstr, "%d", shard);
-                    if (splits == 0) {
-                        suffix = std::string(partstr);
-                    } else {
-                        suffix = std::string(partstr) + ".split";  
+                // Raw data and object cost included
+                memreq += sizeof(svertex_t) + (sizeof(EdgeDataType) + sizeof(vid_t) + 
+                                               sizeof(graphchi_edge<EdgeDataType>))*(outc + inc);
+                if (memreq > membudget) {
+                    return fromvid + i - 1;  // Previous was enough
+                }
+            }
+            return maxvid;
+        }
+        
+        static bool created_edge_less(const created_edge<EdgeDataType> * a, const created_edge<EdgeDataType> * b) {
+            return a->src < b->src || (a->src == b->src && a->dst < b->dst);
+        }
+        
+        /**
+         * Writes the buffered edges of a shard to a new delta shard. Edges
+         * removed while they were buffered are dropped.
+         */
+        delta_shard write_delta_shard(graph_commit &c, int shard) {
+            int nshards = (int) c.intervals.size();
+            std::vector< created_edge<EdgeDataType> * > edges;
+            for(int w=0; w < nshards; w++) {
+                edge_buffer &buffer_for_window = *c.buffers[shard][w];
+                for(unsigned int ebi=0; ebi < buffer_for_window.size(); ebi++) {
+                    if (!buffer_for_window[ebi]->tombstone().is_set()) {
+                        edges.push_back(buffer_for_window[ebi]);
                     }
-                    suffix = suffix + ".i" + std::string(iterstr);
-                    newsuffices.push_back(suffix);
-                    std::string outfile_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + suffix;             
-                    std::string outfile_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + suffix;
-                    
-                    vid_t splitstart = this->intervals[shard].first;
-                    vid_t splitend = this->intervals[shard].second;
-                    if (shard == this->nshards - 1) splitend = max_vertex_id;
-                    
-                    // This is looking more and more hacky
-                    if (outparts == 2) {
-                        if (splits==0) splitend = splitpos;
-                        else splitstart = splitpos+1;
+                }
+            }
+            std::stable_sort(edges.begin(), edges.end(), created_edge_less);
+            
+            char deltastr[64];
+            sprintf(deltastr, ".delta%d", ndeltas_created++);
+            delta_shard d;
+            d.adjfile = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + c.suffices[shard] + deltastr;
+            d.edatafile = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + c.suffices[shard] + deltastr;
+            d.nedges = edges.size();
+            d.memshard = NULL;
+            d.sliding = NULL;
+            d.deletions = NULL;
+            remove(filename_shard_deletions(d.adjfile).c_str());
+            
+            int f = open(d.adjfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            int ef = open(d.edatafile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            assert(f >= 0 && ef >= 0);
+            write_shard_adj_header(f);
+            char * buf = (char*) malloc(BBUF); 
+            char * bufptr = buf;
+            char * ebuf = (char*) malloc(BBUF);
+            char * ebufptr = ebuf;
+            
+            vid_t curvid = 0;
+            for(size_t i=0; i < edges.size(); ) {
+                vid_t src = edges[i]->src;
+                size_t j = i;
+                while(j < edges.size() && edges[j]->src == src) j++;
+                
+                // Vertices without edges are written as runs of zeros
+                while(curvid < src) {
+                    vid_t nz = std::min(src - curvid, (vid_t)255);
+                    bwrite<uint8_t>(f, buf, bufptr, 0);
+                    bwrite<uint8_t>(f, buf, bufptr, (uint8_t)(nz - 1));
+                    curvid += nz;
+                }
+                size_t count = j - i;
+                if (count < 255) {
+                    bwrite<uint8_t>(f, buf, bufptr, (uint8_t)count);
+                } else {
+                    bwrite<uint8_t>(f, buf, bufptr, 0xff);
+                    bwrite<uint32_t>(f, buf, bufptr, (uint32_t)count);
+                }
+                for(; i < j; i++) {
+                    bwrite(f, buf, bufptr, edges[i]->dst);
+                    bwrite<EdgeDataType>(ef, ebuf, ebufptr, edges[i]->data);
+                }
+                curvid = src + 1;
+            }
+            
+            writea(f, buf, bufptr-buf);
+            writea(ef, ebuf, ebufptr-ebuf);
+            free(buf);
+            free(ebuf);
+            close(f);
+            close(ef);
+            
+            if (c.record_edges()) {
+                written_delta wd;
+                wd.adjfile = d.adjfile;
+                wd.edatafile = d.edatafile;
+                c.written_deltas.push_back(wd);
+                c.written_deltas.back().edges.swap(edges);
+            }
+            return d;
+        }
+        
+        void rewrite_delta(graph_commit &c, written_delta &wd) {
+            if (c.rewrite_values) {
+                int ef = open(wd.edatafile.c_str(), O_WRONLY);
+                assert(ef >= 0);
+                char * ebuf = (char*) malloc(BBUF);
+                char * ebufptr = ebuf;
+                for(size_t i=0; i < wd.edges.size(); i++) {
+                    bwrite<EdgeDataType>(ef, ebuf, ebufptr, wd.edges[i]->data);
+                }
+                writea(ef, ebuf, ebufptr-ebuf);
+                free(ebuf);
+                close(ef);
+            }
+            if (c.carry_deletions) {
+                deletion_bitmap deleted(filename_shard_deletions(wd.adjfile), wd.edges.size());
+                for(size_t i=0; i < wd.edges.size(); i++) {
+                    if (wd.edges[i]->tombstone().is_set()) deleted.remove(i);
+                }
+                deleted.save();
+            }
+        }
+        
+        /**
+         * Reader of the values of a shard, for increasing edge indices.
+         */
+        struct edge_value_reader {
+            int f;
+            size_t first;
+            size_t n;
+            std::vector<EdgeDataType> buf;
+            
+            edge_value_reader(std::string filename) : first(0), n(0), buf(1024 * 1024 / sizeof(EdgeDataType) + 1) {
+                f = open(filename.c_str(), O_RDONLY);
+                assert(f >= 0);
+            }
+            
+            ~edge_value_reader() {
+                close(f);
+            }
+            
+            EdgeDataType get(size_t idx) {
+                if (idx < first || idx >= first + n) {
+                    ssize_t rd = pread(f, &buf[0], buf.size() * sizeof(EdgeDataType), idx * sizeof(EdgeDataType));
+                    assert(rd >= (ssize_t) sizeof(EdgeDataType));
+                    n = rd / sizeof(EdgeDataType);
+                    first = idx;
+                }
+                return buf[idx - first];
+            }
+        };
+        
+        /**
+         * A shard, or a delta of it, read by a compaction.
+         */
+        struct compaction_source {
+            int shard;
+            int delta; // -1 for the shard itself
+            
+            compaction_source(int shard, int delta) : shard(shard), delta(delta) {}
+        };
+        
+        /**
+         * The sources of a compaction of shards first..last: the shards in
+         * order, and then their deltas. The merged shards have consecutive
+         * intervals, so the edges of a vertex in the shards are ordered by target.
+         */
+        std::vector<compaction_source> compaction_sources(graph_commit &c, int first, int last) {
+            std::vector<compaction_source> sources;
+            for(int p=first; p <= last; p++) {
+                sources.push_back(compaction_source(p, -1));
+            }
+            for(int p=first; p <= last; p++) {
+                for(int k=0; k < (int)c.deltas[p].size(); k++) {
+                    sources.push_back(compaction_source(p, k));
+                }
+            }
+            assert(sources.size() < BUFFERED_SOURCE);
+            return sources;
+        }
+        
+        std::string shard_edata_file(std::string suffix) {
+            return filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + suffix;
+        }
+        
+        std::string shard_adj_file(std::string suffix) {
+            return filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + suffix;
+        }
+        
+        /**
+         * Writes the values of a compacted shard again from the current
+         * values of its sources, and the edges removed from the sources
+         * after the compaction read them. The compaction skipped the edges
+         * that were deleted when it started.
+         */
+        void rewrite_part(graph_commit &c, written_part &part) {
+            std::vector<compaction_source> sources = compaction_sources(c, part.first, part.last);
+            std::vector<std::string> sourcefiles;
+            std::vector<deletion_bitmap *> live;
+            std::vector<deletion_bitmap *> skipped;
+            for(int i=0; i < (int)sources.size(); i++) {
+                int p = sources[i].shard, k = sources[i].delta;
+                if (k < 0) {
+                    sourcefiles.push_back(shard_edata_file(c.suffices[p]));
+                    live.push_back(this->deletions[p]);
+                } else {
+                    sourcefiles.push_back(c.deltas[p][k].edatafile);
+                    live.push_back(deltashards[p][k].deletions);
+                }
+                skipped.push_back(c.deleted[p][k + 1]);
+            }
+            std::vector<edge_value_reader *> readers;
+            for(int k=0; k < (int)sourcefiles.size() && c.rewrite_values; k++) {
+                readers.push_back(new edge_value_reader(sourcefiles[k]));
+            }
+            
+            int ef = -1;
+            char * ebuf = NULL;
+            char * ebufptr = NULL;
+            if (c.rewrite_values) {
+                ef = open(part.edatafile.c_str(), O_WRONLY);
+                assert(ef >= 0);
+                ebuf = (char*) malloc(BBUF);
+                ebufptr = ebuf;
+            }
+            std::vector<size_t> nextidx(sourcefiles.size(), 0);
+            std::vector<size_t> deletedidx;
+            size_t nbuffered = 0;
+            size_t nwritten = 0;
+            for(size_t i=0; i < part.sources.size(); i++) {
+                uint16_t source = (uint16_t)(part.sources[i] & ~SKIPPED_SOURCE);
+                EdgeDataType val = EdgeDataType();
+                bool deleted = false;
+                if (source == BUFFERED_SOURCE) {
+                    graphchi_edge<EdgeDataType> &e = part.buffered[nbuffered++];
+                    val = *e.data_ptr;
+#ifdef SUPPORT_DELETIONS
+                    deleted = e.is_deleted();
+#endif
+                } else {
+                    size_t &idx = nextidx[source];
+                    while (skipped[source] != NULL && skipped[source]->is_deleted(idx)) idx++;
+                    if (c.rewrite_values) val = readers[source]->get(idx);
+                    deleted = live[source] != NULL && live[source]->is_deleted(idx);
+                    idx++;
+                }
+                if (!(part.sources[i] & SKIPPED_SOURCE)) {
+                    if (c.rewrite_values) bwrite<EdgeDataType>(ef, ebuf, ebufptr, val);
+                    if (deleted) deletedidx.push_back(nwritten);
+                    nwritten++;
+                }
+            }
+            if (c.rewrite_values) {
+                writea(ef, ebuf, ebufptr-ebuf);
+                free(ebuf);
+                close(ef);
+            }
+            for(int k=0; k < (int)readers.size(); k++) {
+                delete readers[k];
+            }
+            if (c.carry_deletions && !deletedidx.empty()) {
+                deletion_bitmap newdeleted(filename_shard_deletions(part.adjfile), nwritten);
+                for(size_t i=0; i < deletedidx.size(); i++) {
+                    newdeleted.remove(deletedidx[i]);
+                }
+                newdeleted.save();
+            }
+        }
+        
+        /**
+         * Orders the out-edges of a vertex by target.
+         */
+        struct edge_index_less {
+            graphchi_edge<EdgeDataType> * edges;
+            edge_index_less(graphchi_edge<EdgeDataType> * edges) : edges(edges) {}
+            bool operator()(int a, int b) const {
+                return edges[a].vertexid < edges[b].vertexid;
+            }
+        };
+        
+        /**
+         * Divides the vertices st..en into nparts intervals with about the same
+         * number of in-edges. Returns the last vertex of each interval; there
+         * can be fewer intervals, if the in-edges are in few vertices.
+         */
+        std::vector<vid_t> split_intervals(graph_commit &c, vid_t st, vid_t en, int nparts) {
+            vid_t maxwindow = degree_window();
+            size_t total = 0;
+            for(vid_t window_st=st; window_st <= en; ) {
+                vid_t window_en = std::min(en, window_st + maxwindow);
+                c.degrees->load(window_st, window_en);
+                for(vid_t v=window_st; v <= window_en; v++) {
+                    total += c.degrees->get_degree(v).indegree;
+                }
+                window_st = window_en + 1;
+            }
+            
+            std::vector<vid_t> ends;
+            size_t nedges = 0;
+            for(vid_t window_st=st; window_st < en && (int)ends.size() < nparts - 1; ) {
+                vid_t window_en = std::min(en, window_st + maxwindow);
+                c.degrees->load(window_st, window_en);
+                for(vid_t v=window_st; v <= window_en && v < en; v++) {
+                    nedges += c.degrees->get_degree(v).indegree;
+                    if (nedges * nparts >= total * (ends.size() + 1)) {
+                        ends.push_back(v);
+                        if ((int)ends.size() == nparts - 1) break;
                     }
-                    newranges.push_back(std::pair<vid_t,vid_t>(splitstart, splitend)); 
-                    
-                    // Create the adj file
-                    int f = open(outfile_adj.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    ftruncate(f, 0);
-                    /* Create edge data file */
-                    int ef = open(outfile_edata.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                    ftruncate(ef, 0);
-                    char * buf = (char*) malloc(BBUF); 
-                    char * bufptr = buf;
-                    char * ebuf = (char*) malloc(BBUF);
-                    char * ebufptr = ebuf;
+                }
+                window_st = window_en + 1;
+            }
+            ends.push_back(en);
+            return ends;
+        }
+        
+        /**
+         * Merges shards first..last, their deltas and their buffered edges into
+         * a new shard, which is split into nparts shards if it has grown too large.
+         * Returns the number of new shards.
+         */
+        int compact_shards(graph_commit &c, int first, int last, int nparts) {
+            vid_t maxwindow = degree_window();
+            size_t mem_budget = (size_t)this->membudget_mb * 1024 * 1024;
+            int nshards = (int) c.intervals.size();
+            char iterstr[128];
+            sprintf(iterstr, "%d", c.iter);
+            std::vector<compaction_source> sources = compaction_sources(c, first, last);
+            int nbases = last - first + 1;
+            
+            vid_t rangest = c.intervals[first].first;
+            vid_t rangeen = (last == nshards - 1 ? c.max_vertex_id : c.intervals[last].second);
+            std::vector<vid_t> splitends;
+            if (nparts > 1) {
+                splitends = split_intervals(c, rangest, rangeen, nparts);
+            } else {
+                splitends.push_back(rangeen);
+            }
+            int outparts = (int) splitends.size();
+            
+            for(int splits=0; splits<outparts; splits++) { // Note: this is not super-efficient because we read the shards once for each part
+                std::vector<typename base_engine::slidingshard_t *> inputs;
+                for(int i=0; i < (int)sources.size(); i++) {
+                    int p = sources[i].shard, k = sources[i].delta;
+                    std::string edatafile = (k < 0 ? shard_edata_file(c.suffices[p]) : c.deltas[p][k].edatafile);
+                    std::string adjfile = (k < 0 ? shard_adj_file(c.suffices[p]) : c.deltas[p][k].adjfile);
+                    inputs.push_back(new typename base_engine::slidingshard_t(c.iomgr, edatafile, adjfile,
+                                                                              c.intervals[p].first, c.intervals[p].second,
+                                                                              1024 * 1024, c.m, true));
+                    inputs.back()->set_deletions(c.deleted[p][k + 1]);
+                }
+                
+                char partstr[128];
+                if (splits == 0) {
+                    sprintf(partstr, "%d", first);
+                } else {
+                    sprintf(partstr, "%d.split%d", first, splits);
+                }
+                std::string suffix = std::string(partstr) + ".i" + std::string(iterstr);
+                c.newsuffices.push_back(suffix);
+                std::string outfile_edata = shard_edata_file(suffix);
+                std::string outfile_adj = shard_adj_file(suffix);
+                
+                vid_t splitstart = (splits == 0 ? rangest : splitends[splits - 1] + 1);
+                vid_t splitend = splitends[splits];
+                c.newranges.push_back(std::pair<vid_t,vid_t>(splitstart, splitend)); 
+                
+                written_part part;
+                part.first = first;
+                part.last = last;
+                part.adjfile = outfile_adj;
+                part.edatafile = outfile_edata;
+                remove(filename_shard_deletions(outfile_adj).c_str());
+                
+                // Create the adj file
+                int f = open(outfile_adj.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                ftruncate(f, 0);
+                write_shard_adj_header(f);
+                /* Create edge data file */
+                int ef = open(outfile_edata.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                ftruncate(ef, 0);
+                char * buf = (char*) malloc(BBUF); 
+                char * bufptr = buf;
+                char * ebuf = (char*) malloc(BBUF);
+                char * ebufptr = ebuf;
+                
+                // Now create a new shard file window by window
+                for(int window=0; window < nshards; window++) {
+                    vid_t range_st = c.intervals[window].first;
+                    vid_t range_en = c.intervals[window].second;
+                    if (window == nshards - 1) range_en = c.max_vertex_id;
                     
-                    // Now create a new shard file window by window
-                    for(int window=0; window < this->nshards; window++) {
-                        vid_t range_st = this->intervals[window].first;
-                        vid_t range_en = this->intervals[window].second;
-                        if (window == this->nshards - 1) range_en = max_vertex_id;
-                        edge_buffer &buffer_for_window = *new_edge_buffers[shard][window];
+                    for(vid_t window_st=range_st; window_st<=range_en; ) {
+                        // Check how much we can read
+                        vid_t window_en = commit_window(c, window_st, 
+                                                        std::min(range_en, window_st + (vid_t)maxwindow), mem_budget);
+                        // Create vertices
+                        int nvertices = window_en-window_st+1;
+                        std::vector< svertex_t > vertices(nvertices, svertex_t());
+                        /* Allocate edge data: to do this, need to compute sum of in & out edges */
+                        graphchi_edge<EdgeDataType> * edata = NULL;
+                        size_t num_edges=0;
+                        for(int i=0; i<nvertices; i++) {
+                            degree d = c.degrees->get_degree(i + window_st);
+                            num_edges += d.indegree+d.outdegree;
+                        }
+                        size_t ecounter = 0;
+                        edata = (graphchi_edge<EdgeDataType>*)malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
+                        for(int i=0; i<(int)nvertices; i++) {
+                            //  int inc = degrees[i].indegree;
+                            degree d = c.degrees->get_degree(i + window_st);
+                            int outc = d.outdegree;
+                            vertices[i] = svertex_t(window_st+i, &edata[ecounter], 
+                                                    &edata[ecounter+0], 0, outc);
+                            vertices[i].scheduled = true; // guarantee that shard will read it
+                            ecounter += 0 + outc;
+                        }
                         
-                        for(vid_t window_st=range_st; window_st<range_en; ) {
-                            // Check how much we can read
-                            vid_t window_en = determine_next_window(window, window_st, 
-                                                                    std::min(range_en, window_st + (vid_t)maxwindow), mem_budget);
-                            // Create vertices
-                            int nvertices = window_en-window_st+1;
-                            std::vector< svertex_t > vertices(nvertices, svertex_t());
-                            /* Allocate edge data: to do this, need to compute sum of in & out edges */
-                            graphchi_edge<EdgeDataType> * edata = NULL;
-                            size_t num_edges=0;
-                            for(int i=0; i<nvertices; i++) {
-                                degree d = this->degree_handler->get_degree(i + window_st);
-                                num_edges += d.indegree+d.outdegree;
-                            }
-                            size_t ecounter = 0;
-                            edata = (graphchi_edge<EdgeDataType>*)malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
-                            for(int i=0; i<(int)nvertices; i++) {
-                                //  int inc = degrees[i].indegree;
-                                degree d = this->degree_handler->get_degree(i + window_st);
-                                int outc = d.outdegree;
-                                vertices[i] = svertex_t(window_st+i, &edata[ecounter], 
-                                                        &edata[ecounter+0], 0, outc);
-                                vertices[i].scheduled = true; // guarantee that shard will read it
-                                ecounter += 0 + outc;
+                        // Read vertices in from the sources, and the buffered edges after them.
+                        // The edges of each source end at sourceend[source][vertex].
+                        std::vector< std::vector<int> > sourceend(inputs.size(), std::vector<int>(nvertices));
+                        for(int k=0; k < (int)inputs.size(); k++) {
+                            inputs[k]->read_next_vertices(nvertices, window_st, vertices, false, true);
+                            for(int iv=0; iv < nvertices; iv++) sourceend[k][iv] = vertices[iv].outc;
+                        }
+                        for(int p=first; p <= last; p++) {
+                            edge_buffer &buffer_for_window = *c.buffers[p][window];
+                            std::pair<unsigned int, unsigned int> r = buffer_for_window.src_range(window_st, window_en);
+                            for(unsigned int ebi=r.first; ebi<r.second; ebi++) {
+                                created_edge<EdgeDataType> * edge = buffer_for_window.by_src(ebi);
+                                add_buffered_outedge(vertices[edge->src-window_st], edge);
                             }
-                            
-                            // Read vertices in
-                            curshard->read_next_vertices(nvertices, window_st, vertices, false, true);
-                            
-                            // Incorporate buffered edges
-                            for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                                created_edge<EdgeDataType> * edge = buffer_for_window[ebi];
-                                if (edge->src >= window_st && edge->src <= window_en) {
-                                    vertices[edge->src-window_st].add_outedge(edge->dst, &edge->data, false);
-                                    
-                                }
+                        }
+                        c.iomgr->wait_for_reads();
+                        
+                        // Memory shards expect the out-edges of a vertex sorted by target,
+                        // so merge the edges of the deltas and the buffers into the edges of the shards.
+                        std::vector<int> perm;
+                        std::vector< graphchi_edge<EdgeDataType> > unsorted;
+                        for(int iv=0; iv < nvertices; iv++) {
+                            int outc = vertices[iv].outc;
+                            int shardedges = sourceend[nbases - 1][iv];
+                            if (outc == 0) continue;
+                            graphchi_edge<EdgeDataType> * e = vertices[iv].outedge(0);
+                            perm.resize(outc);
+                            for(int i=0; i < outc; i++) perm[i] = i;
+                            if (outc > shardedges) {
+                                unsorted.assign(e, e + outc);
+                                edge_index_less cmp(&unsorted[0]);
+                                std::stable_sort(perm.begin() + shardedges, perm.end(), cmp);
+                                std::inplace_merge(perm.begin(), perm.begin() + shardedges, perm.end(), cmp);
+                                for(int i=0; i < outc; i++) e[i] = unsorted[perm[i]];
                             }
-                            this->iomgr->wait_for_reads();
-                            
-                            // If we are splitting, need to adjust counts
-                            std::vector<int> adjusted_counts(vertices.size(), 0);
-                            for(int iv=0; iv< (int)vertices.size(); iv++) adjusted_counts[iv] = vertices[iv].outc;
-                            
-                            if (outparts == 2) {
-                                // do actual counts by removing the edges not in this split
-                                for(int iv=0; iv< (int)vertices.size(); iv++) {
-                                    svertex_t &vertex = vertices[iv];
-                                    for(int i=0; i<vertex.outc; i++) {
-                                        if (!(vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend)) {
-                                            adjusted_counts[iv]--;  
+                            if (c.record_edges()) {
+                                for(int i=0; i < outc; i++) {
+                                    uint16_t source = 0;
+                                    while(source < (uint16_t)sourceend.size() && perm[i] >= sourceend[source][iv]) source++;
+                                    bool inpart = e[i].vertexid >= splitstart && e[i].vertexid <= splitend;
+                                    if (source == (uint16_t)sourceend.size()) {
+                                        if (inpart) {
+                                            part.sources.push_back(BUFFERED_SOURCE);
+                                            part.buffered.push_back(e[i]);
                                         }
+                                    } else {
+                                        part.sources.push_back(inpart ? source : (uint16_t)(source | SKIPPED_SOURCE));
                                     }
                                 }
-                            }   
-                            
-#ifdef SUPPORT_DELETIONS
-                            // Adjust counts to remove deleted edges
+                            }
+                        }
+                        
+                        // If we are splitting, need to adjust counts
+                        std::vector<int> adjusted_counts(vertices.size(), 0);
+                        for(int iv=0; iv< (int)vertices.size(); iv++) adjusted_counts[iv] = vertices[iv].outc;
+                        
+                        if (outparts > 1) {
+                            // do actual counts by removing the edges not in this split
                             for(int iv=0; iv< (int)vertices.size(); iv++) {
                                 svertex_t &vertex = vertices[iv];
                                 for(int i=0; i<vertex.outc; i++) {
-                                    if (is_deleted_edge_value(vertex.outedge(i)->get_data())) {
+                                    if (!(vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend)) {
                                         adjusted_counts[iv]--;  
-                                        assert(false);
                                     }
                                 }
                             }
-                            
-                            // Adjust degrees
-                            //   adjust_degrees_for_deleted(vertices, window_st); // Double counting problem, that is why commented out.
-#endif
-                            
-                            size_t ne = 0;
-                            for(vid_t curvid=window_st; curvid<=window_en;) {
-                                int iv = curvid - window_st;
-                                svertex_t &vertex = vertices[iv];
-                                int count = adjusted_counts[iv];                            
-                                if (count == 0) {
-                                    // Check how many next ones are zeros
-                                    int nz=0;
-                                    curvid++;
-                                    for(; curvid <= window_en && nz<254; curvid++) {
-                                        if (adjusted_counts[curvid - window_st] == 0) {
-                                            nz++;
-                                        } else {
-                                            break;
-                                        }
-                                    }
-                                    uint8_t nnz = (uint8_t)nz;
-                                    // Write zero
-                                    bwrite<uint8_t>(f, buf, bufptr, 0);
-                                    bwrite<uint8_t>(f, buf, bufptr, nnz);
-                                } else {
-                                    if (count < 255) {
-                                        uint8_t x = (uint8_t)count;
-                                        bwrite<uint8_t>(f, buf, bufptr, x);
+                        }   
+                        
+                        size_t ne = 0;
+                        for(vid_t curvid=window_st; curvid<=window_en;) {
+                            int iv = curvid - window_st;
+                            svertex_t &vertex = vertices[iv];
+                            int count = adjusted_counts[iv];                            
+                            if (count == 0) {
+                                // Check how many next ones are zeros
+                                int nz=0;
+                                curvid++;
+                                for(; curvid <= window_en && nz<254; curvid++) {
+                                    if (adjusted_counts[curvid - window_st] == 0) {
+                                        nz++;
                                     } else {
-                                        bwrite<uint8_t>(f, buf, bufptr, 0xff);
-                                        bwrite<uint32_t>(f, buf, bufptr, (uint32_t)count);
-                                    }
-                                    
-                                    for(int i=0; i<vertex.outc; i++) {
-                                        if (vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend) {
-#ifdef SUPPORT_DELETIONS
-                                            if (is_deleted_edge_value(vertex.outedge(i)->get_data())) {
-                                                assert(false);
-                                                
-                                            } 
-#endif
-                                            bwrite(f, buf, bufptr,  vertex.outedge(i)->vertexid);
-                                            bwrite<EdgeDataType>(ef, ebuf, ebufptr, vertex.outedge(i)->get_data());
-                                            ne++;
-                                        } else assert(outparts == 2);
+                                        break;
                                     }
-                                    curvid++;
                                 }
-                            } 
-                            free(edata);
-                            window_st = window_en+1;
-                        }
-                        
-                    } // end window
-                    
-                    // Flush buffers
-                    writea(f, buf, bufptr-buf);
-                    writea(ef, ebuf, ebufptr-ebuf);
-                    
-                    // Release
-                    free(buf); 
-                    free(ebuf);
-                    
-                    
-                    delete curshard;
-                    close(f);
-                    close(ef);
-                    
-                    this->iomgr->wait_for_writes();
-                } // splits
-                
-                // Delete old shard
-                std::string old_file_adj = filename_shard_adj(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];          
-                std::string old_file_edata = filename_shard_edata<EdgeDataType>(this->base_filename, 0, 0) + ".dyngraph" + shard_suffices[shard];
-                remove(old_file_adj.c_str());
-                remove(old_file_edata.c_str());
-            }
-            
-            // Clear buffers
-            for(int shard=0; shard < this->nshards; shard++) {
-                if (was_commited[shard]) {
-                    for (int win=0; win < this->nshards; win++) {
-                        edge_buffer &buffer_for_window = *new_edge_buffers[shard][win];
-                        for(unsigned int ebi=0; ebi<buffer_for_window.size(); ebi++) {
-                            created_edge<EdgeDataType> * edge = buffer_for_window[ebi];                            
-                            if (!edge->accounted_for_outc) {
-                                std::cout << "Edge not accounted (out)! " << edge->src << " -- " << edge->dst << std::endl;
-                            }
-                            if (!edge->accounted_for_inc) {
-                                std::cout << "Edge not accounted (in)! " << edge->src << " -- " << edge->dst << std::endl;
+                                uint8_t nnz = (uint8_t)nz;
+                                // Write zero
+                                bwrite<uint8_t>(f, buf, bufptr, 0);
+                                bwrite<uint8_t>(f, buf, bufptr, nnz);
+                            } else {
+                                if (count < 255) {
+                                    uint8_t x = (uint8_t)count;
+                                    bwrite<uint8_t>(f, buf, bufptr, x);
+                                } else {
+                                    bwrite<uint8_t>(f, buf, bufptr, 0xff);
+                                    bwrite<uint32_t>(f, buf, bufptr, (uint32_t)count);
+                                }
+                                
+                                for(int i=0; i<vertex.outc; i++) {
+                                    if (vertex.outedge(i)->vertexid >= splitstart && vertex.outedge(i)->vertexid <= splitend) {
+                                        bwrite(f, buf, bufptr,  vertex.outedge(i)->vertexid);
+                                        bwrite<EdgeDataType>(ef, ebuf, ebufptr, vertex.outedge(i)->get_data());
+                                        ne++;
+                                    } else assert(outparts > 1);
+                                }
+                                curvid++;
                             }
-                            
-                            assert(edge->accounted_for_inc);
-                            assert(edge->accounted_for_outc);
-                        }
-                        buffer_for_window.clear();
+                        } 
+                        free(edata);
+                        window_st = window_en+1;
                     }
+                    
+                } // end window
+                
+                // Flush buffers
+                writea(f, buf, bufptr-buf);
+                writea(ef, ebuf, ebufptr-ebuf);
+                
+                // Release
+                free(buf); 
+                free(ebuf);
+                
+                
+                for(int k=0; k < (int)inputs.size(); k++) {
+                    delete inputs[k];
                 }
-            }
-            
-            // Update number of shards:
-            last_commit = added_edges;
-            this->intervals = newranges;
-            shard_suffices = newsuffices;
-            this->nshards = (int) this->intervals.size();
-            
-            /* If the vertex intervals change, need to recreate the shard objects. */
-            if (rangeschanged) {
-                shardlock.lock();
-                for (int i=0; i<(int)this->sliding_shards.size(); i++) {
-                    if (this->sliding_shards[i] != NULL) delete this->sliding_shards[i];
+                close(f);
+                close(ef);
+                
+                c.iomgr->wait_for_writes();
+                if (c.record_edges()) {
+                    c.written_parts.push_back(part);
                 }
-                this->sliding_shards.clear();
-                shardlock.unlock();
-            }
-            init_buffers();
-            modification_lock.unlock();
+            } // splits
+            return outparts;
         }
+        
         template <typename T>
         void bwrite(int f, char * buf, char * &bufptr, T val) {
             if (bufptr+sizeof(T)-buf>=BBUF) {
@@ -46,6 +46,11 @@ namespace graphchi {
         }
         
     protected:
+        /* Override - functional engine loads the edges with its own hooks */
+        virtual bool disable_inmemory_mode() {
+            return true;
+        }
+        
         /* Override - load only memory shard (i.e inedges) */
         virtual void load_before_updates(std::vector<fvertex_t> &vertices) {
             logstream(LOG_DEBUG) << "Processing in-edges." << std::endl;
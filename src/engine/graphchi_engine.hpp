@@ -53,7 +53,9 @@
 #include "metrics/metrics.hpp"
 #include "shards/memoryshard.hpp"
 #include "shards/slidingshard.hpp"
+#include "shards/inmemorygraph.hpp"
 #include "util/pthread_tools.hpp"
+#include "util/vertexmap.hpp"
 
 
 namespace graphchi {
@@ -65,6 +67,7 @@ namespace graphchi {
     public:     
         typedef sliding_shard<VertexDataType, EdgeDataType, svertex_t> slidingshard_t;
         typedef memory_shard<VertexDataType, EdgeDataType, svertex_t> memshard_t;
+        typedef inmemory_graph<EdgeDataType> inmemgraph_t;
         
     protected:
         std::string base_filename;
@@ -75,9 +78,13 @@ namespace graphchi {
         
         /* Shards */
         std::vector<slidingshard_t *> sliding_shards;
+        std::vector<deletion_bitmap *> deletions;  // Deleted edges of each shard, or NULL
         memshard_t * memoryshard;
         std::vector<std::pair<vid_t, vid_t> > intervals;
         
+        /* In-memory mode: if the graph fits in memory, all shards are loaded once */
+        inmemgraph_t * inmemgraph;
+        
         /* Auxilliary data handlers */
         degree_data * degree_handler;
         vertex_data_store<VertexDataType> * vertex_data_handler;
@@ -100,6 +107,7 @@ namespace graphchi {
         int membudget_mb;
         int load_threads;
         int exec_threads;
+        int snapshot_interval;
         
         /* State */
         vid_t sub_interval_st;
@@ -121,6 +129,37 @@ namespace graphchi {
             logstream(LOG_INFO) << " membudget_mb = " << membudget_mb << std::endl;
             logstream(LOG_INFO) << " blocksize = " << blocksize << std::endl;
             logstream(LOG_INFO) << " scheduler = " << use_selective_scheduling << std::endl;
+            logstream(LOG_INFO) << " inmemory = " << (inmemgraph != NULL) << std::endl;
+        }
+        
+        /**
+          * Compares the load times of the intervals to the costs predicted
+          * by the sharder (see sharder::compute_partitionintervals()).
+          */
+        void report_interval_costs() {
+            FILE * f = fopen(filename_interval_costs(base_filename, nshards).c_str(), "r");
+            if (f == NULL) return;
+            std::vector<double> predicted;
+            double c;
+            while (fscanf(f, "%lf", &c) == 1) predicted.push_back(c);
+            fclose(f);
+            
+            std::vector<double> actual = m.get("interval.loadtime").v;
+            if ((int)predicted.size() != nshards || (int)actual.size() != nshards) return;
+            double totpredicted = 0, totactual = 0, maxactual = 0;
+            for(int p=0; p < nshards; p++) {
+                totpredicted += predicted[p];
+                totactual += actual[p];
+                maxactual = std::max(maxactual, actual[p]);
+            }
+            if (totpredicted <= 0 || totactual <= 0) return;
+            for(int p=0; p < nshards; p++) {
+                logstream(LOG_INFO) << "Interval " << p << ": predicted load " << 100.0 * predicted[p] / totpredicted
+                    << "%, actual " << 100.0 * actual[p] / totactual << "%" << std::endl;
+                m.set_vector_entry("interval.predicted_share", p, predicted[p] / totpredicted);
+                m.set_vector_entry("interval.actual_share", p, actual[p] / totactual);
+            }
+            m.set("interval.load_imbalance", maxactual * nshards / totactual);
         }
         
     public:
@@ -151,6 +190,7 @@ namespace graphchi {
             
             /* Initialize a plenty of fields */
             memoryshard = NULL;
+            inmemgraph = NULL;
             modifies_outedges = true;
             modifies_inedges = true;
             only_adjacency = false;
@@ -165,6 +205,7 @@ namespace graphchi {
             enable_deterministic_parallelism = true;
             load_threads = get_option_int("loadthreads", 2);
             exec_threads = get_option_int("execthreads", omp_get_max_threads());
+            snapshot_interval = get_option_int("snapshot.interval", 0);
             
             /* Load graph shard interval information */
             load_vertex_intervals();
@@ -179,12 +220,19 @@ namespace graphchi {
                 delete memoryshard;
                 memoryshard = NULL;
             }
+            if (inmemgraph != NULL) {
+                delete inmemgraph;
+                inmemgraph = NULL;
+            }
             for(int i=0; i < (int)sliding_shards.size(); i++) {
                 if (sliding_shards[i] != NULL) {
                     delete sliding_shards[i];
                 }
                 sliding_shards[i] = NULL;
             }
+            for(int i=0; i < (int)deletions.size(); i++) {
+                if (deletions[i] != NULL) delete deletions[i];
+            }
             degree_handler = NULL;
             vertex_data_handler = NULL;
             delete iomgr;
@@ -201,6 +249,18 @@ namespace graphchi {
             return false;
         }
         
+        /**
+          * Engines that modify the graph structure, or load the edges
+          * in their own way, cannot run in the in-memory mode.
+          */
+        virtual bool disable_inmemory_mode() {
+#ifdef SUPPORT_DELETIONS
+            return true;  // Edges are removed through the deletion bitmaps of the shards
+#else
+            return false;
+#endif
+        }
+        
         /**
           * Try to find suitable shards by trying with different
           * shard numbers. Looks up to shard number 2000.
@@ -238,15 +298,68 @@ namespace graphchi {
                                       m, 
                                       !modifies_outedges, 
                                       only_adjacency));
+                deletions.push_back(open_deletion_bitmap<EdgeDataType>(adj_filename, edata_filename));
+                sliding_shards.back()->set_deletions(deletions.back());
                 if (!only_adjacency) 
                     nedges += sliding_shards[sliding_shards.size() - 1]->num_edges();
             }
             
         }
         
+        /**
+          * Returns the largest number of in- and out-edges of the vertices
+          * of an interval, from the degree file.
+          */
+        size_t max_interval_edges() {
+            size_t maxedges = 0;
+            for(int p=0; p < nshards; p++) {
+                degree_handler->load(intervals[p].first, intervals[p].second);
+                size_t num_edges = 0;
+                for(vid_t v=intervals[p].first; v <= intervals[p].second; v++) {
+                    degree d = degree_handler->get_degree(v);
+                    num_edges += d.indegree + d.outdegree;
+                }
+                maxedges = std::max(maxedges, num_edges);
+            }
+            return maxedges;
+        }
+        
+        /**
+          * Decides whether the graph is kept in memory. Configuration parameter
+          * 'inmemory' can be "auto" (default; in-memory if the graph fits in the
+          * memory budget), "1" or "0".
+          */
+        virtual bool use_inmemory_mode() {
+            std::string inmemory = get_option_string("inmemory", "auto");
+            if (inmemory == "0" || disable_inmemory_mode()) return false;
+            if (inmemory != "auto") return true;
+            
+            /* The adjacency files are freed after loading, before the edges of an interval
+               are copied for the updates (see init_vertices_inmemory()). */
+            size_t memreq = inmemgraph_t::estimate_memory(base_filename, nshards, num_vertices()) + 
+                        num_vertices() * (sizeof(VertexDataType) + sizeof(svertex_t)) +
+                        std::max(inmemgraph_t::estimate_load_memory(base_filename, nshards, num_vertices()),
+                                 max_interval_edges() * sizeof(graphchi_edge<EdgeDataType>));
+            logstream(LOG_INFO) << "Memory required for in-memory mode: " << (memreq / 1024 / 1024) << " MB." << std::endl;
+            return memreq <= (size_t)membudget_mb * 1024 * 1024;
+        }
+        
+        virtual void initialize_inmemory_graph() {
+            assert(inmemgraph == NULL);
+            if (!use_inmemory_mode()) return;
+            
+            logstream(LOG_INFO) << "Graph fits in memory, loading all shards into memory." << std::endl;
+            inmemgraph = new inmemgraph_t(iomgr, base_filename, nshards, num_vertices(), only_adjacency, m);
+            inmemgraph->load();
+            
+            /* Vertex values are kept in memory for the whole run */
+            vertex_data_handler->load(0, (vid_t) (num_vertices() - 1));
+            m.set("inmemory", (size_t)1);
+        }
+        
         virtual void initialize_scheduler() {
             if (use_selective_scheduling) {
-                scheduler = new bitset_scheduler((int) num_vertices());
+                scheduler = new bitset_scheduler(num_vertices());
                 scheduler->add_task_to_all();
             } else {
                 scheduler = NULL;
@@ -263,8 +376,8 @@ namespace graphchi {
             degree_handler->load(fromvid, maxvid);
             
             size_t memreq = 0;
-            int max_interval = maxvid - fromvid;
-            for(int i=0; i < max_interval; i++) {
+            size_t max_interval = (size_t) (maxvid - fromvid);
+            for(size_t i=0; i < max_interval; i++) {
                 degree deg = degree_handler->get_degree(fromvid + i);
                 int inc = deg.indegree;
                 int outc = deg.outdegree;
@@ -346,7 +459,7 @@ namespace graphchi {
 #pragma omp section
                 {
 #pragma omp parallel for schedule(dynamic)
-                    for(int vid=sub_interval_st; vid <= (int)sub_interval_en; vid++) {
+                    for(vid_t vid=sub_interval_st; vid <= sub_interval_en; vid++) {
                         svertex_t & v = vertices[vid - sub_interval_st];
                         
                         if (exec_threads == 1 || v.parallel_safe) {
@@ -360,7 +473,7 @@ namespace graphchi {
                 {
                     if (exec_threads > 1 && enable_deterministic_parallelism) {
                         int nonsafe_count = 0;
-                        for(int vid=sub_interval_st; vid <= (int)sub_interval_en; vid++) {
+                        for(vid_t vid=sub_interval_st; vid <= sub_interval_en; vid++) {
                             svertex_t & v = vertices[vid - sub_interval_st];
                             if (!v.parallel_safe && v.scheduled) {
                                 v.dataptr = vertex_data_handler->vertex_data_ptr(vid);
@@ -410,6 +523,97 @@ namespace graphchi {
         }
         
         
+        /**
+          * Initializes vertices from the in-memory graph. The edges of scheduled 
+          * vertices are copied to a buffer, so that the update functions may reorder
+          * them (see sort_edges_indirect()) as with the shards.
+          */
+        void init_vertices_inmemory(std::vector<svertex_t> &vertices, graphchi_edge<EdgeDataType> * &edata) {
+            int nvertices = (int) vertices.size();
+            
+            size_t num_edges = 0;
+            for(int i=0; i < nvertices; i++) {
+                vid_t vid = sub_interval_st + i;
+                if (scheduler == NULL || scheduler->is_scheduled(vid)) {
+                    num_edges += inmemgraph->num_inedges(vid) + inmemgraph->num_outedges(vid);
+                }
+            }
+            edata = (graphchi_edge<EdgeDataType>*) malloc(num_edges * sizeof(graphchi_edge<EdgeDataType>));
+            
+            size_t ecounter = 0;
+            for(int i=0; i < nvertices; i++) {
+                vid_t vid = sub_interval_st + i;
+                int inc = inmemgraph->num_inedges(vid);
+                int outc = inmemgraph->num_outedges(vid);
+                vertices[i] = svertex_t(vid, &edata[ecounter], &edata[ecounter + inc], inc, outc);
+                if (scheduler == NULL || scheduler->is_scheduled(vid)) {
+                    memcpy(&edata[ecounter], inmemgraph->vertex_edges(vid), (inc + outc) * sizeof(graphchi_edge<EdgeDataType>));
+                    vertices[i].inc = inc;
+                    vertices[i].outc = outc;
+                    vertices[i].scheduled = true;
+                    nupdates++;
+                    ecounter += inc + outc;
+                }
+            }
+            work += ecounter;
+            
+            /* Vertices that share an edge cannot be updated in parallel */
+            for(int i=0; i < nvertices; i++) {
+                svertex_t &v = vertices[i];
+                if (!v.scheduled) continue;
+                for(int j=0; j < v.outc; j++) {
+                    vid_t dst = v.outedge(j)->vertexid;
+                    if (dst >= sub_interval_st && dst <= sub_interval_en && vertices[dst - sub_interval_st].scheduled) {
+                        v.parallel_safe = false;
+                        vertices[dst - sub_interval_st].parallel_safe = false;
+                    }
+                }
+            }
+        }
+        
+        /**
+          * Executes the updates of an interval using the in-memory graph. 
+          * The whole interval is executed as one sub-interval.
+          */
+        void exec_interval_inmemory(GraphChiProgram<VertexDataType, EdgeDataType, svertex_t> &userprogram,
+                                    vid_t interval_st, vid_t interval_en) {
+            sub_interval_st = interval_st;
+            sub_interval_en = interval_en;
+            logstream(LOG_INFO) << "Iteration " << iter << "/" << (niters - 1) << ", in-memory interval: " << sub_interval_st << " - " << sub_interval_en << std::endl;
+            
+            if (!is_any_vertex_scheduled(sub_interval_st, sub_interval_en)) {
+                logstream(LOG_INFO) << "No vertices scheduled, skip." << std::endl;
+                return;
+            }
+            
+            int nvertices = sub_interval_en - sub_interval_st + 1;
+            graphchi_edge<EdgeDataType> * edata = NULL;
+            std::vector<svertex_t> vertices(nvertices, svertex_t());
+            init_vertices_inmemory(vertices, edata);
+            
+            /* Now clear scheduler bits for the interval */
+            if (scheduler != NULL)
+                scheduler->remove_tasks(sub_interval_st, sub_interval_en);
+            
+            exec_updates(userprogram, vertices);
+            
+            if (edata != NULL) {
+                free(edata);
+                edata = NULL;
+            }
+        }
+        
+        /**
+          * Writes the vertex values and edge data of the in-memory graph to disk.
+          */
+        virtual void commit_inmemory_graph() {
+            logstream(LOG_INFO) << "Writing in-memory graph to disk." << std::endl;
+            vertex_data_handler->save();
+            if (modifies_inedges || modifies_outedges) {
+                inmemgraph->commit();
+            }
+        }
+        
         void save_vertices(std::vector<svertex_t> &vertices) {
             size_t nvertices = vertices.size();
             bool modified_any_vertex = false;
@@ -539,6 +743,7 @@ namespace graphchi {
             /* Setup */
             initialize_sliding_shards();
             initialize_scheduler();
+            initialize_inmemory_graph();
             omp_set_nested(1);
             
             /* Print configuration */
@@ -585,6 +790,12 @@ namespace graphchi {
                     vid_t interval_en = get_interval_end(exec_interval);
                     
                     userprogram.before_exec_interval(interval_st, interval_en, chicontext);
+                    
+                    if (inmemgraph != NULL) {
+                        exec_interval_inmemory(userprogram, interval_st, interval_en);
+                        userprogram.after_exec_interval(interval_st, interval_en, chicontext);
+                        continue;
+                    }
 
                     /* Flush stream shard for the exec interval */
                     sliding_shards[exec_interval]->flush();
@@ -594,12 +805,19 @@ namespace graphchi {
                     if (memoryshard != NULL) delete memoryshard;
                     memoryshard = create_memshard(interval_st, interval_en);
                     memoryshard->only_adjacency = only_adjacency;
+                    memoryshard->set_deletions(deletions[exec_interval]);
                     
                     
                     sub_interval_st = interval_st;
                     logstream(LOG_INFO) << chicontext.runtime() << "s: Starting: " 
                         << sub_interval_st << " -- " << interval_en << std::endl;
                     
+                    /* Skip the whole interval if none of its vertices is scheduled */
+                    if (!is_any_vertex_scheduled(interval_st, interval_en)) {
+                        logstream(LOG_INFO) << "No vertices scheduled in the interval, skip." << std::endl;
+                        sub_interval_st = interval_en;
+                    }
+                    
                     while (sub_interval_st < interval_en) {
                         /* Determine the sub interval */
                         sub_interval_en = determine_next_window(exec_interval,
@@ -628,7 +846,10 @@ namespace graphchi {
                             scheduler->remove_tasks(sub_interval_st, sub_interval_en);
                         
                         /* Load data */
-                        load_before_updates(vertices);                        
+                        metrics_entry mload = m.start_time();
+                        load_before_updates(vertices);
+                        mload.timer_stop();
+                        m.add_vector_entry("interval.loadtime", exec_interval, mload.lasttime);
                         
                         
                         logstream(LOG_INFO) << "Start updates" << std::endl;
@@ -661,6 +882,7 @@ namespace graphchi {
                         delete memoryshard;
                         memoryshard = NULL;
                     }     
+                    interval_finished();
                    
                     userprogram.after_exec_interval(interval_st, interval_en, chicontext);
                 } // For exec_interval
@@ -675,6 +897,13 @@ namespace graphchi {
                     sliding_shards[p]->set_offset(0, 0, 0);
                 }
                 iomgr->wait_for_writes();
+                save_deletions();
+                
+                if (snapshot_interval > 0 && (iter + 1) % snapshot_interval == 0) {
+                    m.start_time("snapshot");
+                    vertex_data_handler->publish_snapshot(iter, num_vertices());
+                    m.stop_time("snapshot");
+                }
                 
                 /* Write progress log */
                 write_delta_log();
@@ -687,9 +916,22 @@ namespace graphchi {
                 iteration_finished();
             } // Iterations
             
+            if (inmemgraph != NULL) {
+                commit_inmemory_graph();
+            } else {
+                report_interval_costs();
+            }
+            run_finished();
+            
             // Commit preloaded shards
             iomgr->commit_preloaded();
             
+            /* If the graph was reordered, write the results also in the original vertex order */
+            if (is_reordered_graph(base_filename)) {
+                iomgr->wait_for_writes();
+                write_vertex_data_in_original_order<VertexDataType>(base_filename);
+            }
+            
             m.stop_time("runtime");
 
             m.set("updates", nupdates);
@@ -705,6 +947,30 @@ namespace graphchi {
         virtual void iteration_finished() {
             // Do nothing
         }
+        
+        /**
+         * Writes the deletion bitmaps of the shards where edges were
+         * removed during the iteration.
+         */
+        virtual void save_deletions() {
+            for(int p=0; p < (int)deletions.size(); p++) {
+                if (deletions[p] != NULL) deletions[p]->save();
+            }
+        }
+        
+        /**
+         * Called after the memory shard of the execution interval has been committed.
+         */
+        virtual void interval_finished() {
+            // Do nothing
+        }
+        
+        /**
+         * Called after the last iteration.
+         */
+        virtual void run_finished() {
+            // Do nothing
+        }
        
         stripedio * get_iomanager() {
             return iomgr;
@@ -757,6 +1023,15 @@ namespace graphchi {
             enable_deterministic_parallelism = b;
         }
         
+        /**
+         * Publishes a snapshot of the vertex values after every
+         * n iterations, for reading with vertex_snapshot while the
+         * engine runs. Default 0 (no snapshots).
+         */
+        void set_snapshot_interval(int n) {
+            snapshot_interval = n;
+        }
+        
     protected:
         
         /** 
@@ -51,6 +51,7 @@
 #include "metrics/reps/file_reporter.hpp"
 #include "metrics/reps/html_reporter.hpp"
 #include "preprocessing/conversions.hpp"
+#include "preprocessing/reordering.hpp"
 #include "util/cmdopts.hpp"
 
 
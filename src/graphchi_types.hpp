@@ -23,7 +23,15 @@
 
 namespace graphchi {
     
+    /**
+      * Vertex id type. Compile with GRAPHCHI_VID64 (make VID64=1) for
+      * graphs with more than 2^31 vertices.
+      */
+#ifdef GRAPHCHI_VID64
+    typedef uint64_t vid_t;
+#else
     typedef uint32_t vid_t;
+#endif
     
     
     /** 
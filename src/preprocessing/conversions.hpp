@@ -30,10 +30,15 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits>
 
 #include "graphchi_types.hpp"
 #include "logger/logger.hpp"
 #include "preprocessing/sharder.hpp"
+#include "preprocessing/relabel.hpp"
+#include "preprocessing/textparser.hpp"
 
 /**
   * GNU COMPILER HACK TO PREVENT WARNINGS "Unused variable", if 
@@ -56,7 +61,6 @@ namespace graphchi {
     static void VARIABLE_IS_NOT_USED parse(bool &x, const char * s);
     static void VARIABLE_IS_NOT_USED parse(double &x, const char * s);
     static void VARIABLE_IS_NOT_USED parse(short &x, const char * s);
-    static void FIXLINE(char * s);
     
     static void parse(int &x, const char * s) {
         x = atoi(s);//将字符串转化为整数
@@ -110,99 +114,321 @@ namespace graphchi {
     
     
     
-    // Removes \n from the end of line
-    void FIXLINE(char * s) {
-        int len = (int) strlen(s)-1; 	  
-        if(s[len] == '\n') s[len] = 0;
-    }
-    
-    
     /**
-     * Converts graph from an edge list format. Input may contain
-     * value for the edges. Self-edges are ignored.
+     * Parses chunks of an edge list file, see convert_edgelist().
      */
     template <typename EdgeDataType>
-    void convert_edgelist(std::string inputfile, sharder<EdgeDataType> &sharderobj) {
-        FILE * inf = fopen(inputfile.c_str(), "r");
+    struct edgelist_chunk_parser {
+        typedef edge_with_value<EdgeDataType> edge_t;
+        sharder<EdgeDataType> &sharderobj;
         
-        if (inf == NULL) {
-            logstream(LOG_FATAL) << "Could not load :" << inputfile << " error: " << strerror(errno) << std::endl;
+        edgelist_chunk_parser(sharder<EdgeDataType> &sharderobj) : sharderobj(sharderobj) {}
+        
+        void parse_chunk(const char * p, const char * end, std::vector<edge_t> &edges) {
+            char valbuf[256];
+            while (p < end) {
+                const char * eol = next_line(p, end);
+                if (*p != '#' && *p != '%') { // Comment
+                    vid_t from, to;
+                    const char * st = skip_delims(p, eol);
+                    const char * q = scan_vid(st, eol, from);
+                    if (q != st) {
+                        st = skip_delims(q, eol);
+                        q = scan_vid(st, eol, to);
+                        if (q != st) {
+                            /* Check if has value */
+                            EdgeDataType val = EdgeDataType();
+                            if (scan_field(q, eol, valbuf, sizeof(valbuf))) {
+                                parse(val, (const char*) valbuf);
+                            }
+                            edges.push_back(edge_t(from, to, val));
+                        }
+                    }
+                }
+                p = eol;
+            }
         }
-        assert(inf != NULL);
         
-        logstream(LOG_INFO) << "Reading in edge list format!" << std::endl;
-        char s[1024];
-        while(fgets(s, 1024, inf) != NULL) {
-            FIXLINE(s);
-            if (s[0] == '#') continue; // Comment
-            if (s[0] == '%') continue; // Comment
-            
-            char delims[] = "\t ";	
-            char * t;
-            t = strtok(s, delims);
-            vid_t from = atoi(t);
-            t = strtok(NULL, delims);
-            vid_t to = atoi(t);
-            
-            /* Check if has value */
-            t = strtok(NULL, delims);
-            EdgeDataType val;
-            if (t != NULL) {
-                parse(val, (const char*) t);
-            } else {
-                val = EdgeDataType();
+        void flush(std::vector<edge_t> &edges) {
+            sharderobj.preprocessing_add_edges(edges);
+        }
+    };
+    
+    /**
+     * Parses chunks of an adjacency list file, see convert_adjlist().
+     */
+    template <typename EdgeDataType>
+    struct adjlist_chunk_parser {
+        typedef edge_with_value<EdgeDataType> edge_t;
+        sharder<EdgeDataType> &sharderobj;
+        
+        adjlist_chunk_parser(sharder<EdgeDataType> &sharderobj) : sharderobj(sharderobj) {}
+        
+        void parse_chunk(const char * p, const char * end, std::vector<edge_t> &edges) {
+            while (p < end) {
+                const char * eol = next_line(p, end);
+                if (*p != '#' && *p != '%') { // Comment
+                    vid_t from, num, to;
+                    const char * st = skip_delims(p, eol);
+                    const char * q = scan_vid(st, eol, from);
+                    st = skip_delims(q, eol);
+                    q = scan_vid(st, eol, num);
+                    if (q != st) {
+                        vid_t i = 0;
+                        while (true) {
+                            st = skip_delims(q, eol);
+                            q = scan_vid(st, eol, to);
+                            if (q == st) break;
+                            edges.push_back(edge_t(from, to, EdgeDataType()));
+                            i++;
+                        }
+                        if (num != i)
+                            logstream(LOG_ERROR) << "Mismatch when reading adjacency list: " << num << " != " << i 
+                                << " for vertex: " << from << std::endl;
+                        assert(num == i);
+                    }
+                }
+                p = eol;
             }
-            if (from != to) {
-                sharderobj.preprocessing_add_edge(from, to, val);
+        }
+        
+        void flush(std::vector<edge_t> &edges) {
+            sharderobj.preprocessing_add_edges(edges);
+        }
+    };
+    
+    /**
+     * Parses chunks of the entries of a MatrixMarket coordinate file, see 
+     * convert_matrixmarket().
+     */
+    template <typename EdgeDataType>
+    struct matrixmarket_chunk_parser {
+        typedef edge_with_value<EdgeDataType> edge_t;
+        sharder<EdgeDataType> &sharderobj;
+        vid_t coloffset;
+        bool symmetric;
+        bool pattern;
+        
+        matrixmarket_chunk_parser(sharder<EdgeDataType> &sharderobj, vid_t coloffset, bool symmetric, bool pattern) : 
+            sharderobj(sharderobj), coloffset(coloffset), symmetric(symmetric), pattern(pattern) {}
+        
+        void parse_chunk(const char * p, const char * end, std::vector<edge_t> &edges) {
+            char valbuf[256];
+            while (p < end) {
+                const char * eol = next_line(p, end);
+                if (*p != '%') { // Comment
+                    vid_t row, col;
+                    const char * st = skip_delims(p, eol);
+                    const char * q = scan_vid(st, eol, row);
+                    if (q != st) {
+                        st = skip_delims(q, eol);
+                        q = scan_vid(st, eol, col);
+                        if (q != st) {
+                            if (row == 0 || col == 0) {
+                                logstream(LOG_ERROR) << "MatrixMarket indices start from 1, found: " << row << " " << col << std::endl;
+                                assert(false);
+                            }
+                            EdgeDataType val = EdgeDataType();
+                            if (!pattern && scan_field(q, eol, valbuf, sizeof(valbuf))) {
+                                parse(val, (const char*) valbuf);
+                            }
+                            /* Adjust from 1-based to 0-based */
+                            vid_t from = row - 1, to = coloffset + col - 1;
+                            edges.push_back(edge_t(from, to, val));
+                            if (symmetric && row != col) {
+                                edges.push_back(edge_t(col - 1, coloffset + row - 1, val));
+                            }
+                        }
+                    }
+                }
+                p = eol;
             }
         }
-        fclose(inf);
+        
+        void flush(std::vector<edge_t> &edges) {
+            sharderobj.preprocessing_add_edges(edges);
+        }
+    };
+    
+    /**
+     * Parses a text file with the chunk parser. Gzipped files are
+     * decompressed on the fly.
+     */
+    template <typename EdgeDataType, class ChunkParser>
+    void parse_text_input(std::string inputfile, ChunkParser &parser) {
+        int nthreads = get_option_int("execthreads", omp_get_max_threads());
+        if (is_gzipped(inputfile)) {
+            logstream(LOG_INFO) << "Input is gzip-compressed." << std::endl;
+            pid_t gzpid;
+            FILE * f = open_text_input(inputfile, true, gzpid);
+            parse_text_stream<edge_with_value<EdgeDataType> >(f, parser, nthreads);
+            close_text_input(f, gzpid);
+        } else {
+            parse_text_parallel<edge_with_value<EdgeDataType> >(inputfile, parser, nthreads);
+        }
+    }
+    
+    /**
+     * Converts graph from an edge list format. Input may contain
+     * value for the edges. Self-edges are ignored.
+     * The file is memory-mapped and parsed in parallel.
+     */
+    template <typename EdgeDataType>
+    void convert_edgelist(std::string inputfile, sharder<EdgeDataType> &sharderobj) {
+        logstream(LOG_INFO) << "Reading in edge list format!" << std::endl;
+        edgelist_chunk_parser<EdgeDataType> parser(sharderobj);
+        parse_text_input<EdgeDataType>(inputfile, parser);
     }
     
     /**
      * Converts a graph from adjacency list format. Edge values are not supported,
      * and each edge gets the default value for the type. Self-edges are ignored.
+     * The file is memory-mapped and parsed in parallel.
      */
     template <typename EdgeDataType>
     void convert_adjlist(std::string inputfile, sharder<EdgeDataType> &sharderobj) {
-        FILE * inf = fopen(inputfile.c_str(), "r");
-        if (inf == NULL) {
-            logstream(LOG_FATAL) << "Could not load :" << inputfile << " error: " << strerror(errno) << std::endl;
-        }
-        assert(inf != NULL);
         logstream(LOG_INFO) << "Reading in adjacency list format!" << std::endl;
+        adjlist_chunk_parser<EdgeDataType> parser(sharderobj);
+        parse_text_input<EdgeDataType>(inputfile, parser);
+    }
+    
+    /**
+     * Converts a sparse matrix in MatrixMarket coordinate format. Entry (i,j) 
+     * becomes edge i-1 -> j-1. If configuration parameter 'matrixmarket.bipartite' 
+     * is 1, columns get ids after the rows, i.e edge is i-1 -> M+j-1 as in the ALS 
+     * application. For symmetric matrices both directions are added.
+     */
+    template <typename EdgeDataType>
+    void convert_matrixmarket(std::string inputfile, sharder<EdgeDataType> &sharderobj) {
+        logstream(LOG_INFO) << "Reading in MatrixMarket format!" << std::endl;
+        bool gzipped = is_gzipped(inputfile);
+        pid_t gzpid;
+        FILE * f = open_text_input(inputfile, gzipped, gzpid);
+        
+        /* Banner */
+        char * line = NULL;
+        size_t linecap = 0;
+        ssize_t len = getline(&line, &linecap, f);
+        std::string banner = (len > 0 ? std::string(line) : "");
+        for(size_t i=0; i < banner.size(); i++) banner[i] = (char) tolower(banner[i]);
+        if (banner.find("%%matrixmarket") != 0 || banner.find("coordinate") == std::string::npos) {
+            logstream(LOG_FATAL) << "Input must be a MatrixMarket coordinate file. Banner: " << banner << std::endl;
+            assert(false);
+        }
+        if (banner.find("complex") != std::string::npos) {
+            logstream(LOG_FATAL) << "Complex matrices are not supported." << std::endl;
+            assert(false);
+        }
+        bool pattern = banner.find("pattern") != std::string::npos;
+        bool symmetric = banner.find("symmetric") != std::string::npos || banner.find("hermitian") != std::string::npos;
         
-        int maxlen = 100000000;
-        char * s = (char*) malloc(maxlen); 
+        /* Size line follows the comments */
+        unsigned long rows = 0, cols = 0, nnz = 0;
+        while ((len = getline(&line, &linecap, f)) > 0) {
+            if (line[0] == '%') continue;
+            if (sscanf(line, "%lu %lu %lu", &rows, &cols, &nnz) == 3) break;
+        }
+        free(line);
+        logstream(LOG_INFO) << "Matrix dimensions: " << rows << " x " << cols << ", non-zeros: " << nnz 
+            << (symmetric ? " (symmetric)" : "") << std::endl;
         
-        char delims[] = " \t";
-        size_t linenum = 0;
-        /*** PHASE 1 - count ***/
-        while(fgets(s, maxlen, inf) != NULL) {
-            linenum++;
-            FIXLINE(s);
-            if (s[0] == '#') continue; // Comment
-            if (s[0] == '%') continue; // Comment
-            char * t = strtok(s, delims);
-            vid_t from = atoi(t);
-            t = strtok(NULL,delims);
-            if (t != NULL) {
-                vid_t num = atoi(t);
-                vid_t i = 0;
-                while((t = strtok(NULL,delims)) != NULL) {
-                    vid_t to = atoi(t);
-                    if (from != to) {
-                        sharderobj.preprocessing_add_edge(from, to, EdgeDataType());
-                    }
-                    i++;
+        vid_t coloffset = (get_option_int("matrixmarket.bipartite", 0) == 1 ? (vid_t) rows : 0);
+        matrixmarket_chunk_parser<EdgeDataType> parser(sharderobj, coloffset, symmetric, pattern);
+        int nthreads = get_option_int("execthreads", omp_get_max_threads());
+        if (gzipped) {
+            parse_text_stream<edge_with_value<EdgeDataType> >(f, parser, nthreads);
+            close_text_input(f, gzpid);
+        } else {
+            size_t dataoffset = (size_t) ftell(f);
+            close_text_input(f, gzpid);
+            parse_text_parallel<edge_with_value<EdgeDataType> >(inputfile, parser, nthreads, dataoffset);
+        }
+    }
+    
+    inline uint64_t read_binary_id(const char * ptr, int idbytes) {
+        if (idbytes == 4) {
+            uint32_t x;
+            memcpy(&x, ptr, sizeof(uint32_t));
+            return x;
+        } else {
+            uint64_t x;
+            memcpy(&x, ptr, sizeof(uint64_t));
+            return x;
+        }
+    }
+    
+    /**
+     * Converts a binary edge list: array of records (src, dst[, value]) in native
+     * byte order. Configuration parameter 'binedgelist.idbytes' (4 or 8) is the width
+     * of the vertex ids, and if 'binedgelist.values' is 1, each record has the edge value
+     * as sizeof(EdgeDataType) bytes. Self-edges are ignored.
+     */
+    template <typename EdgeDataType>
+    void convert_binedgelist(std::string inputfile, sharder<EdgeDataType> &sharderobj) {
+        typedef edge_with_value<EdgeDataType> edge_t;
+        int idbytes = get_option_int("binedgelist.idbytes", 4);
+        bool hasvalues = get_option_int("binedgelist.values", 0) == 1;
+        if (idbytes != 4 && idbytes != 8) {
+            logstream(LOG_FATAL) << "binedgelist.idbytes must be 4 or 8, was: " << idbytes << std::endl;
+            assert(false);
+        }
+        size_t recsize = 2 * idbytes + (hasvalues ? sizeof(EdgeDataType) : 0);
+        logstream(LOG_INFO) << "Reading in binary edge list format, record size: " << recsize << " bytes." << std::endl;
+        
+        int f = open(inputfile.c_str(), O_RDONLY);
+        if (f < 0) {
+            logstream(LOG_FATAL) << "Could not load :" << inputfile << " error: " << strerror(errno) << std::endl;
+        }
+        assert(f >= 0);
+        size_t filesize = get_filesize(inputfile);
+        if (filesize % recsize != 0) {
+            logstream(LOG_WARNING) << "File size is not a multiple of the record size, ignoring last " << (filesize % recsize) << " bytes." << std::endl;
+        }
+        size_t nrecs = filesize / recsize;
+        size_t blockrecs = TEXTPARSER_CHUNKSIZE / recsize;
+        char * block = (char*) malloc(blockrecs * recsize);
+        assert(block != NULL);
+        std::vector<edge_t> edges;
+        edges.reserve(blockrecs);
+        
+        for(size_t r=0; r < nrecs; r += blockrecs) {
+            size_t n = std::min(blockrecs, nrecs - r);
+            preada(f, block, n * recsize, r * recsize);
+            for(size_t i=0; i < n; i++) {
+                const char * rec = block + i * recsize;
+                uint64_t from = read_binary_id(rec, idbytes);
+                uint64_t to = read_binary_id(rec + idbytes, idbytes);
+                if (from > std::numeric_limits<vid_t>::max() || to > std::numeric_limits<vid_t>::max()) {
+                    logstream(LOG_FATAL) << "Vertex id too large: " << from << " -> " << to << std::endl;
+                    assert(false);
+                }
+                EdgeDataType val = EdgeDataType();
+                if (hasvalues) {
+                    memcpy(&val, rec + 2 * idbytes, sizeof(EdgeDataType));
                 }
-                if (num != i)
-                    logstream(LOG_ERROR) << "Mismatch when reading adjacency list: " << num << " != " << i << " s: " << std::string(s)
-                    << " on line: " << linenum << std::endl;
-                assert(num == i);
+                edges.push_back(edge_t((vid_t) from, (vid_t) to, val));
             }
+            sharderobj.preprocessing_add_edges(edges);
+            edges.clear();
+        }
+        free(block);
+        close(f);
+    }
+    
+    /**
+     * Reads the input in the given format to the sharder.
+     */
+    template <typename EdgeDataType>
+    void convert_input(std::string file_type_str, std::string inputfile, sharder<EdgeDataType> &sharderobj) {
+        if (file_type_str == "adjlist") {
+            convert_adjlist<EdgeDataType>(inputfile, sharderobj);
+        } else if (file_type_str == "edgelist") {
+            convert_edgelist<EdgeDataType>(inputfile, sharderobj);
+        } else if (file_type_str == "matrixmarket") {
+            convert_matrixmarket<EdgeDataType>(inputfile, sharderobj);
+        } else if (file_type_str == "binedgelist") {
+            convert_binedgelist<EdgeDataType>(inputfile, sharderobj);
         }
-        free(s);
     }
     
     
@@ -231,29 +457,52 @@ namespace graphchi {
         }
         sharder<EdgeDataType> sharderobj(basefilename + suffix);
         
-        if (!sharderobj.preprocessed_file_exists()) {
-            std::string file_type_str = get_option_string_interactive("filetype", "edgelist, adjlist");
-            if (file_type_str != "adjlist" && file_type_str != "edgelist") {
-                logstream(LOG_ERROR) << "You need to specify filetype: 'edgelist' or 'adjlist'." << std::endl;
+        /* Sparse vertex ids can be compacted to a dense range. */
+        bool compact = get_option_int("sharder.compactids", 0) == 1;
+        
+        /* In streaming mode, edges are shoveled directly without the preprocessed file */
+        bool streaming = get_option_int("sharder.streaming", 0) == 1 && preprocessor == NULL && !compact;
+        
+        if (streaming || !sharderobj.preprocessed_file_exists()) {
+            std::string file_type_str = get_option_string_interactive("filetype", "edgelist, adjlist, matrixmarket, binedgelist");
+            if (file_type_str != "adjlist" && file_type_str != "edgelist" && 
+                file_type_str != "matrixmarket" && file_type_str != "binedgelist") {
+                logstream(LOG_ERROR) << "You need to specify filetype: 'edgelist', 'adjlist', 'matrixmarket' or 'binedgelist'." << std::endl;
                 assert(false);
             }
             
             /* Start preprocessing */
-            sharderobj.start_preprocessing();
-            
-            if (file_type_str == "adjlist") {
-                convert_adjlist<EdgeDataType>(basefilename, sharderobj);
-            } else if (file_type_str == "edgelist") {
-                convert_edgelist<EdgeDataType>(basefilename, sharderobj);
+            if (streaming) {
+                sharderobj.start_streaming();
+            } else {
+                sharderobj.start_preprocessing();
             }
             
+            convert_input<EdgeDataType>(file_type_str, basefilename, sharderobj);
+            
             /* Finish preprocessing */
-            sharderobj.end_preprocessing();
+            if (streaming) {
+                sharderobj.end_streaming();
+            } else {
+                sharderobj.end_preprocessing();
+            }
+            
+            if (compact) {
+                compact_vertex_ids<EdgeDataType>(sharderobj.preprocessed_name(), basefilename + suffix,
+                                                 get_option_int("execthreads", omp_get_max_threads()));
+            } else {
+                remove(filename_vertex_dictionary(basefilename + suffix).c_str());
+            }
             
             if (preprocessor != NULL) {
                 preprocessor->reprocess(sharderobj.preprocessed_name(), basefilename);
             }
             
+            /* Vertex ids may have changed, so the counts are not valid */
+            if (compact || preprocessor != NULL) {
+                remove(sharderobj.preprocessed_counts_name().c_str());
+            }
+            
         }
         
         int nshards = sharderobj.execute_sharding(nshards_string);
@@ -282,154 +531,6 @@ namespace graphchi {
         return nshards;
     }
     
-    /** 
-     * Special machinery for reordering vertices by 
-     * their degree, i.e setting their vertex ids to be in the order
-     * of vertex degree. This is used at least by the Triangle counting application.
-     */
-    
-    struct vertex_degree {
-        int deg;
-        vid_t id;
-        vertex_degree() {}
-        vertex_degree(int deg, vid_t id) : deg(deg), id(id) {}
-    };
-    
-    bool vertex_degree_less(const vertex_degree &a, const vertex_degree &b);
-    bool vertex_degree_less(const vertex_degree &a, const vertex_degree &b) {
-        return a.deg < b.deg || (a.deg == b.deg && a.id < b.id);
-    }
-    
-    /** 
-      * Special preprocessor which relabels vertices in ascending order
-      * of their degree.
-      */
-    template <typename EdgeDataType>
-    class OrderByDegree : public SharderPreprocessor<EdgeDataType> {
-        
-    public:
-        typedef edge_with_value<EdgeDataType> edge_t;
-        vid_t * translate_table;
-        vid_t max_vertex_id;
-        
-        std::string getSuffix() {
-            return "_degord";
-        }
-        
-        vid_t translate(vid_t vid) {
-            if (vid >= max_vertex_id) return vid;
-            return translate_table[vid];
-        }
-        
-        void reprocess(std::string preprocessedFile, std::string baseFilename) {
-            size_t blocksize = 32 * 1024 * 1024;
-            while (blocksize % sizeof(edge_t)) blocksize++;
-            
-            char * block = (char*) malloc(blocksize);
-            size_t total_to_process = get_filesize(preprocessedFile);
-            
-            FILE * inf = fopen(preprocessedFile.c_str(), "r");
-            if (inf == NULL) {
-                logstream(LOG_ERROR) << "Could not open: " << preprocessedFile << " error: " << strerror(errno) << std::endl;
-            }
-            assert(inf != NULL);
-            fread(&max_vertex_id, sizeof(vid_t), 1, inf);;
-            vertex_degree * degarray = (vertex_degree *) calloc(max_vertex_id + 1, sizeof(vertex_degree));        
-            vid_t nverts = max_vertex_id + 1;
-            for(vid_t i=0; i < nverts; i++) {
-                degarray[i].id = i;
-            }
-            
-            size_t totread = 0;
-            do {
-                size_t len = 0;
-                while(len < blocksize) {
-                    int a = (int) fread(block + len, 1, blocksize - len, inf);
-                    len += a;
-                    if (a <= 0) break; // eof
-                }
-                totread += len;
-                
-                logstream(LOG_DEBUG) << "Degree ordering -- read:"  << (totread * 1.0 / total_to_process * 100) << "%" << std::endl;
-                len /= sizeof(edge_t);
-                edge_t * ptr = (edge_t*)block;      
-                
-                for(int i=0; i<(int)len; i++) {
-                    degarray[ptr[i].src].deg++;
-                    degarray[ptr[i].dst].deg++;         
-                }
-            } while (!feof(inf));
-            fclose(inf);
-            
-            /* Now sort */
-            quickSort(degarray, nverts, vertex_degree_less);
-            
-            /* Create translation table */
-            translate_table = (vid_t*) calloc(sizeof(vid_t), nverts);
-            for(vid_t i=0; i<nverts; i++) {
-                translate_table[degarray[i].id] = i;
-            }
-            delete degarray;
-            
-            /* Write translate table */
-            std::string translate_table_file = baseFilename + ".vertexmap";
-            int df = open(translate_table_file.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-            if (df < 0) logstream(LOG_ERROR) << "Could not write vertex map: " << translate_table_file <<
-                " error: " << strerror(errno) << std::endl;
-            assert(df >= 0);
-            pwrite(df, translate_table, nverts, 0);
-            close(df);
-            
-            /* Now recreate the processed file */
-            std::string tmpfilename = preprocessedFile + ".old";
-            rename(preprocessedFile.c_str(), tmpfilename.c_str());
-            
-            inf = fopen(tmpfilename.c_str(), "r");
-            if (inf == NULL) {
-                logstream(LOG_ERROR) << "Could not open: " << tmpfilename << " error: " << strerror(errno) << std::endl;
-            }
-            assert(inf != NULL);
-            fread(&max_vertex_id, sizeof(vid_t), 1, inf);;
-            
-            FILE * outf = fopen(preprocessedFile.c_str(), "w");
-            if (outf == NULL) {
-                logstream(LOG_ERROR) << "Could not open: " << preprocessedFile << " error: " << strerror(errno) << std::endl;
-            }
-            assert(outf != NULL);
-            fwrite(&max_vertex_id, sizeof(vid_t), 1, outf);
-            
-            totread = 0;
-            do {
-                size_t len = 0;
-                while(len < blocksize) {
-                    int a = (int) fread(block + len, 1, blocksize - len, inf);
-                    len += a;
-                    if (a <= 0) break; // eof
-                }
-                totread += len;
-                
-                logstream(LOG_DEBUG) << "Degree ordering -- write/read:"  << (totread * 1.0 / total_to_process * 100) << "%" << std::endl;
-                len /= sizeof(edge_t);
-                edge_t * ptr = (edge_t*)block;      
-                
-                // Todo: use buffered output
-                for(int i=0; i<(int)len; i++) {
-                    ptr[i].src = translate(ptr[i].src);
-                    ptr[i].dst = translate(ptr[i].dst);
-
-                    fwrite(&ptr[i], sizeof(edge_t), 1, outf);   
-                }
-            } while (!feof(inf));
-           
-            fclose(inf);
-            fclose(outf);
-                           
-            delete translate_table;
-            free(block);
-        }
-        
-    };
-    
 } // end namespace
 
 #endif
@@ -0,0 +1,119 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Combiners for merging the values of duplicate edges in sharding.
+ * A combiner is called as combiner(acc, val) for each duplicate of an
+ * edge, where acc is the value of the first copy of the edge (in the
+ * sorted order) and val the value of the duplicate.
+ *
+ * The built-in combiners are chosen with the configuration option
+ * sharder.duplicates = keep | first | sum | min | max. Sum, min and max
+ * are defined for arithmetic edge types and for PairContainer of those
+ * (element-wise). Other edge types can use sharder::set_duplicate_combiner().
+ */
+
+#ifndef DEF_GRAPHCHI_EDGECOMBINERS
+#define DEF_GRAPHCHI_EDGECOMBINERS
+
+#include <string>
+#include <limits>
+#include <assert.h>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+
+namespace graphchi {
+
+    template <typename EdgeDataType>
+    struct edge_combiner {
+        typedef void (*fn)(EdgeDataType &acc, const EdgeDataType &val);
+    };
+
+    template <typename EdgeDataType>
+    void combine_first(EdgeDataType &acc, const EdgeDataType &val) {}
+
+    /**
+      * Combiners of arithmetic types.
+      */
+    template <typename EdgeDataType, bool arithmetic = std::numeric_limits<EdgeDataType>::is_specialized>
+    struct edge_value_combiners {
+        static void sum(EdgeDataType &acc, const EdgeDataType &val) { acc = (EdgeDataType) (acc + val); }
+        static void min(EdgeDataType &acc, const EdgeDataType &val) { if (val < acc) acc = val; }
+        static void max(EdgeDataType &acc, const EdgeDataType &val) { if (acc < val) acc = val; }
+
+        static bool has_arithmetic() { return true; }
+    };
+
+    /**
+      * Other types have no arithmetic combiners.
+      */
+    template <typename EdgeDataType>
+    struct edge_value_combiners<EdgeDataType, false> {
+        static void sum(EdgeDataType &acc, const EdgeDataType &val) { assert(false); }
+        static void min(EdgeDataType &acc, const EdgeDataType &val) { assert(false); }
+        static void max(EdgeDataType &acc, const EdgeDataType &val) { assert(false); }
+
+        static bool has_arithmetic() { return false; }
+    };
+
+    template <typename T>
+    struct edge_value_combiners<PairContainer<T>, false> {
+        typedef edge_value_combiners<T> elem;
+
+        static void sum(PairContainer<T> &acc, const PairContainer<T> &val) { elem::sum(acc.left, val.left); elem::sum(acc.right, val.right); }
+        static void min(PairContainer<T> &acc, const PairContainer<T> &val) { elem::min(acc.left, val.left); elem::min(acc.right, val.right); }
+        static void max(PairContainer<T> &acc, const PairContainer<T> &val) { elem::max(acc.left, val.left); elem::max(acc.right, val.right); }
+
+        static bool has_arithmetic() { return elem::has_arithmetic(); }
+    };
+
+    /**
+      * Returns the built-in combiner with the given name, or NULL
+      * if duplicate edges are kept.
+      */
+    template <typename EdgeDataType>
+    typename edge_combiner<EdgeDataType>::fn create_edge_combiner(std::string name) {
+        typedef edge_value_combiners<EdgeDataType> combiners;
+        if (name == "" || name == "keep" || name == "none") return NULL;
+        if (name == "first") return &combine_first<EdgeDataType>;
+        if (name == "sum" || name == "min" || name == "max") {
+            if (!combiners::has_arithmetic()) {
+                logstream(LOG_FATAL) << "Duplicate edge combiner '" << name << "' is not defined for the edge data type. "
+                    << "Use sharder::set_duplicate_combiner() instead." << std::endl;
+                assert(false);
+            }
+            if (name == "sum") return &combiners::sum;
+            if (name == "min") return &combiners::min;
+            return &combiners::max;
+        }
+        logstream(LOG_FATAL) << "Unknown duplicate edge combiner: " << name << " (options: keep, first, sum, min, max)" << std::endl;
+        assert(false);
+        return NULL;
+    }
+
+}
+
+#endif
+
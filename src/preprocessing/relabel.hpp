@@ -0,0 +1,231 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Relabeling of vertex ids in the preprocessed edge file (see sharder.hpp),
+ * and compaction of sparse vertex ids to a dense range.
+ *
+ * Compaction builds a dictionary of the vertex ids that appear in the edges,
+ * by sorting the ids of each block of edges and merging the sorted runs.
+ * Vertex i of the compacted graph has the i-th smallest original id. The
+ * dictionary is stored in <graph>.vertexdict, and results are translated
+ * back to the original ids with it (see util/vertexmap.hpp).
+ */
+
+#ifndef DEF_GRAPHCHI_RELABEL
+#define DEF_GRAPHCHI_RELABEL
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "preprocessing/sharder.hpp"
+#include "util/radixsort.hpp"
+#include "util/vertexmap.hpp"
+
+namespace graphchi {
+
+    /**
+      * Reads the edges of a preprocessed file (see sharder::start_preprocessing())
+      * one block at a time.
+      */
+    template <typename EdgeDataType>
+    class preprocessed_edge_reader {
+    public:
+        typedef edge_with_value<EdgeDataType> edge_t;
+
+    private:
+        FILE * inf;
+        edge_t * block;
+        size_t blockedges;
+
+    public:
+        vid_t max_vertex_id;
+
+        preprocessed_edge_reader(std::string filename) {
+            inf = fopen(filename.c_str(), "r");
+            if (inf == NULL) {
+                logstream(LOG_ERROR) << "Could not open: " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(inf != NULL);
+            size_t rd = fread(&max_vertex_id, sizeof(vid_t), 1, inf);
+            assert(rd == 1);
+            blockedges = 32 * 1024 * 1024 / sizeof(edge_t);
+            block = (edge_t *) malloc(blockedges * sizeof(edge_t));
+            assert(block != NULL);
+        }
+
+        ~preprocessed_edge_reader() {
+            fclose(inf);
+            free(block);
+        }
+
+        /**
+          * Reads the next block and returns the number of edges in it,
+          * or zero at the end of the file.
+          */
+        size_t next() {
+            return fread(block, sizeof(edge_t), blockedges, inf);
+        }
+
+        edge_t * edges() {
+            return block;
+        }
+
+    private:
+        // Disable value copying
+        preprocessed_edge_reader(const preprocessed_edge_reader&);
+        preprocessed_edge_reader& operator=(const preprocessed_edge_reader&);
+    };
+
+    /**
+      * Rewrites the preprocessed file with vertex ids translated by
+      * translator(vid). Blocks are translated in parallel and written with
+      * a single write.
+      */
+    template <typename EdgeDataType, class Translator>
+    void relabel_preprocessed_file(std::string preprocessedFile, vid_t new_max_vertex_id,
+                                   const Translator &translator, int nthreads) {
+        typedef edge_with_value<EdgeDataType> edge_t;
+        std::string tmpfilename = preprocessedFile + ".tmp";
+        FILE * outf = fopen(tmpfilename.c_str(), "w");
+        if (outf == NULL) {
+            logstream(LOG_ERROR) << "Could not open: " << tmpfilename << " error: " << strerror(errno) << std::endl;
+        }
+        assert(outf != NULL);
+        fwrite(&new_max_vertex_id, sizeof(vid_t), 1, outf);
+
+        preprocessed_edge_reader<EdgeDataType> reader(preprocessedFile);
+        size_t n;
+        size_t totedges = 0;
+        while ((n = reader.next()) > 0) {
+            edge_t * edges = reader.edges();
+#pragma omp parallel for num_threads(nthreads)
+            for(long long i=0; i < (long long)n; i++) {
+                edges[i].src = translator(edges[i].src);
+                edges[i].dst = translator(edges[i].dst);
+            }
+            size_t written = fwrite(edges, sizeof(edge_t), n, outf);
+            if (written != n) {
+                logstream(LOG_ERROR) << "Could not write: " << tmpfilename << " error: " << strerror(errno) << std::endl;
+                assert(false);
+            }
+            totedges += n;
+        }
+        fclose(outf);
+        rename(tmpfilename.c_str(), preprocessedFile.c_str());
+        logstream(LOG_INFO) << "Relabeled " << totedges << " edges, max vertex id now " << new_max_vertex_id << std::endl;
+    }
+
+    struct vid_identity_key {
+        inline uint64_t operator()(vid_t v) const { return v; }
+    };
+
+    /**
+      * Translates ids with binary search from the sorted dictionary.
+      */
+    struct dictionary_translator {
+        const vid_t * dict;
+        size_t n;
+        dictionary_translator(const vid_t * dict, size_t n) : dict(dict), n(n) {}
+        inline vid_t operator()(vid_t v) const {
+            const vid_t * p = std::lower_bound(dict, dict + n, v);
+            assert(p < dict + n && *p == v);
+            return (vid_t) (p - dict);
+        }
+    };
+
+    /**
+      * Merges the two last sorted runs of unique ids.
+      */
+    static void VARIABLE_IS_NOT_USED merge_last_runs(std::vector<std::vector<vid_t> > &runs) {
+        std::vector<vid_t> &a = runs[runs.size() - 2];
+        std::vector<vid_t> &b = runs[runs.size() - 1];
+        std::vector<vid_t> merged(a.size() + b.size());
+        merged.resize(std::set_union(a.begin(), a.end(), b.begin(), b.end(), merged.begin()) - merged.begin());
+        a.swap(merged);
+        runs.pop_back();
+    }
+
+    /**
+      * Maps the vertex ids of the preprocessed file to the range 0..n-1, where n
+      * is the number of distinct ids in the edges. The relative order of the
+      * vertices is preserved. Returns the number of vertices.
+      */
+    template <typename EdgeDataType>
+    size_t compact_vertex_ids(std::string preprocessedFile, std::string graphname, int nthreads) {
+        typedef edge_with_value<EdgeDataType> edge_t;
+        std::vector<std::vector<vid_t> > runs;  // Sorted runs of unique ids, in decreasing size
+        vid_t max_vertex_id;
+        {
+            preprocessed_edge_reader<EdgeDataType> reader(preprocessedFile);
+            max_vertex_id = reader.max_vertex_id;
+            int keybits = radix_keybits(max_vertex_id);
+            std::vector<vid_t> tmp;
+            size_t n;
+            while ((n = reader.next()) > 0) {
+                edge_t * edges = reader.edges();
+                runs.push_back(std::vector<vid_t>(2 * n));
+                std::vector<vid_t> &ids = runs.back();
+                tmp.resize(2 * n);
+                vid_t * idp = &ids[0];
+#pragma omp parallel for num_threads(nthreads)
+                for(long long i=0; i < (long long)n; i++) {
+                    idp[2 * i] = edges[i].src;
+                    idp[2 * i + 1] = edges[i].dst;
+                }
+                radix_sort(idp, &tmp[0], 2 * n, keybits, vid_identity_key(), nthreads);
+                ids.resize(std::unique(ids.begin(), ids.end()) - ids.begin());
+
+                /* Merge runs of similar size, so that the total cost is O(n log n) */
+                while (runs.size() >= 2 && runs[runs.size() - 2].size() <= 2 * runs.back().size()) {
+                    merge_last_runs(runs);
+                }
+            }
+            while (runs.size() >= 2) {
+                merge_last_runs(runs);
+            }
+        }
+        assert(!runs.empty() && !runs[0].empty());
+        std::vector<vid_t> &dict = runs[0];
+
+        size_t nverts = dict.size();
+        logstream(LOG_INFO) << "Vertex id compaction: " << nverts << " vertices, max id was " << max_vertex_id << std::endl;
+        write_vertex_map(filename_vertex_dictionary(graphname), &dict[0], nverts);
+        relabel_preprocessed_file<EdgeDataType>(preprocessedFile, (vid_t)(nverts - 1),
+                                                dictionary_translator(&dict[0], nverts), nthreads);
+        return nverts;
+    }
+
+} // end namespace
+
+#endif
+
@@ -0,0 +1,479 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Preprocessors that relabel the vertices of the graph before sharding.
+ * A good order places vertices that share edges close to each other, which
+ * reduces conflicts inside an execution window and improves the cache
+ * behavior of the shards. Each preprocessor only computes the new order;
+ * the relabeling of the preprocessed edge file and the vertex id maps are
+ * handled by VertexReordering.
+ *
+ * The maps are stored next to the reordered graph (see util/vertexmap.hpp),
+ * and the engine uses them to write the results also in the original
+ * vertex order.
+ */
+
+#ifndef DEF_GRAPHCHI_REORDERING
+#define DEF_GRAPHCHI_REORDERING
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "preprocessing/conversions.hpp"
+#include "preprocessing/relabel.hpp"
+#include "util/cmdopts.hpp"
+#include "util/radixsort.hpp"
+#include "util/vertexmap.hpp"
+
+namespace graphchi {
+
+    /**
+      * Undirected graph in CSR format, used by the ordering strategies that
+      * need the neighbors of vertices. Self-edges are omitted.
+      */
+    struct reorder_graph {
+        std::vector<size_t> offsets;
+        std::vector<vid_t> nbrs;
+
+        inline size_t degree(vid_t v) const {
+            return offsets[v + 1] - offsets[v];
+        }
+
+        inline const vid_t * neighbors(vid_t v) const {
+            return &nbrs[offsets[v]];
+        }
+    };
+
+    struct vertex_table_translator {
+        const vid_t * table;
+        vertex_table_translator(const vid_t * table) : table(table) {}
+        inline vid_t operator()(vid_t v) const {
+            return table[v];
+        }
+    };
+
+    struct reorder_degree_key {
+        const size_t * deg;
+        size_t maxdeg;
+        bool descending;
+        reorder_degree_key(const size_t * deg, size_t maxdeg, bool descending) : deg(deg), maxdeg(maxdeg), descending(descending) {}
+        inline uint64_t operator()(vid_t v) const {
+            return (uint64_t) (descending ? maxdeg - deg[v] : deg[v]);
+        }
+    };
+
+    struct reorder_degree_less {
+        const reorder_graph &g;
+        reorder_degree_less(const reorder_graph &g) : g(g) {}
+        inline bool operator()(vid_t a, vid_t b) const {
+            size_t da = g.degree(a), db = g.degree(b);
+            return da < db || (da == db && a < b);
+        }
+    };
+
+    /**
+      * Base class for preprocessors that relabel vertices. Subclasses
+      * implement compute_order(), and this class rewrites the preprocessed
+      * edge file and writes the vertex id maps.
+      */
+    template <typename EdgeDataType>
+    class VertexReordering : public SharderPreprocessor<EdgeDataType> {
+
+    public:
+        typedef edge_with_value<EdgeDataType> edge_t;
+
+    protected:
+        std::string preprocessedFile;
+        vid_t nverts;
+        int nthreads;
+
+        /**
+          * Computes the new order of the vertices: order[i] is the original
+          * id of the vertex that gets id i.
+          */
+        virtual void compute_order(std::vector<vid_t> &order) = 0;
+
+        /**
+          * Counts the number of edges of each vertex. Both endpoints
+          * of an edge are counted.
+          */
+        void compute_degrees(std::vector<size_t> &deg) {
+            deg.assign(nverts, 0);
+            size_t * degs = &deg[0];
+            preprocessed_edge_reader<EdgeDataType> reader(preprocessedFile);
+            size_t n;
+            while ((n = reader.next()) > 0) {
+                edge_t * edges = reader.edges();
+#pragma omp parallel for num_threads(nthreads)
+                for(long long i=0; i < (long long)n; i++) {
+                    __sync_fetch_and_add(&degs[edges[i].src], 1);
+                    __sync_fetch_and_add(&degs[edges[i].dst], 1);
+                }
+            }
+        }
+
+        /**
+          * Reads the preprocessed file into an undirected graph. The file
+          * is read twice: first to count the degrees, and then to fill the
+          * neighbor lists, which are finally sorted to make the orderings
+          * deterministic.
+          */
+        void load_undirected_graph(reorder_graph &g) {
+            g.offsets.assign(nverts + 1, 0);
+            size_t * offsets = &g.offsets[0];
+            {
+                preprocessed_edge_reader<EdgeDataType> reader(preprocessedFile);
+                size_t n;
+                while ((n = reader.next()) > 0) {
+                    edge_t * edges = reader.edges();
+#pragma omp parallel for num_threads(nthreads)
+                    for(long long i=0; i < (long long)n; i++) {
+                        if (edges[i].src == edges[i].dst) continue;
+                        __sync_fetch_and_add(&offsets[edges[i].src + 1], 1);
+                        __sync_fetch_and_add(&offsets[edges[i].dst + 1], 1);
+                    }
+                }
+            }
+            for(vid_t v=0; v < nverts; v++) {
+                offsets[v + 1] += offsets[v];
+            }
+            g.nbrs.resize(std::max(offsets[nverts], (size_t)1));
+            vid_t * nbrs = &g.nbrs[0];
+
+            std::vector<size_t> cursors(g.offsets.begin(), g.offsets.end() - 1);
+            size_t * pos = &cursors[0];
+            {
+                preprocessed_edge_reader<EdgeDataType> reader(preprocessedFile);
+                size_t n;
+                while ((n = reader.next()) > 0) {
+                    edge_t * edges = reader.edges();
+#pragma omp parallel for num_threads(nthreads)
+                    for(long long i=0; i < (long long)n; i++) {
+                        vid_t src = edges[i].src, dst = edges[i].dst;
+                        if (src == dst) continue;
+                        nbrs[__sync_fetch_and_add(&pos[src], 1)] = dst;
+                        nbrs[__sync_fetch_and_add(&pos[dst], 1)] = src;
+                    }
+                }
+            }
+
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(nthreads)
+            for(long long v=0; v < (long long)nverts; v++) {
+                std::sort(nbrs + offsets[v], nbrs + offsets[v + 1]);
+            }
+            logstream(LOG_INFO) << "Reordering: loaded graph with " << offsets[nverts] / 2 << " undirected edges." << std::endl;
+        }
+
+        /**
+          * Orders all vertices by their degree. Vertices with equal degree
+          * are in the order of their ids.
+          */
+        void sort_by_degree(std::vector<vid_t> &order, const std::vector<size_t> &deg, bool descending) {
+            order.resize(nverts);
+            for(vid_t v=0; v < nverts; v++) order[v] = v;
+            size_t maxdeg = 0;
+            for(vid_t v=0; v < nverts; v++) maxdeg = std::max(maxdeg, deg[v]);
+            std::vector<vid_t> tmp(nverts);
+            radix_sort(&order[0], &tmp[0], (size_t)nverts, radix_keybits(maxdeg),
+                       reorder_degree_key(&deg[0], maxdeg, descending), nthreads);
+        }
+
+    public:
+
+        VertexReordering() : nverts(0) {
+            nthreads = get_option_int("execthreads", omp_get_max_threads());
+        }
+
+        void reprocess(std::string preprocessedFile, std::string baseFilename) {
+            this->preprocessedFile = preprocessedFile;
+            {
+                preprocessed_edge_reader<EdgeDataType> reader(preprocessedFile);
+                nverts = reader.max_vertex_id + 1;
+            }
+
+            std::vector<vid_t> order;
+            compute_order(order);
+            assert(order.size() == (size_t)nverts);
+
+            /* Invert the order, and check that it is a permutation */
+            std::vector<vid_t> translate_table(nverts);
+            vid_t * tr = &translate_table[0];
+            const vid_t * ord = &order[0];
+#pragma omp parallel for num_threads(nthreads)
+            for(long long i=0; i < (long long)nverts; i++) {
+                assert(ord[i] < nverts);
+                tr[ord[i]] = (vid_t)i;
+            }
+            size_t invalid = 0;
+#pragma omp parallel for reduction(+:invalid) num_threads(nthreads)
+            for(long long i=0; i < (long long)nverts; i++) {
+                if (tr[ord[i]] != (vid_t)i) invalid++;
+            }
+            if (invalid > 0) {
+                logstream(LOG_FATAL) << "Vertex order is not a permutation: " << invalid << " duplicate ids." << std::endl;
+                assert(false);
+            }
+
+            std::string graphname = baseFilename + this->getSuffix();
+            write_vertex_map(filename_vertex_map(graphname), tr, nverts);
+            write_vertex_map(filename_vertex_map_inverse(graphname), ord, nverts);
+
+            relabel_preprocessed_file<EdgeDataType>(preprocessedFile, nverts - 1, vertex_table_translator(tr), nthreads);
+        }
+    };
+
+    /**
+      * Relabels vertices in ascending order of their degree.
+      * This is used at least by the Triangle counting application.
+      */
+    template <typename EdgeDataType>
+    class OrderByDegree : public VertexReordering<EdgeDataType> {
+    public:
+        std::string getSuffix() {
+            return "_degord";
+        }
+
+    protected:
+        void compute_order(std::vector<vid_t> &order) {
+            std::vector<size_t> deg;
+            this->compute_degrees(deg);
+            this->sort_by_degree(order, deg, false);
+        }
+    };
+
+    /**
+      * Reverse Cuthill-McKee ordering. Each connected component is traversed
+      * in breadth-first order starting from its lowest degree vertex, visiting
+      * the neighbors in ascending order of degree. The resulting order is reversed.
+      * Neighbors get nearby ids, so edges of a vertex are concentrated to few intervals.
+      */
+    template <typename EdgeDataType>
+    class OrderByRCM : public VertexReordering<EdgeDataType> {
+    public:
+        std::string getSuffix() {
+            return "_rcm";
+        }
+
+    protected:
+        void compute_order(std::vector<vid_t> &order) {
+            vid_t nverts = this->nverts;
+            reorder_graph g;
+            this->load_undirected_graph(g);
+
+            std::vector<size_t> deg(nverts);
+            for(vid_t v=0; v < nverts; v++) deg[v] = g.degree(v);
+            std::vector<vid_t> bydegree;
+            this->sort_by_degree(bydegree, deg, false);
+
+            std::vector<char> visited(nverts, 0);
+            std::vector<vid_t> frontier;
+            order.clear();
+            order.reserve(nverts);
+            for(vid_t k=0; k < nverts; k++) {
+                vid_t s = bydegree[k];
+                if (visited[s]) continue;
+                visited[s] = 1;
+                order.push_back(s);
+                for(size_t head = order.size() - 1; head < order.size(); head++) {
+                    vid_t v = order[head];
+                    const vid_t * nbrs = g.neighbors(v);
+                    size_t d = g.degree(v);
+                    frontier.clear();
+                    for(size_t j=0; j < d; j++) {
+                        if (!visited[nbrs[j]]) {
+                            visited[nbrs[j]] = 1;
+                            frontier.push_back(nbrs[j]);
+                        }
+                    }
+                    std::sort(frontier.begin(), frontier.end(), reorder_degree_less(g));
+                    order.insert(order.end(), frontier.begin(), frontier.end());
+                }
+            }
+            std::reverse(order.begin(), order.end());
+        }
+    };
+
+    /**
+      * Greedy locality-maximizing ordering, similar to Gorder (Wei et al., 2016).
+      * Vertices are placed one at a time: the next vertex is the one that
+      * has most edges and common neighbors with the last placed vertices
+      * (the window). Common neighbors via high-degree hubs are ignored,
+      * as they are expensive to track and carry little locality.
+      * Configuration: reorder.window (default 5), reorder.hubdegree (default sqrt(nvertices)).
+      */
+    template <typename EdgeDataType>
+    class OrderByGorder : public VertexReordering<EdgeDataType> {
+
+        struct scored_vertex {
+            int score;
+            vid_t v;
+            scored_vertex(int score, vid_t v) : score(score), v(v) {}
+            /* Max-heap order: highest score first, then smallest id */
+            bool operator<(const scored_vertex &b) const {
+                return score < b.score || (score == b.score && v > b.v);
+            }
+        };
+
+        std::vector<int> scores;
+        std::vector<char> placed;
+        std::vector<scored_vertex> heap;
+
+        inline void add_score(vid_t u, int delta) {
+            if (placed[u]) return;
+            scores[u] += delta;
+            if (delta > 0) {
+                heap.push_back(scored_vertex(scores[u], u));
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+
+        /**
+          * Updates the scores when vertex v enters (delta = 1) or
+          * leaves (delta = -1) the window.
+          */
+        void update_window(const reorder_graph &g, vid_t v, int delta, size_t hubdegree) {
+            const vid_t * nbrs = g.neighbors(v);
+            size_t d = g.degree(v);
+            for(size_t j=0; j < d; j++) {
+                vid_t x = nbrs[j];
+                add_score(x, delta);
+                if (g.degree(x) > hubdegree) continue;
+                const vid_t * siblings = g.neighbors(x);
+                size_t dx = g.degree(x);
+                for(size_t k=0; k < dx; k++) {
+                    if (siblings[k] != v) add_score(siblings[k], delta);
+                }
+            }
+        }
+
+        /**
+          * The heap contains an entry for each score increase, and stale entries
+          * are skipped when popped. When it grows too large, it is rebuilt from
+          * the current scores.
+          */
+        void compact_heap() {
+            heap.clear();
+            for(size_t u=0; u < scores.size(); u++) {
+                if (!placed[u] && scores[u] > 0) heap.push_back(scored_vertex(scores[u], (vid_t)u));
+            }
+            std::make_heap(heap.begin(), heap.end());
+        }
+
+    public:
+        std::string getSuffix() {
+            return "_gorder";
+        }
+
+    protected:
+        void compute_order(std::vector<vid_t> &order) {
+            vid_t nverts = this->nverts;
+            reorder_graph g;
+            this->load_undirected_graph(g);
+
+            size_t window = (size_t) get_option_int("reorder.window", 5);
+            size_t hubdegree = (size_t) get_option_int("reorder.hubdegree", (int)sqrt((double)nverts) + 1);
+            assert(window > 0);
+
+            /* When no vertex has a positive score, the next vertex is the
+               unplaced vertex with the highest degree. */
+            std::vector<size_t> deg(nverts);
+            for(vid_t v=0; v < nverts; v++) deg[v] = g.degree(v);
+            std::vector<vid_t> seeds;
+            this->sort_by_degree(seeds, deg, true);
+
+            scores.assign(nverts, 0);
+            placed.assign(nverts, 0);
+            heap.clear();
+            order.clear();
+            order.reserve(nverts);
+            size_t seedpos = 0;
+            for(vid_t i=0; i < nverts; i++) {
+                bool found = false;
+                vid_t v = 0;
+                while (!heap.empty()) {
+                    scored_vertex top = heap.front();
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.pop_back();
+                    if (!placed[top.v] && top.score == scores[top.v] && top.score > 0) {
+                        v = top.v;
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) {
+                    while (placed[seeds[seedpos]]) seedpos++;
+                    v = seeds[seedpos];
+                }
+                placed[v] = 1;
+                order.push_back(v);
+
+                update_window(g, v, 1, hubdegree);
+                if (order.size() > window) {
+                    update_window(g, order[order.size() - 1 - window], -1, hubdegree);
+                }
+                if (heap.size() > 4 * (size_t)nverts + 1024) {
+                    compact_heap();
+                }
+                if (i % 1000000 == 0 && i > 0) {
+                    logstream(LOG_DEBUG) << "Gorder: placed " << i << " / " << nverts << " vertices" << std::endl;
+                }
+            }
+            std::vector<int>().swap(scores);
+            std::vector<char>().swap(placed);
+            std::vector<scored_vertex>().swap(heap);
+        }
+    };
+
+    /**
+      * Creates a reordering preprocessor by name: "degree", "rcm" or "gorder".
+      * Returns NULL for "none".
+      */
+    template <typename EdgeDataType>
+    SharderPreprocessor<EdgeDataType> * create_reordering_preprocessor(std::string ordering) {
+        if (ordering == "none" || ordering == "") {
+            return NULL;
+        } else if (ordering == "degree") {
+            return new OrderByDegree<EdgeDataType>();
+        } else if (ordering == "rcm") {
+            return new OrderByRCM<EdgeDataType>();
+        } else if (ordering == "gorder") {
+            return new OrderByGorder<EdgeDataType>();
+        }
+        logstream(LOG_FATAL) << "Unknown vertex ordering: " << ordering << ". Use 'none', 'degree', 'rcm' or 'gorder'." << std::endl;
+        assert(false);
+        return NULL;
+    }
+
+} // end namespace
+
+#endif
+
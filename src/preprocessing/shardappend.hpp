@@ -0,0 +1,530 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Appends a batch of edges to an existing sharded graph, without
+ * re-sharding the whole graph. The new edges are bucketed by the interval
+ * of their destination and sorted, and each shard that receives new edges
+ * is read once and merged with its bucket. Shards without new edges are
+ * not read at all.
+ *
+ * A shard that grows over the maximum shard size is split into several
+ * shards at vertex boundaries. Then the number of shards changes, and the
+ * shard files that were not rewritten are renamed. Vertices with ids larger
+ * than the current maximum are added to the last interval. The degree file
+ * and the intervals file are updated. The deleted edges of the rewritten
+ * shards (see shards/deletionbitmap.hpp) are dropped.
+ */
+
+#ifndef DEF_GRAPHCHI_SHARDAPPEND
+#define DEF_GRAPHCHI_SHARDAPPEND
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <omp.h>
+
+#include "graphchi_types.hpp"
+#include "api/chifilenames.hpp"
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "metrics/reps/basic_reporter.hpp"
+#include "preprocessing/conversions.hpp"
+#include "preprocessing/edgecombiners.hpp"
+#include "preprocessing/relabel.hpp"
+#include "preprocessing/sharder.hpp"
+#include "shards/deletionbitmap.hpp"
+#include "shards/shardheader.hpp"
+#include "util/cmdopts.hpp"
+#include "util/ioutil.hpp"
+#include "util/vertexmap.hpp"
+
+namespace graphchi {
+
+    /**
+      * Reads the edges of a shard in the order they are stored, i.e
+      * sorted by (src, dst).
+      */
+    template <typename EdgeDataType>
+    class shard_edge_reader {
+        typedef edge_with_value<EdgeDataType> edge_t;
+
+        uint8_t * adjdata;
+        uint8_t * ptr;
+        uint8_t * end;
+        EdgeDataType * edata;
+        size_t edataidx;
+        size_t nedata;
+        int vidbytes;
+        vid_t curvid;
+        int remaining;
+
+    public:
+        shard_edge_reader(std::string adjfilename, std::string edatafilename) : edataidx(0), curvid(0), remaining(0) {
+            shard_adj_format fmt = read_shard_adj_format(adjfilename);
+            vidbytes = fmt.vidbytes;
+            size_t adjsize = get_filesize(adjfilename);
+            size_t edatasize = get_filesize(edatafilename);
+            adjdata = (uint8_t *) malloc(std::max(adjsize, (size_t)1));
+            edata = (EdgeDataType *) malloc(std::max(edatasize, (size_t)1));
+            assert(adjdata != NULL && edata != NULL);
+            read_file(adjfilename, adjdata, adjsize);
+            read_file(edatafilename, edata, edatasize);
+            ptr = adjdata + fmt.headersize;
+            end = adjdata + adjsize;
+            nedata = edatasize / sizeof(EdgeDataType);
+        }
+
+        ~shard_edge_reader() {
+            free(adjdata);
+            free(edata);
+        }
+
+        /**
+          * Reads the next edge, returns false at the end of the shard.
+          */
+        bool next(edge_t &e) {
+            while (remaining == 0) {
+                if (ptr >= end) return false;
+                uint8_t ns = *ptr;
+                ptr += sizeof(uint8_t);
+                if (ns == 0x00) {
+                    /* Next value tells the number of vertices with zeros */
+                    uint8_t nz = *ptr;
+                    ptr += sizeof(uint8_t);
+                    curvid += nz + 1;
+                    continue;
+                }
+                if (ns == 0xff) {
+                    remaining = (int) *((uint32_t*)ptr);
+                    ptr += sizeof(uint32_t);
+                } else {
+                    remaining = ns;
+                }
+                if (remaining == 0) curvid++;
+            }
+            e.src = curvid;
+            e.dst = read_shard_vid(ptr, vidbytes);
+            ptr += vidbytes;
+            assert(edataidx < nedata);
+            e.value = edata[edataidx++];
+            if (--remaining == 0) curvid++;
+            return true;
+        }
+
+    private:
+        void read_file(std::string filename, void * buf, size_t size) {
+            int f = open(filename.c_str(), O_RDONLY);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not open: " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            if (size > 0) preada(f, buf, size, 0);
+            close(f);
+        }
+
+        // Disable value copying
+        shard_edge_reader(const shard_edge_reader&);
+        shard_edge_reader& operator=(const shard_edge_reader&);
+    };
+
+    template <typename EdgeDataType>
+    class shard_appender {
+        typedef edge_with_value<EdgeDataType> edge_t;
+
+        std::string basefilename;
+        int nshards;
+        std::vector< std::pair<vid_t, vid_t> > intervals;
+        int nthreads;
+        typename edge_combiner<EdgeDataType>::fn combiner;
+        metrics m;
+
+    public:
+        shard_appender(std::string basefilename, int nshards) : basefilename(basefilename), nshards(nshards), m("append") {
+            nthreads = std::max(1, get_option_int("execthreads", omp_get_max_threads()));
+            combiner = create_edge_combiner<EdgeDataType>(get_option_string("sharder.duplicates", "keep"));
+            load_intervals();
+        }
+
+        /**
+          * Appends the edges to the shards. Returns the new number of shards.
+          * The edges are reordered.
+          */
+        int append(std::vector<edge_t> &edges) {
+            m.start_time("append");
+            translate_vertex_ids(edges);
+
+            /* New vertices are added to the last interval. As in the sharder, 
+               the last interval ends one past the largest vertex id. */
+            vid_t oldmax = intervals[nshards - 1].second;
+            vid_t newmax = oldmax;
+            for(size_t i=0; i < edges.size(); i++) {
+                vid_t maxid = std::max(edges[i].src, edges[i].dst);
+                if (maxid >= newmax) newmax = maxid + 1;
+            }
+            intervals[nshards - 1].second = newmax;
+            size_t nvertices = (size_t)newmax + 1;
+            logstream(LOG_INFO) << "Appending " << edges.size() << " edges to " << nshards << " shards, max vertex id "
+                << oldmax << " -> " << newmax << std::endl;
+
+            int * degrees = load_degrees(nvertices);
+
+            /* Bucket the edges by shard, and sort each bucket */
+            std::vector<size_t> bucketstart;
+            bucket_edges(edges, newmax, bucketstart);
+
+            /* Plan the new intervals: oversized shards are split */
+            std::vector< std::pair<vid_t, vid_t> > newintervals;
+            std::vector<int> firstnew(nshards + 1);
+            size_t maxedges = max_shard_edges();
+            for(int p=0; p < nshards; p++) {
+                firstnew[p] = (int) newintervals.size();
+                size_t ndelta = bucketstart[p + 1] - bucketstart[p];
+                if (ndelta == 0) {
+                    newintervals.push_back(intervals[p]);
+                } else {
+                    split_interval(p, &edges[bucketstart[p]], ndelta, degrees, maxedges, newintervals);
+                }
+            }
+            firstnew[nshards] = (int) newintervals.size();
+            int newnshards = (int) newintervals.size();
+            if (newnshards != nshards) {
+                logstream(LOG_INFO) << "Oversized shards were split, number of shards " << nshards << " -> " << newnshards << std::endl;
+            }
+
+            /* Rewrite the shards with new edges */
+            for(int p=0; p < nshards; p++) {
+                size_t ndelta = bucketstart[p + 1] - bucketstart[p];
+                if (ndelta > 0) {
+                    rewrite_shard(p, &edges[bucketstart[p]], ndelta, firstnew[p], firstnew[p + 1] - firstnew[p],
+                                  newintervals, newnshards, degrees);
+                }
+            }
+
+            /* Other shards keep their contents, but their names change with the number of shards */
+            if (newnshards != nshards) {
+                for(int p=0; p < nshards; p++) {
+                    if (bucketstart[p + 1] > bucketstart[p]) continue;
+                    rename(filename_shard_adj(basefilename, p, nshards).c_str(),
+                           filename_shard_adj(basefilename, firstnew[p], newnshards).c_str());
+                    rename(filename_shard_edata<EdgeDataType>(basefilename, p, nshards).c_str(),
+                           filename_shard_edata<EdgeDataType>(basefilename, firstnew[p], newnshards).c_str());
+                    rename(filename_shard_deletions(filename_shard_adj(basefilename, p, nshards)).c_str(),
+                           filename_shard_deletions(filename_shard_adj(basefilename, firstnew[p], newnshards)).c_str());
+                }
+                remove(filename_intervals(basefilename, nshards).c_str());
+            }
+            /* The predicted costs of the sharder do not hold anymore */
+            remove(filename_interval_costs(basefilename, nshards).c_str());
+
+            write_degrees(degrees, nvertices);
+            free(degrees);
+
+            intervals = newintervals;
+            nshards = newnshards;
+            write_intervals();
+
+            m.stop_time("append");
+            m.set("append.edges", edges.size());
+            basic_reporter basicrep;
+            m.report(basicrep);
+            return nshards;
+        }
+
+    private:
+
+        void load_intervals() {
+            std::string fname = filename_intervals(basefilename, nshards);
+            FILE * f = fopen(fname.c_str(), "r");
+            if (f == NULL) {
+                logstream(LOG_FATAL) << "Could not open intervals file: " << fname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f != NULL);
+            vid_t st = 0;
+            unsigned long long en;
+            while (fscanf(f, "%llu", &en) == 1) {
+                intervals.push_back(std::pair<vid_t, vid_t>(st, (vid_t)en));
+                st = (vid_t)en + 1;
+            }
+            fclose(f);
+            assert((int)intervals.size() == nshards);
+        }
+
+        void write_intervals() {
+            std::string fname = filename_intervals(basefilename, nshards);
+            FILE * f = fopen(fname.c_str(), "w");
+            if (f == NULL) {
+                logstream(LOG_ERROR) << "Could not open file: " << fname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f != NULL);
+            for(int p=0; p < nshards; p++) {
+                fprintf(f, "%llu\n", (unsigned long long) intervals[p].second);
+            }
+            fclose(f);
+        }
+
+        /**
+          * The new edges have the original vertex ids. Vertices of a reordered
+          * graph are mapped to their new ids; new vertices keep their ids.
+          */
+        void translate_vertex_ids(std::vector<edge_t> &edges) {
+            if (shard_file_exists(filename_vertex_dictionary(basefilename))) {
+                logstream(LOG_FATAL) << "Cannot append to a graph with compacted vertex ids: new ids are not in " <<
+                    filename_vertex_dictionary(basefilename) << ". Shard the graph again." << std::endl;
+                assert(false);
+            }
+            vertex_map forward;
+            if (!forward.load(filename_vertex_map(basefilename))) return;
+#pragma omp parallel for num_threads(nthreads)
+            for(long long i=0; i < (long long)edges.size(); i++) {
+                edges[i].src = forward.translate(edges[i].src);
+                edges[i].dst = forward.translate(edges[i].dst);
+            }
+        }
+
+        int * load_degrees(size_t nvertices) {
+            int * degrees = (int *) calloc(2 * nvertices, sizeof(int));
+            assert(degrees != NULL);
+            std::string fname = filename_degree_data(basefilename);
+            int f = open(fname.c_str(), O_RDONLY);
+            if (f < 0) {
+                logstream(LOG_FATAL) << "Could not open degree file: " << fname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            size_t sz = std::min(get_filesize(fname), 2 * nvertices * sizeof(int));
+            if (sz > 0) preada(f, degrees, sz, 0);
+            close(f);
+            return degrees;
+        }
+
+        void write_degrees(int * degrees, size_t nvertices) {
+            std::string fname = filename_degree_data(basefilename);
+            int f = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not create: " << fname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            pwritea(f, degrees, 2 * nvertices * sizeof(int), 0);
+            close(f);
+        }
+
+        int shard_of(vid_t dst) {
+            int lo = 0, hi = nshards - 1;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (dst > intervals[mid].second) lo = mid + 1; else hi = mid;
+            }
+            return lo;
+        }
+
+        /**
+          * Reorders the edges so that bucketstart[p]..bucketstart[p+1] are the
+          * edges of shard p, sorted by (src, dst).
+          */
+        void bucket_edges(std::vector<edge_t> &edges, vid_t maxid, std::vector<size_t> &bucketstart) {
+            size_t n = edges.size();
+            std::vector<int> shards(n);
+            bucketstart.assign(nshards + 1, 0);
+#pragma omp parallel for num_threads(nthreads)
+            for(long long i=0; i < (long long)n; i++) {
+                shards[i] = shard_of(edges[i].dst);
+            }
+            for(size_t i=0; i < n; i++) bucketstart[shards[i] + 1]++;
+            for(int p=0; p < nshards; p++) bucketstart[p + 1] += bucketstart[p];
+
+            std::vector<edge_t> tmp(edges);
+            std::vector<size_t> pos(bucketstart.begin(), bucketstart.end() - 1);
+            for(size_t i=0; i < n; i++) edges[pos[shards[i]]++] = tmp[i];
+            for(int p=0; p < nshards; p++) {
+                size_t len = bucketstart[p + 1] - bucketstart[p];
+                if (len > 1) sort_edges_by_src<EdgeDataType>(&edges[bucketstart[p]], &tmp[0], len, maxid, nthreads);
+            }
+        }
+
+        /**
+          * Maximum number of edges in a shard, as in sharder::determine_number_of_shards(),
+          * or option append.maxshardedges.
+          */
+        size_t max_shard_edges() {
+            size_t membudget = 1024 * 1024 * get_option_long("membudget_mb", 1024);
+            size_t def = membudget / 8 / sizeof(EdgeDataType);
+            return std::max((size_t)1, (size_t)get_option_long("append.maxshardedges", def));
+        }
+
+        /**
+          * Adds the intervals of shard p after the append to newintervals: the
+          * interval is split if the shard would have more than maxedges edges.
+          */
+        void split_interval(int p, edge_t * delta, size_t ndelta, int * degrees, size_t maxedges,
+                            std::vector< std::pair<vid_t, vid_t> > &newintervals) {
+            vid_t st = intervals[p].first, en = intervals[p].second;
+            std::vector<size_t> indeg((size_t)en - st + 1);
+            size_t total = ndelta;
+            for(vid_t v=st; v <= en; v++) {
+                indeg[v - st] = degrees[2 * (size_t)v];
+                total += indeg[v - st];
+            }
+            if (total <= maxedges) {
+                newintervals.push_back(intervals[p]);
+                return;
+            }
+            for(size_t i=0; i < ndelta; i++) indeg[delta[i].dst - st]++;
+            size_t k = (total + maxedges - 1) / maxedges;
+
+            /* Split at the vertices where the cumulative in-degree passes j/k of the total */
+            size_t cum = 0;
+            size_t j = 1;
+            vid_t curst = st;
+            for(vid_t v=st; v < en && j < k; v++) {
+                cum += indeg[v - st];
+                if (cum >= total * j / k) {
+                    newintervals.push_back(std::pair<vid_t, vid_t>(curst, v));
+                    curst = v + 1;
+                    while (j < k && cum >= total * j / k) j++;
+                }
+            }
+            newintervals.push_back(std::pair<vid_t, vid_t>(curst, en));
+        }
+
+        /**
+          * Merges the new edges to shard p, and writes the result to the
+          * new shards firstnew .. firstnew + k - 1. Updates the degrees.
+          */
+        void rewrite_shard(int p, edge_t * delta, size_t ndelta, int firstnew, int k,
+                           std::vector< std::pair<vid_t, vid_t> > &newintervals, int newnshards, int * degrees) {
+            metrics_entry me = m.start_time();
+            std::string adjname = filename_shard_adj(basefilename, p, nshards);
+            std::string edataname = filename_shard_edata<EdgeDataType>(basefilename, p, nshards);
+            shard_edge_reader<EdgeDataType> reader(adjname, edataname);
+            deletion_bitmap * deleted = open_deletion_bitmap<EdgeDataType>(adjname, edataname);
+
+            /* In-degrees of the interval are recounted by the writers, and the
+               out-degrees of the old edges are added back by them */
+            for(vid_t v=intervals[p].first; v <= intervals[p].second; v++) degrees[2 * (size_t)v] = 0;
+
+            std::vector< shard_writer<EdgeDataType> * > writers;
+            std::vector<vid_t> ends;
+            for(int j=0; j < k; j++) {
+                std::string tmpadj = filename_shard_adj(basefilename, firstnew + j, newnshards) + ".tmp";
+                std::string tmpedata = filename_shard_edata<EdgeDataType>(basefilename, firstnew + j, newnshards) + ".tmp";
+                remove(tmpedata.c_str());
+                writers.push_back(new shard_writer<EdgeDataType>(tmpadj, tmpedata, degrees, combiner));
+                ends.push_back(newintervals[firstnew + j].second);
+            }
+
+            /* Merge: old edges go before new edges with the same endpoints. The deleted
+               old edges are dropped. */
+            edge_t old(0, 0, EdgeDataType());
+            bool hasold = reader.next(old);
+            size_t i = 0;
+            size_t nold = 0;
+            size_t ndeleted = 0;
+            while (hasold || i < ndelta) {
+                edge_t e = old;
+                if (hasold && (i == ndelta || !edge_t_src_less<EdgeDataType>(delta[i], old))) {
+                    degrees[2 * (size_t)old.src + 1]--;
+                    bool isdeleted = deleted != NULL && deleted->is_deleted(nold + ndeleted);
+                    if (isdeleted) ndeleted++;
+                    else nold++;
+                    hasold = reader.next(old);
+                    if (isdeleted) continue;
+                } else {
+                    e = delta[i++];
+                }
+                int j = (int) (std::lower_bound(ends.begin(), ends.end(), e.dst) - ends.begin());
+                writers[j]->add(e);
+            }
+
+            size_t nduplicates = 0;
+            for(int j=0; j < k; j++) {
+                writers[j]->done();
+                nduplicates += writers[j]->nduplicates;
+                delete writers[j];
+            }
+            for(int j=0; j < k; j++) {
+                std::string adj = filename_shard_adj(basefilename, firstnew + j, newnshards);
+                std::string edata = filename_shard_edata<EdgeDataType>(basefilename, firstnew + j, newnshards);
+                rename((adj + ".tmp").c_str(), adj.c_str());
+                rename((edata + ".tmp").c_str(), edata.c_str());
+                remove(filename_shard_deletions(adj).c_str());
+            }
+            if (newnshards != nshards) {
+                remove(adjname.c_str());
+                remove(edataname.c_str());
+            }
+            remove(filename_shard_deletions(adjname).c_str());
+            if (deleted != NULL) delete deleted;
+            logstream(LOG_INFO) << "Shard " << p << ": " << nold << " edges + " << ndelta << " new edges, "
+                << nduplicates << " duplicates merged, " << ndeleted << " deleted edges dropped, written to "
+                << k << " shard(s)." << std::endl;
+            m.stop_time(me, "append.rewrite_shard", p);
+        }
+    };
+
+    /**
+      * Appends the edges of a graph file to the shards of a graph.
+      * Returns the new number of shards.
+      * @param basefilename the graph that was sharded (including the suffix of a reordering)
+      * @param deltafile file with the new edges
+      * @param filetype format of the file, as in convert()
+      */
+    template <typename EdgeDataType>
+    int append_edges(std::string basefilename, std::string deltafile, std::string filetype) {
+        int nshards = find_shards<EdgeDataType>(basefilename, get_option_string("nshards", "auto"));
+        if (nshards == 0) {
+            logstream(LOG_FATAL) << "Could not find shards of " << basefilename << std::endl;
+            assert(false);
+        }
+
+        /* Parse the new edges with the converters, through a preprocessed file */
+        std::vector< edge_with_value<EdgeDataType> > edges;
+        {
+            sharder<EdgeDataType> deltasharder(deltafile);
+            deltasharder.start_preprocessing();
+            convert_input<EdgeDataType>(filetype, deltafile, deltasharder);
+            deltasharder.end_preprocessing();
+
+            preprocessed_edge_reader<EdgeDataType> reader(deltasharder.preprocessed_name());
+            size_t n;
+            while ((n = reader.next()) > 0) {
+                edges.insert(edges.end(), reader.edges(), reader.edges() + n);
+            }
+            remove(deltasharder.preprocessed_name().c_str());
+            remove(deltasharder.preprocessed_counts_name().c_str());
+        }
+
+        shard_appender<EdgeDataType> appender(basefilename, nshards);
+        return appender.append(edges);
+    }
+
+}
+
+#endif
+
@@ -43,8 +43,11 @@
 #include <vector>
 #include <omp.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sstream>
 #include <string>
+#include <limits>
+#include <algorithm>
 
 #include "graphchi_types.hpp"
 #include "api/chifilenames.hpp"
@@ -54,13 +57,18 @@
 #include "shards/memoryshard.hpp"
 #include "logger/logger.hpp"
 #include "util/ioutil.hpp"
+#include "util/merge.hpp"
+#include "util/pthread_tools.hpp"
 #include "util/qsort.hpp"
+#include "util/radixsort.hpp"
+#include "preprocessing/edgecombiners.hpp"
 #include "metrics/metrics.hpp"
 #include "metrics/reps/basic_reporter.hpp"
 
 namespace graphchi {
     
 #define SHARDER_BUFSIZE (64 * 1024 * 1024)
+#define SHARDER_STREAMING_BUCKETS 128
   
     enum ProcPhase  { COMPUTE_INTERVALS=1, SHOVEL=2 };
 
@@ -82,6 +90,316 @@ namespace graphchi {
         return a.src < b.src;
     }
     
+    /**
+      * Radix sort key for edges, orders by (src, dst).
+      */
+    template <typename EdgeDataType>
+    struct edge_radix_key {
+        int dstbits;
+        edge_radix_key(int dstbits) : dstbits(dstbits) {}
+        inline uint64_t operator()(const edge_with_value<EdgeDataType> &e) const {
+            return ((uint64_t)e.src << dstbits) | (uint64_t)e.dst;
+        }
+    };
+    
+    template <typename EdgeDataType>
+    struct edge_src_key {
+        inline uint64_t operator()(const edge_with_value<EdgeDataType> &e) const {
+            return (uint64_t)e.src;
+        }
+    };
+    
+    template <typename EdgeDataType>
+    struct edge_dst_key {
+        inline uint64_t operator()(const edge_with_value<EdgeDataType> &e) const {
+            return (uint64_t)e.dst;
+        }
+    };
+    
+    /**
+      * Sorts edges by (src, dst) with radix sort. If the key does not fit
+      * in 64 bits, sorts by destination and then stably by source.
+      */
+    template <typename EdgeDataType>
+    void sort_edges_by_src(edge_with_value<EdgeDataType> * edges, edge_with_value<EdgeDataType> * tmp, size_t numedges,
+                           vid_t max_vertex_id, int sortthreads) {
+        int bits = radix_keybits(max_vertex_id);
+        if (2 * bits <= 64) {
+            radix_sort(edges, tmp, numedges, 2 * bits, edge_radix_key<EdgeDataType>(bits), sortthreads);
+        } else {
+            radix_sort(edges, tmp, numedges, bits, edge_dst_key<EdgeDataType>(), sortthreads);
+            radix_sort(edges, tmp, numedges, bits, edge_src_key<EdgeDataType>(), sortthreads);
+        }
+    }
+    
+    /**
+      * Out-degree of a vertex in one shard, see shard_writer::spill_degrees().
+      */
+    struct degree_spill_entry {
+        vid_t vid;
+        uint32_t count;
+        degree_spill_entry() {}
+        degree_spill_entry(vid_t vid, uint32_t count) : vid(vid), count(count) {}
+    };
+    
+    /**
+      * Writes the compressed adjacency file and the edge data file of a shard.
+      * Edges must be added in the order of edge_t_src_less().
+      * If degrees is not NULL, the in- and out-degrees of the vertices are
+      * added to it, in the layout of the degree file (see filename_degree_data()).
+      * The in-degrees of the shard's interval are only counted by this writer,
+      * the out-degrees are shared with the other shards and added atomically.
+      * If the degrees of all vertices do not fit in memory, see spill_degrees().
+      * If combiner is not NULL, duplicate edges are merged with it.
+      */
+    template <typename EdgeDataType>
+    class shard_writer : public merge_sink< edge_with_value<EdgeDataType> > {
+        
+        typedef edge_with_value<EdgeDataType> edge_t;
+        
+        int f;
+        int ef;
+        char * buf;
+        char * bufptr;
+        char * ebuf;
+        char * ebufptr;
+        
+        vid_t curvid;
+        bool first;
+        std::vector<vid_t> curdsts;
+        int * degrees;
+        vid_t degreebase;
+        int spillf;
+        char * spillbuf;
+        char * spillbufptr;
+        
+        typename edge_combiner<EdgeDataType>::fn combiner;
+        bool haspending;
+        edge_t pending;
+        
+    public:
+        size_t nduplicates;
+        
+        shard_writer(std::string fname, std::string edfname, int * degrees = NULL, 
+                     typename edge_combiner<EdgeDataType>::fn combiner = NULL) : curvid(0), first(true), degrees(degrees), 
+                        degreebase(0), spillf(-1), spillbuf(NULL), combiner(combiner), haspending(false), pending(0, 0, EdgeDataType()), nduplicates(0) {
+            f = open(fname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not open " << fname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(f >= 0);
+            int trerr = ftruncate(f, 0);
+            assert(trerr == 0);
+            write_shard_adj_header(f);
+            
+            /* Create edge data file */
+            ef = open(edfname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (ef < 0) {
+                logstream(LOG_ERROR) << "Could not open " << edfname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(ef >= 0);
+            
+            buf = (char*) malloc(SHARDER_BUFSIZE); 
+            bufptr = buf;
+            ebuf = (char*) malloc(SHARDER_BUFSIZE);
+            ebufptr = ebuf;
+        }
+        
+        virtual ~shard_writer() {
+            if (buf != NULL) free(buf);
+            if (ebuf != NULL) free(ebuf);
+            if (spillbuf != NULL) free(spillbuf);
+        }
+        
+        /**
+          * Counts the in-degrees to indegrees, which has the layout of the 
+          * degree file for the shard's interval starting from interval_st. 
+          * The out-degree of each source vertex in the shard is written to
+          * spillfname as a degree_spill_entry, in the order of the vertex ids.
+          */
+        void spill_degrees(int * indegrees, vid_t interval_st, std::string spillfname) {
+            degrees = indegrees;
+            degreebase = interval_st;
+            spillf = open(spillfname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (spillf < 0) {
+                logstream(LOG_ERROR) << "Could not create a temporary file " << spillfname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(spillf >= 0);
+            spillbuf = (char*) malloc(SHARDER_BUFSIZE);
+            spillbufptr = spillbuf;
+        }
+        
+        virtual void add(edge_t edge) {
+            if (combiner == NULL) {
+                write_edge(edge);
+                return;
+            }
+            /* Edges come in sorted order, so duplicates are consecutive */
+            if (haspending && edge.src == pending.src && edge.dst == pending.dst) {
+                combiner(pending.value, edge.value);
+                nduplicates++;
+                return;
+            }
+            if (haspending) write_edge(pending);
+            pending = edge;
+            haspending = true;
+        }
+        
+        virtual void done() {
+            if (haspending) write_edge(pending);
+            haspending = false;
+            
+            bwrite<EdgeDataType>(ef, ebuf, ebufptr, EdgeDataType()); // Last "element" is a stopper
+            write_vertex();
+            
+            /* Flush buffers and free memory */
+            writea(f, buf, bufptr - buf);
+            free(buf);
+            buf = NULL;
+            close(f);
+            
+            writea(ef, ebuf, ebufptr - ebuf);
+            free(ebuf);
+            ebuf = NULL;
+            close(ef);
+            
+            if (spillf >= 0) {
+                writea(spillf, spillbuf, spillbufptr - spillbuf);
+                free(spillbuf);
+                spillbuf = NULL;
+                close(spillf);
+                spillf = -1;
+            }
+        }
+        
+    private:
+        void write_edge(const edge_t &edge) {
+            bwrite<EdgeDataType>(ef, ebuf, ebufptr, EdgeDataType(edge.value));
+            
+            if (edge.src != curvid) {
+                // New vertex
+                write_vertex();
+                
+                // Handle zeros
+                if (edge.src - curvid > 1 || (first && edge.src > 0)) {
+                    vid_t nz = edge.src - curvid - 1;
+                    if (first && edge.src > 0) nz = edge.src; // border case with the first one
+                    do {
+                        bwrite<uint8_t>(f, buf, bufptr, 0);
+                        nz--;
+                        vid_t tnz = std::min((vid_t)254, nz);
+                        bwrite<uint8_t>(f, buf, bufptr, (uint8_t) tnz);
+                        nz -= tnz;
+                    } while (nz > 0);
+                }
+                curvid = edge.src;
+            }
+            first = false;
+            curdsts.push_back(edge.dst);
+            if (degrees != NULL) degrees[2 * (size_t)(edge.dst - degreebase)]++;
+        }
+        
+        void write_vertex() {
+            size_t count = curdsts.size();
+            if (count == 0) return;
+            if (count < 255) {
+                uint8_t x = (uint8_t)count;
+                bwrite<uint8_t>(f, buf, bufptr, x);
+            } else {
+                bwrite<uint8_t>(f, buf, bufptr, 0xff);
+                bwrite<uint32_t>(f, buf, bufptr, (uint32_t)count);
+            }
+            if (spillf >= 0) {
+                bwrite(spillf, spillbuf, spillbufptr, degree_spill_entry(curvid, (uint32_t)count));
+            } else if (degrees != NULL) {
+                __sync_fetch_and_add(&degrees[2 * (size_t)curvid + 1], (int)count);
+            }
+            for(size_t j=0; j < count; j++) {
+                bwrite(f, buf, bufptr, curdsts[j]);
+            }
+            curdsts.clear();
+        }
+        
+        template <typename T>
+        void bwrite(int fd, char * wbuf, char * &wbufptr, T val) {
+            if (wbufptr + sizeof(T) - wbuf >= SHARDER_BUFSIZE) {
+                writea(fd, wbuf, wbufptr - wbuf);
+                wbufptr = wbuf;
+            }
+            *((T*)wbufptr) = val;
+            wbufptr += sizeof(T);
+        }
+    };
+    
+    /**
+      * Reads a sorted run of edges written by the external sort.
+      */
+    template <typename EdgeDataType>
+    class shovel_run_source : public merge_source< edge_with_value<EdgeDataType> > {
+        
+        typedef edge_with_value<EdgeDataType> edge_t;
+        
+        int fd;
+        edge_t * buf;
+        size_t bufcapacity;
+        size_t bufidx;
+        size_t buflen;
+        size_t offset;
+        size_t edgesleft;
+        
+    public:
+        shovel_run_source(std::string filename, size_t bufsize) : bufidx(0), buflen(0), offset(0) {
+            fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                logstream(LOG_ERROR) << "Could not open sorted run " << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(fd >= 0);
+            edgesleft = get_filesize(filename) / sizeof(edge_t);
+            bufcapacity = std::max((size_t)1, bufsize / sizeof(edge_t));
+            buf = (edge_t*) malloc(bufcapacity * sizeof(edge_t));
+            assert(buf != NULL);
+        }
+        
+        virtual ~shovel_run_source() {
+            close(fd);
+            free(buf);
+        }
+        
+        virtual bool has_more() {
+            return bufidx < buflen || edgesleft > 0;
+        }
+        
+        virtual edge_t next() {
+            if (bufidx == buflen) {
+                buflen = std::min(bufcapacity, edgesleft);
+                preada(fd, buf, buflen * sizeof(edge_t), offset);
+                offset += buflen * sizeof(edge_t);
+                edgesleft -= buflen;
+                bufidx = 0;
+            }
+            return buf[bufidx++];
+        }
+    };
+    
+    /**
+      * Reads a block of the preprocessed file. Used to read the next
+      * block in a background thread while the current block is processed.
+      */
+    struct sharder_read_task {
+        int fd;
+        char * buf;
+        size_t len;
+        size_t offset;
+        
+        sharder_read_task(int fd, char * buf, size_t len, size_t offset) : fd(fd), buf(buf), len(len), offset(offset) {}
+    };
+    
+    inline void * sharder_read_loop(void * _task) {
+        sharder_read_task * task = (sharder_read_task *) _task;
+        preada(task->fd, task->buf, task->len, task->offset);
+        return NULL;
+    }
+    
     template <typename EdgeDataType>
     class sharder {
         
@@ -99,23 +417,61 @@ namespace graphchi {
         
         size_t bytes_preprocessed;
         
+        /* In- and out-degree counts collected during preprocessing. Counts of 
+           2^preproc_chunkbits successive vertices are combined if needed 
+           to stay in the memory budget. */
+        std::vector<int> preproc_counts;
+        std::vector<int> preproc_outcounts;
+        int preproc_chunkbits;
+        size_t preproc_nedges;
+        
+        /* Streaming mode: edges are shoveled to buckets of destination ids
+           without writing the preprocessed file. Bucket i contains destinations
+           (bucketbounds[i-1], bucketbounds[i]]. Buckets that overlap many
+           shards are split by shard before the shards are written. */
+        bool streaming;
+        std::vector<edge_t> samplebuf;
+        size_t samplecapacity;
+        std::vector<vid_t> bucketbounds;
+        std::vector<bool> bucketsplit;
+        int * bucketfs;
+        edge_t ** bucketbufs;
+        int * bucketbufptrs;
+        size_t bucketbufsize;
+        
         /* Sharding */
         int nshards;
         std::vector< std::pair<vid_t, vid_t> > intervals;
         int phase;
         
         int * edgecounts;
+        int * outedgecounts;
         int vertexchunk;
         size_t nedges;
         std::string prefix;
         
         int * shovelfs;
+        mutex * shovellocks;
         
+        /* Each thread has its own shovel buffer for each shard,
+           buffer for (thread, shard) is at index thread * nshards + shard. */
+        int nthreads;
         edge_t ** bufs;
         int * bufptrs;
+        
+        /* Shard lookup for shoveling: the shard of vertex v is shardlookup[v >> lookupshift],
+           or one of the following shards if their intervals begin within the chunk. */
+        std::vector<int> shardlookup;
+        int lookupshift;
         size_t bufsize;
         size_t edgedatasize;
         
+        /* Combiner for duplicate edges, NULL if duplicates are kept */
+        typename edge_combiner<EdgeDataType>::fn combiner;
+        bool combiner_set;
+        size_t nduplicates;
+        size_t nselfedges;
+        
         metrics m;
         
     public:
@@ -124,7 +480,16 @@ namespace graphchi {
             binfile_fd = (-1);
             prebuf = NULL;
             bufs = NULL;
+            edgecounts = NULL;
+            outedgecounts = NULL;
+            bucketfs = NULL;
+            streaming = false;
+            nthreads = 1;
             edgedatasize = sizeof(EdgeDataType);
+            combiner = NULL;
+            combiner_set = false;
+            nduplicates = 0;
+            nselfedges = 0;
         }
         
         
@@ -133,13 +498,31 @@ namespace graphchi {
             prebuf = NULL;
         }
         
+        /**
+          * Sets the combiner for merging duplicate edges (NULL keeps the duplicates).
+          * Overrides the configuration option sharder.duplicates.
+          */
+        void set_duplicate_combiner(typename edge_combiner<EdgeDataType>::fn c) {
+            combiner = c;
+            combiner_set = true;
+        }
+        
         std::string preprocessed_name() {
             std::stringstream ss;
             ss << basefilename;
-            ss << "." <<  sizeof(EdgeDataType) << "B.bin";
+            ss << "." <<  sizeof(EdgeDataType) << "B";
+            if (sizeof(vid_t) != sizeof(uint32_t)) ss << ".vid" << sizeof(vid_t) * 8;
+            ss << ".bin";
             return ss.str();
         }
         
+        /**
+          * File for the in-degree counts of the preprocessed file.
+          */
+        std::string preprocessed_counts_name() {
+            return preprocessed_name() + ".counts";
+        }
+        
         /**
          * Checks if the preprocessed binary temporary file of a graph already exists,
          * so it does not need to be recreated.
@@ -182,6 +565,11 @@ namespace graphchi {
             bwrite(binfile_fd, prebuf, prebufptr, (vid_t)0);
             max_vertex_id = 0;
             bytes_preprocessed = 0;
+            
+            preproc_counts.clear();
+            preproc_outcounts.clear();
+            preproc_chunkbits = 0;
+            preproc_nedges = 0;
         }
         
         /**
@@ -209,6 +597,10 @@ namespace graphchi {
             prebuf = NULL;
             prebufptr = NULL;
             
+            /* Save the in-degree counts, so that the intervals can be
+               computed without reading the preprocessed file */
+            write_preprocessing_counts();
+            
             /* Rename temporary file */ 
             std::string tmpfilename = preprocessed_name() + ".tmp";
             rename(tmpfilename.c_str(), preprocessed_name().c_str());
@@ -222,13 +614,207 @@ namespace graphchi {
          * Add edge to be preprocessed
          */
         void preprocessing_add_edge(vid_t from, vid_t to, EdgeDataType val) {
-            if (prebuf == NULL) {
-                logstream(LOG_FATAL) << "You need to call start_preprocessing() prior to adding any edges!" << std::endl;
+            if (prebuf == NULL && !streaming) {
+                logstream(LOG_FATAL) << "You need to call start_preprocessing() or start_streaming() prior to adding any edges!" << std::endl;
             }
-            assert(prebuf != NULL);
+            assert(prebuf != NULL || streaming);
             
-            bwrite(binfile_fd, prebuf, prebufptr, edge_t(from, to, val)); 
+            if (from == to) {  // Self-edges are dropped
+                nselfedges++;
+                return;
+            }
+            if (streaming) {
+                streaming_add_edge(edge_t(from, to, val));
+            } else {
+                bwrite(binfile_fd, prebuf, prebufptr, edge_t(from, to, val)); 
+            }
             max_vertex_id = std::max(std::max(from, to), max_vertex_id);
+            
+            vid_t maxid = std::max(from, to);
+            if ((size_t)(maxid >> preproc_chunkbits) >= preproc_counts.size()) {
+                grow_preprocessing_counts(maxid >> preproc_chunkbits);
+            }
+            preproc_counts[to >> preproc_chunkbits]++;
+            preproc_outcounts[from >> preproc_chunkbits]++;
+            preproc_nedges++;
+        }
+        
+        /**
+          * Add a batch of edges to be preprocessed. Self-edges are removed from
+          * the vector, and the rest are written to the preprocessed file at once.
+          */
+        void preprocessing_add_edges(std::vector< edge_with_value<EdgeDataType> > &edges) {
+            if (prebuf == NULL && !streaming) {
+                logstream(LOG_FATAL) << "You need to call start_preprocessing() or start_streaming() prior to adding any edges!" << std::endl;
+            }
+            assert(prebuf != NULL || streaming);
+            
+            size_t n = 0;
+            vid_t maxid = 0;
+            for(size_t i=0; i < edges.size(); i++) {
+                edge_t e = edges[i];
+                if (e.src == e.dst) continue;
+                maxid = std::max(maxid, std::max(e.src, e.dst));
+                edges[n++] = e;
+            }
+            nselfedges += edges.size() - n;
+            edges.resize(n, edge_t(0, 0, EdgeDataType()));
+            if (n == 0) return;
+            
+            if (streaming) {
+                for(size_t i=0; i < n; i++) streaming_add_edge(edges[i]);
+            } else {
+                /* Keep the order of the edges in the file */
+                bytes_preprocessed += prebufptr - prebuf;
+                writea(binfile_fd, prebuf, prebufptr - prebuf);
+                prebufptr = prebuf;
+                writea(binfile_fd, &edges[0], n * sizeof(edge_t));
+                bytes_preprocessed += n * sizeof(edge_t);
+            }
+            
+            max_vertex_id = std::max(maxid, max_vertex_id);
+            if ((size_t)(maxid >> preproc_chunkbits) >= preproc_counts.size()) {
+                grow_preprocessing_counts(maxid >> preproc_chunkbits);
+            }
+            int * counts = &preproc_counts[0];
+            int * outcounts = &preproc_outcounts[0];
+            for(size_t i=0; i < n; i++) {
+                counts[edges[i].dst >> preproc_chunkbits]++;
+                outcounts[edges[i].src >> preproc_chunkbits]++;
+            }
+            preproc_nedges += n;
+        }
+        
+        /**
+          * Grows the count array to include index idx. If the array would
+          * not fit in a quarter of the memory budget, counts of successive 
+          * vertices are combined.
+          */
+        void grow_preprocessing_counts(size_t idx) {
+            size_t maxcounts = 1024 * 1024 * get_option_long("membudget_mb", 1024) / sizeof(int) / 8;
+            while (idx >= maxcounts) {
+                size_t n = preproc_counts.size();
+                for(size_t i=0; i < (n + 1) / 2; i++) {
+                    preproc_counts[i] = preproc_counts[2 * i] + (2 * i + 1 < n ? preproc_counts[2 * i + 1] : 0);
+                    preproc_outcounts[i] = preproc_outcounts[2 * i] + (2 * i + 1 < n ? preproc_outcounts[2 * i + 1] : 0);
+                }
+                preproc_counts.resize((n + 1) / 2);
+                preproc_outcounts.resize((n + 1) / 2);
+                preproc_chunkbits++;
+                idx >>= 1;
+            }
+            if (idx >= preproc_counts.size()) {
+                size_t newsize = std::min(maxcounts, std::max(idx + 1, 2 * preproc_counts.size()));
+                preproc_counts.resize(newsize, 0);
+                preproc_outcounts.resize(newsize, 0);
+            }
+        }
+        
+        /**
+          * Counts file format: vertex chunk size (int), number of edges (size_t),
+          * number of counts (size_t), followed by the in-degree counts (int)
+          * and the out-degree counts (int). Files of earlier versions have no
+          * out-degree counts.
+          */
+        void write_preprocessing_counts() {
+            std::string tmpfilename = preprocessed_counts_name() + ".tmp";
+            int f = open(tmpfilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (f < 0) {
+                logstream(LOG_ERROR) << "Could not create file: " << tmpfilename << " error: " << strerror(errno) << std::endl;
+                return;
+            }
+            int chunk = 1 << preproc_chunkbits;
+            size_t ncounts = std::min(preproc_counts.size(), (size_t) (max_vertex_id >> preproc_chunkbits) + 1);
+            writea(f, &chunk, sizeof(int));
+            writea(f, &preproc_nedges, sizeof(size_t));
+            writea(f, &ncounts, sizeof(size_t));
+            if (ncounts > 0) writea(f, &preproc_counts[0], ncounts * sizeof(int));
+            if (ncounts > 0) writea(f, &preproc_outcounts[0], ncounts * sizeof(int));
+            close(f);
+            rename(tmpfilename.c_str(), preprocessed_counts_name().c_str());
+            
+            std::vector<int>().swap(preproc_counts);
+            std::vector<int>().swap(preproc_outcounts);
+        }
+        
+        /**
+          * Loads the degree counts written during preprocessing. Returns
+          * false if the counts are not available, or if the cost model needs
+          * the out-degrees and the file does not have them.
+          */
+        bool load_preprocessing_counts() {
+            int f = open(preprocessed_counts_name().c_str(), O_RDONLY);
+            if (f < 0) return false;
+            int chunk;
+            size_t ncounts;
+            preada(f, &chunk, sizeof(int), 0);
+            preada(f, &nedges, sizeof(size_t), sizeof(int));
+            preada(f, &ncounts, sizeof(size_t), sizeof(int) + sizeof(size_t));
+            
+            size_t arraysize = max_vertex_id / chunk + 2;
+            if (chunk < 1 || ncounts > arraysize) {
+                logstream(LOG_WARNING) << "Counts file " << preprocessed_counts_name() << " does not match the preprocessed file, ignoring." << std::endl;
+                close(f);
+                return false;
+            }
+            size_t countsoffset = sizeof(int) + 2 * sizeof(size_t);
+            bool hasoutcounts = get_filesize(preprocessed_counts_name()) >= countsoffset + 2 * ncounts * sizeof(int);
+            if (!hasoutcounts && interval_cost_model().outedge > 0) {
+                logstream(LOG_INFO) << "Counts file " << preprocessed_counts_name() << " has no out-degrees, recounting." << std::endl;
+                close(f);
+                return false;
+            }
+            vertexchunk = chunk;
+            edgecounts = (int*) calloc(arraysize, sizeof(int));
+            outedgecounts = (int*) calloc(arraysize, sizeof(int));
+            preada(f, edgecounts, ncounts * sizeof(int), countsoffset);
+            if (hasoutcounts) preada(f, outedgecounts, ncounts * sizeof(int), countsoffset + ncounts * sizeof(int));
+            close(f);
+            return true;
+        }
+        
+        /**
+          * Starts a streaming session: edges added with preprocessing_add_edge() are 
+          * shoveled directly, without the preprocessed file. Call end_streaming() 
+          * and then execute_sharding().
+          */
+        void start_streaming() {
+            assert(prebuf == NULL && !streaming);
+            m.start_time("preprocessing");
+            logstream(LOG_INFO) << "Started streaming: " << basefilename << std::endl;
+            streaming = true;
+            max_vertex_id = 0;
+            preproc_counts.clear();
+            preproc_outcounts.clear();
+            preproc_chunkbits = 0;
+            preproc_nedges = 0;
+            
+            /* Bucket boundaries are estimated from the first edges of the stream */
+            size_t membudget = 1024 * 1024 * get_option_long("membudget_mb", 1024);
+            samplecapacity = membudget / 4 / sizeof(edge_t);
+            bucketbufsize = membudget / 4 / SHARDER_STREAMING_BUCKETS;
+            while(bucketbufsize % sizeof(edge_t) != 0) bucketbufsize++;
+        }
+        
+        void end_streaming() {
+            assert(streaming);
+            if (bucketfs == NULL) {
+                init_buckets();
+            }
+            for(int i=0; i < (int)bucketbounds.size(); i++) {
+                writea(bucketfs[i], bucketbufs[i], sizeof(edge_t) * bucketbufptrs[i]);
+                close(bucketfs[i]);
+                free(bucketbufs[i]);
+            }
+            delete [] bucketfs;
+            delete [] bucketbufs;
+            delete [] bucketbufptrs;
+            bucketfs = NULL;
+            
+            assert(max_vertex_id > 0);
+            logstream(LOG_INFO) << "Maximum vertex id: " << max_vertex_id << std::endl;
+            logstream(LOG_INFO) << "Finished streaming: " << basefilename << ", " << preproc_nedges << " edges." << std::endl;
+            m.stop_time("preprocessing");
         }
         
         /** Buffered write function */
@@ -258,71 +844,107 @@ namespace graphchi {
         int execute_sharding(std::string nshards_string) {
             m.start_time("execute_sharding");
             determine_number_of_shards(nshards_string);
-          
+            nthreads = std::max(1, get_option_int("execthreads", omp_get_max_threads()));
+            m.set("sharder.threads", (size_t)nthreads);
+            if (!combiner_set) {
+                combiner = create_edge_combiner<EdgeDataType>(get_option_string("sharder.duplicates", "keep"));
+            }
+            
+            if (streaming) {
+                /* Edges were already shoveled to the buckets */
+                compute_streaming_intervals();
+            } else {
+                shovel_preprocessed_file();
+            }
+
+            /* Write the shards */
+            write_shards();
+            
+            logstream(LOG_INFO) << "Dropped " << nselfedges << " self-edges, merged " << nduplicates << " duplicate edges." << std::endl;
+            m.set("sharder.selfedges", nselfedges);
+            m.set("sharder.duplicate_edges", nduplicates);
+                      
+            m.stop_time("execute_sharding");
+            
+            /* Print metrics */
+            basic_reporter basicrep;
+            m.report(basicrep);
+            
+            return nshards;
+        }
+        
+        /**
+          * Reads the preprocessed file to compute the intervals (unless the counts
+          * were saved in preprocessing) and to shovel the edges to the shards.
+          */
+        void shovel_preprocessed_file() {
             size_t blocksize = 32 * 1024 * 1024;
             while (blocksize % sizeof(edge_t)) blocksize++;
             
-            char * block = (char*) malloc(blocksize);
+            /* Double buffering: next block is read while the current is processed */
+            char * blocks[2];
+            blocks[0] = (char*) malloc(blocksize);
+            blocks[1] = (char*) malloc(blocksize);
+            assert(blocks[0] != NULL && blocks[1] != NULL);
             size_t total_to_process = get_filesize(preprocessed_name());
 
             for(int phase=1; phase <= 2; ++phase) {
                 /* Start the sharing process */
-                FILE * inf = fopen(preprocessed_name().c_str(), "r");
-                if (inf == NULL) {
+                int inf = open(preprocessed_name().c_str(), O_RDONLY);
+                if (inf < 0) {
                     logstream(LOG_FATAL) << "Could not open preprocessed file: " << preprocessed_name() << 
                     " error: " << strerror(errno) << std::endl;
                 }
-                assert(inf != NULL);
+                assert(inf >= 0);
                 
                 /* Read max vertex id */
-                ssize_t rd = fread(&max_vertex_id, sizeof(vid_t), 1, inf);
-                if (rd != 1) {
-                    logstream(LOG_ERROR) << "Read: " << rd << std::endl;
-                    logstream(LOG_ERROR) << "Could not read from preprocessed file. Error: " << strerror(errno) << std::endl;
-                }
-                assert(rd == 1);
+                preada(inf, &max_vertex_id, sizeof(vid_t), 0);
                 logstream(LOG_INFO) << "Max vertex id: " << max_vertex_id << std::endl; 
                 
+                /* Intervals can be computed from the counts collected in preprocessing */
+                if (phase == COMPUTE_INTERVALS && load_preprocessing_counts()) {
+                    logstream(LOG_INFO) << "Computing intervals from counts: " << preprocessed_counts_name() << std::endl;
+                    close(inf);
+                    compute_partitionintervals();
+                    free_interval_counts();
+                    continue;
+                }
+                
                 this->start_phase(phase);
                 
-                size_t totread = 0;
-                do {
-                    size_t len = 0;
-                    while(len < blocksize) {
-                        int a = (int) fread(block + len, 1, blocksize - len, inf);
-                        len += a;
-                        if (a <= 0) break; // eof
+                int cur = 0;
+                size_t offset = sizeof(vid_t);
+                size_t len = std::min(blocksize, total_to_process - offset);
+                preada(inf, blocks[cur], len, offset);
+                while (len > 0) {
+                    /* Start reading the next block */
+                    size_t nextoffset = offset + len;
+                    sharder_read_task next(inf, blocks[1 - cur], std::min(blocksize, total_to_process - nextoffset), nextoffset);
+                    pthread_t reader;
+                    if (next.len > 0) {
+                        int ret = pthread_create(&reader, NULL, sharder_read_loop, (void*) &next);
+                        assert(ret == 0);
                     }
-                    totread += len;
                     
-                   logstream(LOG_DEBUG) << "Phase: " << phase << " read:" 
-                            << (totread * 1.0 / total_to_process * 100) << "%" << std::endl;
-                    len /= sizeof(edge_t);
-                    edge_t * ptr = (edge_t*)block;      
+                    logstream(LOG_DEBUG) << "Phase: " << phase << " read:" 
+                            << (nextoffset * 1.0 / total_to_process * 100) << "%" << std::endl;
+                    this->receive_edges((edge_t*) blocks[cur], len / sizeof(edge_t));
                     
-                    for(size_t i=0; i<len; i++) {
-                        this->receive_edge(ptr[i].src, ptr[i].dst, ptr[i].value);
+                    if (next.len > 0) {
+                        pthread_join(reader, NULL);
                     }
-                } while (!feof(inf));
+                    offset = nextoffset;
+                    len = next.len;
+                    cur = 1 - cur;
+                }
                 this->end_phase();
                 
-                fclose(inf);
+                close(inf);
             }
             
             /* Release memory */
-            free(block); 
-            block = NULL;
-
-            /* Write the shards */
-            write_shards();
-                      
-            m.stop_time("execute_sharding");
-            
-            /* Print metrics */
-            basic_reporter basicrep;
-            m.report(basicrep);
-            
-            return nshards;
+            free(blocks[0]); 
+            free(blocks[1]);
         }
         
         /**
@@ -331,7 +953,7 @@ namespace graphchi {
     protected:
 
         virtual void determine_number_of_shards(std::string nshards_string) {
-            assert(preprocessed_file_exists());
+            assert(streaming || preprocessed_file_exists());
             if (nshards_string.find("auto") != std::string::npos || nshards_string == "0") {
                 logstream(LOG_INFO) << "Determining number of shards automatically." << std::endl;
                 
@@ -339,9 +961,12 @@ namespace graphchi {
                 logstream(LOG_INFO) << "Assuming available memory is " << membudget_mb << " megabytes. " << std::endl;
                 logstream(LOG_INFO) << " (This can be defined with configuration parameter 'membudget_mb')" << std::endl;
                 
-                bytes_preprocessed = get_filesize(preprocessed_name()) - sizeof(vid_t);
-                assert(bytes_preprocessed > 0);
-                size_t numedges = bytes_preprocessed / sizeof(edge_t);
+                size_t numedges = preproc_nedges;
+                if (!streaming) {
+                    bytes_preprocessed = get_filesize(preprocessed_name()) - sizeof(vid_t);
+                    assert(bytes_preprocessed > 0);
+                    numedges = bytes_preprocessed / sizeof(edge_t);
+                }
                 
                 double max_shardsize = membudget_mb * 1024. * 1024. / 8;
                 logstream(LOG_INFO) << "Determining maximum shard size: " << (max_shardsize / 1024. / 1024.) << " MB." << std::endl;
@@ -355,15 +980,56 @@ namespace graphchi {
             assert(nshards > 1);
         }
         
+        /**
+          * Weights of the interval cost model. The cost of an interval is the
+          * number of bytes loaded for it in an iteration: its in-edges from the
+          * memory shard, its out-edges from the sliding shards and its vertex data.
+          * The default balances the in-edges only.
+          */
+        struct interval_costs {
+            double inedge;
+            double outedge;
+            double vertexbytes;
+        };
+        
+        interval_costs interval_cost_model() {
+            interval_costs c;
+            c.inedge = get_option_float("sharder.cost.inedges", 1.0f);
+            c.outedge = get_option_float("sharder.cost.outedges", 0.0f);
+            c.vertexbytes = get_option_float("sharder.cost.vertexbytes", 0.0f);
+            return c;
+        }
+        
+        void free_interval_counts() {
+            free(edgecounts);
+            free(outedgecounts);
+            edgecounts = NULL;
+            outedgecounts = NULL;
+        }
+        
         void compute_partitionintervals() {
-            size_t edges_per_part = nedges / nshards + 1;
+            interval_costs model = interval_cost_model();
+            double edgebytes = (double) (sizeof(vid_t) + edgedatasize);
+            
+            /* Cost of each chunk of vertices */
+            size_t nchunks = max_vertex_id / vertexchunk + 2;
+            std::vector<double> chunkcosts(nchunks);
+            double totalcost = 0;
+            for(size_t c=0; c < nchunks; c++) {
+                chunkcosts[c] = model.inedge * edgebytes * edgecounts[c] + model.outedge * edgebytes * outedgecounts[c] +
+                                model.vertexbytes * vertexchunk;
+                totalcost += chunkcosts[c];
+            }
+            double cost_per_part = totalcost / nshards;
             
             logstream(LOG_INFO) <<  "Number of shards: " << nshards << std::endl;
-            logstream(LOG_INFO)  << "Edges per shard: " << edges_per_part << std::endl;
+            logstream(LOG_INFO)  << "Edges per shard: " << nedges / nshards + 1 << std::endl;
+            logstream(LOG_INFO)  << "Cost per shard: " << cost_per_part << " bytes" << std::endl;
             logstream(LOG_INFO)  << "Max vertex id: " << max_vertex_id << std::endl;
             
             vid_t cur_st = 0;
-            size_t edgecounter=0;
+            double costcounter = 0;
+            std::vector<double> predicted;
             std::string fname = filename_intervals(basefilename, nshards);
             FILE * f = fopen(fname.c_str(), "w");
             
@@ -376,30 +1042,277 @@ namespace graphchi {
             vid_t i = 0;
             while(nshards > (int) intervals.size()) {
                 i += vertexchunk;
-                edgecounter += edgecounts[i / vertexchunk];
-                if (edgecounter >= edges_per_part || (i >= max_vertex_id)) {
+                costcounter += chunkcosts[std::min((size_t) (i / vertexchunk), nchunks - 1)];
+                if (costcounter > cost_per_part || (i >= max_vertex_id)) {
                     intervals.push_back(std::pair<vid_t,vid_t>(cur_st, i + (i >= max_vertex_id)));
                     logstream(LOG_INFO) << "Interval: " << cur_st << " - " << i << std::endl;
-                    fprintf(f, "%u\n", i + (i == max_vertex_id));
+                    fprintf(f, "%llu\n", (unsigned long long) (i + (i == max_vertex_id)));
+                    predicted.push_back(costcounter);
                     cur_st = i + 1;
-                    edgecounter = 0;
+                    costcounter = 0;
                 }
             }
             fclose(f);
             assert(nshards == (int)intervals.size());
+            write_interval_costs(predicted);
             
             logstream(LOG_INFO) << "Computed intervals." << std::endl;
         }
         
+        /**
+          * Writes the predicted cost of each interval, so that the engine
+          * can compare them to the actual load times.
+          */
+        void write_interval_costs(std::vector<double> &predicted) {
+            std::string fname = filename_interval_costs(basefilename, nshards);
+            FILE * f = fopen(fname.c_str(), "w");
+            if (f == NULL) {
+                logstream(LOG_ERROR) << "Could not open file: " << fname << " error: " << strerror(errno) << std::endl;
+                return;
+            }
+            for(int p=0; p < (int)predicted.size(); p++) {
+                fprintf(f, "%.0lf\n", predicted[p]);
+                m.set_vector_entry("interval.predicted_cost", p, predicted[p]);
+            }
+            fclose(f);
+        }
+        
         std::string shovel_filename(int shard) {
             std::stringstream ss;
             ss << basefilename << shard << "." << nshards << ".shovel";
             return ss.str(); 
         }
         
+        std::string bucket_filename(int bucket) {
+            std::stringstream ss;
+            ss << basefilename << bucket << ".stream.shovel";
+            return ss.str(); 
+        }
+        
+        std::string bucket_filename(int bucket, int shard) {
+            std::stringstream ss;
+            ss << bucket_filename(bucket) << "." << shard;
+            return ss.str(); 
+        }
+        
+        /* Self-edges have been dropped by preprocessing_add_edge() */
+        void streaming_add_edge(edge_t e) {
+            if (bucketfs == NULL) {
+                samplebuf.push_back(e);
+                if (samplebuf.size() >= samplecapacity) {
+                    init_buckets();
+                }
+                return;
+            }
+            int bucket = (int) (std::lower_bound(bucketbounds.begin(), bucketbounds.end(), e.dst) - bucketbounds.begin());
+            bucketbufs[bucket][bucketbufptrs[bucket]++] = e;
+            if (bucketbufptrs[bucket] * sizeof(edge_t) >= bucketbufsize) {
+                writea(bucketfs[bucket], bucketbufs[bucket], sizeof(edge_t) * bucketbufptrs[bucket]);
+                bucketbufptrs[bucket] = 0;
+            }
+        }
+        
+        /**
+          * Chooses the bucket boundaries so that the sampled edges are 
+          * divided evenly. The last bucket is open-ended, because larger 
+          * vertex ids may appear later in the stream.
+          */
+        void init_buckets() {
+            std::vector<vid_t> dsts(samplebuf.size());
+            for(size_t i=0; i < samplebuf.size(); i++) dsts[i] = samplebuf[i].dst;
+            std::sort(dsts.begin(), dsts.end());
+            
+            bucketbounds.clear();
+            for(int i=1; i < SHARDER_STREAMING_BUCKETS && !dsts.empty(); i++) {
+                vid_t bound = dsts[dsts.size() * i / SHARDER_STREAMING_BUCKETS];
+                if (bucketbounds.empty() || bound > bucketbounds.back()) {
+                    bucketbounds.push_back(bound);
+                }
+            }
+            bucketbounds.push_back(std::numeric_limits<vid_t>::max());
+            logstream(LOG_INFO) << "Streaming to " << bucketbounds.size() << " buckets." << std::endl;
+            
+            int nbuckets = (int) bucketbounds.size();
+            bucketfs = new int[nbuckets];
+            bucketbufs = new edge_t*[nbuckets];
+            bucketbufptrs = new int[nbuckets];
+            for(int i=0; i < nbuckets; i++) {
+                std::string fname = bucket_filename(i);
+                bucketfs[i] = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                if (bucketfs[i] < 0) {
+                    logstream(LOG_ERROR) << "Could not create a temporary file " << fname <<
+                    " error: " << strerror(errno) << std::endl;
+                }
+                assert(bucketfs[i] >= 0);
+                bucketbufs[i] = (edge_t*) malloc(bucketbufsize);
+                assert(bucketbufs[i] != NULL);
+                bucketbufptrs[i] = 0;
+            }
+            
+            std::vector<edge_t> sample;
+            sample.swap(samplebuf);
+            for(size_t i=0; i < sample.size(); i++) {
+                streaming_add_edge(sample[i]);
+            }
+        }
+        
+        /**
+          * Computes the intervals from the in-degree counts collected while streaming.
+          */
+        void compute_streaming_intervals() {
+            vertexchunk = 1 << preproc_chunkbits;
+            edgecounts = (int*) calloc(max_vertex_id / vertexchunk + 2, sizeof(int));
+            outedgecounts = (int*) calloc(max_vertex_id / vertexchunk + 2, sizeof(int));
+            size_t ncounts = std::min(preproc_counts.size(), (size_t) (max_vertex_id >> preproc_chunkbits) + 1);
+            if (ncounts > 0) memcpy(edgecounts, &preproc_counts[0], ncounts * sizeof(int));
+            if (ncounts > 0) memcpy(outedgecounts, &preproc_outcounts[0], ncounts * sizeof(int));
+            std::vector<int>().swap(preproc_counts);
+            std::vector<int>().swap(preproc_outcounts);
+            nedges = preproc_nedges;
+            
+            compute_partitionintervals();
+            free_interval_counts();
+            split_buckets();
+        }
+        
+        /**
+          * Splits the buckets that overlap more than two shards into a file per
+          * shard. The bucket bounds are estimated from the beginning of the
+          * stream, so on sorted input most edges end up in the open-ended last 
+          * bucket, which would otherwise be read again for every shard.
+          */
+        void split_buckets() {
+            bucketsplit.assign(bucketbounds.size(), false);
+            size_t bufedges = std::max((size_t)65536, 1024 * 1024 * get_option_long("membudget_mb", 1024) / 4 / sizeof(edge_t));
+            for(int i=0; i < (int)bucketbounds.size(); i++) {
+                int first, last;
+                bucket_shards(i, first, last);
+                if (last - first < 2) continue;
+                
+                logstream(LOG_INFO) << "Splitting bucket " << i << " to shards " << first << " - " << last << std::endl;
+                std::vector<int> fs;
+                std::vector< std::vector<edge_t> > outbufs(last - first + 1);
+                for(int shard=first; shard <= last; shard++) {
+                    std::string fname = bucket_filename(i, shard);
+                    int f = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                    if (f < 0) {
+                        logstream(LOG_ERROR) << "Could not create a temporary file " << fname <<
+                        " error: " << strerror(errno) << std::endl;
+                    }
+                    assert(f >= 0);
+                    fs.push_back(f);
+                }
+                size_t outbufedges = std::max((size_t)4096, bufedges / fs.size());
+                
+                std::string bucketname = bucket_filename(i);
+                size_t nedges_bucket = get_filesize(bucketname) / sizeof(edge_t);
+                size_t nbuf = std::min(bufedges, std::max((size_t)1, nedges_bucket));
+                edge_t * buf = (edge_t*) malloc(nbuf * sizeof(edge_t));
+                assert(buf != NULL);
+                int f = open(bucketname.c_str(), O_RDONLY);
+                assert(f >= 0);
+                for(size_t st=0; st < nedges_bucket; st += nbuf) {
+                    size_t len = std::min(nbuf, nedges_bucket - st);
+                    preada(f, buf, len * sizeof(edge_t), st * sizeof(edge_t));
+                    int shard = first;
+                    for(size_t j=0; j < len; j++) {
+                        edge_t &e = buf[j];
+                        /* Edges of successive vertices tend to go to the same shard */
+                        if (e.dst < intervals[shard].first || e.dst > intervals[shard].second) {
+                            shard = first;
+                            while (e.dst > intervals[shard].second) shard++;
+                        }
+                        std::vector<edge_t> &out = outbufs[shard - first];
+                        out.push_back(e);
+                        if (out.size() >= outbufedges) {
+                            writea(fs[shard - first], &out[0], out.size() * sizeof(edge_t));
+                            out.clear();
+                        }
+                    }
+                }
+                close(f);
+                free(buf);
+                for(int j=0; j < (int)fs.size(); j++) {
+                    if (!outbufs[j].empty()) writea(fs[j], &outbufs[j][0], outbufs[j].size() * sizeof(edge_t));
+                    close(fs[j]);
+                }
+                remove(bucketname.c_str());
+                bucketsplit[i] = true;
+            }
+        }
+        
+        /**
+          * Finds the range of shards whose intervals overlap a bucket.
+          */
+        void bucket_shards(int bucket, int &first, int &last) {
+            vid_t lo = (bucket == 0 ? 0 : bucketbounds[bucket - 1] + 1);
+            vid_t hi = bucketbounds[bucket];
+            first = nshards;
+            last = -1;
+            for(int shard=0; shard < nshards; shard++) {
+                if (lo <= intervals[shard].second && hi >= intervals[shard].first) {
+                    first = std::min(first, shard);
+                    last = shard;
+                }
+            }
+        }
+        
+        /**
+          * Files containing the edges of a shard. In streaming mode, the buckets 
+          * may contain also edges of the neighboring shards.
+          */
+        std::vector<std::string> shovel_parts(int shard) {
+            std::vector<std::string> parts;
+            if (!streaming) {
+                parts.push_back(shovel_filename(shard));
+                return parts;
+            }
+            for(int i=0; i < (int)bucketbounds.size(); i++) {
+                int first, last;
+                bucket_shards(i, first, last);
+                if (shard < first || shard > last) continue;
+                parts.push_back(bucketsplit[i] ? bucket_filename(i, shard) : bucket_filename(i));
+            }
+            return parts;
+        }
+        
+        /**
+          * Reads up to maxedges edges of a shard from the shovel parts, starting from
+          * the cursor (part, byte offset). Edges of other shards are skipped.
+          */
+        size_t read_shovel_edges(int shard, std::vector<std::string> &parts, int &part, size_t &offset, 
+                                 edge_t * buf, size_t maxedges) {
+            vid_t st = intervals[shard].first;
+            vid_t en = intervals[shard].second;
+            size_t n = 0;
+            while (n < maxedges && part < (int)parts.size()) {
+                size_t partsize = get_filesize(parts[part]);
+                size_t toread = std::min(maxedges - n, (partsize - offset) / sizeof(edge_t));
+                if (toread > 0) {
+                    int f = open(parts[part].c_str(), O_RDONLY);
+                    if (f < 0) {
+                        logstream(LOG_ERROR) << "Could not open " << parts[part] << " error: " << strerror(errno) << std::endl;
+                    }
+                    assert(f >= 0);
+                    preada(f, buf + n, toread * sizeof(edge_t), offset);
+                    close(f);
+                    offset += toread * sizeof(edge_t);
+                    size_t base = n;
+                    for(size_t i=0; i < toread; i++) {
+                        edge_t e = buf[base + i];
+                        if (e.dst >= st && e.dst <= en) buf[n++] = e;
+                    }
+                }
+                if (offset + sizeof(edge_t) > partsize) {
+                    part++;
+                    offset = 0;
+                }
+            }
+            return n;
+        }
+        
         void start_phase(int p) {
             phase = p;
-            lastpart = 0;
             logstream(LOG_INFO) << "Starting phase: " << phase << std::endl;
             switch (phase) {
                 case COMPUTE_INTERVALS:
@@ -407,21 +1320,30 @@ namespace graphchi {
                        If there is not enough memory to store degree for each vertex, we combine
                        degrees of successive vertice. This results into less accurate shard split,
                        but in practice it hardly matters. */
-                    vertexchunk = (int) (max_vertex_id * sizeof(int) / (1024 * 1024 * get_option_long("membudget_mb", 1024)));
+                    vertexchunk = (int) (max_vertex_id * 2 * sizeof(int) / (1024 * 1024 * get_option_long("membudget_mb", 1024)));
                     if (vertexchunk<1) vertexchunk = 1;                    
-                    edgecounts = (int*)calloc( max_vertex_id / vertexchunk + 1, sizeof(int));
+                    edgecounts = (int*)calloc( max_vertex_id / vertexchunk + 2, sizeof(int));
+                    outedgecounts = (int*)calloc( max_vertex_id / vertexchunk + 2, sizeof(int));
                     nedges = 0;
                     break;
                     
                 case SHOVEL:
                     shovelfs = new int[nshards];
-                    bufs = new edge_t*[nshards];
-                    bufptrs =  new int[nshards];
-                    bufsize = (1024 * 1024 * get_option_long("membudget_mb", 1024)) / nshards / 4;
+                    shovellocks = new mutex[nshards];
+                    bufs = new edge_t*[nshards * nthreads];
+                    bufptrs =  new int[nshards * nthreads];
+                    bufsize = (1024 * 1024 * get_option_long("membudget_mb", 1024)) / nshards / nthreads / 4;
                     while(bufsize % sizeof(edge_t) != 0) bufsize++;
                     
                     logstream(LOG_DEBUG)<< "Shoveling bufsize: " << bufsize << std::endl;
-                  
+                    
+                    for(int i=0; i < nshards * nthreads; i++) {
+                        bufs[i] = (edge_t*) malloc(bufsize);
+                        assert(bufs[i] != NULL);
+                        bufptrs[i] = 0;
+                    }
+                    init_shard_lookup();
+                    
                     for(int i=0; i < nshards; i++) {
                         std::string fname = shovel_filename(i);
                         shovelfs[i] = open(fname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
@@ -430,8 +1352,6 @@ namespace graphchi {
                             " error: " << strerror(errno) << std::endl;
                         }
                         assert(shovelfs[i] >= 0);
-                        bufs[i] = (edge_t*) malloc(bufsize);
-                        bufptrs[i] = 0;
                     }
                     break;
             }
@@ -442,303 +1362,432 @@ namespace graphchi {
             switch (phase) {
                 case COMPUTE_INTERVALS:
                     compute_partitionintervals();
-                    free(edgecounts);
-                    edgecounts = NULL;
+                    free_interval_counts();
                     break;
                 case SHOVEL:
+                    for(int i=0; i < nshards * nthreads; i++) {
+                        writea(shovelfs[i % nshards], bufs[i], sizeof(edge_t) * (bufptrs[i]));
+                        free(bufs[i]);
+                    }
                     for(int i=0; i<nshards; i++) {
-                        writea(shovelfs[i], bufs[i], sizeof(edge_t) * (bufptrs[i]));
                         close(shovelfs[i]);
-                        free(bufs[i]);
                     }
-                    free(bufs);
-                    free(bufptrs);
+                    delete [] shovelfs;
+                    delete [] shovellocks;
+                    delete [] bufs;
+                    delete [] bufptrs;
+                    shardlookup.clear();
                     break;
             }    
         }
         
         
-        int lastpart;
+        /**
+          * Adds edge to the shovel buffer of the thread. When the buffer is full,
+          * it is flushed to the shovel file of the shard.
+          */
+        void swrite(int thread, int shard, edge_t et) {
+            int bufidx = thread * nshards + shard;
+            bufs[bufidx][bufptrs[bufidx]++] = et;
+            if (bufptrs[bufidx] * sizeof(edge_t) >= bufsize) {
+                shovellocks[shard].lock();
+                writea(shovelfs[shard], bufs[bufidx], sizeof(edge_t) * bufptrs[bufidx]);
+                shovellocks[shard].unlock();
+                bufptrs[bufidx] = 0;
+            }
+        }
         
-        void swrite(int shard, edge_t et) {
-            bufs[shard][bufptrs[shard]++] = et;
-            if (bufptrs[shard] * sizeof(edge_t) >= bufsize) {
-                writea(shovelfs[shard], bufs[shard], sizeof(edge_t) * bufptrs[shard]);
-                bufptrs[shard] = 0;
+        /**
+          * Builds the shard lookup table, with at least 64 chunks per shard
+          * so that usually at most one interval begins within a chunk.
+          */
+        void init_shard_lookup() {
+            size_t maxentries = std::max((size_t)65536, (size_t)64 * nshards);
+            lookupshift = 0;
+            while (((size_t)max_vertex_id >> lookupshift) + 1 > maxentries) lookupshift++;
+            shardlookup.resize(((size_t)max_vertex_id >> lookupshift) + 1);
+            int shard = 0;
+            for(size_t c=0; c < shardlookup.size(); c++) {
+                vid_t chunkst = (vid_t) (c << lookupshift);
+                while (shard < nshards - 1 && chunkst > intervals[shard].second) shard++;
+                shardlookup[c] = shard;
             }
-            
         }
         
-        void receive_edge(vid_t from, vid_t to, EdgeDataType value) {
+        /**
+          * Returns the shard whose interval contains the vertex.
+          */
+        inline int shard_for(vid_t to) {
+            int shard = shardlookup[to >> lookupshift];
+            while (to > intervals[shard].second) shard++;
+            return shard;
+        }
+        
+        /**
+          * Returns false for self-edges, which are dropped. They are normally
+          * dropped already in preprocessing, but older preprocessed files
+          * may contain them.
+          */
+        bool check_edge(vid_t from, vid_t to) {
             if (to == from) {
-                logstream(LOG_WARNING) << "Tried to add self-edge " << from << "->" << to << std::endl;
-                return;
+                return false;
             }
             if (from > max_vertex_id || to > max_vertex_id) {
                 logstream(LOG_ERROR) << "Tried to add an edge with too large from/to values. From:" << 
                     from << " to: "<< to << " max: " << max_vertex_id << std::endl;
                 assert(false);
             }
+            return true;
+        }
+        
+        void receive_edge(vid_t from, vid_t to, EdgeDataType value) {
+            if (!check_edge(from, to)) {
+                if (phase == SHOVEL) nselfedges++;
+                return;
+            }
             switch (phase) {
                 case COMPUTE_INTERVALS:
                     edgecounts[to / vertexchunk]++;
+                    outedgecounts[from / vertexchunk]++;
                     nedges++;
                     break;
                 case SHOVEL:
-                    bool found=false;
-                    for(int i=0; i < nshards; i++) {
-                        int shard = (lastpart + i) % nshards;
-                        if (to >= intervals[shard].first && to <= intervals[shard].second) {
-                            swrite(shard, edge_t(from, to, value));
-                            lastpart = shard;  // Small optimizations, which works if edges are in order for each vertex - not much though
-                            found = true;
-                            break;
+                    swrite(0, shard_for(to), edge_t(from, to, value));
+                    break;
+            }
+        }
+        
+        /**
+          * Processes a block of edges in parallel. 
+          */
+        void receive_edges(edge_t * edges, size_t n) {
+            switch (phase) {
+                case COMPUTE_INTERVALS: {
+                    size_t counted = 0;
+#pragma omp parallel for num_threads(nthreads) reduction(+:counted)
+                    for(long i=0; i < (long)n; i++) {
+                        if (check_edge(edges[i].src, edges[i].dst)) {
+                            __sync_add_and_fetch(&edgecounts[edges[i].dst / vertexchunk], 1);
+                            __sync_add_and_fetch(&outedgecounts[edges[i].src / vertexchunk], 1);
+                            counted++;
                         }
                     }
-                    if(!found) {
-                       logstream(LOG_ERROR) << "Shard not found for : " << to << std::endl; 
+                    nedges += counted;
+                    break;
+                }
+                case SHOVEL: {
+                    size_t selfedges = 0;
+#pragma omp parallel num_threads(nthreads) reduction(+:selfedges)
+                {
+                    int thread = omp_get_thread_num();
+#pragma omp for
+                    for(long i=0; i < (long)n; i++) {
+                        if (check_edge(edges[i].src, edges[i].dst)) {
+                            swrite(thread, shard_for(edges[i].dst), edges[i]);
+                        } else {
+                            selfedges++;
+                        }
                     }
-                    assert(found);
+                }
+                    nselfedges += selfedges;
                     break;
+                }
             }
         }
         
-              
-        
         /** 
           * Write the shard by sorting the shovel file and compressing the
           * adjacency information.
           * To support different shard types, override this function!
           */
         virtual void write_shards() {
+            /* Shards are processed in parallel, as many at a time as fit in memory.
+               Radix sort needs a temporary array of the size of the shovel. */
+            size_t maxshovelsize = 0;
             for(int shard=0; shard < nshards; shard++) {
-                logstream(LOG_INFO) << "Starting final processing for shard: " << shard << std::endl;
-                
-                std::string shovelfname = shovel_filename(shard);
-                std::string fname = filename_shard_adj(basefilename, shard, nshards);
-                std::string edfname = filename_shard_edata<EdgeDataType>(basefilename, shard, nshards);
-                
-                edge_t * shovelbuf;
-                int shovelf = open(shovelfname.c_str(), O_RDONLY);
-                size_t shovelsize = readfull(shovelf, (char**) &shovelbuf);
-                size_t numedges = shovelsize / sizeof(edge_t);
-                
-                logstream(LOG_DEBUG) << "Shovel size:" << shovelsize << " edges: " << numedges << std::endl;
-                
-                quickSort(shovelbuf, (int)numedges, edge_t_src_less<EdgeDataType>);
-               
-                // Create the final file
-                int f = open(fname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                if (f < 0) {
-                    logstream(LOG_ERROR) << "Could not open " << fname << " error: " << strerror(errno) << std::endl;
-                }
-                assert(f >= 0);
-                int trerr = ftruncate(f, 0);
-                assert(trerr == 0);
-                
-                /* Create edge data file */
-                int ef = open(edfname.c_str(), O_WRONLY | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
-                if (ef < 0) {
-                    logstream(LOG_ERROR) << "Could not open " << edfname << " error: " << strerror(errno) << std::endl;
-        
-                }
-                assert(ef >= 0);
-                
-                char * buf = (char*) malloc(SHARDER_BUFSIZE); 
-                char * bufptr = buf;
-                char * ebuf = (char*) malloc(SHARDER_BUFSIZE);
-                char * ebufptr = ebuf;
-                
-                vid_t curvid=0;
-                size_t istart = 0;
-                for(size_t i=0; i <= numedges; i++) {
-                    edge_t edge = (i < numedges ? shovelbuf[i] : edge_t(0, 0, EdgeDataType())); // Last "element" is a stopper
-                    bwrite<EdgeDataType>(ef, ebuf, ebufptr, EdgeDataType(edge.value));
-                  
-                    if ((edge.src != curvid)) {
-                        // New vertex
-                        size_t count = i - istart;
-                        assert(count>0 || curvid==0);
-                        if (count>0) {
-                            if (count < 255) {
-                                uint8_t x = (uint8_t)count;
-                                bwrite<uint8_t>(f, buf, bufptr, x);
-                            } else {
-                                bwrite<uint8_t>(f, buf, bufptr, 0xff);
-                                bwrite<uint32_t>(f, buf, bufptr,(uint32_t)count);
-                            }
-                        }
-                        
-                        for(size_t j=istart; j<i; j++) {
-                            bwrite(f, buf, bufptr,  shovelbuf[j].dst);
-                        }
-                        
-                        istart = i;
-                        
-                        // Handle zeros
-                        if (!edge.stopper()) {
-                            if (edge.src - curvid > 1 || (i == 0 && edge.src>0)) {
-                                int nz = edge.src-curvid-1;
-                                if (i == 0 && edge.src>0) nz = edge.src; // border case with the first one
-                                do {
-                                    bwrite<uint8_t>(f, buf, bufptr, 0);
-                                    nz--;
-                                    int tnz = std::min(254, nz);
-                                    bwrite<uint8_t>(f, buf, bufptr, (uint8_t) tnz);
-                                    nz -= tnz;
-                                } while (nz>0);
-                            }
-                        }
-                        curvid = edge.src;
+                maxshovelsize = std::max(maxshovelsize, shovel_size(shard));
+            }
+            size_t membudget = 1024 * 1024 * get_option_long("membudget_mb", 1024);
+            
+            /* The degrees are counted while writing the shards, if they fit in
+               half of the memory budget. Otherwise each writer writes the 
+               in-degrees of its interval and spills the out-degrees, which are
+               added to the degree file afterwards. */
+            size_t nvertices = 1 + (size_t)intervals[nshards - 1].second;
+            size_t degreebytes = nvertices * sizeof(int) * 2;
+            size_t maxintervalbytes = 0;
+            for(int shard=0; shard < nshards; shard++) {
+                size_t len = (size_t)(intervals[shard].second - intervals[shard].first) + 1;
+                maxintervalbytes = std::max(maxintervalbytes, len * sizeof(int) * 2);
+            }
+            int * degrees = NULL;
+            if (degreebytes <= membudget / 2) {
+                degrees = (int*) calloc(nvertices * 2, sizeof(int));
+                assert(degrees != NULL);
+                membudget -= degreebytes;
+            } else {
+                logstream(LOG_INFO) << "Degrees do not fit in memory, spilling the out-degrees of the shards." << std::endl;
+                create_empty_degree_file(nvertices);
+            }
+            
+            size_t writermem = 2 * maxshovelsize + 2 * SHARDER_BUFSIZE + (degrees == NULL ? maxintervalbytes + SHARDER_BUFSIZE : 0);
+            int nwriters = (int) std::min((size_t)nthreads, membudget / writermem);
+            nwriters = std::max(1, nwriters);
+            int sortthreads = std::max(1, nthreads / nwriters);
+            logstream(LOG_INFO) << "Writing " << nwriters << " shards in parallel." << std::endl;
+            
+            omp_set_nested(1);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nwriters)
+            for(int shard=0; shard < nshards; shard++) {
+                write_shard(shard, membudget / nwriters, sortthreads, degrees);
+            }
+            
+            if (streaming) {
+                for(int i=0; i < (int)bucketbounds.size(); i++) {
+                    if (!bucketsplit[i]) {
+                        remove(bucket_filename(i).c_str());
+                        continue;
+                    }
+                    int first, last;
+                    bucket_shards(i, first, last);
+                    for(int shard=first; shard <= last; shard++) {
+                        remove(bucket_filename(i, shard).c_str());
                     }
                 }
-                
-                /* Flush buffers and free memory */
-                writea(f, buf, bufptr - buf);
-                free(buf);
-                free(shovelbuf);
-                close(f);
-                close(shovelf);
-                
-                writea(ef, ebuf, ebufptr - ebuf);
-                close(ef);
-                
-                free(ebuf);
-                remove(shovelfname.c_str()); 
-                
             }
             
-            create_degree_file();
+            if (degrees != NULL) {
+                write_degree_file(degrees, nvertices);
+                free(degrees);
+            } else {
+                add_spilled_outdegrees(nvertices, membudget);
+            }
         }
         
+        size_t shovel_size(int shard) {
+            std::vector<std::string> parts = shovel_parts(shard);
+            size_t sz = 0;
+            for(int i=0; i < (int)parts.size(); i++) sz += get_filesize(parts[i]);
+            return sz;
+        }
         
-        typedef char dummy_t;
-
-        typedef sliding_shard<int, dummy_t> slidingshard_t;
-        typedef memory_shard<int, dummy_t> memshard_t;
-
+        std::string run_filename(int shard, int run) {
+            std::stringstream ss;
+            ss << shovel_filename(shard) << ".run" << run;
+            return ss.str();
+        }
+        
+        void sort_edges(edge_t * edges, edge_t * tmp, size_t numedges, int sortthreads) {
+            sort_edges_by_src<EdgeDataType>(edges, tmp, numedges, max_vertex_id, sortthreads);
+        }
         
-        void create_degree_file() {
-            // Initialize IO
-            stripedio * iomgr = new stripedio(m);
-            std::vector<slidingshard_t * > sliding_shards;
+        /**
+          * Sorts the shovel file of a shard and writes the compressed adjacency 
+          * and edge data files. If the shovel does not fit in the memory budget,
+          * it is sorted in runs that are merged while writing the shard.
+          */
+        void write_shard(int shard, size_t membudget, int sortthreads, int * degrees) {
+            logstream(LOG_INFO) << "Starting final processing for shard: " << shard << std::endl;
             
-            int subwindow = 5000000;
-            std::cout << "Subwindow : " << subwindow << std::endl;
-            m.set("subwindow", (size_t)subwindow);
+            std::vector<std::string> parts = shovel_parts(shard);
+            std::string fname = filename_shard_adj(basefilename, shard, nshards);
+            std::string edfname = filename_shard_edata<EdgeDataType>(basefilename, shard, nshards);
             
-            int loadthreads = 4;
+            size_t shovelsize = shovel_size(shard);
+            size_t numedges = shovelsize / sizeof(edge_t);  // Upper bound in streaming mode
+            int part = 0;
+            size_t partoffset = 0;
             
-            m.start_time("degrees.runtime");
+            logstream(LOG_DEBUG) << "Shovel size:" << shovelsize << " edges: " << numedges << std::endl;
             
-            /* Initialize streaming shards */
-            int blocksize = get_option_int("blocksize", 1024 * 1024);
+            /* Edges in a sorted run, which needs space for the run and the temporary array */
+            size_t sortbudget = (membudget > 4 * SHARDER_BUFSIZE ? membudget - 2 * SHARDER_BUFSIZE : membudget / 2);
+            size_t runedges = std::max((size_t) 65536, sortbudget / 2 / sizeof(edge_t));
             
-            for(int p=0; p < nshards; p++) {
-                std::cout << "Initialize streaming shard: " << p << std::endl;
-                sliding_shards.push_back(
-                                        new slidingshard_t(iomgr, filename_shard_edata<EdgeDataType>(basefilename, p, nshards), 
-                                                           filename_shard_adj(basefilename, p, nshards), intervals[p].first, 
-                                                           intervals[p].second, 
-                                                           blocksize, m, true));
+            shard_writer<EdgeDataType> writer(fname, edfname, degrees, combiner);
+            remove(filename_shard_deletions(fname).c_str());  // Of an earlier shard with the same name
+            
+            int * indegrees = NULL;
+            size_t intervallen = (size_t)(intervals[shard].second - intervals[shard].first) + 1;
+            if (degrees == NULL) {
+                indegrees = (int*) calloc(intervallen * 2, sizeof(int));
+                assert(indegrees != NULL);
+                writer.spill_degrees(indegrees, intervals[shard].first, degree_spill_filename(shard));
             }
-            for(int p=0; p < nshards; p++) sliding_shards[p]->only_adjacency = true;
             
-            graphchi_context ginfo;
-            ginfo.nvertices = 1 + intervals[nshards - 1].second;
-            ginfo.scheduler = NULL;
+            if (numedges <= runedges) {
+                edge_t * shovelbuf = (edge_t*) malloc(std::max((size_t)1, numedges) * sizeof(edge_t));
+                edge_t * tmpbuf = (edge_t*) malloc(std::max((size_t)1, numedges) * sizeof(edge_t));
+                assert(shovelbuf != NULL && tmpbuf != NULL);
+                numedges = read_shovel_edges(shard, parts, part, partoffset, shovelbuf, numedges);
+                
+                sort_edges(shovelbuf, tmpbuf, numedges, sortthreads);
+                free(tmpbuf);
+                
+                for(size_t i=0; i < numedges; i++) {
+                    writer.add(shovelbuf[i]);
+                }
+                writer.done();
+                free(shovelbuf);
+            } else {
+                /* External sort */
+                logstream(LOG_INFO) << "Shovel " << shard << " does not fit in memory, sorting in runs." << std::endl;
+                
+                edge_t * runbuf = (edge_t*) malloc(runedges * sizeof(edge_t));
+                edge_t * tmpbuf = (edge_t*) malloc(runedges * sizeof(edge_t));
+                assert(runbuf != NULL && tmpbuf != NULL);
+                int nruns = 0;
+                while (true) {
+                    size_t len = read_shovel_edges(shard, parts, part, partoffset, runbuf, runedges);
+                    if (len == 0) break;
+                    sort_edges(runbuf, tmpbuf, len, sortthreads);
+                    
+                    std::string runfname = run_filename(shard, nruns++);
+                    int runf = open(runfname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+                    if (runf < 0) {
+                        logstream(LOG_ERROR) << "Could not create a temporary file " << runfname << " error: " << strerror(errno) << std::endl;
+                    }
+                    assert(runf >= 0);
+                    writea(runf, runbuf, len * sizeof(edge_t));
+                    close(runf);
+                }
+                free(runbuf);
+                free(tmpbuf);
+                logstream(LOG_INFO) << "Merging " << nruns << " sorted runs of shard " << shard << std::endl;
+                
+                /* Merge the runs directly to the shard writer */
+                std::vector< merge_source<edge_t> * > sources;
+                for(int run=0; run < nruns; run++) {
+                    sources.push_back(new shovel_run_source<EdgeDataType>(run_filename(shard, run), sortbudget / nruns));
+                }
+                kway_merge<edge_t, bool (*)(const edge_t&, const edge_t&)> merger(sources, &writer, edge_t_src_less<EdgeDataType>);
+                merger.merge();
+                
+                for(int run=0; run < nruns; run++) {
+                    delete sources[run];
+                    remove(run_filename(shard, run).c_str());
+                }
+            }
+            __sync_fetch_and_add(&nduplicates, writer.nduplicates);
             
+            /* The interval belongs to this shard only, so its in-degrees are final */
+            if (indegrees != NULL) {
+                std::string degfname = filename_degree_data(basefilename);
+                int degf = open(degfname.c_str(), O_WRONLY);
+                assert(degf >= 0);
+                pwritea(degf, indegrees, intervallen * sizeof(int) * 2, (size_t)intervals[shard].first * sizeof(int) * 2);
+                close(degf);
+                free(indegrees);
+            }
             
+            if (!streaming) {
+                remove(shovel_filename(shard).c_str()); 
+            }
+        }
+        
+        
+        /**
+          * Writes the degrees counted while writing the shards.
+          */
+        void write_degree_file(int * degrees, size_t nvertices) {
             std::string outputfname = filename_degree_data(basefilename);
-            
-            int degreeOutF = open(outputfname.c_str(), O_RDWR | O_CREAT, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            int degreeOutF = open(outputfname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
             if (degreeOutF < 0) {
-                logstream(LOG_ERROR) << "Could not create: " << degreeOutF << std::endl;
+                logstream(LOG_ERROR) << "Could not create: " << outputfname << " error: " << strerror(errno) << std::endl;
             }
             assert(degreeOutF >= 0);
-            int trerr = ftruncate(degreeOutF, ginfo.nvertices * sizeof(int) * 2);
+            m.start_time("degrees.runtime");
+            pwritea(degreeOutF, degrees, nvertices * sizeof(int) * 2, 0);
+            close(degreeOutF);
+            m.stop_time("degrees.runtime");
+        }
+        
+        std::string degree_spill_filename(int shard) {
+            std::stringstream ss;
+            ss << shovel_filename(shard) << ".outdegs";
+            return ss.str();
+        }
+        
+        /**
+          * Creates the degree file, which the shard writers fill with the
+          * in-degrees of their intervals.
+          */
+        void create_empty_degree_file(size_t nvertices) {
+            std::string outputfname = filename_degree_data(basefilename);
+            int degreeOutF = open(outputfname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            if (degreeOutF < 0) {
+                logstream(LOG_ERROR) << "Could not create: " << outputfname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(degreeOutF >= 0);
+            int trerr = ftruncate(degreeOutF, nvertices * sizeof(int) * 2);
             assert(trerr == 0);
+            close(degreeOutF);
+        }
+        
+        /**
+          * Adds the out-degrees spilled by the shard writers to the degree file.
+          * The spills are sorted by vertex id, so the degree file is updated 
+          * in windows, reading each spill once.
+          */
+        void add_spilled_outdegrees(size_t nvertices, size_t membudget) {
+            m.start_time("degrees.runtime");
+            std::string outputfname = filename_degree_data(basefilename);
+            int degreeOutF = open(outputfname.c_str(), O_RDWR);
+            if (degreeOutF < 0) {
+                logstream(LOG_ERROR) << "Could not open: " << outputfname << " error: " << strerror(errno) << std::endl;
+            }
+            assert(degreeOutF >= 0);
             
-            for(int window=0; window<nshards; window++) {
-                metrics_entry mwi = m.start_time();
-                
-                vid_t interval_st = intervals[window].first;
-                vid_t interval_en = intervals[window].second;
-                
-                /* Flush stream shard for the window */
-                sliding_shards[window]->flush();
-                
-                /* Load shard[window] into memory */
-                memshard_t memshard(iomgr, filename_shard_edata<EdgeDataType>(basefilename, window, nshards), filename_shard_adj(basefilename, window, nshards),
-                                              interval_st, interval_en, m);
-                memshard.only_adjacency = true;
-                logstream(LOG_INFO) << "Interval: " << interval_st << " " << interval_en << std::endl;
-                
-                for(vid_t subinterval_st=interval_st; subinterval_st < interval_en; ) {
-                    vid_t subinterval_en = std::min(interval_en, subinterval_st + subwindow);
-                    logstream(LOG_INFO) << "(Degree proc.) Sub-window: [" << subinterval_st << " - " << subinterval_en << "]" << std::endl;
-                    assert(subinterval_en >= subinterval_st && subinterval_en <= interval_en);
-                                        
-                    /* Preallocate vertices */
-                    metrics_entry men = m.start_time();
-                    int nvertices = subinterval_en-subinterval_st+1;
-                    std::vector< graphchi_vertex<int, dummy_t> > vertices(nvertices, graphchi_vertex<int, dummy_t>()); // preallocate
-                    
-                    
-                    for(int i=0; i < nvertices; i++) {
-                        vertices[i] = graphchi_vertex<int, dummy_t>(subinterval_st + i, NULL, NULL, 0, 0);
-                        vertices[i].scheduled =  true;
-                    } 
-                    
-                    metrics_entry me = m.start_time();
-                    omp_set_num_threads(loadthreads);
-#pragma omp parallel for
-                    for(int p=-1; p < nshards; p++)  {
-                        if (p == (-1)) {
-                            // if first window, now need to load the memshard
-                            if (memshard.loaded() == false) {
-                                memshard.load();
-                            }
-                            
-                            /* Load vertices from memshard (only inedges for now so can be done in parallel) */
-                            memshard.load_vertices(subinterval_st, subinterval_en, vertices);
-                        } else {
-                            /* Stream forward other than the window partition */
-                            if (p != window) {
-                                sliding_shards[p]->read_next_vertices(nvertices, subinterval_st, vertices, false);
-                            }
+            size_t spillbufentries = std::max((size_t)1024, membudget / 4 / nshards / sizeof(degree_spill_entry));
+            std::vector<degree_spill_entry *> bufs(nshards);
+            std::vector<size_t> buflens(nshards, 0), bufidxs(nshards, 0), offsets(nshards, 0), sizes(nshards);
+            std::vector<int> fds(nshards);
+            for(int p=0; p < nshards; p++) {
+                std::string fname = degree_spill_filename(p);
+                fds[p] = open(fname.c_str(), O_RDONLY);
+                if (fds[p] < 0) {
+                    logstream(LOG_ERROR) << "Could not open: " << fname << " error: " << strerror(errno) << std::endl;
+                }
+                assert(fds[p] >= 0);
+                sizes[p] = get_filesize(fname);
+                bufs[p] = (degree_spill_entry *) malloc(spillbufentries * sizeof(degree_spill_entry));
+                assert(bufs[p] != NULL);
+            }
+            
+            size_t window = std::max((size_t)65536, membudget / 2 / (sizeof(int) * 2));
+            int * degbuf = (int*) malloc(std::min(window, nvertices) * sizeof(int) * 2);
+            assert(degbuf != NULL);
+            for(size_t st=0; st < nvertices; st += window) {
+                size_t len = std::min(window, nvertices - st);
+                preada(degreeOutF, degbuf, len * sizeof(int) * 2, st * sizeof(int) * 2);
+                for(int p=0; p < nshards; p++) {
+                    while (true) {
+                        if (bufidxs[p] == buflens[p]) {
+                            size_t toread = std::min(spillbufentries * sizeof(degree_spill_entry), sizes[p] - offsets[p]);
+                            if (toread == 0) break;
+                            preada(fds[p], bufs[p], toread, offsets[p]);
+                            offsets[p] += toread;
+                            buflens[p] = toread / sizeof(degree_spill_entry);
+                            bufidxs[p] = 0;
                         }
+                        degree_spill_entry &e = bufs[p][bufidxs[p]];
+                        if ((size_t)e.vid >= st + len) break;
+                        degbuf[2 * ((size_t)e.vid - st) + 1] += (int)e.count;
+                        bufidxs[p]++;
                     }
-                    
-                    m.stop_time(me, "stream_ahead", window,  true);  
-                    
-                    
-                    metrics_entry mev = m.start_time();
-                    // Read first current values
-                    
-                    int * vbuf = (int*) malloc(nvertices*sizeof(int)*2);
-                    
-                    for(int i=0; i<nvertices; i++) {
-                        vbuf[2 * i] = vertices[i].num_inedges();
-                        vbuf[2 * i +1] = vertices[i].num_outedges();
-                    }
-                    pwritea(degreeOutF, vbuf, nvertices * sizeof(int) * 2, subinterval_st * sizeof(int) * 2);
-                    
-                    free(vbuf);
-                    
-                    // Move window
-                    subinterval_st = subinterval_en+1;
                 }
-                /* Move the offset of the window-shard forward */
-                sliding_shards[window]->set_offset(memshard.offset_for_stream_cont(), memshard.offset_vid_for_stream_cont(),
-                                                  memshard.edata_ptr_for_stream_cont());   
+                pwritea(degreeOutF, degbuf, len * sizeof(int) * 2, st * sizeof(int) * 2);
+            }
+            free(degbuf);
+            for(int p=0; p < nshards; p++) {
+                free(bufs[p]);
+                close(fds[p]);
+                remove(degree_spill_filename(p).c_str());
             }
             close(degreeOutF);
             m.stop_time("degrees.runtime");
-            delete iomgr;
         }
 
-
     }; // End class sharder
    
 }; // namespace
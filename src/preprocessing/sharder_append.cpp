@@ -0,0 +1,79 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ 
+ *
+ * @section DESCRIPTION
+ *
+ * Sharder_append adds the edges of a file to the shards of a graph
+ * that has already been sharded, without sharding the graph again.
+ * The edges are read in the same formats as in sharder_basic. For a
+ * reordered graph, give the name of the reordered shards, e.g
+ * file=mygraph_degord.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <assert.h>
+
+#include "logger/logger.hpp"
+#include "preprocessing/shardappend.hpp"
+#include "util/cmdopts.hpp"
+
+using namespace graphchi;
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+    
+    global_logger().set_log_level(LOG_DEBUG);
+    
+    std::string basefile = get_option_string_interactive("file", "[path to the sharded graph]");
+    std::string deltafile = get_option_string_interactive("delta", "[path to the file with the new edges]");
+    std::string edge_data_type = get_option_string_interactive("edgedatatype", "int, uint, short, float, char, double, boolean, long, float-float, int-int");
+    std::string filetype = get_option_string("filetype", "edgelist");
+    
+    if (edge_data_type == "float") {
+        append_edges<float>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "float-float") {
+        append_edges<PairContainer<float> >(basefile, deltafile, filetype);
+    } else if (edge_data_type == "int") {
+        append_edges<int>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "uint") {
+        append_edges<unsigned int>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "int-int") {
+        append_edges<PairContainer<int> >(basefile, deltafile, filetype);
+    } else if (edge_data_type == "short") {
+        append_edges<short>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "double") {
+        append_edges<double>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "char") {
+        append_edges<char>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "boolean") {
+        append_edges<bool>(basefile, deltafile, filetype);
+    } else if (edge_data_type == "long") {
+        append_edges<long>(basefile, deltafile, filetype);
+    } else {
+        logstream(LOG_ERROR) << "You need to specify edgedatatype. Currently supported: int, short, float, char, double, boolean, long.";
+        return -1;    
+    }
+    
+    return 0;
+}
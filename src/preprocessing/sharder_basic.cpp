@@ -33,6 +33,7 @@
 
 #include "logger/logger.hpp"
 #include "preprocessing/conversions.hpp"
+#include "preprocessing/reordering.hpp"
 #include "preprocessing/sharder.hpp"
 #include "util/cmdopts.hpp"
 
@@ -47,27 +48,28 @@ int main(int argc, const char ** argv) {
     std::string basefile = get_option_string_interactive("file", "[path to the input graph]");
     std::string edge_data_type = get_option_string_interactive("edgedatatype", "int, uint, short, float, char, double, boolean, long, float-float, int-int");
     std::string nshards_str = get_option_string_interactive("nshards", "Number of shards to create, or 'auto'");
+    std::string ordering = get_option_string("reorder", "none");  // none, degree, rcm or gorder
     
     if (edge_data_type == "float") {
-        convert<float>(basefile, nshards_str);
+        convert<float>(basefile, nshards_str, create_reordering_preprocessor<float>(ordering));
     } if (edge_data_type == "float-float") {
-        convert<PairContainer<float> >(basefile, nshards_str);
+        convert<PairContainer<float> >(basefile, nshards_str, create_reordering_preprocessor<PairContainer<float> >(ordering));
     } else if (edge_data_type == "int") {
-        convert<int>(basefile, nshards_str);
+        convert<int>(basefile, nshards_str, create_reordering_preprocessor<int>(ordering));
     } else if (edge_data_type == "uint") {
-        convert<unsigned int>(basefile, nshards_str);
+        convert<unsigned int>(basefile, nshards_str, create_reordering_preprocessor<unsigned int>(ordering));
     } else if (edge_data_type == "int-int") {
-        convert<PairContainer<int> >(basefile, nshards_str);
+        convert<PairContainer<int> >(basefile, nshards_str, create_reordering_preprocessor<PairContainer<int> >(ordering));
     } else if (edge_data_type == "short") {
-        convert<short>(basefile, nshards_str);
+        convert<short>(basefile, nshards_str, create_reordering_preprocessor<short>(ordering));
     } else if (edge_data_type == "double") {
-        convert<double>(basefile, nshards_str);
+        convert<double>(basefile, nshards_str, create_reordering_preprocessor<double>(ordering));
     } else if (edge_data_type == "char") {
-        convert<char>(basefile, nshards_str);
+        convert<char>(basefile, nshards_str, create_reordering_preprocessor<char>(ordering));
     } else if (edge_data_type == "boolean") {
-        convert<bool>(basefile, nshards_str);
+        convert<bool>(basefile, nshards_str, create_reordering_preprocessor<bool>(ordering));
     } else if (edge_data_type == "long") {
-        convert<long>(basefile, nshards_str);
+        convert<long>(basefile, nshards_str, create_reordering_preprocessor<long>(ordering));
     } else {
         logstream(LOG_ERROR) << "You need to specify edgedatatype. Currently supported: int, short, float, char, double, boolean, long.";
         return -1;    
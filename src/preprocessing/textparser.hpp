@@ -0,0 +1,315 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Parallel parsing of memory-mapped text files. The file is split
+ * into chunks of complete lines, which are parsed by several threads.
+ * The results are passed on in the order of the chunks, so the output
+ * is the same as with sequential parsing. Gzip-compressed files are
+ * decompressed by an external gzip process and parsed from the stream.
+ */
+
+#ifndef GRAPHCHI_TEXTPARSER_DEF
+#define GRAPHCHI_TEXTPARSER_DEF
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+
+namespace graphchi {
+
+#define TEXTPARSER_CHUNKSIZE (16 * 1024 * 1024)
+
+    /* Scanning functions. The functions return pointer to the first
+       character that was not consumed. */
+
+    inline bool is_field_delim(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char * skip_delims(const char * p, const char * end) {
+        while (p < end && is_field_delim(*p)) p++;
+        return p;
+    }
+
+    /**
+      * Parses an unsigned decimal number. If there is no number,
+      * returns p.
+      */
+    inline const char * scan_vid(const char * p, const char * end, vid_t &x) {
+        x = 0;
+        while (p < end && (unsigned)(*p - '0') < 10) {
+            x = x * 10 + (vid_t)(*p - '0');
+            p++;
+        }
+        return p;
+    }
+
+    /**
+      * Copies the next field to a null-terminated buffer, for parsing
+      * with the standard functions. Returns false if the line has no more fields.
+      */
+    inline bool scan_field(const char * &p, const char * end, char * buf, size_t bufsize) {
+        p = skip_delims(p, end);
+        size_t len = 0;
+        while (p < end && !is_field_delim(*p) && *p != '\n') {
+            if (len + 1 < bufsize) buf[len++] = *p;
+            p++;
+        }
+        buf[len] = 0;
+        return len > 0;
+    }
+
+    /**
+      * Returns the start of the next line.
+      */
+    inline const char * next_line(const char * p, const char * end) {
+        const char * nl = (const char *) memchr(p, '\n', end - p);
+        return (nl == NULL ? end : nl + 1);
+    }
+
+    /**
+      * Read-only memory mapping of a text file.
+      */
+    class mmap_textfile {
+        int fd;
+        char * data;
+        size_t size;
+
+    public:
+        mmap_textfile(std::string filename) : data(NULL), size(0) {
+            fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                logstream(LOG_FATAL) << "Could not load :" << filename << " error: " << strerror(errno) << std::endl;
+            }
+            assert(fd >= 0);
+            struct stat st;
+            fstat(fd, &st);
+            size = (size_t) st.st_size;
+            if (size > 0) {
+                data = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    logstream(LOG_FATAL) << "Could not mmap :" << filename << " error: " << strerror(errno) << std::endl;
+                }
+                assert(data != MAP_FAILED);
+                madvise(data, size, MADV_SEQUENTIAL);
+            }
+        }
+
+        ~mmap_textfile() {
+            if (data != NULL) munmap(data, size);
+            close(fd);
+        }
+
+        const char * begin() { return data; }
+        const char * end() { return data + size; }
+
+        /**
+          * Splits the file into chunks of approximately chunksize bytes,
+          * ending at line boundaries. Returns the chunk start offsets,
+          * followed by the file size.
+          */
+        std::vector<size_t> line_chunks(size_t chunksize, size_t startoffset=0) {
+            std::vector<size_t> offsets;
+            offsets.push_back(std::min(startoffset, size));
+            while (offsets.back() < size) {
+                size_t off = offsets.back() + chunksize;
+                if (off >= size) {
+                    off = size;
+                } else {
+                    off = next_line(data + off, data + size) - data;
+                }
+                offsets.push_back(off);
+            }
+            return offsets;
+        }
+
+    private:
+        // Disable value copying
+        mmap_textfile(const mmap_textfile&);
+        mmap_textfile& operator=(const mmap_textfile&);
+    };
+
+    /**
+      * Parses a text file in parallel. ChunkParser must have functions
+      * parse_chunk(const char * st, const char * en, std::vector<T> &out), which
+      * is called in parallel, and flush(std::vector<T> &out), which is called
+      * for the chunks in the file order.
+      */
+    template <typename T, class ChunkParser>
+    void parse_text_parallel(std::string filename, ChunkParser &parser, int nthreads, size_t startoffset=0) {
+        mmap_textfile file(filename);
+        std::vector<size_t> chunks = file.line_chunks(TEXTPARSER_CHUNKSIZE, startoffset);
+        int nchunks = (int)chunks.size() - 1;
+        const char * base = file.begin();
+
+#pragma omp parallel for ordered schedule(dynamic, 1) num_threads(nthreads)
+        for(int i=0; i < nchunks; i++) {
+            std::vector<T> out;
+            parser.parse_chunk(base + chunks[i], base + chunks[i + 1], out);
+#pragma omp ordered
+            {
+                parser.flush(out);
+            }
+        }
+    }
+    
+    /**
+      * Checks the gzip magic number.
+      */
+    inline bool is_gzipped(std::string filename) {
+        unsigned char magic[2] = {0, 0};
+        FILE * f = fopen(filename.c_str(), "rb");
+        if (f == NULL) return false;
+        size_t rd = fread(magic, 1, 2, f);
+        fclose(f);
+        return rd == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    }
+    
+    /**
+      * Opens a text file for reading. Gzipped files are read through a pipe
+      * from a gzip process, whose pid is stored to gzpid (0 for plain files).
+      * The filename is passed to gzip as an argument, not through a shell.
+      * Close with close_text_input().
+      */
+    inline FILE * open_text_input(std::string filename, bool gzipped, pid_t &gzpid) {
+        FILE * f = NULL;
+        gzpid = 0;
+        if (gzipped) {
+            int fds[2];
+            if (pipe(fds) == 0) {
+                gzpid = fork();
+                if (gzpid == 0) {
+                    close(fds[0]);
+                    dup2(fds[1], STDOUT_FILENO);
+                    close(fds[1]);
+                    execlp("gzip", "gzip", "-dc", filename.c_str(), (char*) NULL);
+                    _exit(127);
+                }
+                close(fds[1]);
+                if (gzpid > 0) {
+                    f = fdopen(fds[0], "r");
+                } else {
+                    close(fds[0]);
+                    gzpid = 0;
+                }
+            }
+        } else {
+            f = fopen(filename.c_str(), "r");
+        }
+        if (f == NULL) {
+            logstream(LOG_FATAL) << "Could not load :" << filename << " error: " << strerror(errno) << std::endl;
+        }
+        assert(f != NULL);
+        return f;
+    }
+    
+    /**
+      * Closes a file opened with open_text_input(). Fails if gzip could not
+      * decompress the whole file.
+      */
+    inline void close_text_input(FILE * f, pid_t gzpid) {
+        fclose(f);
+        if (gzpid == 0) return;
+        int status = 0;
+        while (waitpid(gzpid, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+                logstream(LOG_FATAL) << "Could not run gzip." << std::endl;
+            } else if (WIFEXITED(status)) {
+                logstream(LOG_FATAL) << "gzip exited with error: " << WEXITSTATUS(status) << std::endl;
+            } else {
+                logstream(LOG_FATAL) << "gzip was killed by signal: " << WTERMSIG(status) << std::endl;
+            }
+            assert(false);
+        }
+    }
+    
+    /**
+      * Parses text from a stream, such as the output of gzip. Reads one chunk
+      * for each thread, and then parses them in parallel as parse_text_parallel().
+      */
+    template <typename T, class ChunkParser>
+    void parse_text_stream(FILE * f, ChunkParser &parser, int nthreads) {
+        std::vector<char *> bufs(nthreads);
+        std::vector<size_t> lens(nthreads);
+        for(int i=0; i < nthreads; i++) {
+            bufs[i] = (char*) malloc(TEXTPARSER_CHUNKSIZE);
+            assert(bufs[i] != NULL);
+        }
+        std::string carry;  // Incomplete line, moved to the next chunk
+        bool eof = false;
+        while (!eof) {
+            int nchunks = 0;
+            while (nchunks < nthreads && !eof) {
+                char * buf = bufs[nchunks];
+                size_t len = carry.size();
+                memcpy(buf, carry.data(), len);
+                len += fread(buf + len, 1, TEXTPARSER_CHUNKSIZE - len, f);
+                eof = (len < TEXTPARSER_CHUNKSIZE);
+                
+                /* Chunk ends at the last newline */
+                size_t chunkend = len;
+                if (!eof) {
+                    while (chunkend > 0 && buf[chunkend - 1] != '\n') chunkend--;
+                    if (chunkend == 0) {
+                        logstream(LOG_FATAL) << "Line longer than " << TEXTPARSER_CHUNKSIZE << " bytes." << std::endl;
+                        assert(false);
+                    }
+                }
+                carry.assign(buf + chunkend, len - chunkend);
+                lens[nchunks++] = chunkend;
+            }
+            
+#pragma omp parallel for ordered schedule(dynamic, 1) num_threads(nthreads)
+            for(int i=0; i < nchunks; i++) {
+                std::vector<T> out;
+                parser.parse_chunk(bufs[i], bufs[i] + lens[i], out);
+#pragma omp ordered
+                {
+                    parser.flush(out);
+                }
+            }
+        }
+        for(int i=0; i < nthreads; i++) free(bufs[i]);
+    }
+
+}
+
+#endif
+
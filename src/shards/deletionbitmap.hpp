@@ -0,0 +1,180 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Deleted edges of a shard. The bitmap has one bit for each edge, indexed
+ * by the position of the edge in the edge data file, and it is stored
+ * beside the adjacency file of the shard (filename_shard_deletions()).
+ * The shards skip the deleted edges while parsing the adjacency, so the
+ * edge data is not needed for it and can be loaded asynchronously.
+ *
+ * Edges are deleted with graphchi_vertex::remove_edge(), which requires
+ * SUPPORT_DELETIONS to be defined before including GraphChi. Programs
+ * compiled without it skip the edges deleted earlier, but cannot delete
+ * edges. The edges are dropped from the shards when the shards are
+ * rewritten: by the compaction of the dynamic graph engine, or by
+ * sharder_append.
+ */
+
+#ifndef DEF_GRAPHCHI_DELETIONBITMAP
+#define DEF_GRAPHCHI_DELETIONBITMAP
+
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "api/chifilenames.hpp"
+#include "api/graph_objects.hpp"
+#include "io/stripedio.hpp"
+#include "logger/logger.hpp"
+#include "util/ioutil.hpp"
+
+namespace graphchi {
+
+    class deletion_bitmap {
+
+        std::string filename;
+        size_t nedges;
+        std::vector<uint32_t> words;
+        size_t nsaved; // Number of deleted edges in the file
+
+    public:
+        /**
+          * Reads the bitmap from the file, if it exists.
+          */
+        deletion_bitmap(std::string filename, size_t nedges) : filename(filename), nedges(nedges),
+                    words((nedges + 31) / 32, 0), nsaved(0) {
+            if (!shard_file_exists(filename)) return;
+            size_t sz = get_filesize(filename);
+            if (sz != words.size() * sizeof(uint32_t)) {
+                logstream(LOG_FATAL) << "Deletion bitmap " << filename << " does not match the shard with " << nedges
+                    << " edges. The shard was rewritten without dropping the deleted edges." << std::endl;
+                assert(false);
+            }
+            if (sz > 0) {
+                int f = open(filename.c_str(), O_RDONLY);
+                assert(f >= 0);
+                preada(f, &words[0], sz, 0);
+                close(f);
+            }
+            nsaved = num_deleted();
+        }
+
+        size_t num_edges() const {
+            return nedges;
+        }
+
+        inline bool is_deleted(size_t idx) const {
+            return (words[idx >> 5] >> (idx & 31)) & 1;
+        }
+
+        inline edge_tombstone tombstone(size_t idx) {
+            return edge_tombstone(&words[idx >> 5], 1u << (idx & 31));
+        }
+
+        void remove(size_t idx) {
+            __sync_fetch_and_or(&words[idx >> 5], 1u << (idx & 31));
+        }
+
+        size_t num_deleted() const {
+            size_t n = 0;
+            for(size_t i=0; i < words.size(); i++) {
+                n += __builtin_popcount(words[i]);
+            }
+            return n;
+        }
+
+        /**
+          * Writes the bitmap, if edges have been deleted since it
+          * was read or saved. Edges are never undeleted.
+          */
+        void save() {
+            size_t n = num_deleted();
+            if (n == nsaved) return;
+            int f = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+            assert(f >= 0);
+            pwritea(f, &words[0], words.size() * sizeof(uint32_t), 0);
+            close(f);
+            nsaved = n;
+        }
+    };
+
+    /**
+      * Opens the deletion bitmap of a shard. Returns NULL if the edges of the
+      * shard cannot be deleted and none have been.
+      */
+    template <typename ET>
+    deletion_bitmap * open_deletion_bitmap(std::string adjfilename, std::string edatafilename) {
+        std::string filename = filename_shard_deletions(adjfilename);
+#ifndef SUPPORT_DELETIONS
+        if (!shard_file_exists(filename)) return NULL;
+#endif
+        return new deletion_bitmap(filename, get_filesize(edatafilename) / sizeof(ET));
+    }
+
+    /**
+      * Adds an edge of a shard to a vertex, unless the edge has been deleted.
+      * The edge has index idx in the bitmap.
+      */
+    template <typename svertex_t, typename ET>
+    inline void add_shard_inedge(svertex_t &vertex, vid_t src, ET * ptr, bool special_edge, deletion_bitmap * deletions, size_t idx) {
+        if (deletions != NULL) {
+            if (deletions->is_deleted(idx)) {
+#ifdef SUPPORT_DELETIONS
+                vertex.deleted_inc++;
+#endif
+                return;
+            }
+#ifdef SUPPORT_DELETIONS
+            vertex.add_inedge(src, ptr, special_edge, deletions->tombstone(idx));
+            return;
+#endif
+        }
+        vertex.add_inedge(src, ptr, special_edge);
+    }
+
+    template <typename svertex_t, typename ET>
+    inline void add_shard_outedge(svertex_t &vertex, vid_t dst, ET * ptr, bool special_edge, deletion_bitmap * deletions, size_t idx) {
+        if (deletions != NULL) {
+            if (deletions->is_deleted(idx)) {
+#ifdef SUPPORT_DELETIONS
+                __sync_add_and_fetch(&vertex.deleted_outc, 1);
+#endif
+                return;
+            }
+#ifdef SUPPORT_DELETIONS
+            vertex.add_outedge(dst, ptr, special_edge, deletions->tombstone(idx));
+            return;
+#endif
+        }
+        vertex.add_outedge(dst, ptr, special_edge);
+    }
+
+}
+
+#endif
+
@@ -0,0 +1,291 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * In-memory representation of all shards of a graph. Used by the engine
+ * when the whole graph fits in the memory budget: the shards are read once,
+ * and each vertex gets a contiguous array of its in-edges followed by its
+ * out-edges (i.e combined CSC/CSR). Edges point to the edge data arrays
+ * of the shards, which are written back to disk only on commit.
+ * This class should only be accessed internally by the GraphChi engine.
+ */
+
+#ifndef DEF_GRAPHCHI_INMEMORYGRAPH
+#define DEF_GRAPHCHI_INMEMORYGRAPH
+
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "api/chifilenames.hpp"
+#include "api/graph_objects.hpp"
+#include "io/stripedio.hpp"
+#include "logger/logger.hpp"
+#include "metrics/metrics.hpp"
+#include "graphchi_types.hpp"
+#include "shards/deletionbitmap.hpp"
+#include "shards/shardheader.hpp"
+
+
+namespace graphchi {
+
+    template <typename ET>
+    class inmemory_graph {
+
+        stripedio * iomgr;
+        std::string base_filename;
+        int nshards;
+        size_t nvertices;
+        bool only_adjacency;
+        metrics &m;
+
+        /* Edge data of each shard, in the order of the shard file */
+        std::vector<int> edata_sessions;
+        std::vector<ET *> edgedata;
+        std::vector<size_t> edatafilesizes;
+        std::vector<shard_adj_format> adjformats;
+        std::vector<deletion_bitmap *> deletions;
+
+        /* Vertex v has edges [offsets[v], offsets[v+1]), in-edges first */
+        size_t * offsets;
+        int * indegrees;
+        graphchi_edge<ET> * edges;
+        size_t nedges;
+
+    public:
+
+        inmemory_graph(stripedio * iomgr, std::string base_filename, int nshards, size_t nvertices,
+                       bool only_adjacency, metrics &_m) : iomgr(iomgr), base_filename(base_filename), nshards(nshards),
+                    nvertices(nvertices), only_adjacency(only_adjacency), m(_m) {
+            offsets = NULL;
+            indegrees = NULL;
+            edges = NULL;
+            nedges = 0;
+        }
+
+        ~inmemory_graph() {
+            for(int p=0; p < (int)edata_sessions.size(); p++) {
+                if (edgedata[p] != NULL) iomgr->managed_release(edata_sessions[p], &edgedata[p]);
+                iomgr->close_session(edata_sessions[p]);
+            }
+            for(int p=0; p < (int)deletions.size(); p++) {
+                if (deletions[p] != NULL) delete deletions[p];
+            }
+            if (offsets != NULL) free(offsets);
+            if (indegrees != NULL) free(indegrees);
+            if (edges != NULL) free(edges);
+        }
+
+        /**
+          * Returns the amount of memory (in bytes) needed to keep the
+          * graph in memory. Vertex values are not included.
+          */
+        static size_t estimate_memory(std::string base_filename, int nshards, size_t nvertices) {
+            size_t num_edges = 0;
+            for(int p=0; p < nshards; p++) {
+                num_edges += get_filesize(filename_shard_edata<ET>(base_filename, p, nshards)) / sizeof(ET);
+            }
+            return num_edges * (sizeof(ET) + 2 * sizeof(graphchi_edge<ET>)) +
+                        nvertices * (sizeof(size_t) + sizeof(int));
+        }
+
+        /**
+          * Returns the amount of memory (in bytes) that load() needs on top of
+          * estimate_memory(): the adjacency files of all shards are read at once,
+          * and the out-degrees are counted in a temporary array.
+          */
+        static size_t estimate_load_memory(std::string base_filename, int nshards, size_t nvertices) {
+            size_t adjbytes = 0;
+            for(int p=0; p < nshards; p++) {
+                adjbytes += get_filesize(filename_shard_adj(base_filename, p, nshards));
+            }
+            return adjbytes + nvertices * sizeof(int);
+        }
+
+        /**
+          * Reads all shards and builds the edge arrays.
+          */
+        void load() {
+            metrics_entry me = m.start_time();
+            offsets = (size_t *) calloc(nvertices + 1, sizeof(size_t));
+            indegrees = (int *) calloc(nvertices, sizeof(int));
+            int * outdegrees = (int *) calloc(nvertices, sizeof(int));
+            assert(offsets != NULL && indegrees != NULL && outdegrees != NULL);
+
+            /* Read adjacency of every shard. The files are parsed twice: first to
+               count the degrees, and then to fill the edge arrays. */
+            std::vector<uint8_t *> adjdata(nshards, (uint8_t*) NULL);
+            std::vector<size_t> adjfilesizes(nshards, 0);
+            std::vector<int> adj_sessions(nshards, -1);
+            for(int p=0; p < nshards; p++) {
+                std::string adj_filename = filename_shard_adj(base_filename, p, nshards);
+                adjfilesizes[p] = get_filesize(adj_filename);
+                adj_sessions[p] = iomgr->open_session(adj_filename, true);
+                iomgr->managed_malloc(adj_sessions[p], &adjdata[p], adjfilesizes[p], 0);
+                iomgr->managed_preada_now(adj_sessions[p], &adjdata[p], adjfilesizes[p], 0);
+
+                if (!only_adjacency) {
+                    std::string edata_filename = filename_shard_edata<ET>(base_filename, p, nshards);
+                    size_t edatasize = get_filesize(edata_filename);
+                    int edata_session = iomgr->open_session(edata_filename, false);
+                    ET * edata = NULL;
+                    iomgr->managed_malloc(edata_session, &edata, edatasize, 0);
+                    iomgr->managed_preada_now(edata_session, &edata, edatasize, 0);
+                    edata_sessions.push_back(edata_session);
+                    edgedata.push_back(edata);
+                    edatafilesizes.push_back(edatasize);
+                }
+
+                adjformats.push_back(read_shard_adj_format(adj_filename));
+                deletions.push_back(open_deletion_bitmap<ET>(adj_filename, filename_shard_edata<ET>(base_filename, p, nshards)));
+                parse_adjacency(adjdata[p], adjfilesizes[p], p, outdegrees, false);
+            }
+
+            /* Compute offsets */
+            for(size_t v=0; v < nvertices; v++) {
+                offsets[v + 1] = offsets[v] + indegrees[v] + outdegrees[v];
+            }
+            nedges = offsets[nvertices] / 2;
+            edges = (graphchi_edge<ET> *) malloc(sizeof(graphchi_edge<ET>) * offsets[nvertices]);
+            assert(edges != NULL || nedges == 0);
+
+            /* Fill edges. The degree arrays are used as cursors: in-degrees count up
+               from zero, and out-degrees count down to zero. */
+            memset(indegrees, 0, sizeof(int) * nvertices);
+            for(int p=0; p < nshards; p++) {
+                parse_adjacency(adjdata[p], adjfilesizes[p], p, outdegrees, true);
+                iomgr->managed_release(adj_sessions[p], &adjdata[p]);
+                iomgr->close_session(adj_sessions[p]);
+            }
+            free(outdegrees);
+            m.stop_time(me, "inmemory_graph_load");
+            logstream(LOG_INFO) << "Loaded graph into memory: " << nvertices << " vertices, " << nedges << " edges." << std::endl;
+        }
+
+        /**
+          * Writes the edge data back to the shard files.
+          */
+        void commit() {
+            if (only_adjacency) return;
+            metrics_entry me = m.start_time();
+            for(int p=0; p < (int)edata_sessions.size(); p++) {
+                iomgr->managed_pwritea_now(edata_sessions[p], &edgedata[p], edatafilesizes[p], 0);
+            }
+            m.stop_time(me, "inmemory_graph_commit");
+        }
+
+        size_t num_edges() {
+            return nedges;
+        }
+
+        inline int num_inedges(vid_t v) {
+            return indegrees[v];
+        }
+
+        inline int num_outedges(vid_t v) {
+            return (int) (offsets[v + 1] - offsets[v]) - indegrees[v];
+        }
+
+        /**
+          * Returns pointer to the in-edges of a vertex, which are
+          * immediately followed by its out-edges.
+          */
+        inline graphchi_edge<ET> * vertex_edges(vid_t v) {
+            return &edges[offsets[v]];
+        }
+
+    protected:
+
+        /**
+          * Parses the compressed adjacency format written by the sharder
+          * (see memory_shard::load_vertices()). If fill is false, only counts
+          * the degrees.
+          */
+        void parse_adjacency(uint8_t * adjdata, size_t adjfilesize, int p, int * outdegrees, bool fill) {
+            const int vidbytes = adjformats[p].vidbytes;
+            uint8_t * ptr = adjdata + adjformats[p].headersize;
+            uint8_t * end = adjdata + adjfilesize;
+            vid_t vid = 0;
+            size_t edgeidx = 0;
+            ET * edata = (only_adjacency ? NULL : edgedata[p]);
+            deletion_bitmap * deleted = deletions[p];
+
+            while (ptr < end) {
+                uint8_t ns = *ptr;
+                int n;
+                ptr += sizeof(uint8_t);
+
+                if (ns == 0x00) {
+                    // next value tells the number of vertices with zeros
+                    uint8_t nz = *ptr;
+                    ptr += sizeof(uint8_t);
+                    vid++;
+                    vid += nz;
+                    continue;
+                }
+
+                if (ns == 0xff) {
+                    n = *((uint32_t*)ptr);
+                    ptr += sizeof(uint32_t);
+                } else {
+                    n = ns;
+                }
+
+                while(--n >= 0) {
+                    vid_t target = read_shard_vid(ptr, vidbytes);
+                    ptr += vidbytes;
+                    assert(target < nvertices && vid < nvertices);
+                    if (deleted != NULL && deleted->is_deleted(edgeidx)) {
+                        edgeidx++;
+                        continue;
+                    }
+
+                    if (fill) {
+                        ET * eptr = (edata == NULL ? NULL : &edata[edgeidx]);
+                        edges[offsets[target] + indegrees[target]] = graphchi_edge<ET>(vid, eptr);
+                        edges[offsets[vid + 1] - outdegrees[vid]] = graphchi_edge<ET>(target, eptr);
+                        outdegrees[vid]--;
+                    } else {
+                        outdegrees[vid]++;
+                    }
+                    indegrees[target]++;
+                    edgeidx++;
+                }
+                vid++;
+            }
+        }
+
+    private:
+        // Disable value copying
+        inmemory_graph(const inmemory_graph&);
+        inmemory_graph& operator=(const inmemory_graph&);
+    };
+
+};
+
+#endif
+
@@ -43,6 +43,8 @@
 #include "metrics/metrics.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
+#include "shards/deletionbitmap.hpp"
+#include "shards/shardheader.hpp"
 
 
 namespace graphchi {
@@ -68,6 +70,7 @@ namespace graphchi {
         size_t range_start_edge_ptr;
         size_t streaming_offset_edge_ptr;
         uint8_t * adjdata;
+        shard_adj_format adjformat;
         ET * edgedata;
         metrics &m;
         uint64_t chunkid;
@@ -77,6 +80,7 @@ namespace graphchi {
         streaming_task adj_stream_session;
         
         bool is_loaded;
+        deletion_bitmap * deletions;
         
     public:
         bool only_adjacency;
@@ -95,6 +99,7 @@ namespace graphchi {
             is_loaded = false;
             adj_session = -1;
             edata_iosession = -1;
+            deletions = NULL;
         }
         
         ~memory_shard() {
@@ -143,18 +148,22 @@ namespace graphchi {
             return is_loaded;
         }
         
+        /**
+          * Deleted edges are not added to the vertices. The bitmap
+          * is owned by the engine.
+          */
+        void set_deletions(deletion_bitmap * _deletions) {
+            deletions = _deletions;
+        }
+        
         // TODO: recycle ptr!
         void load() {
             is_loaded = true;
             adjfilesize = get_filesize(filename_adj);
+            adjformat = read_shard_adj_format(filename_adj);
             edatafilesize = get_filesize(filename_edata);
             
             bool async_inedgedata_loading = !svertex_t().computational_edges();
-            
-#ifdef SUPPORT_DELETIONS
-            async_inedgedata_loading = false;  // Currently we encode the deleted status of an edge into the edge value (should be changed!),
-                                               // so we need the edge data while loading
-#endif
                         
             //preada(adjf, adjdata, adjfilesize, 0);
             
@@ -193,12 +202,13 @@ namespace graphchi {
             assert(adjdata != NULL);
             
             // Now start creating vertices
-            uint8_t * ptr = adjdata;
-            uint8_t * end = ptr + adjfilesize;
+            const int vidbytes = adjformat.vidbytes;
+            uint8_t * ptr = adjdata + adjformat.headersize;
+            uint8_t * end = adjdata + adjfilesize;
             vid_t vid = 0;
             edgeptr = 0;
             
-            streaming_offset = 0;
+            streaming_offset = adjformat.headersize;
             streaming_offset_vid = 0;
             streaming_offset_edge_ptr = 0;
             range_start_offset = adjfilesize;
@@ -248,16 +258,17 @@ namespace graphchi {
                     vertex = &prealloc[vid-window_st];
                     if (!vertex->scheduled) vertex = NULL;
                 }
-                check_stream_progress(n*4, ptr-adjdata);  
+                check_stream_progress(n*vidbytes, ptr-adjdata);  
                 while(--n>=0) {
                     bool special_edge = false;
-                    vid_t target = (sizeof(ET)==sizeof(ETspecial) ? *((vid_t*) ptr) : translate_edge(*((vid_t*) ptr), special_edge));
-                    ptr += sizeof(vid_t);
+                    vid_t target = (sizeof(ET)==sizeof(ETspecial) ? read_shard_vid(ptr, vidbytes) : translate_edge(read_shard_vid(ptr, vidbytes), special_edge));
+                    ptr += vidbytes;
                     
                     
                     if (vertex != NULL && outedges) 
                     {    
-                      vertex->add_outedge(target, (only_adjacency ? NULL : (ET*) &((char*)edgedata)[edgeptr]), special_edge);
+                      add_shard_outedge(*vertex, target, (only_adjacency ? NULL : (ET*) &((char*)edgedata)[edgeptr]), special_edge,
+                                        deletions, edgeptr / sizeof(ET));
                     }
                     
                     if (target >= window_st)  {
@@ -267,7 +278,8 @@ namespace graphchi {
                                 svertex_t & dstvertex = prealloc[target-window_st];
                                 if (dstvertex.scheduled) {
                                     assert(only_adjacency ||  edgeptr < edatafilesize);
-                                    dstvertex.add_inedge(vid,  (only_adjacency ? NULL : (ET*) &((char*)edgedata)[edgeptr]), special_edge);
+                                    add_shard_inedge(dstvertex, vid, (only_adjacency ? NULL : (ET*) &((char*)edgedata)[edgeptr]), special_edge,
+                                                     deletions, edgeptr / sizeof(ET));
                                     if (vertex != NULL) {
                                         dstvertex.parallel_safe = false; 
                                         vertex->parallel_safe = false;  // This edge is shared with another vertex in the same window - not safe to run in parallel.
@@ -277,7 +289,7 @@ namespace graphchi {
                         } else if (sizeof(ET) == sizeof(ETspecial)) { // Note, we cannot skip if there can be "special edges". FIXME so dirty.
                             // This vertex has no edges any more for this window, bail out
                             if (vertex == NULL) {
-                                ptr += sizeof(vid_t)*n;
+                                ptr += vidbytes*n;
                                 edgeptr += (n+1)*sizeof(ET);
                                 break;
                             }
@@ -0,0 +1,131 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Header of the shard adjacency files, which records the width of the
+ * vertex ids in the shard. Shards with 32-bit vertex ids have no header,
+ * so that they are identical to the shards of earlier versions. Shards
+ * created by a build with 64-bit vertex ids (GRAPHCHI_VID64) start with
+ * the header. The magic number starts with bytes 0x00 0xff, which cannot
+ * start a headerless adjacency file, as zero-runs are at most 254 long.
+ *
+ * Readers call read_shard_adj_format() and read the ids with read_shard_vid():
+ * a 64-bit build can read both kinds of shards.
+ */
+
+#ifndef DEF_GRAPHCHI_SHARDHEADER
+#define DEF_GRAPHCHI_SHARDHEADER
+
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "graphchi_types.hpp"
+#include "logger/logger.hpp"
+#include "util/ioutil.hpp"
+
+namespace graphchi {
+
+    static const uint8_t shard_adj_magic[8] = {0x00, 0xff, 'G', 'C', 'H', 'I', 'A', 'D'};
+
+    struct shard_adj_header {
+        uint8_t magic[8];
+        uint32_t vidbytes;
+        uint32_t reserved;
+    };
+
+    struct shard_adj_format {
+        size_t headersize;
+        int vidbytes;
+        shard_adj_format() : headersize(0), vidbytes(sizeof(uint32_t)) {}
+    };
+
+    /**
+      * Size of the header in shards written by this build.
+      */
+    inline size_t shard_adj_header_size() {
+        return (sizeof(vid_t) == sizeof(uint32_t) ? 0 : sizeof(shard_adj_header));
+    }
+
+    /**
+      * Writes the header, if any, to an adjacency file. Must be called
+      * before anything else is written to the file.
+      */
+    inline void write_shard_adj_header(int f) {
+        if (shard_adj_header_size() == 0) return;
+        shard_adj_header hdr;
+        memcpy(hdr.magic, shard_adj_magic, sizeof(hdr.magic));
+        hdr.vidbytes = sizeof(vid_t);
+        hdr.reserved = 0;
+        writea(f, &hdr, sizeof(hdr));
+    }
+
+    /**
+      * Reads the id width of an adjacency file. Shards with wider ids than
+      * vid_t of this build cannot be read.
+      */
+    inline shard_adj_format read_shard_adj_format(std::string adjfilename) {
+        shard_adj_format fmt;
+        int f = open(adjfilename.c_str(), O_RDONLY);
+        if (f < 0) {
+            logstream(LOG_ERROR) << "Could not open: " << adjfilename << " error: " << strerror(errno) << std::endl;
+        }
+        assert(f >= 0);
+        shard_adj_header hdr;
+        ssize_t rd = pread(f, &hdr, sizeof(hdr), 0);
+        close(f);
+        if (rd == (ssize_t) sizeof(hdr) && memcmp(hdr.magic, shard_adj_magic, sizeof(hdr.magic)) == 0) {
+            fmt.headersize = sizeof(hdr);
+            fmt.vidbytes = (int) hdr.vidbytes;
+        }
+        if (fmt.vidbytes != sizeof(uint32_t) && fmt.vidbytes != sizeof(uint64_t)) {
+            logstream(LOG_FATAL) << "Shard " << adjfilename << " has invalid vertex id width: " << fmt.vidbytes << std::endl;
+            assert(false);
+        }
+        if (fmt.vidbytes > (int) sizeof(vid_t)) {
+            logstream(LOG_FATAL) << "Shard " << adjfilename << " has " << fmt.vidbytes * 8 << "-bit vertex ids. "
+                << "Compile with 64-bit vertex ids (make VID64=1) to use it." << std::endl;
+            assert(false);
+        }
+        return fmt;
+    }
+
+    /**
+      * Reads a vertex id of the given width from an adjacency file.
+      */
+    inline vid_t read_shard_vid(const uint8_t * ptr, int vidbytes) {
+#ifdef GRAPHCHI_VID64
+        if (vidbytes == sizeof(uint32_t)) return *((const uint32_t *) ptr);
+#endif
+        return *((const vid_t *) ptr);
+    }
+
+}
+
+#endif
+
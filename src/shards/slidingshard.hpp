@@ -39,12 +39,17 @@
 #include <unistd.h>
 #include <assert.h>
 #include <string>
+#include <map>
+#include <functional>
+#include <algorithm>
 
 #include "api/graph_objects.hpp"
 #include "metrics/metrics.hpp"
 #include "logger/logger.hpp"
 #include "io/stripedio.hpp"
 #include "graphchi_types.hpp"
+#include "shards/deletionbitmap.hpp"
+#include "shards/shardheader.hpp"
 
 
 namespace graphchi {
@@ -123,10 +128,12 @@ namespace graphchi {
         sblock * curadjblock;
         metrics &m;
         
-        std::map<int, indexentry> sparse_index; // Sparse index that can be created in the fly
+        std::map<vid_t, indexentry, std::greater<vid_t> > sparse_index; // Sparse index that can be created in the fly
+        shard_adj_format adjformat;
         bool disable_writes;
         bool async_edata_loading;
         bool need_read_outedges; // In this model, we need not to read edgedata but must be careful when commiting it
+        deletion_bitmap * deletions;
         
         
     public:
@@ -142,14 +149,15 @@ namespace graphchi {
         blocksize(_blocksize), 
         m(_m),  
         disable_writes(_disable_writes) {
+            adjformat = read_shard_adj_format(filename_adj);
             curvid = 0;
-            adjoffset = 0;
+            adjoffset = adjformat.headersize;
             edataoffset = 0;
-            disable_writes = false;
             only_adjacency = onlyadj;
             curblock = NULL;
             curadjblock = NULL;
             window_start_edataoffset = 0;
+            deletions = NULL;
             
             while(blocksize % sizeof(ET) != 0) blocksize++;
             assert(blocksize % sizeof(ET)==0);
@@ -166,9 +174,6 @@ namespace graphchi {
             save_offset();
             
             async_edata_loading = !svertex_t().computational_edges();
-#ifdef SUPPORT_DELETIONS
-            async_edata_loading = false; // See comment above for memshard, async_edata_loading = false;
-#endif  
             need_read_outedges = svertex_t().read_outedges();    
         }
         
@@ -193,33 +198,40 @@ namespace graphchi {
         size_t num_edges() {
             return edatafilesize / sizeof(ET);
         }
-        
+
+        /**
+          * Deleted edges are not added to the vertices. The bitmap
+          * is owned by the engine.
+          */
+        void set_deletions(deletion_bitmap * _deletions) {
+            deletions = _deletions;
+        }
+
     protected:
         size_t get_adjoffset() { return adjoffset; }
         size_t get_edataoffset() { return edataoffset; }
         
         void save_offset() {
-            // Note, so that we can use the lower bound operation in map, we need
-            // to insert indices in reverse order
-            sparse_index.insert(std::pair<int, indexentry>(-((int)curvid), indexentry(adjoffset, edataoffset)));
+            // Note: the index is in descending order, so that the lower bound
+            // operation returns the closest entry before a vertex.
+            sparse_index.insert(std::pair<vid_t, indexentry>(curvid, indexentry(adjoffset, edataoffset)));
         }
         
         void move_close_to(vid_t v) {        
             if (curvid >= v) return;
             
-            std::map<int,indexentry>::iterator lowerbd_iter = sparse_index.lower_bound(-((int)v));
-            int closest_vid = -((int)lowerbd_iter->first);
-            assert(closest_vid>=0);
+            typename std::map<vid_t, indexentry, std::greater<vid_t> >::iterator lowerbd_iter = sparse_index.lower_bound(v);
+            vid_t closest_vid = lowerbd_iter->first;
             indexentry closest_offset = lowerbd_iter->second;
-            assert(closest_vid <= (int)v);
-            if (closest_vid > (int)curvid) {   /* Note: this will fail if we have over 2B vertices! */
+            assert(closest_vid <= v);
+            if (closest_vid > curvid) {
                 logstream(LOG_DEBUG) 
                     << "Sliding shard, start: " << range_st << " moved to: " << closest_vid << " " << closest_offset.adjoffset << ", asked for : " << v << " was in: curvid= " << curvid  << " " << adjoffset << std::endl;
                 if (curblock != NULL) // Move the pointer - this may invalidate the curblock, but it is being checked later
                     curblock->ptr += closest_offset.edataoffset - edataoffset;
                 if (curadjblock != NULL)
                     curadjblock->ptr += closest_offset.adjoffset - adjoffset;
-                curvid = (vid_t)closest_vid;
+                curvid = closest_vid;
                 adjoffset = closest_offset.adjoffset;
                 edataoffset = closest_offset.edataoffset;
                 return;
@@ -281,9 +293,19 @@ namespace graphchi {
             return res;
         }
         
+        inline vid_t read_vid() {
+#ifdef GRAPHCHI_VID64
+            if (adjformat.vidbytes == sizeof(uint32_t)) return read_val<uint32_t>();
+#endif
+            return read_val<vid_t>();
+        }
+        
         template <typename U>
         inline U * read_edgeptr() {
-            if (only_adjacency) return NULL;
+            if (only_adjacency) {
+                edataoffset += sizeof(U);
+                return NULL;
+            }
             check_curblock(sizeof(U));
             U * resptr = ((U*)curblock->ptr);
             edataoffset += sizeof(U);
@@ -322,7 +344,7 @@ namespace graphchi {
             vid_t lastrec = start;
             window_start_edataoffset = edataoffset;
             
-            for(int i=((int)curvid) - ((int)start); i<nvecs; i++) {               
+            for(int i=(int)((int64_t)curvid - (int64_t)start); i<nvecs; i++) {               
                 if (adjoffset >= adjfilesize) break;
                 
                 // TODO: skip unscheduled vertices.
@@ -349,7 +371,7 @@ namespace graphchi {
                 
                 if (i<0) {
                     // Just skipping
-                    skip(n, sizeof(vid_t));
+                    skip(n, adjformat.vidbytes);
                 } else {
                     svertex_t& vertex = prealloc[i];
                     assert(vertex.id() == curvid);
@@ -358,7 +380,8 @@ namespace graphchi {
                         
                         while(--n>=0) {
                             bool special_edge = false;
-                            vid_t target = (sizeof(ET) == sizeof(ETspecial) ? read_val<vid_t>() : translate_edge(read_val<vid_t>(), special_edge));
+                            vid_t target = (sizeof(ET) == sizeof(ETspecial) ? read_vid() : translate_edge(read_vid(), special_edge));
+                            size_t edgeidx = edataoffset / sizeof(ET);
                             ET * evalue = (special_edge ? (ET*)read_edgeptr<ETspecial>(): read_edgeptr<ET>());
                             
                             if (!only_adjacency) {
@@ -372,18 +395,21 @@ namespace graphchi {
                                 // Note: this needs to be set always because curblock might change during this loop.
                                 curblock->active = true; // This block has an scheduled vertex - need to commit
                             }
-                            vertex.add_outedge(target, evalue, special_edge);                            
+                            add_shard_outedge(vertex, target, evalue, special_edge, deletions, edgeidx);
                             
-                            if (!((target >= range_st && target <= range_end))) {
+                            /* Deleted edges may point to vertices trimmed from the dynamic graph */
+                            bool inrange = (target >= range_st && target <= range_end) ||
+                                           (deletions != NULL && deletions->is_deleted(edgeidx));
+                            if (!inrange) {
                                 logstream(LOG_ERROR) << "Error : " << target << " not in [" << range_st << " - " << range_end << "]" << std::endl;
                                 iomgr->print_session(adjfile_session);
                             } 
-                            assert(target >= range_st && target <= range_end);
+                            assert(inrange);
                         }
                         
                     } else {
                         // This vertex was not scheduled, so we can just skip its edges.
-                        skip(n, sizeof(vid_t));
+                        skip(n, adjformat.vidbytes);
                     }
                 }
                 curvid++;
@@ -424,7 +450,7 @@ namespace graphchi {
           * Set the position of the sliding shard.
           */
         void set_offset(size_t newoff, vid_t _curvid, size_t edgeptr) {
-            this->adjoffset = newoff;
+            this->adjoffset = std::max(newoff, adjformat.headersize); // Offset 0 is the beginning of the adjacency data
             this->curvid = _curvid;
             this->edataoffset = edgeptr;
             if (curadjblock != NULL) {
@@ -441,7 +467,7 @@ namespace graphchi {
             for(int i=(int)activeblocks.size() - 1; i >= 0; i--) {
                 sblock &b = activeblocks[i];
                 if (b.end <= edataoffset || all) {
-                    commit(b, all, disable_writes);  
+                    commit(b, all, disable_writes || this->disable_writes);
                     activeblocks.erase(activeblocks.begin() + (unsigned int)i);
                 }
             }
@@ -0,0 +1,242 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for adding and removing edges in the dynamic graph engine.
+ * Writes a graph to the given file, and after each iteration adds edges
+ * between the vertices and to new vertices with add_edges(). The vertices
+ * remove some of their in-edges. The shards are small, so that the commits
+ * compact and split them. Checks the in-edges and the edge values of each
+ * vertex on every iteration, and the number of edges and shards.
+ *
+ * Usage: bin/tests/dynamicengine_addedges_smoketest file /tmp/dyngraph.txt [nvertices 20000]
+ */
+
+#include <string>
+#include <vector>
+
+#define SUPPORT_DELETIONS 1
+
+#include "graphchi_basic_includes.hpp"
+#include "engine/dynamic_graphs/graphchi_dynamicgraph_engine.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef vid_t EdgeDataType;
+
+/**
+ * Exposes the number of shards, which grows when the commits split shards.
+ */
+class dynamic_test_engine : public graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType> {
+public:
+    dynamic_test_engine(std::string base_filename, int nshards, metrics &_m) :
+        graphchi_dynamicgraph_engine<VertexDataType, EdgeDataType>(base_filename, nshards, false, _m) {}
+
+    int num_shards() {
+        return this->nshards;
+    }
+};
+
+dynamic_test_engine * engine = NULL;
+
+/* Deterministic choices of the test */
+static vid_t hash_vid(size_t x) {
+    x = (x ^ (x >> 15)) * 2654435761ULL;
+    return (vid_t) ((x ^ (x >> 13)) & 0x7fffffff);
+}
+
+static bool remove_edge(vid_t src, vid_t dst, int iteration) {
+    return hash_vid(src * 31 + dst * 17 + iteration) % 8 == 0;
+}
+
+/**
+ * As in basic_smoketest: each vertex writes id + iteration number to its
+ * out-edges, and checks the values of its in-edges. The added edges have
+ * the value their source would have written in the previous iteration. The
+ * vertex value is the number of in-edges left after the update.
+ */
+struct AddEdgesSmokeTestProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+
+    std::vector<vid_t> indegrees;   // Expected number of in-edges of each vertex
+    vid_t nvertices;                // Vertices in the graph, with the added ones
+    size_t nedges;                  // Expected number of edges in the next iteration
+    size_t inedges_seen;
+    size_t ndeleted;
+    size_t nadded;
+    int add_until;                  // Last iteration after which edges are added
+
+    AddEdgesSmokeTestProgram(vid_t n, size_t maxvertices, int add_until) : indegrees(maxvertices, 0),
+        nvertices(n), nedges(0), inedges_seen(0), ndeleted(0), nadded(0), add_until(add_until) {}
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        assert(vertex.id() < nvertices);
+        if (vertex.num_inedges() != (int) indegrees[vertex.id()]) {
+            logstream(LOG_ERROR) << "Vertex " << vertex.id() << " has " << vertex.num_inedges() << " in-edges, expected "
+                << indegrees[vertex.id()] << std::endl;
+            assert(false);
+        }
+        __sync_add_and_fetch(&inedges_seen, vertex.num_inedges());
+
+        int ninedges = 0;
+        for(int i=0; i < vertex.num_inedges(); i++) {
+            graphchi_edge<EdgeDataType> * edge = vertex.inedge(i);
+            if (gcontext.iteration > 0) {
+                vid_t expected = edge->vertex_id() + gcontext.iteration - (edge->vertex_id() > vertex.id());
+                if (edge->get_data() != expected) {
+                    logstream(LOG_ERROR) << "Edge " << edge->vertex_id() << " -> " << vertex.id() << ": " << edge->get_data()
+                        << " != " << expected << std::endl;
+                    assert(false);
+                }
+                if (remove_edge(edge->vertex_id(), vertex.id(), gcontext.iteration)) {
+                    vertex.remove_inedge(i);
+                    __sync_add_and_fetch(&ndeleted, 1);
+                    continue;
+                }
+            }
+            ninedges++;
+        }
+        indegrees[vertex.id()] = ninedges;
+
+        for(int i=0; i < vertex.num_outedges(); i++) {
+            graphchi_edge<EdgeDataType> * edge = vertex.outedge(i);
+            if (!edge->is_deleted()) edge->set_data(vertex.id() + gcontext.iteration);
+        }
+        vertex.set_data(ninedges);
+    }
+
+    void before_iteration(int iteration, graphchi_context &gcontext) {
+        inedges_seen = 0;
+        ndeleted = 0;
+    }
+
+    /**
+     * Checks the number of edges, and adds edges to be seen in the next iteration.
+     */
+    void after_iteration(int iteration, graphchi_context &gcontext) {
+        logstream(LOG_INFO) << "Edges: " << inedges_seen << ", removed: " << ndeleted << ", shards: "
+            << engine->num_shards() << std::endl;
+        if (inedges_seen != nedges) {
+            logstream(LOG_ERROR) << "Saw " << inedges_seen << " edges, expected " << nedges << std::endl;
+            assert(false);
+        }
+        if (iteration > 0) assert(ndeleted > 0);
+        nedges -= ndeleted;
+        if (iteration > add_until) return;
+
+        std::vector< created_edge<EdgeDataType> > edges;
+        /* Edges between the vertices */
+        for(vid_t k=0; k < nvertices / 2; k++) {
+            vid_t src = hash_vid(k * 3 + iteration * 1000003) % nvertices;
+            vid_t dst = hash_vid(k * 5 + iteration * 7919 + 1) % nvertices;
+            if (src != dst) edges.push_back(created_edge<EdgeDataType>(src, dst, src + iteration));
+        }
+        /* New vertices, with an edge in each direction */
+        vid_t nnew = (vid_t) std::min((size_t)nvertices / 10, indegrees.size() - nvertices);
+        for(vid_t v=nvertices; v < nvertices + nnew; v++) {
+            vid_t u = hash_vid(v) % nvertices;
+            edges.push_back(created_edge<EdgeDataType>(v, u, v + iteration));
+            edges.push_back(created_edge<EdgeDataType>(u, v, u + iteration));
+        }
+        nvertices += nnew;
+        for(size_t i=0; i < edges.size(); i++) indegrees[edges[i].dst]++;
+        nedges += edges.size();
+        nadded += edges.size();
+        engine->add_edges(edges);
+    }
+};
+
+/**
+ * Checks that the vertex values are the numbers of in-edges after the last iteration.
+ */
+class InDegreeChecker : public VCallback<VertexDataType> {
+    std::vector<vid_t> &indegrees;
+public:
+    size_t total;
+
+    InDegreeChecker(std::vector<vid_t> &indegrees) : indegrees(indegrees), total(0) {}
+    void callback(vid_t vertex_id, VertexDataType &value) {
+        assert(value == indegrees[vertex_id]);
+        total += value;
+    }
+};
+
+int main(int argc, const char ** argv) {
+    /* Small shards, so that they are split as edges are added */
+    std::vector<const char *> args(argv, argv + argc);
+    args.push_back("filetype");
+    args.push_back("edgelist");
+    args.push_back("dynamic.maxshardedges");
+    args.push_back("30000");
+    graphchi_init((int) args.size(), &args[0]);
+
+    metrics m("dynamicengine-addedges-smoketest");
+
+    std::string filename = get_option_string("file");
+    vid_t n              = (vid_t) get_option_int("nvertices", 20000);
+    int niters           = get_option_int("niters", 8);
+    assert(niters >= 4);
+
+    /* Ring, and a chord from each vertex */
+    FILE * f = fopen(filename.c_str(), "w");
+    assert(f != NULL);
+    size_t nedges = 0;
+    std::vector<vid_t> initial(n, 0);
+    for(vid_t i=0; i < n; i++) {
+        vid_t dsts[2] = { (i + 1) % n, (vid_t) (((size_t)i * 7 + 3) % n) };
+        for(int k=0; k < 2; k++) {
+            if (dsts[k] == i || (k == 1 && dsts[1] == dsts[0])) continue;
+            fprintf(f, "%u %u\n", (unsigned int) i, (unsigned int) dsts[k]);
+            initial[dsts[k]]++;
+            nedges++;
+        }
+    }
+    fclose(f);
+
+    /* Shard the new input even if an earlier run left its preprocessed file */
+    remove(sharder<EdgeDataType>(filename).preprocessed_name().c_str());
+    int nshards = convert<EdgeDataType>(filename, get_option_string("nshards", "2"));
+
+    engine = new dynamic_test_engine(filename, nshards, m);
+
+    /* Edges are added after all but the last two iterations. The sharder
+       ends the last interval one past the largest id, so the graph has an
+       extra vertex without edges. */
+    AddEdgesSmokeTestProgram program((vid_t) engine->num_vertices(), (size_t)n * 2, niters - 3);
+    std::copy(initial.begin(), initial.end(), program.indegrees.begin());
+    program.nedges = nedges;
+    engine->run(program, niters);
+    logstream(LOG_INFO) << "Added " << program.nadded << " edges, " << program.nvertices << " vertices." << std::endl;
+
+    assert(engine->num_vertices() == program.nvertices);
+    assert(engine->num_shards() > nshards);
+
+    InDegreeChecker checker(program.indegrees);
+    foreach_vertices(filename, 0, engine->num_vertices(), checker);
+    assert(checker.total == program.nedges);
+
+    delete engine;
+    metrics_report(m);
+    logstream(LOG_INFO) << "Dynamic engine add_edges smoketest passed successfully!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for the in-memory mode of the engine (inmemory=1). Writes a
+ * graph to the given file and runs the smoketest program on it, first in
+ * memory, then from the shards, and then in memory again. The iterations
+ * are numbered across the runs, so each run checks the edge and vertex
+ * values written to disk by the previous one.
+ *
+ * Usage: bin/tests/inmemory_smoketest file /tmp/inmemgraph.txt [nvertices 20000]
+ */
+
+#include <string>
+#include <vector>
+
+#include "graphchi_basic_includes.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef vid_t EdgeDataType;
+
+/**
+ * As in basic_smoketest: each vertex writes id + iteration number to its
+ * out-edges, and checks the values of its in-edges. The vertex value is
+ * the number of iterations run, and is checked too. The iteration numbers
+ * continue from the previous run.
+ */
+struct InMemorySmokeTestProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+    int firstiter;
+
+    InMemorySmokeTestProgram(int firstiter) : firstiter(firstiter) {}
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        int iteration = firstiter + gcontext.iteration;
+        if (iteration > 0) {
+            assert(vertex.get_data() == (vid_t) iteration);
+            for(int i=0; i < vertex.num_inedges(); i++) {
+                graphchi_edge<EdgeDataType> * edge = vertex.inedge(i);
+                vid_t expected = edge->vertex_id() + iteration - (edge->vertex_id() > vertex.id());
+                if (edge->get_data() != expected) {
+                    logstream(LOG_ERROR) << "Edge " << edge->vertex_id() << " -> " << vertex.id() << ": " << edge->get_data()
+                        << " != " << expected << std::endl;
+                    assert(false);
+                }
+            }
+        }
+        for(int i=0; i < vertex.num_outedges(); i++) {
+            vertex.outedge(i)->set_data(vertex.id() + iteration);
+        }
+        vertex.set_data(iteration + 1);
+    }
+};
+
+/**
+  * Vertex callback that checks the vertex data is ok.
+  */
+class VertexDataChecker : public VCallback<VertexDataType> {
+    int iters;
+public:
+    size_t total;
+
+    VertexDataChecker(int iters) : iters(iters), total(0) {}
+    void callback(vid_t vertex_id, VertexDataType &vecvalue) {
+        assert(vecvalue == (vid_t) iters);
+        total += iters;
+    }
+};
+
+/**
+ * Runs niters iterations, in memory or from the shards. The options are read
+ * from args until the next graphchi_init().
+ */
+static void run(std::vector<const char *> &args, std::string filename, int nshards, bool inmemory,
+                int firstiter, int niters) {
+    args.push_back("inmemory");
+    args.push_back(inmemory ? "1" : "0");
+    graphchi_init((int) args.size(), &args[0]);
+
+    metrics m(inmemory ? "inmemory-smoketest" : "inmemory-smoketest-shards");
+    InMemorySmokeTestProgram program(firstiter);
+    graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, false, m);
+    engine.run(program, niters);
+    if (inmemory) {
+        assert(m.get("inmemory").value == 1);
+    }
+    metrics_report(m);
+}
+
+int main(int argc, const char ** argv) {
+    std::vector<const char *> args(argv, argv + argc);
+    args.push_back("filetype");
+    args.push_back("edgelist");
+    graphchi_init((int) args.size(), &args[0]);
+
+    std::string filename = get_option_string("file");
+    vid_t n              = (vid_t) get_option_int("nvertices", 20000);
+    int niters           = get_option_int("niters", 4);
+
+    /* Ring, and two chords from each vertex */
+    FILE * f = fopen(filename.c_str(), "w");
+    assert(f != NULL);
+    for(vid_t i=0; i < n; i++) {
+        vid_t dsts[3] = { (i + 1) % n, (vid_t) (((size_t)i * 7 + 3) % n), (vid_t) (((size_t)i * 13 + 5) % n) };
+        for(int k=0; k < 3; k++) {
+            if (dsts[k] != i) fprintf(f, "%u %u\n", (unsigned int) i, (unsigned int) dsts[k]);
+        }
+    }
+    fclose(f);
+
+    /* Shard the new input even if an earlier run left its preprocessed file */
+    remove(sharder<EdgeDataType>(filename).preprocessed_name().c_str());
+    int nshards = convert<EdgeDataType>(filename, get_option_string("nshards", "3"));
+
+    std::vector<const char *> inmemargs(args), shardargs(args), inmemargs2(args);
+    run(inmemargs, filename, nshards, true, 0, niters);
+    run(shardargs, filename, nshards, false, niters, 2);
+    run(inmemargs2, filename, nshards, true, niters + 2, niters);
+
+    size_t nvertices = (size_t)n + 1;   // The last interval ends one past the largest id
+    VertexDataChecker vchecker(2 * niters + 2);
+    foreach_vertices(filename, 0, nvertices, vchecker);
+    assert(vchecker.total == nvertices * (2 * niters + 2));
+
+    logstream(LOG_INFO) << "In-memory smoketest passed successfully!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for the parallel radix sort. Sorts keys tagged with their positions,
+ * both directly and from inside an outer parallel region, where OpenMP gives
+ * the sort fewer threads than it asks for. Checks that the result is sorted,
+ * stable, and a permutation of the input.
+ *
+ * Usage: bin/tests/radixsort_smoketest [n 1000000]
+ */
+
+#include <vector>
+#include <omp.h>
+
+#include "graphchi_basic_includes.hpp"
+#include "util/radixsort.hpp"
+
+using namespace graphchi;
+
+/* Key in the high word, original position in the low word */
+struct high_key {
+    uint64_t operator()(uint64_t x) const {
+        return x >> 32;
+    }
+};
+
+static void check_sort(size_t n, int keybits, int nthreads, uint64_t seed) {
+    std::vector<uint64_t> A(n), tmp(n);
+    uint64_t x = seed;
+    for(size_t i=0; i < n; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        A[i] = ((x >> 33) & ((1ULL << keybits) - 1)) << 32 | i;
+    }
+    radix_sort(&A[0], &tmp[0], n, keybits, high_key(), nthreads);
+
+    /* Sorted by the key and then by the position, and each position appears once */
+    std::vector<bool> seen(n, false);
+    for(size_t i=0; i < n; i++) {
+        if (i > 0 && A[i - 1] >= A[i]) {
+            logstream(LOG_ERROR) << "Not sorted at " << i << " (nthreads " << nthreads << ")" << std::endl;
+            assert(false);
+        }
+        size_t pos = (size_t) (A[i] & 0xffffffffULL);
+        assert(pos < n && !seen[pos]);
+        seen[pos] = true;
+    }
+}
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+    size_t n = (size_t) get_option_long("n", 1000000);
+
+    check_sort(n, 20, 8, 1);
+    check_sort(n, 32, 4, 2);
+    check_sort(1000, 8, 8, 3);
+
+    /* Nested in a parallel region, as in the shard writers of the sharder */
+    omp_set_nested(0);
+#pragma omp parallel for num_threads(2)
+    for(int k=0; k < 4; k++) {
+        check_sort(n, 20, 8, 10 + k);
+    }
+
+    logstream(LOG_INFO) << "Radix sort smoketest passed successfully!" << std::endl;
+    return 0;
+}
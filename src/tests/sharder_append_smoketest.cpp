@@ -0,0 +1,206 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for appending edges to the shards of a graph (sharder_append).
+ * Writes a graph and a file of new edges, with new vertices and duplicates
+ * of the old edges. The graph is sharded and the new edges are appended to
+ * it, and the concatenation of the two files is sharded from scratch. The
+ * shards are small, so that the append splits them. Checks that the degree
+ * files are identical, and that the vertices of the two graphs have the
+ * same in-edges with the same values, and the same out-edges.
+ *
+ * Usage: bin/tests/sharder_append_smoketest file /tmp/appendgraph.txt [nvertices 20000]
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "graphchi_basic_includes.hpp"
+#include "preprocessing/shardappend.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef unsigned int EdgeDataType;
+
+static EdgeDataType edge_value(vid_t src, vid_t dst) {
+    return (EdgeDataType) (src * 3 + dst * 7 + 1);
+}
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    return x ^ (x >> 33);
+}
+
+/**
+ * Summary of the edges of a vertex, independent of the order of the edges
+ */
+struct edge_signature {
+    size_t nin, nout;
+    uint64_t in, out;
+    edge_signature() : nin(0), nout(0), in(0), out(0) {}
+    bool operator==(const edge_signature &x) const {
+        return nin == x.nin && nout == x.nout && in == x.in && out == x.out;
+    }
+};
+
+/**
+ * Checks the values of the in-edges, and records the signature of each vertex.
+ */
+struct SignatureProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+    std::vector<edge_signature> signatures;
+
+    SignatureProgram(size_t nvertices) : signatures(nvertices) {}
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        edge_signature &s = signatures[vertex.id()];
+        for(int i=0; i < vertex.num_inedges(); i++) {
+            graphchi_edge<EdgeDataType> * edge = vertex.inedge(i);
+            assert(edge->get_data() == edge_value(edge->vertex_id(), vertex.id()));
+            s.in += mix(edge->vertex_id());
+        }
+        for(int i=0; i < vertex.num_outedges(); i++) {
+            s.out += mix(vertex.outedge(i)->vertex_id());
+        }
+        s.nin = vertex.num_inedges();
+        s.nout = vertex.num_outedges();
+    }
+};
+
+static void write_edge(FILE * f, vid_t src, vid_t dst) {
+    fprintf(f, "%u %u %u\n", (unsigned int) src, (unsigned int) dst, (unsigned int) edge_value(src, dst));
+}
+
+static std::vector<edge_signature> run_signatures(std::string filename, int nshards, size_t nvertices, metrics &m) {
+    SignatureProgram program(nvertices);
+    graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, false, m);
+    engine.run(program, 1);
+    assert(engine.num_vertices() == nvertices);
+    return program.signatures;
+}
+
+static std::string read_file(std::string filename) {
+    FILE * f = fopen(filename.c_str(), "rb");
+    assert(f != NULL);
+    std::string contents;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) contents.append(buf, n);
+    fclose(f);
+    return contents;
+}
+
+int main(int argc, const char ** argv) {
+    graphchi_init(argc, argv);
+    vid_t n              = (vid_t) get_option_int("nvertices", 20000);
+
+    /* Shards of less than the edges of the graph, so that the append splits them */
+    char maxshardedges[32];
+    sprintf(maxshardedges, "%u", (unsigned int) n * 3 / 4);
+    std::vector<const char *> args(argv, argv + argc);
+    args.push_back("filetype");
+    args.push_back("edgelist");
+    args.push_back("append.maxshardedges");
+    args.push_back(maxshardedges);
+    graphchi_init((int) args.size(), &args[0]);
+
+    metrics m("sharder-append-smoketest");
+
+    std::string filename = get_option_string("file");
+    std::string deltafile = filename + ".delta";
+    std::string fullfile = filename + ".full";
+
+    /* The graph is a ring, and a chord from each vertex. The new edges are chords to
+       other vertices, duplicates of the ring edges, and edges to n / 10 new vertices. */
+    FILE * f = fopen(filename.c_str(), "w");
+    FILE * df = fopen(deltafile.c_str(), "w");
+    FILE * ff = fopen(fullfile.c_str(), "w");
+    assert(f != NULL && df != NULL && ff != NULL);
+    for(vid_t i=0; i < n; i++) {
+        vid_t dst = (vid_t) (((size_t)i * 7 + 3) % n);
+        write_edge(f, i, (i + 1) % n);
+        write_edge(ff, i, (i + 1) % n);
+        if (dst != i) {
+            write_edge(f, i, dst);
+            write_edge(ff, i, dst);
+        }
+    }
+    for(vid_t i=0; i < n; i++) {
+        vid_t dst = (vid_t) (((size_t)i * 13 + 5) % n);
+        if (dst != i) {
+            write_edge(df, i, dst);
+            write_edge(ff, i, dst);
+        }
+        if (i % 5 == 0) {
+            write_edge(df, i, (i + 1) % n);
+            write_edge(ff, i, (i + 1) % n);
+        }
+        if (i % 10 == 0) {
+            vid_t v = n + i / 10;
+            write_edge(df, v, i);
+            write_edge(df, i, v);
+            write_edge(ff, v, i);
+            write_edge(ff, i, v);
+        }
+    }
+    fclose(f);
+    fclose(df);
+    fclose(ff);
+
+    /* Shard the new inputs even if an earlier run left their preprocessed files */
+    remove(sharder<EdgeDataType>(filename).preprocessed_name().c_str());
+    remove(sharder<EdgeDataType>(fullfile).preprocessed_name().c_str());
+
+    std::string nshards_str = get_option_string("nshards", "2");
+    int nshards = convert<EdgeDataType>(filename, nshards_str);
+    int appended_nshards = append_edges<EdgeDataType>(filename, deltafile, "edgelist");
+    logstream(LOG_INFO) << "Shards after the append: " << nshards << " -> " << appended_nshards << std::endl;
+    assert(appended_nshards > nshards);
+    int full_nshards = convert<EdgeDataType>(fullfile, nshards_str);
+
+    /* Both end the last interval one past the largest id */
+    size_t nvertices = (size_t)n + n / 10 + 1;
+    assert(read_file(filename_degree_data(filename)) == read_file(filename_degree_data(fullfile)));
+
+    std::vector<edge_signature> appended = run_signatures(filename, appended_nshards, nvertices, m);
+    std::vector<edge_signature> full = run_signatures(fullfile, full_nshards, nvertices, m);
+    size_t nedges = 0;
+    for(size_t v=0; v < nvertices; v++) {
+        if (!(appended[v] == full[v])) {
+            logstream(LOG_ERROR) << "Vertex " << v << ": in-edges " << appended[v].nin << " / " << full[v].nin
+                << ", out-edges " << appended[v].nout << " / " << full[v].nout << std::endl;
+            assert(false);
+        }
+        nedges += appended[v].nin;
+    }
+    std::string fulledges = read_file(fullfile);
+    assert(nedges == (size_t) std::count(fulledges.begin(), fulledges.end(), '\n'));
+    logstream(LOG_INFO) << "Edges: " << nedges << std::endl;
+
+    metrics_report(m);
+    logstream(LOG_INFO) << "Sharder append smoketest passed successfully!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for the streaming sharder (sharder.streaming=1). Writes an edge
+ * list sorted by the destination, and shards it with and without streaming.
+ * The memory budget is small, so that the buckets are estimated from the
+ * beginning of the stream and the last bucket is split. Checks that both
+ * produce the same intervals, adjacency shards and degrees, and runs a
+ * program on the streamed shards that checks the edges of each vertex.
+ *
+ * Usage: bin/tests/sharder_streaming_smoketest file /tmp/streamgraph.txt [nvertices 20000]
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "graphchi_basic_includes.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef unsigned int EdgeDataType;
+
+static EdgeDataType edge_value(vid_t src, vid_t dst) {
+    return (EdgeDataType) (src * 3 + dst * 7 + 1);
+}
+
+static bool dst_less(const std::pair<vid_t, vid_t> &a, const std::pair<vid_t, vid_t> &b) {
+    return a.second < b.second || (a.second == b.second && a.first < b.first);
+}
+
+/**
+ * Checks the values of the in-edges, and the numbers of in- and out-edges.
+ */
+struct EdgeCheckProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+    std::vector<int> &indegrees, &outdegrees;
+
+    EdgeCheckProgram(std::vector<int> &indegrees, std::vector<int> &outdegrees) :
+        indegrees(indegrees), outdegrees(outdegrees) {}
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        assert(vertex.num_inedges() == indegrees[vertex.id()]);
+        assert(vertex.num_outedges() == outdegrees[vertex.id()]);
+        for(int i=0; i < vertex.num_inedges(); i++) {
+            graphchi_edge<EdgeDataType> * edge = vertex.inedge(i);
+            assert(edge->get_data() == edge_value(edge->vertex_id(), vertex.id()));
+        }
+        for(int i=0; i < vertex.num_outedges(); i++) {
+            graphchi_edge<EdgeDataType> * edge = vertex.outedge(i);
+            assert(edge->get_data() == edge_value(vertex.id(), edge->vertex_id()));
+        }
+        vertex.set_data(vertex.num_inedges());
+    }
+};
+
+static std::string read_file(std::string filename) {
+    FILE * f = fopen(filename.c_str(), "rb");
+    assert(f != NULL);
+    std::string contents;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) contents.append(buf, n);
+    fclose(f);
+    return contents;
+}
+
+/**
+ * Shards the file, with or without streaming. The options are read from
+ * args until the next graphchi_init().
+ */
+static int shard(std::vector<const char *> &args, std::string filename, bool streaming) {
+    args.push_back("sharder.streaming");
+    args.push_back(streaming ? "1" : "0");
+    graphchi_init((int) args.size(), &args[0]);
+    /* Shard the input even if an earlier run left its preprocessed file */
+    remove(sharder<EdgeDataType>(filename).preprocessed_name().c_str());
+    return convert<EdgeDataType>(filename, get_option_string("nshards", "4"));
+}
+
+int main(int argc, const char ** argv) {
+    /* Small memory budget: the buckets are chosen from a short sample of the stream */
+    std::vector<const char *> args(argv, argv + argc);
+    args.push_back("filetype");
+    args.push_back("edgelist");
+    args.push_back("membudget_mb");
+    args.push_back("1");
+    graphchi_init((int) args.size(), &args[0]);
+
+    metrics m("sharder-streaming-smoketest");
+
+    std::string filename = get_option_string("file");
+    std::string streamfile = filename + ".streaming";
+    vid_t n              = (vid_t) get_option_int("nvertices", 20000);
+
+    /* Ring, and two chords from each vertex */
+    std::vector< std::pair<vid_t, vid_t> > edges;
+    for(vid_t i=0; i < n; i++) {
+        vid_t dsts[3] = { (i + 1) % n, (vid_t) (((size_t)i * 7 + 3) % n), (vid_t) (((size_t)i * 13 + 5) % n) };
+        for(int k=0; k < 3; k++) {
+            if (dsts[k] != i) edges.push_back(std::pair<vid_t, vid_t>(i, dsts[k]));
+        }
+    }
+    std::sort(edges.begin(), edges.end(), dst_less);
+    std::vector<int> indegrees(n + 1, 0), outdegrees(n + 1, 0);
+    FILE * f = fopen(filename.c_str(), "w");
+    FILE * sf = fopen(streamfile.c_str(), "w");
+    assert(f != NULL && sf != NULL);
+    for(size_t i=0; i < edges.size(); i++) {
+        vid_t src = edges[i].first, dst = edges[i].second;
+        fprintf(f, "%u %u %u\n", (unsigned int) src, (unsigned int) dst, (unsigned int) edge_value(src, dst));
+        fprintf(sf, "%u %u %u\n", (unsigned int) src, (unsigned int) dst, (unsigned int) edge_value(src, dst));
+        indegrees[dst]++;
+        outdegrees[src]++;
+    }
+    fclose(f);
+    fclose(sf);
+
+    std::vector<const char *> preprocessedargs(args), streamingargs(args);
+    int nshards = shard(preprocessedargs, filename, false);
+    int streaming_nshards = shard(streamingargs, streamfile, true);
+    assert(nshards == streaming_nshards);
+
+    assert(read_file(filename_intervals(filename, nshards)) == read_file(filename_intervals(streamfile, nshards)));
+    assert(read_file(filename_degree_data(filename)) == read_file(filename_degree_data(streamfile)));
+    for(int p=0; p < nshards; p++) {
+        assert(read_file(filename_shard_adj(filename, p, nshards)) == read_file(filename_shard_adj(streamfile, p, nshards)));
+    }
+
+    EdgeCheckProgram program(indegrees, outdegrees);
+    graphchi_engine<VertexDataType, EdgeDataType> engine(streamfile, nshards, false, m);
+    engine.run(program, 1);
+    /* The last interval ends one past the largest id */
+    assert(engine.num_vertices() == (size_t)n + 1);
+
+    metrics_report(m);
+    logstream(LOG_INFO) << "Streaming sharder smoketest passed successfully!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Smoketest for 64-bit vertex ids. Always compiled with GRAPHCHI_VID64.
+ * Writes an edge list with vertex ids above 2^32 to the given file, shards
+ * it with sharder.compactids=1 and runs the smoketest program on it. Checks
+ * that the shards have 64-bit ids, and that the vertex values are reported
+ * with the original ids.
+ *
+ * Usage: bin/tests/vid64_smoketest file /tmp/graph64.txt [nvertices 20000]
+ */
+
+#include <string>
+#include <vector>
+
+#include "graphchi_basic_includes.hpp"
+#include "shards/shardheader.hpp"
+
+using namespace graphchi;
+
+typedef vid_t VertexDataType;
+typedef vid_t EdgeDataType;
+
+/* Vertex i of the generated graph has id idbase + i * idstride. */
+static const uint64_t idbase = 5ULL << 32;
+static const uint64_t idstride = 1000003ULL;
+
+/**
+ * As in basic_smoketest: each vertex writes id + iteration number to its
+ * out-edges, and checks the values of its in-edges. The vertex value is
+ * the number of in-edges.
+ */
+struct VID64SmokeTestProgram : public GraphChiProgram<VertexDataType, EdgeDataType> {
+
+    void update(graphchi_vertex<VertexDataType, EdgeDataType> &vertex, graphchi_context &gcontext) {
+        if (gcontext.iteration > 0) {
+            for(int i=0; i < vertex.num_inedges(); i++) {
+                graphchi_edge<vid_t> * edge = vertex.inedge(i);
+                vid_t expected = edge->vertex_id() + gcontext.iteration - (edge->vertex_id() > vertex.id());
+                assert(edge->get_data() == expected);
+            }
+        }
+        for(int i=0; i < vertex.num_outedges(); i++) {
+            vertex.outedge(i)->set_data(vertex.id() + gcontext.iteration);
+        }
+        vertex.set_data(vertex.num_inedges());
+    }
+};
+
+/**
+  * Checks the in-degrees of the vertices, which are reported with the
+  * original ids. The sharder ends the last interval one past the largest
+  * id, so there is an extra vertex outside of the dictionary.
+  */
+class InDegreeChecker : public VCallback<VertexDataType> {
+    std::vector<vid_t> &indegrees;
+public:
+    size_t nchecked;
+
+    InDegreeChecker(std::vector<vid_t> &indegrees) : indegrees(indegrees), nchecked(0) {}
+    void callback(vid_t vertex_id, VertexDataType &value) {
+        if (vertex_id == indegrees.size()) {
+            assert(value == 0);
+            return;
+        }
+        assert(vertex_id >= idbase && (vertex_id - idbase) % idstride == 0);
+        size_t i = (size_t) ((vertex_id - idbase) / idstride);
+        assert(i < indegrees.size());
+        assert(value == indegrees[i]);
+        nchecked++;
+    }
+};
+
+int main(int argc, const char ** argv) {
+    /* The ids must be compacted: the vertex files of the raw ids would
+       take tens of gigabytes. */
+    std::vector<const char *> args(argv, argv + argc);
+    args.push_back("sharder.compactids");
+    args.push_back("1");
+    args.push_back("filetype");
+    args.push_back("edgelist");
+    graphchi_init((int) args.size(), &args[0]);
+
+    metrics m("vid64-smoketest");
+
+    std::string filename = get_option_string("file");
+    size_t n             = get_option_int("nvertices", 20000);
+    int niters           = get_option_int("niters", 4);
+    assert(sizeof(vid_t) == 8);
+
+    /* Ring, and a chord from each vertex */
+    std::vector<vid_t> indegrees(n, 0);
+    FILE * f = fopen(filename.c_str(), "w");
+    assert(f != NULL);
+    for(size_t i=0; i < n; i++) {
+        size_t dsts[2] = { (i + 1) % n, (i * 7 + 3) % n };
+        for(int k=0; k < 2; k++) {
+            if (dsts[k] == i || (k == 1 && dsts[1] == dsts[0])) continue;
+            fprintf(f, "%llu %llu\n", (unsigned long long) (idbase + i * idstride),
+                    (unsigned long long) (idbase + dsts[k] * idstride));
+            indegrees[dsts[k]]++;
+        }
+    }
+    fclose(f);
+    
+    /* Preprocess the new input even if an earlier run left its preprocessed file */
+    remove(sharder<EdgeDataType>(filename).preprocessed_name().c_str());
+
+    int nshards = convert<EdgeDataType>(filename, get_option_string("nshards", "3"));
+    for(int p=0; p < nshards; p++) {
+        shard_adj_format format = read_shard_adj_format(filename_shard_adj(filename, p, nshards));
+        assert(format.vidbytes == 8);
+    }
+
+    VID64SmokeTestProgram program;
+    graphchi_engine<VertexDataType, EdgeDataType> engine(filename, nshards, false, m);
+    engine.run(program, niters);
+    assert(engine.num_vertices() == n + 1);
+
+    InDegreeChecker checker(indegrees);
+    foreach_vertices(filename, 0, engine.num_vertices(), checker);
+    assert(checker.nchecked == n);
+
+    metrics_report(m);
+    logstream(LOG_INFO) << "VID64 smoketest passed successfully!" << std::endl;
+    return 0;
+}
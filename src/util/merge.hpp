@@ -25,6 +25,10 @@
 #ifndef DEF_MERGE
 #define DEF_MERGE
 
+#include <algorithm>
+#include <queue>
+#include <vector>
+
 template <class ET, class F> 
 void merge(ET* S1, int l1, ET* S2, int l2, ET* R, F f) {
     ET* pR = R; 
@@ -40,5 +44,70 @@ void merge(ET* S1, int l1, ET* S2, int l2, ET* R, F f) {
 }
 
 
+/**
+ * K-way merge of sorted streams (GraphChi extension). Sources must
+ * return their values in the order given by the comparator.
+ */
+template <typename T>
+class merge_source {
+public:
+    virtual ~merge_source() {}
+    virtual bool has_more() = 0;
+    virtual T next() = 0;
+};
+
+template <typename T>
+class merge_sink {
+public:
+    virtual ~merge_sink() {}
+    virtual void add(T val) = 0;
+    virtual void done() = 0;
+};
+
+template <typename T, class F>
+class kway_merge {
+    
+    struct heap_entry {
+        T value;
+        int source;
+        F f;
+        heap_entry(T value, int source, F f) : value(value), source(source), f(f) {}
+        
+        /* std::priority_queue is a max-heap, so order is reversed. Ties are
+           broken by the source index to make the merge stable. */
+        bool operator<(const heap_entry &other) const {
+            if (f(other.value, value)) return true;
+            if (f(value, other.value)) return false;
+            return source > other.source;
+        }
+    };
+    
+    std::vector< merge_source<T> * > sources;
+    merge_sink<T> * sink;
+    F f;
+    
+public:
+    kway_merge(std::vector< merge_source<T> * > sources, merge_sink<T> * sink, F f) : sources(sources), sink(sink), f(f) {}
+    
+    void merge() {
+        std::priority_queue<heap_entry> heap;
+        for(int i=0; i < (int)sources.size(); i++) {
+            if (sources[i]->has_more()) {
+                heap.push(heap_entry(sources[i]->next(), i, f));
+            }
+        }
+        while(!heap.empty()) {
+            heap_entry top = heap.top();
+            heap.pop();
+            sink->add(top.value);
+            if (sources[top.source]->has_more()) {
+                heap.push(heap_entry(sources[top.source]->next(), top.source, f));
+            }
+        }
+        sink->done();
+    }
+};
+
+
 #endif
 
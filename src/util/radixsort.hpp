@@ -0,0 +1,110 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Parallel LSD radix sort for arrays with an integer key.
+ */
+
+#ifndef DEF_GRAPHCHI_RADIXSORT
+#define DEF_GRAPHCHI_RADIXSORT
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include <omp.h>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+namespace graphchi {
+
+    /**
+     * Sorts array A stably by key(A[i]), which must be smaller than 2^keybits.
+     * Each pass sorts by RADIX_BITS bits of the key: threads first count the digits of
+     * their chunk of the array, and then scatter the chunk to the temporary array.
+     * The array is split by the size of the team OpenMP actually creates, which can be
+     * smaller than nthreads when called from a parallel region or under OMP_THREAD_LIMIT.
+     * @param A array to sort
+     * @param tmp temporary array of n elements
+     * @param key function returning the key as uint64_t
+     */
+    template <typename T, typename KeyFunc>
+    void radix_sort(T * A, T * tmp, size_t n, int keybits, KeyFunc key, int nthreads) {
+        if (n <= 1) return;
+        nthreads = std::max(1, std::min(nthreads, (int) (n / 65536) + 1));
+        std::vector<size_t> counts(nthreads * RADIX_BUCKETS);
+
+        T * src = A;
+        T * dst = tmp;
+        for(int shift=0; shift < keybits; shift += RADIX_BITS) {
+            std::fill(counts.begin(), counts.end(), 0);
+
+#pragma omp parallel num_threads(nthreads)
+            {
+                int t = omp_get_thread_num();
+                int nteam = omp_get_num_threads();
+                size_t st = n * t / nteam;
+                size_t en = n * (t + 1) / nteam;
+                size_t * cnt = &counts[t * RADIX_BUCKETS];
+                for(size_t i=st; i < en; i++) {
+                    cnt[(key(src[i]) >> shift) & (RADIX_BUCKETS - 1)]++;
+                }
+#pragma omp barrier
+#pragma omp single
+                {
+                    /* Prefix sum over (digit, thread) so that the sort is stable */
+                    size_t total = 0;
+                    for(int d=0; d < RADIX_BUCKETS; d++) {
+                        for(int j=0; j < nteam; j++) {
+                            size_t c = counts[j * RADIX_BUCKETS + d];
+                            counts[j * RADIX_BUCKETS + d] = total;
+                            total += c;
+                        }
+                    }
+                }
+                for(size_t i=st; i < en; i++) {
+                    dst[cnt[(key(src[i]) >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+                }
+            }
+            std::swap(src, dst);
+        }
+        if (src != A) {
+            memcpy(A, src, n * sizeof(T));
+        }
+    }
+
+    /**
+     * Returns the number of bits needed to represent the value.
+     */
+    inline int radix_keybits(uint64_t maxval) {
+        int bits = 0;
+        while (maxval > 0) { bits++; maxval >>= 1; }
+        return bits;
+    }
+
+}
+
+#endif
+
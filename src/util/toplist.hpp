@@ -38,7 +38,9 @@
 #include "util/merge.hpp"
 #include "util/ioutil.hpp"
 #include "util/qsort.hpp"
+#include "util/vertexmap.hpp"
 #include "api/chifilenames.hpp"
+#include "engine/auxdata/vertex_snapshot.hpp"
 
 namespace graphchi {
   
@@ -56,25 +58,37 @@ namespace graphchi {
     }
      
     /**
-      * Reads the vertex data file and returns top N values.
-      * Vertex value type must be given as a template parameter.
-      * This method has been implemented in a manner to consume very little
-      * memory, i.e the whole file is not loaded into memory (unless ntop = nvertices).
-      * @param basefilename name of the graph
-      * @param ntop number of top values to return (if ntop is smaller than the total number of vertices, returns all in sorted order)
-      * @return a vector of top ntop values  
-     */
+      * Reads the vertex values from a file, for get_top_vertices_of().
+      */
     template <typename VertexDataType>
-    std::vector<vertex_value<VertexDataType> > get_top_vertices(std::string basefilename, int ntop) {
-        typedef vertex_value<VertexDataType> vv_t;
-        std::string filename = filename_vertex_data<VertexDataType>(basefilename);
-        int f = open(filename.c_str(), O_RDONLY);
-        if (f < 0) {
-            logstream(LOG_ERROR) << "Could not open file: " << filename << 
-               " error: " << strerror(errno) << std::endl;
-            return std::vector<vertex_value<VertexDataType> >();
+    struct vertex_file_reader {
+        int f;
+        vertex_file_reader(int f) : f(f) {}
+        const VertexDataType * read(size_t offset, size_t len, VertexDataType * buffer) {
+            preada(f, buffer, len, offset);
+            return buffer;
         }
-        size_t sz = lseek(f, 0, SEEK_END);
+    };
+    
+    /**
+      * Reads the vertex values from memory, such as a mapped snapshot, without copying.
+      */
+    template <typename VertexDataType>
+    struct vertex_array_reader {
+        const VertexDataType * values;
+        vertex_array_reader(const VertexDataType * values) : values(values) {}
+        const VertexDataType * read(size_t offset, size_t len, VertexDataType * buffer) {
+            return values + offset / sizeof(VertexDataType);
+        }
+    };
+    
+    /**
+      * Returns top N values of sz bytes of vertex values of the graph,
+      * read with the reader.
+      */
+    template <typename VertexDataType, class VertexReader>
+    std::vector<vertex_value<VertexDataType> > get_top_vertices_of(std::string basefilename, VertexReader &reader, size_t sz, int ntop) {
+        typedef vertex_value<VertexDataType> vv_t;
         
         /* Setup buffer sizes */
         int nverts = (int) (sz / sizeof(VertexDataType));
@@ -97,7 +111,7 @@ namespace graphchi {
         int count = 0;
         while (nread < sz) {
             size_t len = std::min(sz - nread, bufsize);
-            preada(f, buffer, len, nread); 
+            const VertexDataType * values = reader.read(nread, len, buffer);
             nread += len;
             
             int nt = (int) (len / sizeof(VertexDataType));
@@ -107,8 +121,8 @@ namespace graphchi {
                 minima = topbuf[ntop - 1].value; // Minimum value that should be even considered
             }
             for(int j=0; j < nt; j++) {
-                if (count == 0 || (buffer[j] > minima)) {
-                    buffer_idxs[k] = vv_t((vid_t)idx, buffer[j]);
+                if (count == 0 || (values[j] > minima)) {
+                    buffer_idxs[k] = vv_t((vid_t)idx, values[j]);
                     k++;
                 }
                 idx++;
@@ -131,19 +145,70 @@ namespace graphchi {
             count++;
         }
                    
-        /* Return */
+        /* Return. If the graph was reordered or compacted, the vertex ids are translated to the original ids. */
+        original_vertex_ids origids(basefilename);
         std::vector< vv_t > ret;
         for(int i=0; i < ntop; i++) {
-            ret.push_back(topbuf[i]);
+            ret.push_back(vv_t(origids.translate(topbuf[i].vertex), topbuf[i].value));
         }
         free(buffer);
         free(buffer_idxs);
         free(mergearr);
         free(topbuf);
+        return ret;
+    }
+    
+    /**
+      * Returns top N values of a file of vertex values of the graph.
+      */
+    template <typename VertexDataType>
+    std::vector<vertex_value<VertexDataType> > get_top_vertices_of_file(std::string basefilename, std::string filename, int ntop) {
+        int f = open(filename.c_str(), O_RDONLY);
+        if (f < 0) {
+            logstream(LOG_ERROR) << "Could not open file: " << filename << 
+               " error: " << strerror(errno) << std::endl;
+            return std::vector<vertex_value<VertexDataType> >();
+        }
+        size_t sz = lseek(f, 0, SEEK_END);
+        vertex_file_reader<VertexDataType> reader(f);
+        std::vector<vertex_value<VertexDataType> > ret = get_top_vertices_of<VertexDataType>(basefilename, reader, sz, ntop);
         close(f);
         return ret;
     }
 
+    /**
+      * Reads the vertex data file and returns top N values.
+      * Vertex value type must be given as a template parameter.
+      * This method has been implemented in a manner to consume very little
+      * memory, i.e the whole file is not loaded into memory (unless ntop = nvertices).
+      * For reordered or compacted graphs, the returned vertex ids are the original ids.
+      * @param basefilename name of the graph
+      * @param ntop number of top values to return (if ntop is smaller than the total number of vertices, returns all in sorted order)
+      * @return a vector of top ntop values  
+     */
+    template <typename VertexDataType>
+    std::vector<vertex_value<VertexDataType> > get_top_vertices(std::string basefilename, int ntop) {
+        return get_top_vertices_of_file<VertexDataType>(basefilename, filename_vertex_data<VertexDataType>(basefilename), ntop);
+    }
+    
+    /**
+      * Returns top N values of the latest vertex data snapshot published by
+      * the engine. Unlike the vertex data file, the snapshot can be read while 
+      * the engine is running. The snapshot is mapped, so repeated calls read
+      * it from the page cache.
+      */
+    template <typename VertexDataType>
+    std::vector<vertex_value<VertexDataType> > get_top_vertices_snapshot(std::string basefilename, int ntop) {
+        vertex_snapshot<VertexDataType> snapshot(basefilename);
+        if (!snapshot.available()) {
+            logstream(LOG_INFO) << "No vertex data snapshot has been published yet: " 
+                << filename_vertex_snapshot<VertexDataType>(basefilename) << std::endl;
+            return std::vector<vertex_value<VertexDataType> >();
+        }
+        vertex_array_reader<VertexDataType> reader(snapshot.data());
+        return get_top_vertices_of<VertexDataType>(basefilename, reader, snapshot.num_vertices() * sizeof(VertexDataType), ntop);
+    }
+
     
 };
 
@@ -0,0 +1,177 @@
+
+/**
+ * @file
+ * @author  Aapo Kyrola <akyrola@cs.cmu.edu>
+ * @version 1.0
+ *
+ * @section LICENSE
+ *
+ * Copyright [2012] [Aapo Kyrola, Guy Blelloch, Carlos Guestrin / Carnegie Mellon University]
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ *
+ * @section DESCRIPTION
+ *
+ * Vertex id maps of reordered graphs. When the vertices of a graph are
+ * relabeled before sharding (see preprocessing/reordering.hpp), the mapping
+ * from original ids to new ids and its inverse are stored next to the shards.
+ * If the ids were compacted (see preprocessing/relabel.hpp), the dictionary
+ * of the original ids is stored as well. These are used for translating
+ * the results back to the original ids.
+ */
+
+#ifndef DEF_GRAPHCHI_VERTEXMAP
+#define DEF_GRAPHCHI_VERTEXMAP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+
+#include "graphchi_types.hpp"
+#include "api/chifilenames.hpp"
+#include "logger/logger.hpp"
+#include "util/ioutil.hpp"
+
+namespace graphchi {
+
+    /**
+      * Writes a vertex id map: entry i is the id vertex i is mapped to.
+      */
+    static void VARIABLE_IS_NOT_USED write_vertex_map(std::string filename, const vid_t * ids, size_t n) {
+        int f = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+        if (f < 0) {
+            logstream(LOG_ERROR) << "Could not write vertex map: " << filename << " error: " << strerror(errno) << std::endl;
+        }
+        assert(f >= 0);
+        pwritea(f, ids, n * sizeof(vid_t), 0);
+        close(f);
+    }
+
+    class vertex_map {
+        std::vector<vid_t> ids;
+
+    public:
+
+        /**
+          * Loads a map written by write_vertex_map(). Returns false if
+          * the file does not exist.
+          */
+        bool load(std::string filename) {
+            int f = open(filename.c_str(), O_RDONLY);
+            if (f < 0) return false;
+            size_t sz = (size_t) lseek(f, 0, SEEK_END);
+            if (sz % sizeof(vid_t) != 0) {
+                logstream(LOG_ERROR) << "Vertex map " << filename << " has invalid size: " << sz << std::endl;
+                assert(false);
+            }
+            ids.resize(sz / sizeof(vid_t));
+            if (sz > 0) preada(f, &ids[0], sz, 0);
+            close(f);
+            return true;
+        }
+
+        size_t size() const {
+            return ids.size();
+        }
+
+        /**
+          * Vertices outside of the map (e.g vertices added to a dynamic
+          * graph after reordering) keep their ids.
+          */
+        inline vid_t translate(vid_t v) const {
+            return (v < ids.size() ? ids[v] : v);
+        }
+    };
+
+    /**
+      * Translates vertex ids of a graph to the ids of the input graph,
+      * through the inverse reordering map and the compaction dictionary,
+      * if the graph has them.
+      */
+    class original_vertex_ids {
+        vertex_map inverse;
+        vertex_map dictionary;
+
+    public:
+        original_vertex_ids(std::string basefilename) {
+            inverse.load(filename_vertex_map_inverse(basefilename));
+            dictionary.load(filename_vertex_dictionary(basefilename));
+        }
+
+        inline vid_t translate(vid_t v) const {
+            return dictionary.translate(inverse.translate(v));
+        }
+    };
+
+    /**
+      * Returns true if the graph has been reordered.
+      */
+    static bool VARIABLE_IS_NOT_USED is_reordered_graph(std::string basefilename) {
+        return shard_file_exists(filename_vertex_map_inverse(basefilename));
+    }
+
+    /**
+      * Writes the vertex data of a reordered graph in the order of the
+      * original vertex ids, to filename_vertex_data_origorder(). If the ids
+      * were also compacted, the order is that of the compacted ids,
+      * i.e the order of the dictionary.
+      */
+    template <typename VertexDataType>
+    void write_vertex_data_in_original_order(std::string basefilename) {
+        vertex_map inverse;
+        if (!inverse.load(filename_vertex_map_inverse(basefilename))) return;
+
+        std::string infilename = filename_vertex_data<VertexDataType>(basefilename);
+        int inf = open(infilename.c_str(), O_RDONLY);
+        if (inf < 0) {
+            logstream(LOG_ERROR) << "Could not open: " << infilename << " error: " << strerror(errno) << std::endl;
+            return;
+        }
+        size_t n = (size_t) lseek(inf, 0, SEEK_END) / sizeof(VertexDataType);
+        VertexDataType * data = (VertexDataType *) malloc(std::max(n, (size_t)1) * sizeof(VertexDataType));
+        VertexDataType * out = (VertexDataType *) malloc(std::max(n, (size_t)1) * sizeof(VertexDataType));
+        assert(data != NULL && out != NULL);
+        if (n > 0) preada(inf, data, n * sizeof(VertexDataType), 0);
+        close(inf);
+
+#pragma omp parallel for
+        for(long long i=0; i < (long long)n; i++) {
+            vid_t orig = inverse.translate((vid_t)i);
+            assert(orig < n);
+            out[orig] = data[i];
+        }
+
+        std::string outfilename = filename_vertex_data_origorder<VertexDataType>(basefilename);
+        int outf = open(outfilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IROTH | S_IWOTH | S_IWUSR | S_IRUSR);
+        if (outf < 0) {
+            logstream(LOG_ERROR) << "Could not write: " << outfilename << " error: " << strerror(errno) << std::endl;
+        }
+        assert(outf >= 0);
+        pwritea(outf, out, n * sizeof(VertexDataType), 0);
+        close(outf);
+        free(data);
+        free(out);
+        logstream(LOG_INFO) << "Wrote vertex values in the original vertex order to " << outfilename << std::endl;
+    }
+
+}
+
+#endif
+